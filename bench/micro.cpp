@@ -0,0 +1,129 @@
+// Google Benchmark microbenchmarks for the interpreter's hottest helpers.
+// Built as bloa_micro_bench by the `bench` target when the benchmark
+// library is installed.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bloa/array.hpp"
+#include "bloa/dict.hpp"
+#include "bloa/env.hpp"
+#include "bloa/interpreter.hpp"
+#include "bloa/parser.hpp"
+#include "bloa/stdlib.hpp"
+
+namespace {
+
+using bloa::Environment;
+using bloa::Value;
+
+// A global scope over the builtins, with `depth` empty scopes between it
+// and the returned one, as in a nested function call.
+std::shared_ptr<Environment> nested_scope(int depth) {
+  auto env = std::make_shared<Environment>(bloa::builtin_scope());
+  env->set("counter", Value::make_int(0));
+  for (int i = 0; i < depth; ++i) env = std::make_shared<Environment>(env);
+  return env;
+}
+
+void BM_EnvironmentGet(benchmark::State &state) {
+  auto env = nested_scope(static_cast<int>(state.range(0)));
+  const std::string name = "counter";
+  for (auto _ : state) benchmark::DoNotOptimize(env->get(name));
+}
+BENCHMARK(BM_EnvironmentGet)->Arg(0)->Arg(4);
+
+void BM_EnvironmentSet(benchmark::State &state) {
+  auto env = nested_scope(static_cast<int>(state.range(0)));
+  const std::string name = "counter";
+  int64_t i = 0;
+  for (auto _ : state) env->set(name, Value::make_int(++i));
+}
+BENCHMARK(BM_EnvironmentSet)->Arg(0)->Arg(4);
+
+// What every `use`, parallel worker and --serve request pays first.
+void BM_InterpreterConstruct(benchmark::State &state) {
+  for (auto _ : state) bloa::Interpreter interp("");
+}
+BENCHMARK(BM_InterpreterConstruct);
+
+void BM_ParseExpression(benchmark::State &state) {
+  const std::string expr = "total + values[i] * 2 - len(name) / (count + 1)";
+  for (auto _ : state) benchmark::DoNotOptimize(bloa::parse_expression(expr));
+}
+BENCHMARK(BM_ParseExpression);
+
+void BM_CallBuiltin(benchmark::State &state) {
+  const bloa::BuiltinFunction *len = bloa::find_builtin("len");
+  std::vector<Value> args = {Value::make_str("a moderately long string")};
+  for (auto _ : state) benchmark::DoNotOptimize(bloa::call_builtin(*len, args));
+}
+BENCHMARK(BM_CallBuiltin);
+
+// `state.range(0)` distinct string keys, as a group-by over them sees.
+std::vector<Value> dict_keys(int64_t n) {
+  std::vector<Value> keys;
+  for (int64_t i = 0; i < n; ++i)
+    keys.push_back(Value::make_str("user" + std::to_string(i * 7919 % n)));
+  return keys;
+}
+
+void BM_DictInsert(benchmark::State &state) {
+  auto keys = dict_keys(state.range(0));
+  for (auto _ : state) {
+    bloa::Dict dict;
+    for (const auto &key : keys) dict.set(key, Value::make_int(1));
+    benchmark::DoNotOptimize(dict.size());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DictInsert)->Arg(1000)->Arg(100000);
+
+void BM_DictFind(benchmark::State &state) {
+  auto keys = dict_keys(state.range(0));
+  bloa::Dict dict;
+  for (const auto &key : keys) dict.set(key, Value::make_int(1));
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(dict.find(keys[i]));
+    if (++i == keys.size()) i = 0;
+  }
+}
+BENCHMARK(BM_DictFind)->Arg(1000)->Arg(100000);
+
+// sum() over the same numbers as a list of Values and as an array_f64.
+void BM_SumList(benchmark::State &state) {
+  std::vector<Value> items;
+  for (int64_t i = 0; i < state.range(0); ++i)
+    items.push_back(Value::make_double(0.5 * static_cast<double>(i)));
+  std::vector<Value> args = {Value::make_list(std::move(items))};
+  const bloa::BuiltinFunction *sum = bloa::find_builtin("sum");
+  for (auto _ : state) benchmark::DoNotOptimize(bloa::call_builtin(*sum, args));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SumList)->Arg(100000);
+
+void BM_SumArray(benchmark::State &state) {
+  std::vector<Value> items;
+  for (int64_t i = 0; i < state.range(0); ++i)
+    items.push_back(Value::make_double(0.5 * static_cast<double>(i)));
+  std::vector<Value> args = {
+      bloa::make_array(Value::make_list(std::move(items)), false)};
+  const bloa::BuiltinFunction *sum = bloa::find_builtin("sum");
+  for (auto _ : state) benchmark::DoNotOptimize(bloa::call_builtin(*sum, args));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SumArray)->Arg(100000);
+
+void BM_FindBuiltin(benchmark::State &state) {
+  const std::string name = "regex_replace";
+  for (auto _ : state) benchmark::DoNotOptimize(bloa::find_builtin(name));
+}
+BENCHMARK(BM_FindBuiltin);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,259 @@
+// Runs bloa over benchmark workloads and reports, per workload, wall time,
+// CPU time, peak RSS and (where perf events are available) instructions
+// retired, as a table on stdout and as JSON.
+//
+//   bloa_bench_runner <bloa> [--runs N] [--vm] [--out file.json]
+//                     <workload.bloa | directory>...
+//
+// Each workload runs N times (default 5) with stdout discarded; times are
+// the minimum, median and maximum over the runs. A workload that exits
+// non-zero or reports a script error (bloa prints "[BLOA Error]" to
+// stderr and still exits 0) fails the whole run.
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Run {
+  double wall_ms;
+  double cpu_ms;
+  long max_rss_kb;
+  std::optional<uint64_t> instructions;
+};
+
+struct Result {
+  std::string name;
+  std::vector<Run> runs;
+};
+
+// A counter of user-space instructions for `pid` and its children, armed
+// to start when the child calls exec. -1 when perf events are unavailable
+// (no kernel support, or perf_event_paranoid forbids it).
+int open_instruction_counter(pid_t pid) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+std::optional<Run> run_once(const std::string &bloa, bool vm,
+                            const std::string &script) {
+  // The child waits on `gate` until its counter is attached. Its stderr
+  // comes back through `err`.
+  int gate[2];
+  if (pipe(gate) != 0) return std::nullopt;
+  int err[2];
+  if (pipe(err) != 0) return std::nullopt;
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid < 0) return std::nullopt;
+  if (pid == 0) {
+    close(gate[1]);
+    char byte;
+    if (read(gate[0], &byte, 1) < 0) _exit(127);
+    close(gate[0]);
+    close(err[0]);
+    dup2(err[1], STDERR_FILENO);
+    close(err[1]);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>(bloa.c_str()));
+    if (vm) argv.push_back(const_cast<char *>("--vm"));
+    argv.push_back(const_cast<char *>(script.c_str()));
+    argv.push_back(nullptr);
+    execv(bloa.c_str(), argv.data());
+    _exit(127);
+  }
+  close(gate[0]);
+  close(err[1]);
+  int counter = open_instruction_counter(pid);
+  if (write(gate[1], "x", 1) < 0) perror("write");
+  close(gate[1]);
+  std::string errors;
+  char buf[4096];
+  ssize_t got;
+  while ((got = read(err[0], buf, sizeof(buf))) > 0)
+    errors.append(buf, static_cast<size_t>(got));
+  close(err[0]);
+
+  int status = 0;
+  rusage usage{};
+  wait4(pid, &status, 0, &usage);
+  auto end = std::chrono::steady_clock::now();
+
+  Run run;
+  run.wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+  auto ms = [](const timeval &tv) {
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+  };
+  run.cpu_ms = ms(usage.ru_utime) + ms(usage.ru_stime);
+  run.max_rss_kb = usage.ru_maxrss;
+  if (counter >= 0) {
+    uint64_t count = 0;
+    if (read(counter, &count, sizeof(count)) == sizeof(count))
+      run.instructions = count;
+    close(counter);
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+      errors.find("[BLOA Error]") != std::string::npos) {
+    std::cerr << script << " failed\n" << errors << std::flush;
+    return std::nullopt;
+  }
+  return run;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+template <typename F>
+std::vector<double> field(const Result &r, F f) {
+  std::vector<double> out;
+  for (const auto &run : r.runs) out.push_back(f(run));
+  return out;
+}
+
+std::string json_string(const std::string &s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out.push_back('\\');
+    out.push_back(c);
+  }
+  return out + "\"";
+}
+
+void write_json(std::ostream &out, const std::string &bloa, bool vm, int runs,
+                const std::vector<Result> &results) {
+  char num[64];
+  out << "{\n  \"bloa\": " << json_string(bloa) << ",\n  \"engine\": \""
+      << (vm ? "vm" : "tree-walker") << "\",\n  \"runs\": " << runs
+      << ",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    auto wall = field(r, [](const Run &x) { return x.wall_ms; });
+    auto cpu = field(r, [](const Run &x) { return x.cpu_ms; });
+    long rss = 0;
+    std::optional<uint64_t> instructions;
+    for (const auto &run : r.runs) {
+      rss = std::max(rss, run.max_rss_kb);
+      if (!run.instructions) continue;
+      if (!instructions || *run.instructions < *instructions)
+        instructions = run.instructions;
+    }
+    out << "    {\"name\": " << json_string(r.name);
+    auto spread = [&](const char *key, const std::vector<double> &values) {
+      std::snprintf(num, sizeof(num), "%.3f",
+                    *std::min_element(values.begin(), values.end()));
+      out << ", \"" << key << "_min\": " << num;
+      std::snprintf(num, sizeof(num), "%.3f", median(values));
+      out << ", \"" << key << "_median\": " << num;
+      std::snprintf(num, sizeof(num), "%.3f",
+                    *std::max_element(values.begin(), values.end()));
+      out << ", \"" << key << "_max\": " << num;
+    };
+    spread("wall_ms", wall);
+    spread("cpu_ms", cpu);
+    out << ", \"max_rss_kb\": " << rss << ", \"instructions\": ";
+    if (instructions)
+      out << *instructions;
+    else
+      out << "null";
+    out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <bloa> [--runs N] [--vm] [--out file.json]"
+                 " <workload.bloa | directory>...\n";
+    return 2;
+  }
+  std::string bloa = argv[1];
+  int runs = 5;
+  bool vm = false;
+  std::string out_path;
+  std::vector<std::string> scripts;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--runs" && i + 1 < argc) {
+      runs = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--vm") {
+      vm = true;
+    } else if (arg == "--out" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (fs::is_directory(arg)) {
+      std::vector<std::string> found;
+      for (const auto &entry : fs::directory_iterator(arg))
+        if (entry.path().extension() == ".bloa")
+          found.push_back(entry.path().string());
+      std::sort(found.begin(), found.end());
+      scripts.insert(scripts.end(), found.begin(), found.end());
+    } else {
+      scripts.push_back(arg);
+    }
+  }
+
+  std::vector<Result> results;
+  std::printf("%-20s %12s %12s %12s %14s\n", "workload", "wall ms", "cpu ms",
+              "max rss kb", "instructions");
+  for (const auto &script : scripts) {
+    Result r{fs::path(script).stem().string(), {}};
+    for (int i = 0; i < runs; ++i) {
+      auto run = run_once(bloa, vm, script);
+      if (!run) return 1;
+      r.runs.push_back(*run);
+    }
+    auto wall = field(r, [](const Run &x) { return x.wall_ms; });
+    auto cpu = field(r, [](const Run &x) { return x.cpu_ms; });
+    const Run &first = r.runs.front();
+    std::printf("%-20s %12.1f %12.1f %12ld %14s\n", r.name.c_str(),
+                *std::min_element(wall.begin(), wall.end()),
+                *std::min_element(cpu.begin(), cpu.end()), first.max_rss_kb,
+                first.instructions ? std::to_string(*first.instructions).c_str()
+                                   : "-");
+    std::fflush(stdout);
+    results.push_back(std::move(r));
+  }
+
+  if (out_path.empty()) {
+    write_json(std::cout, bloa, vm, runs, results);
+  } else {
+    std::ofstream out(out_path);
+    write_json(out, bloa, vm, runs, results);
+    std::printf("wrote %s\n", out_path.c_str());
+  }
+  return 0;
+}
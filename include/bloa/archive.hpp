@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace bloa {
+
+// A .baar archive opened for random access. The file is memory-mapped and
+// only its table of contents is parsed, so looking up one entry does not
+// touch the payloads of the others. Both layouts are readable:
+//
+//   v1  "BLOAARCHIVE\n", u64 count, then per entry u64 name length,
+//       u64 data length, name, data.
+//   v2  "BLOAARCHIVE2", u32 flags (0), u64 table offset, u64 count, the
+//       payloads, then at the table offset per entry u32 name length,
+//       u8 method, 3 bytes padding, u64 offset, u64 stored size, u64 size,
+//       name.
+//
+// Integers are in host byte order, as v1 always wrote them.
+class Archive {
+ public:
+  enum class Method : uint8_t { Stored = 0, Deflate = 1 };
+
+  struct Entry {
+    std::string name;
+    uint64_t offset = 0;       // of the stored bytes, from the file start
+    uint64_t stored_size = 0;  // bytes in the file
+    uint64_t size = 0;         // bytes once decompressed
+    Method method = Method::Stored;
+  };
+
+  explicit Archive(const std::string &path);
+  ~Archive();
+  Archive(const Archive &) = delete;
+  Archive &operator=(const Archive &) = delete;
+
+  const std::vector<Entry> &entries() const { return entries_; }
+  const Entry *find(std::string_view name) const;
+
+  // The entry a `.baar` runs: main.bloa or index.bloa, else the first .bloa
+  // entry, else the first entry; empty entries are passed over. Null when
+  // every entry is empty.
+  const Entry *main_entry() const;
+
+  // Contents of `entry`. Stored entries are viewed in place and stay valid
+  // while the Archive lives; compressed ones are inflated into `scratch`.
+  std::string_view contents(const Entry &entry, std::string &scratch) const;
+  std::string read(const Entry &entry) const;
+
+ private:
+  std::string path_;
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  std::string buffer_;  // file contents where mmap is unavailable
+  std::vector<Entry> entries_;
+
+  void parse_v1();
+  void parse_v2();
+  void unmap();
+};
+
+std::vector<std::pair<std::string, std::string>> read_archive(
+    const std::string &path);
+// Writes a v2 archive. With `compress`, each entry that deflate shrinks is
+// stored compressed; the rest are stored as is.
+void write_archive(
+    const std::string &path,
+    const std::vector<std::pair<std::string, std::string>> &entries,
+    bool compress = false);
+
+}  // namespace bloa
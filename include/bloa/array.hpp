@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "bloa/ast.hpp"
+#include "bloa/env.hpp"
+
+namespace bloa {
+
+// The array_f64 / array_i64 value: numbers stored unboxed in one vector.
+// An array never changes once built. Values (and parallel workers) share
+// it without copying, and every operation returns a new array. Reductions
+// and elementwise math run over the packed storage, with SSE2 where the
+// build has it.
+class NumArray {
+ public:
+  using F64 = std::vector<double>;
+  using I64 = std::vector<int64_t>;
+
+  explicit NumArray(F64 data) : data_(std::move(data)) {}
+  explicit NumArray(I64 data) : data_(std::move(data)) {}
+
+  bool is_int() const { return std::holds_alternative<I64>(data_); }
+  size_t size() const {
+    return is_int() ? i64().size() : f64().size();
+  }
+  const F64 &f64() const { return std::get<F64>(data_); }
+  const I64 &i64() const { return std::get<I64>(data_); }
+  Value at(size_t i) const {
+    return is_int() ? Value::make_int(i64()[i]) : Value::make_double(f64()[i]);
+  }
+
+ private:
+  std::variant<F64, I64> data_;
+};
+
+// Collects numbers for a new array. It stays array_i64 while every number
+// is an integer and turns into array_f64 at the first float.
+class ArrayBuilder {
+ public:
+  void reserve(size_t n);
+  void add(int64_t x);
+  void add(double x);
+  // A number, or a string that parses as one; anything else throws.
+  void add(const Value &x);
+  Value build();
+
+ private:
+  bool is_int_ = true;
+  NumArray::I64 ints_;
+  NumArray::F64 floats_;
+};
+
+// array_f64(x) / array_i64(x) of a list, range or array; to_list(a).
+Value make_array(const Value &source, bool as_int);
+Value array_to_list(const NumArray &array);
+
+// sum and min/max keep the element type (sum of an array_i64 becomes a
+// float only if it overflows); mean and dot are floats. Every one but sum
+// and dot throws on an empty array.
+Value array_sum(const NumArray &array);
+Value array_min(const NumArray &array);
+Value array_max(const NumArray &array);
+Value array_mean(const NumArray &array);
+Value array_dot(const NumArray &a, const NumArray &b);
+
+// `+ - * /` with an array operand: elementwise over two arrays of the same
+// length, or between each element and a number. Integer `+ - *` stay
+// array_i64 unless a result overflows; `/` is always array_f64.
+Value array_arithmetic(BinaryOp op, const Value &left, const Value &right);
+
+// sqrt, exp and log of every element, as array_f64.
+enum class ElementFn { Sqrt, Exp, Log };
+Value array_map(const NumArray &array, ElementFn fn);
+
+// Ascending copy; NaNs go last. Large arrays are sorted in parallel.
+Value array_sorted(const NumArray &array);
+Value array_slice(const NumArray &array, size_t start, size_t end);
+
+bool array_equal(const NumArray &a, const NumArray &b);
+
+}  // namespace bloa
@@ -5,68 +5,233 @@
 #include <variant>
 #include <vector>
 
+#include "bloa/env.hpp"
+
 namespace bloa {
 
+// Expressions are compiled once by the parser into this tree and evaluated
+// directly by the interpreter. Each node records its kind so evaluation can
+// dispatch with a switch instead of RTTI.
+enum class ExprKind {
+  Literal,
+  List,
+  Name,
+  Not,
+  AddressOf,
+  Deref,
+  Binary,
+  Call,
+  Member,
+  MethodCall,
+  Index,
+  New,
+  Dict,
+};
+
+enum class BinaryOp {
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Pow,
+  Eq,
+  Ne,
+  Lt,
+  Le,
+  Gt,
+  Ge,
+  And,
+  Or,
+};
+
+struct Expr;
+using ExprPtr = std::shared_ptr<Expr>;
+using ExprList = std::vector<ExprPtr>;
+
+struct Expr {
+  explicit Expr(ExprKind k) : kind(k) {}
+  virtual ~Expr() = default;
+  ExprKind kind;
+};
+
+struct LiteralExpr : Expr {
+  Value value;
+  LiteralExpr(Value v) : Expr(ExprKind::Literal), value(std::move(v)) {}
+};
+struct ListExpr : Expr {
+  ExprList elements;
+  ListExpr(ExprList e) : Expr(ExprKind::List), elements(std::move(e)) {}
+};
+// `{key: value, ...}`; keys[i] pairs with values[i].
+struct DictExpr : Expr {
+  ExprList keys;
+  ExprList values;
+  DictExpr(ExprList k, ExprList v)
+      : Expr(ExprKind::Dict), keys(std::move(k)), values(std::move(v)) {}
+};
+struct NameExpr : Expr {
+  std::string name;
+  SlotRef slot;
+  NameExpr(std::string n) : Expr(ExprKind::Name), name(std::move(n)) {}
+};
+struct NotExpr : Expr {
+  ExprPtr operand;
+  NotExpr(ExprPtr o) : Expr(ExprKind::Not), operand(std::move(o)) {}
+};
+// `&name`, or the first argument of an in-place builtin call, which the
+// resolver rewrites into one; `builtin` then names that builtin, and a
+// script function of the same name gets the plain value instead.
+struct AddressOfExpr : Expr {
+  std::string name;
+  std::string builtin;
+  AddressOfExpr(std::string n, std::string b = {})
+      : Expr(ExprKind::AddressOf), name(std::move(n)), builtin(std::move(b)) {}
+};
+struct DerefExpr : Expr {
+  ExprPtr operand;
+  DerefExpr(ExprPtr o) : Expr(ExprKind::Deref), operand(std::move(o)) {}
+};
+struct BinaryExpr : Expr {
+  BinaryOp op;
+  ExprPtr left;
+  ExprPtr right;
+  BinaryExpr(BinaryOp o, ExprPtr l, ExprPtr r)
+      : Expr(ExprKind::Binary),
+        op(o),
+        left(std::move(l)),
+        right(std::move(r)) {}
+};
+// `callee(args)`. When the callee is a plain name it is resolved against
+// builtins, classes and user functions in that order.
+struct CallExpr : Expr {
+  ExprPtr callee;
+  ExprList args;
+  CallExpr(ExprPtr c, ExprList a)
+      : Expr(ExprKind::Call), callee(std::move(c)), args(std::move(a)) {}
+};
+struct MemberExpr : Expr {
+  ExprPtr object;
+  std::string member;
+  MemberExpr(ExprPtr o, std::string m)
+      : Expr(ExprKind::Member), object(std::move(o)), member(std::move(m)) {}
+};
+struct FunctionDefEntry;
+
+// Monomorphic inline cache for a method call site: the method resolved for
+// the last receiver class. The site usually sits in a method body that
+// class owns, so it only watches the class: `method` is valid while a
+// receiver still holds the same class, which compares by owner so a new
+// class at a reused address never matches.
+struct MethodCache {
+  std::weak_ptr<const ClassDefEntry> klass;
+  const FunctionDefEntry *method = nullptr;
+
+  bool hit(const std::shared_ptr<const ClassDefEntry> &receiver) const {
+    return method && !klass.owner_before(receiver) &&
+           !receiver.owner_before(klass);
+  }
+};
+
+struct MethodCallExpr : Expr {
+  ExprPtr object;
+  std::string method;
+  ExprList args;
+  mutable MethodCache cache;
+  MethodCallExpr(ExprPtr o, std::string m, ExprList a)
+      : Expr(ExprKind::MethodCall),
+        object(std::move(o)),
+        method(std::move(m)),
+        args(std::move(a)) {}
+};
+struct IndexExpr : Expr {
+  ExprPtr object;
+  ExprPtr index;
+  IndexExpr(ExprPtr o, ExprPtr i)
+      : Expr(ExprKind::Index), object(std::move(o)), index(std::move(i)) {}
+};
+struct NewExpr : Expr {
+  std::string class_name;
+  ExprList args;
+  NewExpr(std::string c, ExprList a)
+      : Expr(ExprKind::New), class_name(std::move(c)), args(std::move(a)) {}
+};
+
 struct Node;
 using NodePtr = std::shared_ptr<Node>;
 using NodeList = std::vector<NodePtr>;
 
+// Inside function bodies the resolver (bloa/resolver.hpp) fills in the
+// `SlotRef` and `ScopeLayoutPtr` fields below. Elsewhere they stay empty and
+// names are looked up in the environment by string.
 struct Node {
   virtual ~Node() = default;
+  int line = 0;  // 1-based line the statement starts on; 0 if unknown
 };
 
 struct Say : Node {
-  std::string expr;
-  Say(std::string e) : expr(std::move(e)) {}
+  ExprPtr expr;
+  Say(ExprPtr e) : expr(std::move(e)) {}
 };
 struct Ask : Node {
-  std::string prompt;
+  ExprPtr prompt;
   std::string var;
-  Ask(std::string p, std::string v) : prompt(std::move(p)), var(std::move(v)) {}
+  SlotRef slot;
+  Ask(ExprPtr p, std::string v) : prompt(std::move(p)), var(std::move(v)) {}
 };
 struct Assign : Node {
   std::string name;
-  std::string expr;
-  Assign(std::string n, std::string e)
-      : name(std::move(n)), expr(std::move(e)) {}
+  ExprPtr expr;
+  SlotRef slot;
+  // Set by the resolver for `name = name + a + b ...` where evaluating the
+  // pieces cannot rebind `name`: a string is then appended to in its
+  // binding. The pieces are the right operands of the chain of `+`.
+  bool append = false;
+  Assign(std::string n, ExprPtr e) : name(std::move(n)), expr(std::move(e)) {}
 };
 struct Declare : Node {
   std::string name;
-  std::string expr;
-  Declare(std::string n, std::string e)
-      : name(std::move(n)), expr(std::move(e)) {}
+  ExprPtr expr;
+  SlotRef slot;
+  Declare(std::string n, ExprPtr e) : name(std::move(n)), expr(std::move(e)) {}
 };
 struct If : Node {
-  std::string cond;
+  ExprPtr cond;
   NodeList then_block;
   NodeList else_block;
-  If(std::string c, NodeList t, NodeList e)
+  ScopeLayoutPtr then_scope;
+  ScopeLayoutPtr else_scope;
+  If(ExprPtr c, NodeList t, NodeList e)
       : cond(std::move(c)),
         then_block(std::move(t)),
         else_block(std::move(e)) {}
 };
 struct Repeat : Node {
-  std::string times_expr;
+  ExprPtr times_expr;
   NodeList block;
-  Repeat(std::string t, NodeList b)
+  ScopeLayoutPtr scope;
+  SlotRef count_slot;
+  Repeat(ExprPtr t, NodeList b)
       : times_expr(std::move(t)), block(std::move(b)) {}
 };
 struct FunctionDef : Node {
   std::string name;
   std::vector<std::string> params;
   NodeList block;
+  ScopeLayoutPtr scope;  // parameters occupy the first slots
   FunctionDef(std::string n, std::vector<std::string> p, NodeList b)
       : name(std::move(n)), params(std::move(p)), block(std::move(b)) {}
 };
 struct FunctionCall : Node {
   std::string name;
-  std::vector<std::string> args;
-  FunctionCall(std::string n, std::vector<std::string> a)
+  ExprList args;
+  SlotRef slot;
+  FunctionCall(std::string n, ExprList a)
       : name(std::move(n)), args(std::move(a)) {}
 };
 struct Return : Node {
-  std::optional<std::string> expr;
-  Return(std::optional<std::string> e) : expr(std::move(e)) {}
+  ExprPtr expr;  // null for a bare `return`
+  Return(ExprPtr e) : expr(std::move(e)) {}
 };
 struct Import : Node {
   std::string name;
@@ -77,18 +242,28 @@ struct Require : Node {
   Require(std::string p) : path(std::move(p)) {}
 };
 struct ExprStmt : Node {
-  std::string expr;
-  ExprStmt(std::string e) : expr(std::move(e)) {}
+  ExprPtr expr;
+  ExprStmt(ExprPtr e) : expr(std::move(e)) {}
 };
 
 struct MemberAssign : Node {
   std::string object;
   std::string member;
-  std::string expr;
-  MemberAssign(std::string o, std::string m, std::string e)
+  ExprPtr expr;
+  SlotRef object_slot;
+  MemberAssign(std::string o, std::string m, ExprPtr e)
       : object(std::move(o)), member(std::move(m)), expr(std::move(e)) {}
 };
 
+// `object[index] = expr`, which sets a dict key or a list element.
+struct IndexAssign : Node {
+  ExprPtr object;
+  ExprPtr index;
+  ExprPtr expr;
+  IndexAssign(ExprPtr o, ExprPtr i, ExprPtr e)
+      : object(std::move(o)), index(std::move(i)), expr(std::move(e)) {}
+};
+
 struct ClassDef : Node {
   std::string name;
   std::optional<std::string> parent;
@@ -98,22 +273,27 @@ struct ClassDef : Node {
 };
 
 struct While : Node {
-  std::string cond;
+  ExprPtr cond;
   NodeList block;
-  While(std::string c, NodeList b) : cond(std::move(c)), block(std::move(b)) {}
+  ScopeLayoutPtr scope;
+  While(ExprPtr c, NodeList b) : cond(std::move(c)), block(std::move(b)) {}
 };
 struct Break : Node {};
 struct Continue : Node {};
 struct ForIn : Node {
   std::string var;
-  std::string iterable;
+  ExprPtr iterable;
   NodeList block;
-  ForIn(std::string v, std::string it, NodeList b)
+  ScopeLayoutPtr scope;
+  SlotRef var_slot;
+  ForIn(std::string v, ExprPtr it, NodeList b)
       : var(std::move(v)), iterable(std::move(it)), block(std::move(b)) {}
 };
 struct TryExcept : Node {
   NodeList try_block;
   NodeList except_block;
+  ScopeLayoutPtr try_scope;
+  ScopeLayoutPtr except_scope;
   TryExcept(NodeList t, NodeList e)
       : try_block(std::move(t)), except_block(std::move(e)) {}
 };
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bloa/env.hpp"
+
+namespace bloa {
+
+// The dict value: a map from string and integer keys to Values, shared by
+// reference like an object. Entries are kept in insertion order in one
+// vector; the table that finds them is open addressing over groups of 16
+// one-byte tags, as in a Swiss table. A tag holds 7 bits of the key's hash
+// (or marks the slot empty or deleted), so a probe compares 16 candidates
+// at once and looks at an entry only when its tag matches.
+class Dict {
+ public:
+  struct Entry {
+    Value key;  // null once the entry has been erased
+    Value value;
+    uint64_t hash;
+  };
+
+  Dict() = default;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Keys must be strings or integers; an integral float is taken as the
+  // integer, stored in `scratch`. Anything else throws.
+  static const Value &key_of(const Value &key, Value &scratch);
+
+  const Value *find(const Value &key) const;
+  Value *find(const Value &key) {
+    return const_cast<Value *>(static_cast<const Dict *>(this)->find(key));
+  }
+  // The value under `key`, inserting null first if it is missing.
+  Value &operator[](const Value &key);
+  void set(const Value &key, Value value) { (*this)[key] = std::move(value); }
+  bool erase(const Value &key);
+  void reserve(size_t n);
+
+  // Calls f(key, value) for every entry in insertion order.
+  template <typename F>
+  void for_each(F &&f) const {
+    for (const auto &e : entries_)
+      if (!std::holds_alternative<std::monostate>(e.key.v)) f(e.key, e.value);
+  }
+
+ private:
+  static constexpr size_t kGroup = 16;
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  // Slot in the table holding `key`, or npos.
+  size_t find_slot(const Value &key, uint64_t hash) const;
+  // A free slot on the probe sequence of `hash`.
+  size_t free_slot(uint64_t hash) const;
+  void rehash(size_t capacity);
+
+  std::vector<Entry> entries_;
+  std::vector<int8_t> tags_;     // one per slot; a multiple of kGroup
+  std::vector<uint32_t> slots_;  // index into entries_, per slot
+  size_t size_ = 0;
+  size_t used_ = 0;  // slots that are full or deleted
+};
+
+}  // namespace bloa
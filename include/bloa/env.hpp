@@ -1,6 +1,8 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -10,13 +12,27 @@
 
 namespace bloa {
 
-struct Environment;  // forward declaration
+struct Environment;    // forward declaration
+struct ClassDefEntry;  // defined by the interpreter
+class Dict;            // bloa/dict.hpp
+class NumArray;        // bloa/array.hpp
+struct NativeIterator;  // stdlib.cpp
 
 struct ObjectInstance {
   std::string class_name;
   std::shared_ptr<Environment> properties;
-  ObjectInstance(std::string c, std::shared_ptr<Environment> p)
-      : class_name(std::move(c)), properties(std::move(p)) {}
+  // The class the object was made from; null for plain records such as
+  // json_parse results, which have no methods.
+  std::shared_ptr<const ClassDefEntry> klass;
+  // The reader behind a csv_rows/ndjson_rows/iter_dir/iter_glob record;
+  // null for everything else. It closes when the last copy of the record
+  // goes, so leaving a for-in early releases it.
+  std::shared_ptr<NativeIterator> native;
+  ObjectInstance(std::string c, std::shared_ptr<Environment> p,
+                 std::shared_ptr<const ClassDefEntry> k = nullptr)
+      : class_name(std::move(c)),
+        properties(std::move(p)),
+        klass(std::move(k)) {}
 };
 
 struct Reference {
@@ -29,10 +45,73 @@ struct Reference {
 struct Value;
 using ValuePtr = std::shared_ptr<Value>;
 
+// List storage shared between copies. Copying a list Value is O(1); the
+// buffer is cloned only when a holder mutates it while others share it.
+class List {
+ public:
+  // What range() returns: `count` ints from `start` in steps of `step`,
+  // held as those three numbers. size(), at() and for-in never build the
+  // elements; items() builds them once for every copy of the list, and
+  // mutate() gives the mutating copy a buffer of its own.
+  struct Range {
+    int64_t start;
+    int64_t step;
+    size_t count;
+    mutable std::once_flag built;
+    mutable std::vector<Value> elements;
+    Range(int64_t s, int64_t st, size_t n) : start(s), step(st), count(n) {}
+    int64_t operator[](size_t i) const {
+      return start + static_cast<int64_t>(i) * step;
+    }
+  };
+
+  List() = default;
+  explicit List(std::vector<Value> items);
+  static List range(int64_t start, int64_t step, size_t count);
+
+  const std::vector<Value> &items() const;
+  size_t size() const {
+    return data ? data->size() : range_ ? range_->count : 0;
+  }
+  bool empty() const { return size() == 0; }
+  const Value &operator[](size_t i) const { return items()[i]; }
+  Value at(size_t i) const;
+  // The range this list still is, or null once it has its own elements.
+  const Range *lazy_range() const { return data ? nullptr : range_.get(); }
+  std::vector<Value>::const_iterator begin() const;
+  std::vector<Value>::const_iterator end() const;
+
+  // Unshares the buffer and returns it for in-place modification.
+  std::vector<Value> &mutate();
+
+ private:
+  std::shared_ptr<std::vector<Value>> data;
+  std::shared_ptr<const Range> range_;
+};
+
+// A native function from the builtin table in stdlib.cpp. `max_args` is -1
+// for variadic functions; call_builtin checks the count before calling `fn`.
+// An `in_place` function modifies its first argument: a variable named there
+// is passed as a reference to the caller's binding (see resolver.cpp).
+struct BuiltinFunction {
+  const char *name;
+  Value (*fn)(const std::vector<Value> &args,
+              const std::shared_ptr<Environment> &env);
+  int8_t min_args;
+  int8_t max_args;
+  bool in_place = false;
+};
+
+// "{key: value, ...}" in insertion order, as say prints a dict.
+std::string dict_to_string(const Dict &dict);
+// "[1, 2, 3]", as say prints an array.
+std::string array_to_string(const NumArray &array);
+
 struct Value {
   std::variant<std::monostate, int64_t, double, std::string, bool,
-               std::vector<Value>, std::shared_ptr<ObjectInstance>,
-               std::shared_ptr<Reference>>
+               List, std::shared_ptr<ObjectInstance>,
+               std::shared_ptr<Reference>, const BuiltinFunction *,
+               std::shared_ptr<Dict>, std::shared_ptr<const NumArray>>
       v;
 
   Value() = default;
@@ -59,15 +138,28 @@ struct Value {
   }
   static Value make_list(std::vector<Value> list) {
     Value val;
-    val.v = std::move(list);
+    val.v = List(std::move(list));
+    return val;
+  }
+
+  static Value make_object(
+      std::string class_name, std::shared_ptr<Environment> properties,
+      std::shared_ptr<const ClassDefEntry> klass = nullptr) {
+    Value val;
+    val.v = std::make_shared<ObjectInstance>(
+        std::move(class_name), std::move(properties), std::move(klass));
+    return val;
+  }
+
+  static Value make_dict(std::shared_ptr<Dict> dict) {
+    Value val;
+    val.v = std::move(dict);
     return val;
   }
 
-  static Value make_object(std::string class_name,
-                           std::shared_ptr<Environment> properties) {
+  static Value make_array(std::shared_ptr<const NumArray> array) {
     Value val;
-    val.v = std::make_shared<ObjectInstance>(std::move(class_name),
-                                             std::move(properties));
+    val.v = std::move(array);
     return val;
   }
 
@@ -77,6 +169,16 @@ struct Value {
     return val;
   }
 
+  static Value make_builtin(const BuiltinFunction *fn) {
+    Value val;
+    val.v = fn;
+    return val;
+  }
+
+  bool is_builtin() const {
+    return std::holds_alternative<const BuiltinFunction *>(v);
+  }
+
   bool is_reference() const {
     return std::holds_alternative<std::shared_ptr<Reference>>(v);
   }
@@ -91,9 +193,8 @@ struct Value {
     throw std::runtime_error("Value is not a number");
   }
 
-  std::vector<Value> as_list() const {
-    if (std::holds_alternative<std::vector<Value>>(v))
-      return std::get<std::vector<Value>>(v);
+  const std::vector<Value> &as_list() const {
+    if (std::holds_alternative<List>(v)) return std::get<List>(v).items();
     throw std::runtime_error("Value is not a list");
   }
 
@@ -103,15 +204,16 @@ struct Value {
       return std::to_string(std::get<int64_t>(v));
     if (std::holds_alternative<double>(v)) {
       double d = std::get<double>(v);
-      if (std::floor(d) == d) return std::to_string(static_cast<int64_t>(d));
+      if (std::floor(d) == d && std::fabs(d) < 1e18)
+        return std::to_string(static_cast<int64_t>(d));
       return std::to_string(d);
     }
     if (std::holds_alternative<std::string>(v)) return std::get<std::string>(v);
     if (std::holds_alternative<bool>(v))
       return std::get<bool>(v) ? "true" : "false";
-    if (std::holds_alternative<std::vector<Value>>(v)) {
+    if (std::holds_alternative<List>(v)) {
       std::string out = "[";
-      const auto &list = std::get<std::vector<Value>>(v);
+      const auto &list = std::get<List>(v);
       for (size_t i = 0; i < list.size(); ++i) {
         if (i > 0) out += ", ";
         out += list[i].to_string();
@@ -127,19 +229,100 @@ struct Value {
       const auto &ref = std::get<std::shared_ptr<Reference>>(v);
       return "<ref " + ref->name + ">";
     }
+    if (std::holds_alternative<const BuiltinFunction *>(v)) {
+      const auto *fn = std::get<const BuiltinFunction *>(v);
+      return std::string("<builtin ") + fn->name + ">";
+    }
+    if (std::holds_alternative<std::shared_ptr<Dict>>(v))
+      return dict_to_string(*std::get<std::shared_ptr<Dict>>(v));
+    if (std::holds_alternative<std::shared_ptr<const NumArray>>(v))
+      return array_to_string(*std::get<std::shared_ptr<const NumArray>>(v));
     return "<unknown>";
   }
 };
 
+inline List::List(std::vector<Value> items)
+    : data(std::make_shared<std::vector<Value>>(std::move(items))) {}
+
+inline List List::range(int64_t start, int64_t step, size_t count) {
+  List list;
+  if (count > 0)
+    list.range_ = std::make_shared<const Range>(start, step, count);
+  return list;
+}
+
+inline const std::vector<Value> &List::items() const {
+  static const std::vector<Value> none;
+  if (data) return *data;
+  if (!range_) return none;
+  const Range &r = *range_;
+  std::call_once(r.built, [&r] {
+    r.elements.reserve(r.count);
+    for (size_t i = 0; i < r.count; ++i)
+      r.elements.push_back(Value::make_int(r[i]));
+  });
+  return r.elements;
+}
+
+inline Value List::at(size_t i) const {
+  if (data) return (*data)[i];
+  return Value::make_int((*range_)[i]);
+}
+
+inline std::vector<Value>::const_iterator List::begin() const {
+  return items().begin();
+}
+
+inline std::vector<Value>::const_iterator List::end() const {
+  return items().end();
+}
+
+inline std::vector<Value> &List::mutate() {
+  if (!data) {
+    data = std::make_shared<std::vector<Value>>();
+    if (range_) {
+      data->reserve(range_->count);
+      for (size_t i = 0; i < range_->count; ++i)
+        data->push_back(Value::make_int((*range_)[i]));
+      range_.reset();
+    }
+  } else if (data.use_count() > 1) {
+    data = std::make_shared<std::vector<Value>>(*data);
+  }
+  return *data;
+}
+
 struct Variable {
   Value value;
   std::string visibility;
 };
 
+// Static address of a resolved variable: follow `hops` parent links from the
+// current scope, then read slot `index` of that scope.
+struct SlotRef {
+  int16_t hops = -1;
+  int16_t index = -1;
+  bool resolved() const { return hops >= 0; }
+};
+
+// Names bound in one scope of a function body, in slot order. While slot i
+// is unbound the name resolves through `outer[i]`, which is relative to the
+// scope owning this layout.
+struct ScopeLayout {
+  std::vector<std::string> names;
+  std::vector<SlotRef> outer;
+};
+using ScopeLayoutPtr = std::shared_ptr<const ScopeLayout>;
+
+// A scope created with a layout keeps the names listed there in slots and
+// everything else in the hash map. The by-name API sees both, so dynamic
+// features (vars, isset, unset, references, closures) keep working.
 struct Environment {
-  Environment(std::shared_ptr<Environment> parent = nullptr);
+  Environment(std::shared_ptr<Environment> parent = nullptr,
+              ScopeLayoutPtr layout = nullptr);
   std::optional<Value> get(const std::string &name) const;
   std::optional<Value> get_local(const std::string &name) const;
+  Value *find(const std::string &name);
   void set(const std::string &name, Value val);
   void set_local(const std::string &name, Value val);
   bool has(const std::string &name) const;
@@ -147,29 +330,111 @@ struct Environment {
   bool remove(const std::string &name);
   std::vector<std::string> local_keys() const;
   std::vector<std::string> keys() const;
+  void reset(std::shared_ptr<Environment> parent_, ScopeLayoutPtr layout_);
+  void clear_bindings();
+  Value *find_slot(SlotRef ref);
+  void bind_slot(int16_t index, Value val) { slots[index] = std::move(val); }
   std::shared_ptr<Environment> parent;
+  // Set on builtin_scope() only. A shared scope is read by every
+  // interpreter and thread and written by none: set() binds a name it
+  // holds in the scope below instead, find() does not return its storage
+  // and remove() stops at it.
+  bool shared = false;
 
  private:
+  int slot_of(const std::string &name) const;
+  Value *bound_slot(const std::string &name);
+  const Value *bound_slot(const std::string &name) const;
+
   std::unordered_map<std::string, Variable> vars;
+  ScopeLayoutPtr layout;
+  std::vector<std::optional<Value>> slots;
 };
 
+// Reinitialises a recycled scope. Clearing keeps the slot vector's and hash
+// table's storage, so a reused scope does not allocate.
+inline void Environment::reset(std::shared_ptr<Environment> parent_,
+                               ScopeLayoutPtr layout_) {
+  parent = std::move(parent_);
+  vars.clear();
+  layout = std::move(layout_);
+  slots.clear();
+  if (layout) slots.resize(layout->names.size());
+}
+
+// Drops every binding but keeps parent and layout, for the next iteration of
+// the loop body this scope belongs to.
+inline void Environment::clear_bindings() {
+  if (!vars.empty()) vars.clear();
+  for (auto &slot : slots) slot.reset();
+}
+
+inline int Environment::slot_of(const std::string &name) const {
+  if (!layout) return -1;
+  for (size_t i = 0; i < layout->names.size(); ++i) {
+    if (layout->names[i] == name) return static_cast<int>(i);
+  }
+  return -1;
+}
+
+inline Value *Environment::bound_slot(const std::string &name) {
+  int i = slot_of(name);
+  if (i < 0 || !slots[i]) return nullptr;
+  return &*slots[i];
+}
+
+inline const Value *Environment::bound_slot(const std::string &name) const {
+  return const_cast<Environment *>(this)->bound_slot(name);
+}
+
+inline Value *Environment::find_slot(SlotRef ref) {
+  Environment *scope = this;
+  while (ref.resolved()) {
+    for (int16_t i = 0; i < ref.hops; ++i) scope = scope->parent.get();
+    auto &slot = scope->slots[ref.index];
+    if (slot) return &*slot;
+    ref = scope->layout->outer[ref.index];
+  }
+  return nullptr;
+}
+
 inline std::optional<Value> Environment::get_local(
     const std::string &name) const {
   auto it = vars.find(name);
   if (it != vars.end()) return it->second.value;
+  if (const Value *slot = bound_slot(name)) return *slot;
   return std::nullopt;
 }
 
+// The storage bound to `name` in this scope or the nearest enclosing one.
+inline Value *Environment::find(const std::string &name) {
+  for (Environment *scope = this; scope && !scope->shared;
+       scope = scope->parent.get()) {
+    auto it = scope->vars.find(name);
+    if (it != scope->vars.end()) return &it->second.value;
+    if (Value *slot = scope->bound_slot(name)) return slot;
+  }
+  return nullptr;
+}
+
 inline void Environment::set_local(const std::string &name, Value val) {
+  int i = slot_of(name);
+  if (i >= 0) {
+    slots[i] = std::move(val);
+    return;
+  }
   vars[name] = Variable{std::move(val), std::string{}};
 }
 
 inline std::vector<std::string> Environment::local_keys() const {
   std::vector<std::string> result;
-  result.reserve(vars.size());
+  result.reserve(vars.size() + slots.size());
   for (const auto &entry : vars) {
     result.push_back(entry.first);
   }
+  for (size_t i = 0; i < slots.size(); ++i) {
+    if (slots[i]) result.push_back(layout->names[i]);
+  }
   return result;
 }
 
@@ -183,11 +448,11 @@ inline std::vector<std::string> Environment::keys() const {
 }
 
 inline bool Environment::has_local(const std::string &name) const {
-  return vars.find(name) != vars.end();
+  return vars.find(name) != vars.end() || bound_slot(name) != nullptr;
 }
 
 inline bool Environment::has(const std::string &name) const {
-  if (vars.find(name) != vars.end()) return true;
+  if (has_local(name)) return true;
   if (parent) return parent->has(name);
   return false;
 }
@@ -198,7 +463,12 @@ inline bool Environment::remove(const std::string &name) {
     vars.erase(it);
     return true;
   }
-  if (parent) return parent->remove(name);
+  int i = slot_of(name);
+  if (i >= 0 && slots[i]) {
+    slots[i].reset();
+    return true;
+  }
+  if (parent && !parent->shared) return parent->remove(name);
   return false;
 }
 
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "bloa/ast.hpp"
+
+namespace bloa {
+
+// Checked int64_t arithmetic: store a op b in `out` and report overflow.
+#if defined(__GNUC__) || defined(__clang__)
+inline bool add_overflows(int64_t a, int64_t b, int64_t &out) {
+  return __builtin_add_overflow(a, b, &out);
+}
+inline bool sub_overflows(int64_t a, int64_t b, int64_t &out) {
+  return __builtin_sub_overflow(a, b, &out);
+}
+inline bool mul_overflows(int64_t a, int64_t b, int64_t &out) {
+  return __builtin_mul_overflow(a, b, &out);
+}
+#else
+inline bool add_overflows(int64_t a, int64_t b, int64_t &out) {
+  if ((b > 0 && a > std::numeric_limits<int64_t>::max() - b) ||
+      (b < 0 && a < std::numeric_limits<int64_t>::min() - b))
+    return true;
+  out = a + b;
+  return false;
+}
+inline bool sub_overflows(int64_t a, int64_t b, int64_t &out) {
+  if ((b < 0 && a > std::numeric_limits<int64_t>::max() + b) ||
+      (b > 0 && a < std::numeric_limits<int64_t>::min() + b))
+    return true;
+  out = a - b;
+  return false;
+}
+inline bool mul_overflows(int64_t a, int64_t b, int64_t &out) {
+  if (a != 0 && b != 0) {
+    if (a == -1) return sub_overflows(0, b, out);
+    if (b == -1) return sub_overflows(0, a, out);
+    int64_t product = static_cast<int64_t>(static_cast<uint64_t>(a) *
+                                           static_cast<uint64_t>(b));
+    if (product / b != a) return true;
+    out = product;
+    return false;
+  }
+  out = 0;
+  return false;
+}
+#endif
+
+// Integer kernel for Add, Sub, Mul, Div, Mod and Pow. Returns false when
+// the exact result is not an int64_t (overflow, an inexact quotient or a
+// negative exponent) so the caller can fall back to double arithmetic.
+inline bool int_arithmetic(BinaryOp op, int64_t a, int64_t b, int64_t &out) {
+  switch (op) {
+    case BinaryOp::Add:
+      return !add_overflows(a, b, out);
+    case BinaryOp::Sub:
+      return !sub_overflows(a, b, out);
+    case BinaryOp::Mul:
+      return !mul_overflows(a, b, out);
+    case BinaryOp::Div:
+      if (b == 0) throw std::runtime_error("Division by zero");
+      if (b == -1 && a == std::numeric_limits<int64_t>::min()) return false;
+      if (a % b != 0) return false;
+      out = a / b;
+      return true;
+    case BinaryOp::Mod:
+      if (b == 0) throw std::runtime_error("Modulo by zero");
+      out = b == -1 ? 0 : a % b;
+      return true;
+    case BinaryOp::Pow: {
+      if (b < 0) return false;
+      int64_t result = 1;
+      while (b > 0) {
+        if ((b & 1) && mul_overflows(result, a, result)) return false;
+        b >>= 1;
+        if (b > 0 && mul_overflows(a, a, a)) return false;
+      }
+      out = result;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace bloa
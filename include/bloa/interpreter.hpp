@@ -1,44 +1,195 @@
 #pragma once
 #include <functional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "bloa/ast.hpp"
 #include "bloa/env.hpp"
+#include "bloa/module_cache.hpp"
 
 namespace bloa {
 
+struct Chunk;
+
+struct FunctionDefEntry {
+  std::string name;  // "Class.method" for methods
+  std::vector<std::string> params;
+  NodeList block;
+  ScopeLayoutPtr scope;
+  std::shared_ptr<Environment> def_env;
+  mutable std::shared_ptr<const Chunk> code;  // compiled on first VM call
+};
+
+// A class as built by its definition. `methods` holds the methods the class
+// declares; `method_table` also has every inherited one that is not
+// overridden, so a lookup never walks the parent chain.
+struct ClassDefEntry {
+  std::string name;
+  std::shared_ptr<const ClassDefEntry> parent;
+  std::unordered_map<std::string, FunctionDefEntry> methods;
+  std::unordered_map<std::string, const FunctionDefEntry *> method_table;
+  const FunctionDefEntry *init = nullptr;  // __init__, possibly inherited
+  std::shared_ptr<Environment> class_env;
+};
+
+// How control left a block. Break and Continue are consumed by the nearest
+// enclosing loop; Return carries the value up to the function call.
+struct Completion {
+  enum class Kind { Normal, Break, Continue, Return };
+  Kind kind = Kind::Normal;
+  Value value;
+};
+
 class Interpreter {
  public:
   Interpreter(std::string stdlib_path = "", const std::string &source = "");
-  NodeList parse(const std::string &source);
+  NodeList parse(std::string_view source);
   void run(const std::string &code, const std::string &filename = "<string>");
+  // Runs the script at `path`, parsing it through the cache that `use` and
+  // `require` share. Throws if the file cannot be stat'ed; other errors are
+  // reported as run() reports them.
+  void run_file(const std::string &path);
   Value eval_expr(const std::string &expr, std::shared_ptr<Environment> env);
-  Value execute_block(const NodeList &nodes, std::shared_ptr<Environment> env);
+  Completion execute_block(const NodeList &nodes,
+                           std::shared_ptr<Environment> env);
+
+  // Bytecode engine. When enabled, run() and every user function call
+  // execute compiled chunks instead of walking the AST; the tree walker
+  // stays the reference implementation.
+  void set_vm_enabled(bool enabled) { vm_enabled = enabled; }
+  bool is_vm_enabled() const { return vm_enabled; }
+  Value execute_chunk(const Chunk &chunk, std::shared_ptr<Environment> env);
+
+  // Directory for parsed `use` and `require` modules kept between runs.
+  // Empty, the default, keeps them in memory only.
+  void set_cache_dir(std::string dir) { cache_dir = std::move(dir); }
+
+  // The sources this interpreter has run, and ways to parse one ahead of
+  // its first use or drop it again. bloa --serve forks requests from an
+  // interpreter that has only ever preloaded, so they start with every
+  // source warm; a preloaded source is not reported until something runs
+  // it.
+  std::vector<std::string> used_paths() const;
+  void preload(const std::string &path);
+  void forget(const std::string &path);
 
  private:
   std::shared_ptr<Environment> global_env;
-  struct FunctionDefEntry {
-    std::vector<std::string> params;
-    NodeList block;
-    std::shared_ptr<Environment> def_env;
+  std::unordered_map<std::string, FunctionDefEntry> functions;
+  std::unordered_map<std::string, std::shared_ptr<const ClassDefEntry>>
+      classes;
+  // Keyed by canonical path. A module runs once per version of its file;
+  // a required file is run every time but parsed once per version.
+  struct LoadedModule {
+    SourceStamp stamp;
+    std::shared_ptr<Environment> env;
   };
-  struct ClassDefEntry {
-    std::string name;
-    std::optional<std::string> parent;
-    std::unordered_map<std::string, FunctionDefEntry> methods;
-    std::shared_ptr<Environment> class_env;
+  struct ParsedSource {
+    SourceStamp stamp;
+    NodeList nodes;
+    bool used = true;
   };
-  std::unordered_map<std::string, FunctionDefEntry> functions;
-  std::unordered_map<std::string, ClassDefEntry> classes;
-  std::unordered_map<std::string, std::shared_ptr<Environment>> loaded_modules;
+  std::unordered_map<std::string, LoadedModule> loaded_modules;
+  std::unordered_map<std::string, ParsedSource> parsed_sources;
   std::string stdlib_path;
+  std::string cache_dir;
+  bool vm_enabled = false;
+  // Set once a FunctionDef takes a builtin's name, which then calls the
+  // script's function instead; see shadows_builtin.
+  bool builtin_shadowed = false;
+  // FunctionDef and ClassDef statements in the order they first ran. A
+  // parallel worker replays them to get its own copy of every definition.
+  NodeList definitions;
+  std::unordered_set<const Node *> recorded_definitions;
+  // Calls started by spawn() that have not been awaited, by task id.
+  // Dropping a task waits for its thread.
+  struct Task;
+  std::unordered_map<int64_t, std::shared_ptr<Task>> tasks;
+  int64_t next_task_id = 1;
+  // Block and call scopes handed back by release_scope, ready for reuse.
+  std::vector<std::shared_ptr<Environment>> free_scopes;
 
   // helpers for expression parsing
   const std::string &s;
   size_t pos = 0;
-  // parse expression helpers (implemented in .cpp)
-  Value parse_expression(std::string expr, std::shared_ptr<Environment> env);
+  // expression evaluation (implemented in .cpp)
+  Value evaluate(const Expr &expr, const std::shared_ptr<Environment> &env);
+  std::vector<Value> evaluate_args(const ExprList &args,
+                                   const std::shared_ptr<Environment> &env);
+
+  // scope allocation shared by both engines
+  std::shared_ptr<Environment> acquire_scope(
+      std::shared_ptr<Environment> parent, ScopeLayoutPtr layout);
+  void release_scope(std::shared_ptr<Environment> scope);
+  Completion execute_scoped(const NodeList &block, const ScopeLayoutPtr &layout,
+                            const std::shared_ptr<Environment> &env);
+  const std::shared_ptr<Environment> &iteration_scope(
+      std::shared_ptr<Environment> &scope,
+      const std::shared_ptr<Environment> &parent, const ScopeLayoutPtr &layout);
+
+  // call and lookup semantics shared by both engines; `slot` is the
+  // resolver's address for `name`, tried before the by-name lookup
+  Value load_name(const std::string &name, SlotRef slot,
+                  const std::shared_ptr<Environment> &env);
+  Value load_object(const std::string &name, SlotRef slot,
+                    const std::shared_ptr<Environment> &env);
+  void store_name(const std::string &name, SlotRef slot, Value val,
+                  const std::shared_ptr<Environment> &env);
+  void declare_name(const std::string &name, SlotRef slot, Value val,
+                    const std::shared_ptr<Environment> &env);
+  // The storage bound to `name`, or null if it is not a variable here.
+  Value *find_binding(const std::string &name, SlotRef slot,
+                      const std::shared_ptr<Environment> &env);
+  // What `e` names, as the target of `e[index] = value`: a binding, an
+  // object property, a dict value or a list element, so a list there is
+  // changed in place. Null when `e` is not such a place, e.g. a call.
+  Value *place_of(const Expr &e, const std::shared_ptr<Environment> &env);
+  // An Assign marked `append`: `name = name + pieces...`, appending to the
+  // string in the binding rather than copying it.
+  void append_name(const std::string &name, SlotRef slot,
+                   std::span<const Value> pieces,
+                   const std::shared_ptr<Environment> &env);
+  bool shadows_builtin(const std::string &name) const {
+    return builtin_shadowed && functions.count(name);
+  }
+  // An AddressOf: a reference to `name`, unless it was made for the
+  // in-place `builtin` and the script has replaced that builtin.
+  Value address_of_arg(const std::string &name, const std::string *builtin,
+                       const std::shared_ptr<Environment> &env);
+  Value invoke_name(const std::string &name, SlotRef slot,
+                    const std::vector<Value> &args,
+                    const std::shared_ptr<Environment> &env);
+  Value invoke_value(const Value &callee, const std::vector<Value> &args,
+                     const std::shared_ptr<Environment> &env);
+  Value invoke_method(const Value &base, const std::string &method,
+                      const std::vector<Value> &args, MethodCache &cache);
+  Value call_function(const FunctionDefEntry &fn, const Value *self,
+                      const std::vector<Value> &args);
+  // for-in over a list, an object whose class has __iter__ or __next__, or
+  // a native iterator (a record whose __next__ is a builtin). `index` is
+  // the position in a list and unused otherwise; false means exhausted.
+  Value begin_iteration(const Value &iterable);
+  bool next_item(const Value &iterator, int64_t &index, Value &item);
+  Value instantiate(const std::string &class_name,
+                    const std::vector<Value> &args);
+  NodeList load_source(const std::string &path, const SourceStamp &stamp);
+  void run_nodes(const std::function<NodeList()> &load,
+                 const std::string &filename);
+  void record_definition(const NodePtr &node);
+
+  // parallel_map, parallel_for, spawn and await (parallel.cpp). They need
+  // the interpreter itself, so invoke_name dispatches them rather than the
+  // builtin table.
+  Value parallel_map(const std::vector<Value> &args);
+  Value parallel_for(const std::vector<Value> &args);
+  Value spawn(const std::vector<Value> &args);
+  Value await_task(const std::vector<Value> &args);
+  Value await_all(const std::vector<Value> &args);
+  Value finish_task(int64_t id, std::string &error);
+  std::unique_ptr<Interpreter> make_worker(const std::string &definitions_code);
 };
 
 }  // namespace bloa
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "bloa/ast.hpp"
+
+namespace bloa {
+
+// Identifies one version of a source file. A parsed module is reused only
+// while the file's modification time and size still match.
+struct SourceStamp {
+  int64_t mtime = 0;  // file clock ticks
+  uint64_t size = 0;
+  bool operator==(const SourceStamp &) const = default;
+};
+
+// Stamp of the file at `path`, or nullopt if it cannot be stat'ed.
+std::optional<SourceStamp> stamp_source(const std::string &path);
+
+// Contents of the file at `path`, read into one buffer sized up front, or
+// nullopt if it cannot be read.
+std::optional<std::string> read_source(const std::string &path);
+
+// On-disk cache of parsed modules, one file per source under `cache_dir`.
+// load_cached_module returns resolved nodes ready to run, or nullopt when
+// there is no entry for this version of `source_path` or it is unreadable.
+// store_cached_module is best effort: nodes it cannot encode and I/O errors
+// leave the cache without an entry.
+std::optional<NodeList> load_cached_module(const std::string &cache_dir,
+                                           const std::string &source_path,
+                                           const SourceStamp &stamp);
+void store_cached_module(const std::string &cache_dir,
+                         const std::string &source_path,
+                         const SourceStamp &stamp, const NodeList &nodes);
+
+// The same encoding without a file header, to give another interpreter its
+// own copy of a tree (parallel workers must not share call-site caches).
+// encode_nodes throws for nodes it cannot encode; decode_nodes returns
+// resolved nodes and throws on malformed input.
+std::string encode_nodes(const NodeList &nodes);
+NodeList decode_nodes(const std::string &data);
+
+}  // namespace bloa
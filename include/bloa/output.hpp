@@ -0,0 +1,15 @@
+#pragma once
+#include <string_view>
+
+namespace bloa {
+
+// Script output (say, print, ask prompts). In buffered mode text collects
+// in a userspace buffer and reaches stdout in large writes; otherwise each
+// write is flushed at once. Anything that hands the terminal or stdout to
+// someone else (input, child processes, error reports, exit) must call
+// flush_output first.
+void set_output_buffered(bool buffered);
+void write_output(std::string_view text);
+void flush_output();
+
+}  // namespace bloa
@@ -1,14 +1,24 @@
 #pragma once
+#include <deque>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "bloa/ast.hpp"
 
 namespace bloa {
 
-std::vector<std::string> split_lines(const std::string &code);
-int indent_level(const std::string &line);
+// The lines of a script with comments removed. Lines view the source
+// directly, so it must outlive them, except those a comment was cut out of,
+// which view their stripped copy in `stripped`.
+struct SourceLines {
+  std::vector<std::string_view> lines;
+  std::deque<std::string> stripped;
+};
+
+SourceLines split_lines(std::string_view code);
+int indent_level(std::string_view line);
 
 // ParseError carries a message and location (line, column)
 struct ParseError : public std::runtime_error {
@@ -18,8 +28,12 @@ struct ParseError : public std::runtime_error {
       : std::runtime_error(msg), line(line_), col(col_) {}
 };
 
+// parse_expression compiles one expression into an Expr tree. Syntax errors
+// are reported as ParseError with line 0 and the column inside `expr`.
+ExprPtr parse_expression(std::string_view expr);
+
 // parse_block returns pair: NodeList and next index
-std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
+std::pair<NodeList, int> parse_block(const std::vector<std::string_view> &lines,
                                      int start_idx = 0, int base_indent = 0);
 
 }  // namespace bloa
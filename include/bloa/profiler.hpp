@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace bloa {
+
+// Profiler behind `bloa --profile`. It records the thread that enabled it
+// only; parallel workers and tasks are not profiled. Until then every hook
+// below is a test of one thread-local flag.
+namespace profiler {
+
+using Clock = std::chrono::steady_clock;
+struct Stats;
+
+inline thread_local bool active = false;
+
+void enable();
+
+void enter_function(const std::string &name);
+void exit_function();
+void count_builtin(const char *name, Clock::duration time);
+void count_scope(bool reused);
+void count_exception();
+
+// The flat report, and "a;b;c <microseconds>" lines of self time per call
+// stack as read by flamegraph.pl and speedscope.
+void write_report(std::ostream &out);
+bool write_collapsed_stacks(const std::string &path);
+
+// Brackets one statement, which is counted against the running function.
+// A statement's self time leaves out the statements nested in it.
+class LineProbe {
+ public:
+  explicit LineProbe(int line) : on_(active), line_(line) {
+    if (on_) begin();
+  }
+  ~LineProbe() {
+    if (on_) end();
+  }
+  LineProbe(const LineProbe &) = delete;
+  LineProbe &operator=(const LineProbe &) = delete;
+
+ private:
+  void begin();
+  void end();
+
+  bool on_;
+  int line_;
+  Clock::time_point start_;
+  Clock::duration nested_{};
+  LineProbe *parent_ = nullptr;
+  Stats *stats_ = nullptr;
+};
+
+// Brackets one user function call.
+class CallProbe {
+ public:
+  explicit CallProbe(const std::string &name) : on_(active) {
+    if (on_) enter_function(name);
+  }
+  ~CallProbe() {
+    if (on_) exit_function();
+  }
+  CallProbe(const CallProbe &) = delete;
+  CallProbe &operator=(const CallProbe &) = delete;
+
+ private:
+  bool on_;
+};
+
+}  // namespace profiler
+
+}  // namespace bloa
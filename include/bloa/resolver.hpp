@@ -0,0 +1,16 @@
+#pragma once
+#include "bloa/ast.hpp"
+
+namespace bloa {
+
+// resolve_function gives every name bound inside `fn` (parameters, `let` /
+// `var` declarations, assignments, loop variables) a fixed slot in the scope
+// that would hold it at runtime, and annotates uses with their SlotRef.
+// Nested function and class definitions are resolved on their own.
+void resolve_function(FunctionDef &fn);
+
+// resolve_program lays out the blocks of top-level code. Its own names stay
+// in the Environment it runs in, keyed by string.
+void resolve_program(const NodeList &nodes);
+
+}  // namespace bloa
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+#include "bloa/ast.hpp"
+#include "bloa/env.hpp"
+#include "bloa/int_math.hpp"
+
+namespace bloa {
+
+// Value helpers shared by the tree-walking interpreter and the bytecode VM.
+Value resolve_reference(const Value &v);
+std::string value_to_string(const Value &v);
+bool is_list_value(const Value &v);
+double value_as_number(const Value &v);
+bool value_is_true(const Value &v);
+Value parse_input_value(const std::string &input);
+
+// Operators and accessors with the language's runtime semantics. `And` and
+// `Or` are not handled by apply_binary since they short-circuit.
+Value apply_binary(BinaryOp op, const Value &left, const Value &right);
+Value address_of(const std::string &name,
+                 const std::shared_ptr<Environment> &env);
+Value dereference(const Value &operand);
+Value get_member(const Value &base, const std::string &member);
+void set_member(const Value &base, const std::string &member, Value value);
+// A dict from alternating keys and values, as a `{k: v}` literal builds.
+Value make_dict(std::span<Value> pairs);
+Value index_value(const Value &base, const Value &index);
+// `target[index] = value` where `target` is the binding, property or
+// element holding the list or dict. A dict key is set; a list element is
+// replaced in place, cloning the buffer first if another value shares it.
+// A reference is followed to the binding it names.
+void set_index(Value &target, const Value &index, Value value);
+// The same for a base that is not such a place, like a call result. A dict
+// is shared, so it is still updated; a list would only change a copy, which
+// is an error.
+void set_index_temporary(const Value &base, const Value &index, Value value);
+// `base[index]` as a place to write through: an existing dict value, or a
+// list element (bounds-checked and unshared as set_index does). Null for
+// anything else.
+Value *index_place(Value &base, const Value &index);
+// The right operands of `name + a + b ...`, an Assign marked `append`.
+void append_pieces(const Expr &sum, std::vector<const Expr *> &out);
+
+}  // namespace bloa
@@ -0,0 +1,50 @@
+#pragma once
+#include <sys/un.h>
+
+#include <cstddef>
+#include <string>
+
+namespace bloa {
+
+// bloa --serve: a daemon that runs scripts sent over a Unix socket. It
+// starts one interpreter with the standard library registered and never
+// runs user code in it; each request is a fork of that interpreter, so it
+// gets a fresh global scope, and process state (cwd, environment, open
+// handles) cannot leak between requests. After a request the daemon
+// parses every source it loaded, so later requests find them warm; the
+// least recently used are dropped past a fixed count.
+//
+// bloa --client sends a script path (or, for "-", source read from stdin)
+// with the client's cwd, environment and stdin/stdout/stderr descriptors.
+// The request writes straight to those descriptors, and the client exits
+// with its status. bloa-client is the same client without the rest of
+// bloa, for callers that pay for every exec.
+
+// A request is NUL-terminated fields followed by the source, if any:
+//   magic, flags ('v' vm, 'u' unbuffered, 's' source follows), cwd,
+//   script name, environment count, that many NAME=value entries.
+// The client's stdin, stdout and stderr arrive with its first bytes, and
+// it shuts down its side once the request is written. The reply is the
+// request's exit status as an int32_t.
+inline constexpr char kServeMagic[] = "bloa-serve/1";
+
+// write() until all of `data` is written; false on error.
+bool write_all(int fd, const char *data, size_t size);
+// Fills `addr` for `path`; false, with a message, if it is too long.
+bool socket_address(const std::string &path, sockaddr_un &addr);
+// True if the process at the other end of `sock` runs as this user. Both
+// sides check it: a request hands over the client's environment and stdio.
+bool peer_is_self(int sock);
+
+// $BLOA_SOCKET, else bloa.sock in $XDG_RUNTIME_DIR, else a per-user socket
+// under /tmp.
+std::string default_socket_path();
+
+// Serves until SIGINT or SIGTERM; returns the process exit status. The
+// socket is created with mode 0600.
+int serve(const std::string &socket_path, const std::string &cache_dir);
+
+int run_client(const std::string &socket_path, const std::string &script,
+               bool use_vm, bool unbuffered);
+
+}  // namespace bloa
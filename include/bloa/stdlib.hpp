@@ -1,18 +1,18 @@
 #pragma once
-#include <utility>
+#include <span>
 #include <vector>
 
 #include "bloa/env.hpp"
 
 namespace bloa {
 
-void register_stdlib(std::shared_ptr<Environment> env);
-Value handle_builtin(const std::string &marker, const std::vector<Value> &args,
-                     std::shared_ptr<Environment> env = nullptr);
-std::vector<std::pair<std::string, std::string>> read_archive(
-    const std::string &path);
-void write_archive(
-    const std::string &path,
-    const std::vector<std::pair<std::string, std::string>> &entries);
+// Parent of every interpreter's global scope: null, true, false and each
+// builtin, built on first use and never modified after. A global of the
+// same name shadows a builtin, so creating an interpreter copies nothing.
+const std::shared_ptr<Environment> &builtin_scope();
+std::span<const BuiltinFunction> builtin_functions();
+const BuiltinFunction *find_builtin(const std::string &name);
+Value call_builtin(const BuiltinFunction &fn, const std::vector<Value> &args,
+                   const std::shared_ptr<Environment> &env = nullptr);
 
 }  // namespace bloa
\ No newline at end of file
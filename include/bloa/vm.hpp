@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bloa/ast.hpp"
+#include "bloa/env.hpp"
+
+namespace bloa {
+
+// Opcodes for the stack VM. Operand meaning per opcode:
+//   a = constant/name/layout/method site index or jump target, b = argument
+//   count, loop scope register or (AddressOf) the in-place builtin's name or
+//   -1, slot = resolved address of the name in `a`.
+#define BLOA_OPCODES(X) \
+  X(Const)              \
+  X(Pop)                \
+  X(LoadName)           \
+  X(StoreName)          \
+  X(AppendName)         \
+  X(DeclareName)        \
+  X(LoadObject)         \
+  X(SetMember)          \
+  X(SetIndex)           \
+  X(MakeList)           \
+  X(MakeDict)           \
+  X(Not)                \
+  X(AddressOf)          \
+  X(Deref)              \
+  X(Add)                \
+  X(Sub)                \
+  X(Mul)                \
+  X(Div)                \
+  X(Mod)                \
+  X(Pow)                \
+  X(Eq)                 \
+  X(Ne)                 \
+  X(Lt)                 \
+  X(Le)                 \
+  X(Gt)                 \
+  X(Ge)                 \
+  X(AndJump)            \
+  X(OrJump)             \
+  X(ToBool)             \
+  X(Jump)               \
+  X(JumpIfFalse)        \
+  X(CallName)           \
+  X(Call)               \
+  X(GetMember)          \
+  X(CallMethod)         \
+  X(Index)              \
+  X(New)                \
+  X(Say)                \
+  X(Ask)                \
+  X(PushScope)          \
+  X(PopScope)           \
+  X(PushLoopScope)      \
+  X(ReleaseScope)       \
+  X(IterInit)           \
+  X(IterNext)           \
+  X(TryBegin)           \
+  X(TryEnd)             \
+  X(ExecNode)           \
+  X(Fail)               \
+  X(Return)             \
+  X(ReturnNone)
+
+enum class OpCode : uint8_t {
+#define BLOA_OPCODE_ENUM(name) name,
+  BLOA_OPCODES(BLOA_OPCODE_ENUM)
+#undef BLOA_OPCODE_ENUM
+};
+
+struct Instr {
+  OpCode op;
+  int32_t a = 0;
+  int32_t b = 0;
+  SlotRef slot;
+};
+
+// A method call in a chunk, with the inline cache for its receiver's class.
+struct MethodSite {
+  int32_t name;
+  mutable MethodCache cache;
+};
+
+// A flat instruction stream lowered from a NodeList. Statements without a
+// bytecode form (definitions, imports) are kept as nodes and delegated to
+// the tree walker through ExecNode.
+struct Chunk {
+  std::vector<Instr> code;
+  std::vector<Value> constants;
+  std::vector<std::string> names;
+  std::vector<NodeList> nodes;
+  std::vector<ScopeLayoutPtr> layouts;
+  std::vector<MethodSite> method_sites;
+  int32_t loop_scopes = 0;  // registers holding reusable loop body scopes
+};
+
+std::shared_ptr<const Chunk> compile_chunk(const NodeList &nodes);
+
+}  // namespace bloa
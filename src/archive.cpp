@@ -0,0 +1,288 @@
+#include "bloa/archive.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#ifdef BLOA_USE_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BLOA_HAVE_MMAP 1
+#endif
+
+namespace fs = std::filesystem;
+
+namespace bloa {
+
+namespace {
+
+constexpr std::string_view kMagicV1 = "BLOAARCHIVE\n";
+constexpr std::string_view kMagicV2 = "BLOAARCHIVE2";
+constexpr size_t kHeaderV2 = 32;   // magic, flags, table offset, count
+constexpr size_t kTocRecord = 32;  // fixed part of a table entry
+
+class Reader {
+ public:
+  Reader(const char *data, size_t size, size_t pos, const std::string &path)
+      : data(data), size(size), pos(pos), path(path) {}
+
+  template <typename T>
+  T get() {
+    need(sizeof(T));
+    T v;
+    std::memcpy(&v, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return v;
+  }
+  std::string str(uint64_t n) {
+    need(n);
+    std::string s(data + pos, n);
+    pos += n;
+    return s;
+  }
+  void skip(uint64_t n) {
+    need(n);
+    pos += n;
+  }
+  void need(uint64_t n) const {
+    if (n > size - pos) throw std::runtime_error("Corrupt archive: " + path);
+  }
+
+  const char *data;
+  size_t size;
+  size_t pos;
+
+ private:
+  const std::string &path;
+};
+
+template <typename T>
+void put(std::string &out, T v) {
+  out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+}  // namespace
+
+Archive::Archive(const std::string &path) : path_(path) {
+#ifdef BLOA_HAVE_MMAP
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open archive: " + path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Cannot open archive: " + path);
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ > 0) {
+    void *map = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Cannot map archive: " + path);
+    }
+    data_ = static_cast<const char *>(map);
+    mapped_ = true;
+  }
+  ::close(fd);
+#else
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) throw std::runtime_error("Cannot open archive: " + path);
+  buffer_.assign((std::istreambuf_iterator<char>(ifs)), {});
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+#endif
+  try {
+    std::string_view head(data_ ? data_ : "", size_);
+    if (head.substr(0, kMagicV2.size()) == kMagicV2)
+      parse_v2();
+    else if (head.substr(0, kMagicV1.size()) == kMagicV1)
+      parse_v1();
+    else
+      throw std::runtime_error("Invalid archive: " + path);
+  } catch (...) {
+    unmap();
+    throw;
+  }
+}
+
+Archive::~Archive() { unmap(); }
+
+void Archive::unmap() {
+#ifdef BLOA_HAVE_MMAP
+  if (mapped_) ::munmap(const_cast<char *>(data_), size_);
+  mapped_ = false;
+#endif
+}
+
+// v1 has no table; its entry headers are walked in place, skipping over
+// each payload.
+void Archive::parse_v1() {
+  Reader in(data_, size_, kMagicV1.size(), path_);
+  auto count = in.get<uint64_t>();
+  for (uint64_t i = 0; i < count; ++i) {
+    auto name_len = in.get<uint64_t>();
+    auto data_len = in.get<uint64_t>();
+    Entry entry;
+    entry.name = in.str(name_len);
+    entry.offset = in.pos;
+    entry.stored_size = entry.size = data_len;
+    in.skip(data_len);
+    entries_.push_back(std::move(entry));
+  }
+}
+
+void Archive::parse_v2() {
+  Reader in(data_, size_, kMagicV2.size(), path_);
+  if (in.get<uint32_t>() != 0)
+    throw std::runtime_error("Unsupported archive version: " + path_);
+  auto toc_offset = in.get<uint64_t>();
+  auto count = in.get<uint64_t>();
+  if (toc_offset > size_ || count > (size_ - toc_offset) / kTocRecord)
+    throw std::runtime_error("Corrupt archive: " + path_);
+  in.pos = static_cast<size_t>(toc_offset);
+  entries_.reserve(static_cast<size_t>(count));
+  for (uint64_t i = 0; i < count; ++i) {
+    auto name_len = in.get<uint32_t>();
+    auto method = in.get<uint8_t>();
+    in.skip(3);
+    Entry entry;
+    entry.offset = in.get<uint64_t>();
+    entry.stored_size = in.get<uint64_t>();
+    entry.size = in.get<uint64_t>();
+    entry.name = in.str(name_len);
+    if (method > static_cast<uint8_t>(Method::Deflate) ||
+        entry.offset > size_ || entry.stored_size > size_ - entry.offset)
+      throw std::runtime_error("Corrupt archive: " + path_);
+    entry.method = static_cast<Method>(method);
+    entries_.push_back(std::move(entry));
+  }
+}
+
+const Archive::Entry *Archive::find(std::string_view name) const {
+  for (const auto &entry : entries_)
+    if (entry.name == name) return &entry;
+  return nullptr;
+}
+
+const Archive::Entry *Archive::main_entry() const {
+  for (const auto &entry : entries_) {
+    if ((entry.name == "main.bloa" || entry.name == "index.bloa") &&
+        entry.size > 0)
+      return &entry;
+  }
+  for (const auto &entry : entries_) {
+    if (fs::path(entry.name).extension() == ".bloa" && entry.size > 0)
+      return &entry;
+  }
+  if (!entries_.empty() && entries_[0].size > 0) return &entries_[0];
+  return nullptr;
+}
+
+std::string_view Archive::contents(const Entry &entry,
+                                   std::string &scratch) const {
+  std::string_view stored(data_ + entry.offset,
+                          static_cast<size_t>(entry.stored_size));
+  if (entry.method == Method::Stored) return stored;
+#ifdef BLOA_USE_ZLIB
+  scratch.resize(static_cast<size_t>(entry.size));
+  uLongf out_len = static_cast<uLongf>(entry.size);
+  int rc = ::uncompress(reinterpret_cast<Bytef *>(scratch.data()), &out_len,
+                        reinterpret_cast<const Bytef *>(stored.data()),
+                        static_cast<uLong>(stored.size()));
+  if (rc != Z_OK || out_len != entry.size)
+    throw std::runtime_error("Corrupt archive entry '" + entry.name +
+                             "' in " + path_);
+  return scratch;
+#else
+  (void)scratch;
+  throw std::runtime_error("Archive entry '" + entry.name +
+                           "' is compressed; rebuild with BLOA_USE_ZLIB");
+#endif
+}
+
+std::string Archive::read(const Entry &entry) const {
+  std::string scratch;
+  std::string_view view = contents(entry, scratch);
+  return entry.method == Method::Stored ? std::string(view) : scratch;
+}
+
+std::vector<std::pair<std::string, std::string>> read_archive(
+    const std::string &path) {
+  Archive archive(path);
+  std::vector<std::pair<std::string, std::string>> entries;
+  entries.reserve(archive.entries().size());
+  for (const auto &entry : archive.entries())
+    entries.emplace_back(entry.name, archive.read(entry));
+  return entries;
+}
+
+void write_archive(
+    const std::string &path,
+    const std::vector<std::pair<std::string, std::string>> &entries,
+    bool compress) {
+  // Compressed payloads are built first so the table can be laid out
+  // before anything is written.
+  std::vector<std::string> packed(entries.size());
+  std::vector<Archive::Method> methods(entries.size(),
+                                       Archive::Method::Stored);
+#ifdef BLOA_USE_ZLIB
+  if (compress) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const std::string &data = entries[i].second;
+      uLongf len = ::compressBound(static_cast<uLong>(data.size()));
+      std::string out(len, '\0');
+      if (::compress2(reinterpret_cast<Bytef *>(out.data()), &len,
+                      reinterpret_cast<const Bytef *>(data.data()),
+                      static_cast<uLong>(data.size()),
+                      Z_DEFAULT_COMPRESSION) == Z_OK &&
+          len < data.size()) {
+        out.resize(len);
+        packed[i] = std::move(out);
+        methods[i] = Archive::Method::Deflate;
+      }
+    }
+  }
+#else
+  (void)compress;
+#endif
+
+  std::string toc;
+  uint64_t offset = kHeaderV2;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto &[name, data] = entries[i];
+    uint64_t stored = methods[i] == Archive::Method::Stored
+                          ? data.size()
+                          : packed[i].size();
+    put<uint32_t>(toc, static_cast<uint32_t>(name.size()));
+    put<uint8_t>(toc, static_cast<uint8_t>(methods[i]));
+    toc.append(3, '\0');
+    put<uint64_t>(toc, offset);
+    put<uint64_t>(toc, stored);
+    put<uint64_t>(toc, data.size());
+    toc.append(name);
+    offset += stored;
+  }
+
+  std::string header(kMagicV2);
+  put<uint32_t>(header, 0);
+  put<uint64_t>(header, offset);
+  put<uint64_t>(header, entries.size());
+
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs) throw std::runtime_error("Cannot create archive: " + path);
+  ofs.write(header.data(), static_cast<std::streamsize>(header.size()));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const std::string &payload = methods[i] == Archive::Method::Stored
+                                     ? entries[i].second
+                                     : packed[i];
+    ofs.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+  }
+  ofs.write(toc.data(), static_cast<std::streamsize>(toc.size()));
+  if (!ofs) throw std::runtime_error("Cannot write archive: " + path);
+}
+
+}  // namespace bloa
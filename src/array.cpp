@@ -0,0 +1,513 @@
+#include "bloa/array.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "bloa/runtime.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace bloa {
+
+namespace {
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+Value wrap(NumArray::F64 data) {
+  return Value::make_array(std::make_shared<const NumArray>(std::move(data)));
+}
+
+Value wrap(NumArray::I64 data) {
+  return Value::make_array(std::make_shared<const NumArray>(std::move(data)));
+}
+
+NumArray::F64 to_f64(const NumArray &a) {
+  if (!a.is_int()) return a.f64();
+  return NumArray::F64(a.i64().begin(), a.i64().end());
+}
+
+void require_nonempty(const NumArray &a, const char *fn) {
+  if (a.size() == 0)
+    throw std::runtime_error(std::string(fn) + "() of an empty array");
+}
+
+double sum_f64(const double *x, size_t n) {
+  size_t i = 0;
+  double total = 0;
+#ifdef __SSE2__
+  // Four independent accumulators keep the adds from waiting on each other.
+  __m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(x + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(x + i + 2));
+    s2 = _mm_add_pd(s2, _mm_loadu_pd(x + i + 4));
+    s3 = _mm_add_pd(s3, _mm_loadu_pd(x + i + 6));
+  }
+  __m128d s = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+  double lanes[2];
+  _mm_storeu_pd(lanes, s);
+  total = lanes[0] + lanes[1];
+#endif
+  for (; i < n; ++i) total += x[i];
+  return total;
+}
+
+double dot_f64(const double *x, const double *y, size_t n) {
+  size_t i = 0;
+  double total = 0;
+#ifdef __SSE2__
+  __m128d s0 = _mm_setzero_pd(), s1 = s0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    s1 = _mm_add_pd(
+        s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+  total = lanes[0] + lanes[1];
+#endif
+  for (; i < n; ++i) total += x[i] * y[i];
+  return total;
+}
+
+// The exact sum of n int64s. With SSE2 each element is taken apart as
+// hi * 2^32 + lo - sign * 2^64 (hi and lo unsigned 32-bit halves), and the
+// three parts are summed in 64-bit lanes that cannot overflow for blocks
+// below 2^31 elements.
+__int128 sum_i64(const int64_t *x, size_t n) {
+  __int128 total = 0;
+  size_t i = 0;
+#ifdef __SSE2__
+  constexpr size_t kBlock = size_t(1) << 30;
+  const __m128i low_mask = _mm_set1_epi64x(0xffffffff);
+  while (i + 2 <= n) {
+    size_t end = i + std::min(kBlock, (n - i) & ~size_t(1));
+    __m128i lo = _mm_setzero_si128(), hi = lo, sign = lo;
+    for (; i < end; i += 2) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+      lo = _mm_add_epi64(lo, _mm_and_si128(v, low_mask));
+      hi = _mm_add_epi64(hi, _mm_srli_epi64(v, 32));
+      sign = _mm_add_epi64(sign, _mm_srli_epi64(v, 63));
+    }
+    uint64_t l[2], h[2], s[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(l), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(h), hi);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(s), sign);
+    for (int k = 0; k < 2; ++k)
+      total += static_cast<__int128>(l[k]) +
+               (static_cast<__int128>(h[k]) << 32) -
+               (static_cast<__int128>(s[k]) << 64);
+  }
+#endif
+  for (; i < n; ++i) total += x[i];
+  return total;
+}
+
+// Four running values, for the same reason as sum_f64. Each starts at
+// `none`, which any element replaces unless it is NaN, so a NaN is skipped
+// wherever it sits.
+template <typename T, typename Better>
+T extreme(const T *x, size_t n, Better better, T none) {
+  T m[4] = {none, none, none, none};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    for (int k = 0; k < 4; ++k)
+      if (better(x[i + k], m[k])) m[k] = x[i + k];
+  for (; i < n; ++i)
+    if (better(x[i], m[0])) m[0] = x[i];
+  for (int k = 1; k < 4; ++k)
+    if (better(m[k], m[0])) m[0] = m[k];
+  return m[0];
+}
+
+// min or max of doubles. NaNs are missing samples and are skipped; only
+// an array of nothing but NaNs gives NaN.
+template <bool Min>
+double extreme_f64(const NumArray::F64 &x) {
+  constexpr double none = Min ? std::numeric_limits<double>::infinity()
+                              : -std::numeric_limits<double>::infinity();
+  size_t n = x.size();
+#ifdef __SSE2__
+  // minpd and maxpd return their second operand when either is NaN, so
+  // the running value stays a number.
+  __m128d m = _mm_set1_pd(none);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d v = _mm_loadu_pd(x.data() + i);
+    m = Min ? _mm_min_pd(v, m) : _mm_max_pd(v, m);
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, m);
+  double r = Min ? std::min(lanes[0], lanes[1]) : std::max(lanes[0], lanes[1]);
+  for (; i < n; ++i)
+    if (Min ? x[i] < r : x[i] > r) r = x[i];
+#else
+  double r = Min ? extreme(x.data(), n, std::less<double>(), none)
+                 : extreme(x.data(), n, std::greater<double>(), none);
+#endif
+  if (r == none && std::find(x.begin(), x.end(), none) == x.end())
+    return kNaN;
+  return r;
+}
+
+// The i64 result of `a op b` for every element. Addition and subtraction
+// wrap and then test signs, which vectorizes; false on any overflow.
+template <typename A, typename B>
+bool int_elementwise(BinaryOp op, A a, B b, size_t n, NumArray::I64 &out) {
+  out.resize(n);
+  int64_t *r = out.data();
+  int64_t overflow = 0;
+  switch (op) {
+    case BinaryOp::Add:
+      for (size_t i = 0; i < n; ++i) {
+        int64_t x = a(i), y = b(i);
+        r[i] = static_cast<int64_t>(static_cast<uint64_t>(x) +
+                                    static_cast<uint64_t>(y));
+        overflow |= (x ^ r[i]) & (y ^ r[i]);
+      }
+      return overflow >= 0;
+    case BinaryOp::Sub:
+      for (size_t i = 0; i < n; ++i) {
+        int64_t x = a(i), y = b(i);
+        r[i] = static_cast<int64_t>(static_cast<uint64_t>(x) -
+                                    static_cast<uint64_t>(y));
+        overflow |= (x ^ y) & (x ^ r[i]);
+      }
+      return overflow >= 0;
+    default:
+      for (size_t i = 0; i < n; ++i)
+        if (mul_overflows(a(i), b(i), r[i])) return false;
+      return true;
+  }
+}
+
+template <typename A, typename B>
+NumArray::F64 float_elementwise(BinaryOp op, A a, B b, size_t n) {
+  NumArray::F64 out(n);
+  double *r = out.data();
+  switch (op) {
+    case BinaryOp::Add:
+      for (size_t i = 0; i < n; ++i) r[i] = a(i) + b(i);
+      break;
+    case BinaryOp::Sub:
+      for (size_t i = 0; i < n; ++i) r[i] = a(i) - b(i);
+      break;
+    case BinaryOp::Mul:
+      for (size_t i = 0; i < n; ++i) r[i] = a(i) * b(i);
+      break;
+    default:
+      for (size_t i = 0; i < n; ++i) {
+        if (b(i) == 0.0) throw std::runtime_error("Division by zero");
+        r[i] = a(i) / b(i);
+      }
+      break;
+  }
+  return out;
+}
+
+// An operand as a function of the element index: an array's elements or
+// a number broadcast to every index.
+struct IntOperand {
+  const int64_t *data;
+  int64_t scalar;
+  int64_t operator()(size_t i) const { return data ? data[i] : scalar; }
+};
+
+struct FloatOperand {
+  const double *f;
+  const int64_t *i;
+  double scalar;
+  double operator()(size_t k) const {
+    return f ? f[k] : i ? static_cast<double>(i[k]) : scalar;
+  }
+};
+
+// Sorts `data` ascending, over several threads once it is large enough to
+// pay for them: each thread sorts a run, then runs are merged pairwise.
+template <typename T>
+void sort_values(std::vector<T> &data) {
+  constexpr size_t kParallelMin = size_t(1) << 20;
+  size_t threads = std::min<size_t>(std::thread::hardware_concurrency(), 8);
+  if (data.size() < kParallelMin || threads < 2) {
+    std::sort(data.begin(), data.end());
+    return;
+  }
+  std::vector<size_t> bounds;
+  for (size_t t = 0; t <= threads; ++t)
+    bounds.push_back(data.size() * t / threads);
+  auto at = [&](size_t k) {
+    return data.begin() + static_cast<std::ptrdiff_t>(bounds[k]);
+  };
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t)
+    workers.emplace_back([&, t] { std::sort(at(t), at(t + 1)); });
+  for (auto &w : workers) w.join();
+  for (size_t width = 1; width < threads; width *= 2) {
+    workers.clear();
+    for (size_t t = 0; t + width < threads; t += 2 * width) {
+      size_t end = std::min(t + 2 * width, threads);
+      workers.emplace_back([&, t, width, end] {
+        std::inplace_merge(at(t), at(t + width), at(end));
+      });
+    }
+    for (auto &w : workers) w.join();
+  }
+}
+
+}  // namespace
+
+void ArrayBuilder::reserve(size_t n) {
+  if (is_int_)
+    ints_.reserve(n);
+  else
+    floats_.reserve(n);
+}
+
+void ArrayBuilder::add(int64_t x) {
+  if (is_int_)
+    ints_.push_back(x);
+  else
+    floats_.push_back(static_cast<double>(x));
+}
+
+void ArrayBuilder::add(double x) {
+  if (is_int_) {
+    floats_.reserve(std::max(ints_.capacity(), ints_.size() + 1));
+    floats_.assign(ints_.begin(), ints_.end());
+    ints_ = {};
+    is_int_ = false;
+  }
+  floats_.push_back(x);
+}
+
+void ArrayBuilder::add(const Value &x) {
+  if (const auto *i = std::get_if<int64_t>(&x.v)) return add(*i);
+  if (const auto *d = std::get_if<double>(&x.v)) return add(*d);
+  const auto *s = std::get_if<std::string>(&x.v);
+  if (!s) throw std::runtime_error(value_to_string(x) + " is not a number");
+  // An empty field is a missing sample.
+  if (s->empty()) return add(kNaN);
+  const char *begin = s->data();
+  const char *end = begin + s->size();
+  int64_t i;
+  auto parsed = std::from_chars(begin, end, i);
+  if (parsed.ec == std::errc() && parsed.ptr == end) return add(i);
+  char *stop = nullptr;
+  double d = std::strtod(begin, &stop);
+  if (stop != end) throw std::runtime_error("'" + *s + "' is not a number");
+  add(d);
+}
+
+Value ArrayBuilder::build() {
+  if (is_int_) return wrap(std::move(ints_));
+  return wrap(std::move(floats_));
+}
+
+Value make_array(const Value &source, bool as_int) {
+  const char *fn = as_int ? "array_i64" : "array_f64";
+  if (const auto *array =
+          std::get_if<std::shared_ptr<const NumArray>>(&source.v)) {
+    const NumArray &a = **array;
+    if (a.is_int() == as_int) return source;
+    if (!as_int) return wrap(to_f64(a));
+    return make_array(array_to_list(a), true);
+  }
+  const auto *list = std::get_if<List>(&source.v);
+  if (!list)
+    throw std::runtime_error(std::string(fn) + "() requires a list or array");
+  if (as_int) {
+    NumArray::I64 out;
+    out.reserve(list->size());
+    if (const auto *range = list->lazy_range()) {
+      for (size_t i = 0; i < range->count; ++i) out.push_back((*range)[i]);
+      return wrap(std::move(out));
+    }
+    for (const auto &item : *list) {
+      if (const auto *i = std::get_if<int64_t>(&item.v)) {
+        out.push_back(*i);
+        continue;
+      }
+      double d = value_as_number(item);
+      if (std::floor(d) != d || std::fabs(d) >= 9.2e18)
+        throw std::runtime_error(std::string(fn) + "() element " +
+                                 value_to_string(item) +
+                                 " is not an integer");
+      out.push_back(static_cast<int64_t>(d));
+    }
+    return wrap(std::move(out));
+  }
+  NumArray::F64 out;
+  out.reserve(list->size());
+  for (size_t i = 0; i < list->size(); ++i)
+    out.push_back(value_as_number(list->at(i)));
+  return wrap(std::move(out));
+}
+
+Value array_to_list(const NumArray &array) {
+  std::vector<Value> items;
+  items.reserve(array.size());
+  for (size_t i = 0; i < array.size(); ++i) items.push_back(array.at(i));
+  return Value::make_list(std::move(items));
+}
+
+Value array_sum(const NumArray &array) {
+  if (!array.is_int())
+    return Value::make_double(sum_f64(array.f64().data(), array.size()));
+  __int128 total = sum_i64(array.i64().data(), array.size());
+  if (total >= std::numeric_limits<int64_t>::min() &&
+      total <= std::numeric_limits<int64_t>::max())
+    return Value::make_int(static_cast<int64_t>(total));
+  return Value::make_double(static_cast<double>(total));
+}
+
+Value array_min(const NumArray &array) {
+  require_nonempty(array, "min");
+  if (array.is_int())
+    return Value::make_int(extreme(array.i64().data(), array.size(),
+                                   std::less<int64_t>(),
+                                   std::numeric_limits<int64_t>::max()));
+  return Value::make_double(extreme_f64<true>(array.f64()));
+}
+
+Value array_max(const NumArray &array) {
+  require_nonempty(array, "max");
+  if (array.is_int())
+    return Value::make_int(extreme(array.i64().data(), array.size(),
+                                   std::greater<int64_t>(),
+                                   std::numeric_limits<int64_t>::min()));
+  return Value::make_double(extreme_f64<false>(array.f64()));
+}
+
+Value array_mean(const NumArray &array) {
+  require_nonempty(array, "mean");
+  double total = array.is_int()
+                     ? static_cast<double>(
+                           sum_i64(array.i64().data(), array.size()))
+                     : sum_f64(array.f64().data(), array.size());
+  return Value::make_double(total / static_cast<double>(array.size()));
+}
+
+Value array_dot(const NumArray &a, const NumArray &b) {
+  if (a.size() != b.size())
+    throw std::runtime_error("dot() needs arrays of the same length");
+  if (!a.is_int() && !b.is_int())
+    return Value::make_double(
+        dot_f64(a.f64().data(), b.f64().data(), a.size()));
+  NumArray::F64 x = to_f64(a), y = to_f64(b);
+  return Value::make_double(dot_f64(x.data(), y.data(), x.size()));
+}
+
+Value array_arithmetic(BinaryOp op, const Value &left, const Value &right) {
+  if (op != BinaryOp::Add && op != BinaryOp::Sub && op != BinaryOp::Mul &&
+      op != BinaryOp::Div)
+    throw std::runtime_error("Arrays support only + - * /");
+  auto operand = [](const Value &v, const NumArray *&array) {
+    if (const auto *a = std::get_if<std::shared_ptr<const NumArray>>(&v.v))
+      array = a->get();
+    else if (!std::holds_alternative<int64_t>(v.v) &&
+             !std::holds_alternative<double>(v.v))
+      throw std::runtime_error("Array arithmetic needs an array or a number");
+  };
+  const NumArray *a = nullptr;
+  const NumArray *b = nullptr;
+  operand(left, a);
+  operand(right, b);
+  size_t n = a ? a->size() : b->size();
+  if (a && b && a->size() != b->size())
+    throw std::runtime_error("Array lengths differ: " +
+                             std::to_string(a->size()) + " and " +
+                             std::to_string(b->size()));
+
+  auto is_int = [](const NumArray *array, const Value &v) {
+    return array ? array->is_int() : std::holds_alternative<int64_t>(v.v);
+  };
+  if (op != BinaryOp::Div && is_int(a, left) && is_int(b, right)) {
+    auto ints = [](const NumArray *array, const Value &v) {
+      return array ? IntOperand{array->i64().data(), 0}
+                   : IntOperand{nullptr, std::get<int64_t>(v.v)};
+    };
+    NumArray::I64 out;
+    if (int_elementwise(op, ints(a, left), ints(b, right), n, out))
+      return wrap(std::move(out));
+  }
+  auto floats = [](const NumArray *array, const Value &v) {
+    if (!array) return FloatOperand{nullptr, nullptr, value_as_number(v)};
+    if (array->is_int()) return FloatOperand{nullptr, array->i64().data(), 0};
+    return FloatOperand{array->f64().data(), nullptr, 0};
+  };
+  return wrap(float_elementwise(op, floats(a, left), floats(b, right), n));
+}
+
+Value array_map(const NumArray &array, ElementFn fn) {
+  NumArray::F64 out = to_f64(array);
+  double *x = out.data();
+  size_t i = 0, n = out.size();
+  switch (fn) {
+    case ElementFn::Sqrt:
+#ifdef __SSE2__
+      for (; i + 2 <= n; i += 2)
+        _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+#endif
+      for (; i < n; ++i) x[i] = std::sqrt(x[i]);
+      break;
+    case ElementFn::Exp:
+      for (; i < n; ++i) x[i] = std::exp(x[i]);
+      break;
+    case ElementFn::Log:
+      for (; i < n; ++i) x[i] = std::log(x[i]);
+      break;
+  }
+  return wrap(std::move(out));
+}
+
+Value array_sorted(const NumArray &array) {
+  if (array.is_int()) {
+    NumArray::I64 out = array.i64();
+    sort_values(out);
+    return wrap(std::move(out));
+  }
+  NumArray::F64 out = array.f64();
+  // NaN is unordered, so it is moved out of the way before sorting.
+  auto nans = std::stable_partition(out.begin(), out.end(),
+                                    [](double x) { return !std::isnan(x); });
+  NumArray::F64 numbers(out.begin(), nans);
+  sort_values(numbers);
+  std::copy(numbers.begin(), numbers.end(), out.begin());
+  return wrap(std::move(out));
+}
+
+Value array_slice(const NumArray &array, size_t start, size_t end) {
+  auto first = static_cast<std::ptrdiff_t>(start);
+  auto last = static_cast<std::ptrdiff_t>(end);
+  if (array.is_int())
+    return wrap(NumArray::I64(array.i64().begin() + first,
+                              array.i64().begin() + last));
+  return wrap(
+      NumArray::F64(array.f64().begin() + first, array.f64().begin() + last));
+}
+
+bool array_equal(const NumArray &a, const NumArray &b) {
+  if (a.size() != b.size()) return false;
+  if (a.is_int() && b.is_int()) return a.i64() == b.i64();
+  for (size_t i = 0; i < a.size(); ++i)
+    if (value_as_number(a.at(i)) != value_as_number(b.at(i))) return false;
+  return true;
+}
+
+std::string array_to_string(const NumArray &array) {
+  std::string out = "[";
+  for (size_t i = 0; i < array.size(); ++i) {
+    if (i > 0) out += ", ";
+    out += array.at(i).to_string();
+  }
+  return out + "]";
+}
+
+}  // namespace bloa
@@ -0,0 +1,154 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+
+#include "bloa/server.hpp"
+
+extern char **environ;
+
+// The client half of bloa --serve. It needs nothing from the interpreter,
+// so bloa-client is built from this file alone.
+
+namespace bloa {
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool socket_address(const std::string &path, sockaddr_un &addr) {
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "Socket path is too long: " << path << std::endl;
+    return false;
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+bool peer_is_self(int sock) {
+  ucred cred{};
+  socklen_t len = sizeof(cred);
+  return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+         cred.uid == getuid();
+}
+
+std::string default_socket_path() {
+  if (const char *path = std::getenv("BLOA_SOCKET")) return path;
+  const char *runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && *runtime_dir)
+    return std::string(runtime_dir) + "/bloa.sock";
+  return "/tmp/bloa-" + std::to_string(getuid()) + ".sock";
+}
+
+int run_client(const std::string &socket_path, const std::string &script,
+               bool use_vm, bool unbuffered) {
+  sockaddr_un addr;
+  if (!socket_address(socket_path, addr)) return 1;
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0 ||
+      connect(sock, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr))) {
+    std::cerr << "Unable to connect to the bloa server at " << socket_path
+              << ": " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  // The request carries this process's environment and stdio, so it only
+  // goes to a server of the same user; anyone can create a socket in /tmp.
+  if (!peer_is_self(sock)) {
+    std::cerr << "The server at " << socket_path
+              << " is not running as this user" << std::endl;
+    close(sock);
+    return 1;
+  }
+
+  std::string flags;
+  if (use_vm) flags += 'v';
+  if (unbuffered) flags += 'u';
+  std::string name = script;
+  std::string source;
+  if (script == "-") {
+    flags += 's';
+    name = "<stdin>";
+    source.assign(std::istreambuf_iterator<char>(std::cin),
+                  std::istreambuf_iterator<char>());
+  }
+  std::error_code ec;
+  std::string cwd = std::filesystem::current_path(ec).string();
+  size_t env_count = 0;
+  while (environ[env_count]) ++env_count;
+
+  std::string request;
+  for (const std::string &f : {std::string(kServeMagic), flags, cwd, name,
+                               std::to_string(env_count)}) {
+    request += f;
+    request += '\0';
+  }
+  for (size_t i = 0; i < env_count; ++i) {
+    request += environ[i];
+    request += '\0';
+  }
+  request += source;
+
+  // A closed stdin, stdout or stderr is sent as /dev/null.
+  int fds[3];
+  for (int fd = 0; fd < 3; ++fd)
+    fds[fd] = fcntl(fd, F_GETFD) < 0 ? open("/dev/null", O_RDWR) : fd;
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+  iovec iov{request.data(), request.size()};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  ssize_t sent;
+  while ((sent = sendmsg(sock, &msg, 0)) < 0 && errno == EINTR) {
+  }
+  if (sent < 0 ||
+      !write_all(sock, request.data() + sent, request.size() - sent)) {
+    std::cerr << "Unable to send the request: " << std::strerror(errno)
+              << std::endl;
+    return 1;
+  }
+  shutdown(sock, SHUT_WR);
+
+  int32_t status = 0;
+  size_t got = 0;
+  auto *out = reinterpret_cast<char *>(&status);
+  while (got < sizeof(status)) {
+    ssize_t n = read(sock, out + got, sizeof(status) - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      std::cerr << "The bloa server closed the connection" << std::endl;
+      return 1;
+    }
+    got += static_cast<size_t>(n);
+  }
+  close(sock);
+  return status;
+}
+
+}  // namespace bloa
@@ -0,0 +1,31 @@
+#include <iostream>
+#include <string>
+
+#include "bloa/server.hpp"
+
+// bloa-client [--socket <path>] [--vm] [--unbuffered] <script | ->
+// does what `bloa --client` does, as a small executable of its own.
+int main(int argc, char **argv) {
+  std::string socket_path = bloa::default_socket_path();
+  bool use_vm = false;
+  bool unbuffered = false;
+  int argi = 1;
+  for (; argi < argc; ++argi) {
+    std::string opt = argv[argi];
+    if (opt == "--vm") {
+      use_vm = true;
+    } else if (opt == "--unbuffered") {
+      unbuffered = true;
+    } else if (opt == "--socket" && argi + 1 < argc) {
+      socket_path = argv[++argi];
+    } else {
+      break;
+    }
+  }
+  if (argi + 1 != argc) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--socket <path>] [--vm] [--unbuffered] <script | ->\n";
+    return 2;
+  }
+  return bloa::run_client(socket_path, argv[argi], use_vm, unbuffered);
+}
@@ -0,0 +1,204 @@
+#include "bloa/dict.hpp"
+
+#include <bit>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace bloa {
+
+namespace {
+
+constexpr int8_t kEmpty = -128;
+constexpr int8_t kDeleted = -2;
+
+uint64_t hash_key(const Value &key) {
+  if (const auto *i = std::get_if<int64_t>(&key.v)) {
+    // splitmix64's finalizer: consecutive ids spread over every group.
+    uint64_t x = static_cast<uint64_t>(*i);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+  return std::hash<std::string_view>()(std::get<std::string>(key.v));
+}
+
+bool same_key(const Value &a, const Value &b) {
+  if (const auto *x = std::get_if<int64_t>(&a.v)) {
+    const auto *y = std::get_if<int64_t>(&b.v);
+    return y && *x == *y;
+  }
+  const auto *x = std::get_if<std::string>(&a.v);
+  const auto *y = std::get_if<std::string>(&b.v);
+  return x && y && *x == *y;
+}
+
+int8_t tag_of(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+// Bit i is set where tags[i] == tag, for the 16 tags of a group.
+uint32_t match(const int8_t *tags, int8_t tag) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags));
+  return static_cast<uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag))));
+#else
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; ++i)
+    if (tags[i] == tag) bits |= 1u << i;
+  return bits;
+#endif
+}
+
+// Bit i is set where tags[i] is empty or deleted (the sign bit is set).
+uint32_t match_free(const int8_t *tags) {
+#ifdef __SSE2__
+  __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tags));
+  return static_cast<uint32_t>(_mm_movemask_epi8(group));
+#else
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; ++i)
+    if (tags[i] < 0) bits |= 1u << i;
+  return bits;
+#endif
+}
+
+}  // namespace
+
+const Value &Dict::key_of(const Value &key, Value &scratch) {
+  if (std::holds_alternative<int64_t>(key.v) ||
+      std::holds_alternative<std::string>(key.v))
+    return key;
+  if (const auto *d = std::get_if<double>(&key.v)) {
+    if (std::floor(*d) == *d && std::fabs(*d) < 9.2e18) {
+      scratch = Value::make_int(static_cast<int64_t>(*d));
+      return scratch;
+    }
+  }
+  throw std::runtime_error("Dict keys must be strings or integers");
+}
+
+// Groups are probed in triangular order, which visits every group of a
+// power-of-two table. The load limit guarantees an empty slot, so a probe
+// ends at the first group that has one.
+size_t Dict::find_slot(const Value &key, uint64_t hash) const {
+  if (tags_.empty()) return npos;
+  size_t mask = tags_.size() / kGroup - 1;
+  size_t group = (hash >> 7) & mask;
+  int8_t tag = tag_of(hash);
+  for (size_t step = 1;; ++step) {
+    const int8_t *tags = &tags_[group * kGroup];
+    for (uint32_t m = match(tags, tag); m; m &= m - 1) {
+      size_t slot = group * kGroup + static_cast<size_t>(std::countr_zero(m));
+      const Entry &e = entries_[slots_[slot]];
+      if (e.hash == hash && same_key(e.key, key)) return slot;
+    }
+    if (match(tags, kEmpty)) return npos;
+    group = (group + step) & mask;
+  }
+}
+
+size_t Dict::free_slot(uint64_t hash) const {
+  size_t mask = tags_.size() / kGroup - 1;
+  size_t group = (hash >> 7) & mask;
+  for (size_t step = 1;; ++step) {
+    uint32_t m = match_free(&tags_[group * kGroup]);
+    if (m) return group * kGroup + static_cast<size_t>(std::countr_zero(m));
+    group = (group + step) & mask;
+  }
+}
+
+// Rebuilds the table with `capacity` slots, dropping erased entries.
+void Dict::rehash(size_t capacity) {
+  if (size_ < entries_.size()) {
+    std::vector<Entry> live;
+    live.reserve(size_);
+    for (auto &e : entries_)
+      if (!std::holds_alternative<std::monostate>(e.key.v))
+        live.push_back(std::move(e));
+    entries_ = std::move(live);
+  }
+  tags_.assign(capacity, kEmpty);
+  slots_.assign(capacity, 0);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    size_t slot = free_slot(entries_[i].hash);
+    tags_[slot] = tag_of(entries_[i].hash);
+    slots_[slot] = static_cast<uint32_t>(i);
+  }
+  used_ = entries_.size();
+}
+
+// Capacity for n entries at a load of at most 7/8.
+static size_t capacity_for(size_t n) {
+  return std::max<size_t>(16, std::bit_ceil(n + n / 7 + 1));
+}
+
+void Dict::reserve(size_t n) {
+  entries_.reserve(n);
+  if (capacity_for(n) > tags_.size()) rehash(capacity_for(n));
+}
+
+const Value *Dict::find(const Value &key) const {
+  Value scratch;
+  const Value &k = key_of(key, scratch);
+  size_t slot = find_slot(k, hash_key(k));
+  return slot == npos ? nullptr : &entries_[slots_[slot]].value;
+}
+
+Value &Dict::operator[](const Value &key) {
+  Value scratch;
+  const Value &k = key_of(key, scratch);
+  uint64_t hash = hash_key(k);
+  size_t slot = find_slot(k, hash);
+  if (slot != npos) return entries_[slots_[slot]].value;
+  // Erased entries stay in entries_ (and their slots stay tombstones, which
+  // reuse does not count) until a rebuild drops them. Rebuild once they
+  // outnumber both the live entries and half the slots, so set/unset churn
+  // stays bounded and each rebuild is paid for by that many erasures.
+  if (entries_.size() - size_ > std::max(size_, tags_.size() / 2))
+    rehash(tags_.size());
+  if ((used_ + 1) * 8 > tags_.size() * 7) {
+    // Mostly tombstones: rebuild at the same size; else grow.
+    rehash(size_ * 2 < used_ ? std::max<size_t>(16, tags_.size())
+                             : capacity_for(2 * (size_ + 1)));
+  }
+  slot = free_slot(hash);
+  if (tags_[slot] == kEmpty) ++used_;
+  tags_[slot] = tag_of(hash);
+  slots_[slot] = static_cast<uint32_t>(entries_.size());
+  entries_.push_back(Entry{k, Value(), hash});
+  ++size_;
+  return entries_.back().value;
+}
+
+bool Dict::erase(const Value &key) {
+  Value scratch;
+  const Value &k = key_of(key, scratch);
+  size_t slot = find_slot(k, hash_key(k));
+  if (slot == npos) return false;
+  Entry &e = entries_[slots_[slot]];
+  e.key = Value();
+  e.value = Value();
+  tags_[slot] = kDeleted;
+  --size_;
+  return true;
+}
+
+std::string dict_to_string(const Dict &dict) {
+  std::string out = "{";
+  bool first = true;
+  dict.for_each([&](const Value &key, const Value &value) {
+    if (!first) out += ", ";
+    first = false;
+    out += key.to_string();
+    out += ": ";
+    out += value.to_string();
+  });
+  return out + "}";
+}
+
+}  // namespace bloa
@@ -11,8 +11,16 @@
 #include <sstream>
 #include <stdexcept>
 
+#include "bloa/archive.hpp"
+#include "bloa/array.hpp"
+#include "bloa/dict.hpp"
+#include "bloa/output.hpp"
 #include "bloa/parser.hpp"
+#include "bloa/profiler.hpp"
+#include "bloa/resolver.hpp"
+#include "bloa/runtime.hpp"
 #include "bloa/stdlib.hpp"
+#include "bloa/vm.hpp"
 
 namespace fs = std::filesystem;
 
@@ -20,10 +28,32 @@ namespace bloa {
 
 using NodePtr = std::shared_ptr<Node>;
 
-struct BreakException {};
-struct ContinueException {};
+// Break and continue that reach a function or script boundary had no loop
+// to consume them.
+static void check_completion(const Completion &c) {
+  if (c.kind == Completion::Kind::Break)
+    throw std::runtime_error("'break' outside loop");
+  if (c.kind == Completion::Kind::Continue)
+    throw std::runtime_error("'continue' outside loop");
+}
 
-static Value resolve_reference(const Value &v) {
+// Applied to each loop body result: true when the loop must stop. A break
+// is consumed here; a return is left for the caller to propagate.
+static bool loop_exit(Completion &c) {
+  switch (c.kind) {
+    case Completion::Kind::Normal:
+    case Completion::Kind::Continue:
+      return false;
+    case Completion::Kind::Break:
+      c.kind = Completion::Kind::Normal;
+      return true;
+    case Completion::Kind::Return:
+      return true;
+  }
+  return true;
+}
+
+Value resolve_reference(const Value &v) {
   if (std::holds_alternative<std::shared_ptr<Reference>>(v.v)) {
     auto ref = std::get<std::shared_ptr<Reference>>(v.v);
     auto target = ref->env->get(ref->name);
@@ -34,13 +64,13 @@ static Value resolve_reference(const Value &v) {
   return v;
 }
 
-static std::string value_to_string(const Value &v) {
+std::string value_to_string(const Value &v) {
   if (std::holds_alternative<std::monostate>(v.v)) return "None";
   if (std::holds_alternative<int64_t>(v.v))
     return std::to_string(std::get<int64_t>(v.v));
   if (std::holds_alternative<double>(v.v)) {
     double d = std::get<double>(v.v);
-    if (std::floor(d) == d) {
+    if (std::floor(d) == d && std::fabs(d) < 1e18) {
       return std::to_string(static_cast<int64_t>(d));
     }
     return std::to_string(d);
@@ -49,9 +79,9 @@ static std::string value_to_string(const Value &v) {
     return std::get<std::string>(v.v);
   if (std::holds_alternative<bool>(v.v))
     return std::get<bool>(v.v) ? "true" : "false";
-  if (std::holds_alternative<std::vector<Value>>(v.v)) {
+  if (std::holds_alternative<List>(v.v)) {
     std::string out = "[";
-    const auto &list = std::get<std::vector<Value>>(v.v);
+    const auto &list = std::get<List>(v.v);
     for (size_t i = 0; i < list.size(); ++i) {
       if (i > 0) out += ", ";
       out += value_to_string(list[i]);
@@ -67,24 +97,25 @@ static std::string value_to_string(const Value &v) {
     const auto &ref = std::get<std::shared_ptr<Reference>>(v.v);
     return "<ref " + ref->name + ">";
   }
+  if (v.is_builtin() || std::holds_alternative<std::shared_ptr<Dict>>(v.v) ||
+      std::holds_alternative<std::shared_ptr<const NumArray>>(v.v))
+    return v.to_string();
   return "<unknown>";
 }
 
-static bool is_list_value(const Value &v) {
-  Value resolved = resolve_reference(v);
-  return std::holds_alternative<std::vector<Value>>(resolved.v);
+bool is_list_value(const Value &v) {
+  if (v.is_reference()) return is_list_value(resolve_reference(v));
+  return std::holds_alternative<List>(v.v);
 }
 
-static double value_as_number(const Value &v) {
-  Value resolved = resolve_reference(v);
-  if (std::holds_alternative<int64_t>(resolved.v))
-    return static_cast<double>(std::get<int64_t>(resolved.v));
-  if (std::holds_alternative<double>(resolved.v))
-    return std::get<double>(resolved.v);
-  if (std::holds_alternative<std::string>(resolved.v)) {
-    const std::string &s = std::get<std::string>(resolved.v);
+double value_as_number(const Value &v) {
+  if (const auto *i = std::get_if<int64_t>(&v.v))
+    return static_cast<double>(*i);
+  if (const auto *d = std::get_if<double>(&v.v)) return *d;
+  if (v.is_reference()) return value_as_number(resolve_reference(v));
+  if (const auto *s = std::get_if<std::string>(&v.v)) {
     try {
-      return std::stod(s);
+      return std::stod(*s);
     } catch (...) {
       // fall through to error
     }
@@ -92,85 +123,336 @@ static double value_as_number(const Value &v) {
   throw std::runtime_error("Value is not numeric");
 }
 
-static bool value_is_true(const Value &v) {
-  Value resolved = resolve_reference(v);
-  if (std::holds_alternative<std::monostate>(resolved.v)) return false;
-  if (std::holds_alternative<bool>(resolved.v))
-    return std::get<bool>(resolved.v);
-  if (std::holds_alternative<int64_t>(resolved.v))
-    return std::get<int64_t>(resolved.v) != 0;
-  if (std::holds_alternative<double>(resolved.v))
-    return std::get<double>(resolved.v) != 0.0;
-  if (std::holds_alternative<std::string>(resolved.v))
-    return !std::get<std::string>(resolved.v).empty();
-  if (std::holds_alternative<std::vector<Value>>(resolved.v))
-    return !std::get<std::vector<Value>>(resolved.v).empty();
-  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(resolved.v))
+bool value_is_true(const Value &v) {
+  if (std::holds_alternative<std::monostate>(v.v)) return false;
+  if (std::holds_alternative<bool>(v.v)) return std::get<bool>(v.v);
+  if (std::holds_alternative<int64_t>(v.v)) return std::get<int64_t>(v.v) != 0;
+  if (std::holds_alternative<double>(v.v)) return std::get<double>(v.v) != 0.0;
+  if (std::holds_alternative<std::string>(v.v))
+    return !std::get<std::string>(v.v).empty();
+  if (std::holds_alternative<List>(v.v)) return !std::get<List>(v.v).empty();
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v))
     return true;  // all objects are truthy
+  if (const auto *d = std::get_if<std::shared_ptr<Dict>>(&v.v))
+    return !(*d)->empty();
+  if (const auto *a = std::get_if<std::shared_ptr<const NumArray>>(&v.v))
+    return (*a)->size() > 0;
+  if (v.is_reference()) return value_is_true(resolve_reference(v));
+  if (v.is_builtin()) return true;
   return false;
 }
 
-static std::vector<Value> as_list(const Value &v) {
-  Value resolved = resolve_reference(v);
-  return std::get<std::vector<Value>>(resolved.v);
+Value parse_input_value(const std::string &input) {
+  try {
+    std::size_t pos;
+    long long xi = std::stoll(input, &pos);
+    if (pos == input.size()) return Value::make_int(xi);
+    double xd = std::stod(input, &pos);
+    if (pos == input.size()) return Value::make_double(xd);
+  } catch (...) {
+  }
+  return Value::make_str(input);
+}
+
+// Int/int operands stay int64_t while the result is exact; everything else,
+// including an overflowing or inexact int result, is computed as double.
+static Value arithmetic(BinaryOp op, const Value &left, const Value &right) {
+  const auto *a = std::get_if<int64_t>(&left.v);
+  const auto *b = std::get_if<int64_t>(&right.v);
+  if (a && b) {
+    int64_t result;
+    if (int_arithmetic(op, *a, *b, result)) return Value::make_int(result);
+  } else if (left.is_reference() || right.is_reference()) {
+    return arithmetic(op, resolve_reference(left), resolve_reference(right));
+  } else if (std::holds_alternative<std::shared_ptr<const NumArray>>(left.v) ||
+             std::holds_alternative<std::shared_ptr<const NumArray>>(right.v)) {
+    return array_arithmetic(op, left, right);
+  }
+  double x = value_as_number(left);
+  double y = value_as_number(right);
+  switch (op) {
+    case BinaryOp::Add:
+      return Value::make_double(x + y);
+    case BinaryOp::Sub:
+      return Value::make_double(x - y);
+    case BinaryOp::Mul:
+      return Value::make_double(x * y);
+    case BinaryOp::Div:
+      if (y == 0.0) throw std::runtime_error("Division by zero");
+      return Value::make_double(x / y);
+    case BinaryOp::Mod:
+      if (y == 0.0) throw std::runtime_error("Modulo by zero");
+      return Value::make_double(std::fmod(x, y));
+    case BinaryOp::Pow:
+      return Value::make_double(std::pow(x, y));
+    default:
+      break;
+  }
+  throw std::runtime_error("Unknown binary operator");
+}
+
+template <typename T>
+static bool ordered(BinaryOp op, T a, T b) {
+  switch (op) {
+    case BinaryOp::Lt:
+      return a < b;
+    case BinaryOp::Le:
+      return a <= b;
+    case BinaryOp::Gt:
+      return a > b;
+    default:
+      return a >= b;
+  }
+}
+
+Value apply_binary(BinaryOp op, const Value &left, const Value &right) {
+  switch (op) {
+    case BinaryOp::Add:
+      if (std::holds_alternative<std::string>(left.v) ||
+          std::holds_alternative<std::string>(right.v)) {
+        return Value::make_str(value_to_string(left) + value_to_string(right));
+      }
+      return arithmetic(op, left, right);
+    case BinaryOp::Sub:
+    case BinaryOp::Mul:
+    case BinaryOp::Div:
+    case BinaryOp::Mod:
+    case BinaryOp::Pow:
+      return arithmetic(op, left, right);
+    case BinaryOp::Eq:
+    case BinaryOp::Ne: {
+      bool eq_op = op == BinaryOp::Eq;
+      bool result = !eq_op;
+      if (std::holds_alternative<int64_t>(left.v) &&
+          std::holds_alternative<int64_t>(right.v)) {
+        result = std::get<int64_t>(left.v) == std::get<int64_t>(right.v);
+      } else if (std::holds_alternative<double>(left.v) ||
+                 std::holds_alternative<double>(right.v)) {
+        result = value_as_number(left) == value_as_number(right);
+      } else if (std::holds_alternative<std::string>(left.v) &&
+                 std::holds_alternative<std::string>(right.v)) {
+        result =
+            std::get<std::string>(left.v) == std::get<std::string>(right.v);
+      } else if (std::holds_alternative<bool>(left.v) &&
+                 std::holds_alternative<bool>(right.v)) {
+        result = std::get<bool>(left.v) == std::get<bool>(right.v);
+      } else if (left.is_builtin() && right.is_builtin()) {
+        result = std::get<const BuiltinFunction *>(left.v) ==
+                 std::get<const BuiltinFunction *>(right.v);
+      } else if (std::holds_alternative<std::shared_ptr<Dict>>(left.v) &&
+                 std::holds_alternative<std::shared_ptr<Dict>>(right.v)) {
+        // Dicts are shared by reference, so compare as the same dict.
+        result = std::get<std::shared_ptr<Dict>>(left.v) ==
+                 std::get<std::shared_ptr<Dict>>(right.v);
+      } else if (const auto *a =
+                     std::get_if<std::shared_ptr<const NumArray>>(&left.v)) {
+        const auto *b = std::get_if<std::shared_ptr<const NumArray>>(&right.v);
+        if (!b) return Value::make_bool(!eq_op);
+        result = array_equal(**a, **b);
+      } else {
+        return Value::make_bool(!eq_op);
+      }
+      return Value::make_bool(eq_op ? result : !result);
+    }
+    case BinaryOp::Lt:
+    case BinaryOp::Le:
+    case BinaryOp::Gt:
+    case BinaryOp::Ge: {
+      const auto *a = std::get_if<int64_t>(&left.v);
+      const auto *b = std::get_if<int64_t>(&right.v);
+      if (a && b) return Value::make_bool(ordered(op, *a, *b));
+      return Value::make_bool(
+          ordered(op, value_as_number(left), value_as_number(right)));
+    }
+    default:
+      break;
+  }
+  throw std::runtime_error("Unknown binary operator");
+}
+
+Value address_of(const std::string &name,
+                 const std::shared_ptr<Environment> &env) {
+  auto ref_env = env;
+  while (ref_env && !ref_env->has_local(name)) ref_env = ref_env->parent;
+  if (!ref_env) throw std::runtime_error("Undefined variable '" + name + "'");
+  return Value::make_ref(ref_env, name);
+}
+
+Value dereference(const Value &operand) {
+  if (!operand.is_reference())
+    throw std::runtime_error("Cannot dereference non-pointer value");
+  const auto &ref = operand.as_reference();
+  auto target = ref.env->get(ref.name);
+  if (!target)
+    throw std::runtime_error("Invalid reference target: " + ref.name);
+  return *target;
 }
 
-Environment::Environment(std::shared_ptr<Environment> parent_)
-    : parent(std::move(parent_)), vars() {}
+Value get_member(const Value &base, const std::string &member) {
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&base.v)) {
+    const Value *found = (*dict)->find(Value::make_str(member));
+    if (!found)
+      throw std::runtime_error("Key '" + member + "' not found in dict");
+    return *found;
+  }
+  if (!std::holds_alternative<std::shared_ptr<ObjectInstance>>(base.v))
+    throw std::runtime_error("Cannot access member on non-object");
+  const auto &obj_inst = std::get<std::shared_ptr<ObjectInstance>>(base.v);
+  auto prop_val = obj_inst->properties->get(member);
+  if (!prop_val.has_value())
+    throw std::runtime_error("Property '" + member + "' not found in object");
+  return std::move(*prop_val);
+}
+
+void set_member(const Value &base, const std::string &member, Value value) {
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&base.v))
+    (*dict)->set(Value::make_str(member), std::move(value));
+  else
+    std::get<std::shared_ptr<ObjectInstance>>(base.v)->properties->set(
+        member, std::move(value));
+}
+
+Value make_dict(std::span<Value> pairs) {
+  auto dict = std::make_shared<Dict>();
+  dict->reserve(pairs.size() / 2);
+  for (size_t i = 0; i + 1 < pairs.size(); i += 2)
+    dict->set(pairs[i], std::move(pairs[i + 1]));
+  return Value::make_dict(std::move(dict));
+}
+
+static size_t list_index(const Value &index, size_t size) {
+  int64_t idx = static_cast<int64_t>(value_as_number(index));
+  if (idx < 0 || idx >= static_cast<int64_t>(size)) {
+    throw std::runtime_error("List index " + std::to_string(idx) +
+                             " out of range [0, " + std::to_string(size) +
+                             ")");
+  }
+  return static_cast<size_t>(idx);
+}
+
+Value index_value(const Value &base, const Value &index) {
+  Value resolved;
+  const Value *target = &base;
+  if (base.is_reference()) {
+    resolved = resolve_reference(base);
+    target = &resolved;
+  }
+  // A missing key reads as null, as get() does.
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&target->v)) {
+    const Value *found = (*dict)->find(index);
+    return found ? *found : Value();
+  }
+  if (const auto *array =
+          std::get_if<std::shared_ptr<const NumArray>>(&target->v)) {
+    int64_t idx = static_cast<int64_t>(value_as_number(index));
+    if (idx < 0 || idx >= static_cast<int64_t>((*array)->size()))
+      throw std::runtime_error("Array index " + std::to_string(idx) +
+                               " out of range [0, " +
+                               std::to_string((*array)->size()) + ")");
+    return (*array)->at(static_cast<size_t>(idx));
+  }
+  if (!std::holds_alternative<List>(target->v))
+    throw std::runtime_error("Object is not subscriptable (not a list)");
+  const auto &list = std::get<List>(target->v);
+  return list.at(list_index(index, list.size()));
+}
+
+// The binding a reference names, following references to references.
+static Value &follow_references(Value &v) {
+  Value *target = &v;
+  while (target->is_reference()) {
+    const Reference &ref = target->as_reference();
+    target = ref.env->find(ref.name);
+    if (!target)
+      throw std::runtime_error("Invalid reference target: " + ref.name);
+  }
+  return *target;
+}
+
+void set_index(Value &base, const Value &index, Value value) {
+  Value &target = follow_references(base);
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&target.v)) {
+    (*dict)->set(index, std::move(value));
+    return;
+  }
+  auto *list = std::get_if<List>(&target.v);
+  if (!list)
+    throw std::runtime_error(
+        "Only list elements and dict keys can be assigned with []");
+  size_t i = list_index(index, list->size());
+  list->mutate()[i] = std::move(value);
+}
+
+void set_index_temporary(const Value &base, const Value &index,
+                         Value value) {
+  Value copy = resolve_reference(base);
+  if (std::holds_alternative<List>(copy.v))
+    throw std::runtime_error("List element assignment requires a variable");
+  set_index(copy, index, std::move(value));
+}
+
+Value *index_place(Value &base, const Value &index) {
+  Value &target = follow_references(base);
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&target.v))
+    return (*dict)->find(index);
+  auto *list = std::get_if<List>(&target.v);
+  if (!list) return nullptr;
+  size_t i = list_index(index, list->size());
+  return &list->mutate()[i];
+}
+
+Environment::Environment(std::shared_ptr<Environment> parent_,
+                         ScopeLayoutPtr layout_)
+    : parent(std::move(parent_)), vars(), layout(std::move(layout_)) {
+  if (layout) slots.resize(layout->names.size());
+}
 
 std::optional<Value> Environment::get(const std::string &name) const {
   auto it = vars.find(name);
   if (it != vars.end()) return it->second.value;
+  if (const Value *slot = bound_slot(name)) return *slot;
   if (parent) return parent->get(name);
   return std::nullopt;
 }
 
 void Environment::set(const std::string &name, Value val) {
   if (name == "true" || name == "false" || name == "none") {
-    if (vars.find(name) != vars.end()) {
+    // The constants live in the builtin scope, so a global scope is the
+    // one with it as parent.
+    if (vars.find(name) != vars.end() || (parent && parent->shared)) {
       throw std::runtime_error("Cannot reassign constant '" + name + "'");
     }
   }
-  auto it = vars.find(name);
-  if (it != vars.end()) {
-    it->second.value = std::move(val);
-    return;
-  }
-
-  auto current = parent;
-  while (current) {
+  Environment *below = this;
+  for (Environment *current = this; current;
+       below = current, current = current->parent.get()) {
+    if (current->shared) {
+      // A builtin is shadowed in the global scope, as if assigned there.
+      Environment *target = current->vars.count(name) ? below : this;
+      target->set_local(name, std::move(val));
+      return;
+    }
     auto pit = current->vars.find(name);
     if (pit != current->vars.end()) {
       pit->second.value = std::move(val);
       return;
     }
-    current = current->parent;
+    if (Value *slot = current->bound_slot(name)) {
+      *slot = std::move(val);
+      return;
+    }
   }
 
-  vars[name] = Variable{std::move(val), std::string{}};
+  set_local(name, std::move(val));
 }
 
 Interpreter::Interpreter(std::string stdlib_path_, const std::string &source)
-    : global_env(std::make_shared<Environment>(nullptr)),
+    : global_env(std::make_shared<Environment>(builtin_scope())),
       functions(),
       classes(),
       loaded_modules(),
       stdlib_path(std::move(stdlib_path_)),
       s(source) {
-  global_env->set("null", Value());
-  global_env->set("true", Value::make_bool(true));
-  global_env->set("false", Value::make_bool(false));
-
-  global_env->set("print", Value::make_str("__builtin_print"));
-  global_env->set("range", Value::make_str("__builtin_range"));
-  global_env->set("len", Value::make_str("__builtin_len"));
-  global_env->set("str", Value::make_str("__builtin_str"));
-  global_env->set("int", Value::make_str("__builtin_int"));
-  global_env->set("float", Value::make_str("__builtin_float"));
-  global_env->set("append", Value::make_str("__builtin_append"));
-
-  // Register standard library
-  register_stdlib(global_env);
 
   // Load default standard library modules
   /*
@@ -194,17 +476,79 @@ Interpreter::Interpreter(std::string stdlib_path_, const std::string &source)
   */
 }
 
-NodeList Interpreter::parse(const std::string &source) {
-  auto lines = split_lines(source);
-  auto res = parse_block(lines, 0, 0);
+NodeList Interpreter::parse(std::string_view source) {
+  SourceLines source_lines = split_lines(source);
+  auto res = parse_block(source_lines.lines, 0, 0);
+  resolve_program(res.first);
   return res.first;
 }
 
+void Interpreter::record_definition(const NodePtr &node) {
+  if (recorded_definitions.insert(node.get()).second)
+    definitions.push_back(node);
+}
+
+std::shared_ptr<Environment> Interpreter::acquire_scope(
+    std::shared_ptr<Environment> parent, ScopeLayoutPtr layout) {
+  if (profiler::active) profiler::count_scope(!free_scopes.empty());
+  if (free_scopes.empty())
+    return std::make_shared<Environment>(std::move(parent), std::move(layout));
+  auto scope = std::move(free_scopes.back());
+  free_scopes.pop_back();
+  scope->reset(std::move(parent), std::move(layout));
+  return scope;
+}
+
+void Interpreter::release_scope(std::shared_ptr<Environment> scope) {
+  // A scope captured by a closure, reference or live child scope must keep
+  // its bindings, so only exclusively owned scopes are recycled.
+  constexpr size_t kMaxFreeScopes = 64;
+  if (scope.use_count() != 1 || free_scopes.size() >= kMaxFreeScopes) return;
+  scope->reset(nullptr, nullptr);
+  free_scopes.push_back(std::move(scope));
+}
+
+// Blocks the resolver found binding nothing have no layout and run in the
+// enclosing scope without allocating one.
+Completion Interpreter::execute_scoped(
+    const NodeList &block, const ScopeLayoutPtr &layout,
+    const std::shared_ptr<Environment> &env) {
+  if (!layout) return execute_block(block, env);
+  auto scope = acquire_scope(env, layout);
+  Completion result = execute_block(block, scope);
+  release_scope(std::move(scope));
+  return result;
+}
+
+// Loop bodies keep one scope for the whole loop and clear it between
+// iterations. If the last iteration let the scope escape, a fresh one is
+// taken instead so the captured bindings survive.
+const std::shared_ptr<Environment> &Interpreter::iteration_scope(
+    std::shared_ptr<Environment> &scope,
+    const std::shared_ptr<Environment> &parent, const ScopeLayoutPtr &layout) {
+  if (!layout) return parent;
+  if (scope && scope.use_count() == 1 && scope->parent == parent)
+    scope->clear_bindings();
+  else
+    scope = acquire_scope(parent, layout);
+  return scope;
+}
+
 void Interpreter::run(const std::string &code, const std::string &filename) {
+  run_nodes([&] { return parse(code); }, filename);
+}
+
+// Parse errors from `load` are reported the same way as runtime ones.
+void Interpreter::run_nodes(const std::function<NodeList()> &load,
+                            const std::string &filename) {
   try {
-    auto nodes = parse(code);
-    execute_block(nodes, global_env);
+    NodeList nodes = load();
+    if (vm_enabled)
+      execute_chunk(*compile_chunk(nodes), global_env);
+    else
+      check_completion(execute_block(nodes, global_env));
   } catch (const std::exception &e) {
+    flush_output();
     std::cerr << "[BLOA Error] " << e.what() << "\n";
     std::cerr << "  File: " << filename << "\n";
   }
@@ -217,907 +561,706 @@ static std::string trim(const std::string &s) {
   return s.substr(a, (b - a + 1));
 }
 
-static bool is_ident_start(char c) {
-  return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+std::vector<Value> Interpreter::evaluate_args(
+    const ExprList &args, const std::shared_ptr<Environment> &env) {
+  std::vector<Value> values;
+  values.reserve(args.size());
+  for (const auto &arg : args) values.push_back(evaluate(*arg, env));
+  return values;
 }
 
-static bool is_ident_continue(char c) {
-  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '\'';
+Value Interpreter::call_function(const FunctionDefEntry &fn, const Value *self,
+                                 const std::vector<Value> &args) {
+  profiler::CallProbe probe(fn.name);
+  // Parameters occupy the first slots of the function scope.
+  auto call_env = acquire_scope(fn.def_env, fn.scope);
+  int16_t first = 0;
+  if (self) {
+    call_env->bind_slot(0, *self);
+    first = 1;
+  }
+  for (size_t i = 0; i < args.size(); ++i) {
+    call_env->bind_slot(static_cast<int16_t>(first + i), args[i]);
+  }
+  Value result;
+  if (vm_enabled) {
+    if (!fn.code) fn.code = compile_chunk(fn.block);
+    result = execute_chunk(*fn.code, call_env);
+  } else {
+    Completion c = execute_block(fn.block, call_env);
+    check_completion(c);
+    result = std::move(c.value);
+  }
+  release_scope(std::move(call_env));
+  return result;
 }
 
-Value Interpreter::parse_expression(std::string expr,
-                                    std::shared_ptr<Environment> env) {
-  struct Parser {
-    std::string s;
-    size_t pos;
-    Interpreter *interp;
-    std::shared_ptr<Environment> env;
+Value Interpreter::instantiate(const std::string &class_name,
+                               const std::vector<Value> &args) {
+  auto class_it = classes.find(class_name);
+  if (class_it == classes.end())
+    throw std::runtime_error("Class '" + class_name + "' not found");
+
+  const auto &klass = class_it->second;
+  auto instance_env = std::make_shared<Environment>(klass->class_env);
+  auto instance = Value::make_object(class_name, instance_env, klass);
+
+  const FunctionDefEntry *init_method = klass->init;
+  if (init_method) {
+    if (init_method->params.size() != args.size() + 1)
+      throw std::runtime_error(
+          "__init__() expects " +
+          std::to_string(static_cast<int>(init_method->params.size()) - 1) +
+          " arguments but got " + std::to_string(args.size()));
+    call_function(*init_method, &instance, args);
+  } else if (!args.empty()) {
+    throw std::runtime_error("Class '" + class_name +
+                             "' does not accept arguments");
+  }
+  return instance;
+}
 
-    Parser(const std::string &str, Interpreter *i,
-           std::shared_ptr<Environment> e)
-        : s(str), pos(0), interp(i), env(std::move(e)) {}
+static std::string canonical_key(const fs::path &path) {
+  std::error_code ec;
+  fs::path canonical = fs::weakly_canonical(path, ec);
+  return ec ? path.string() : canonical.string();
+}
 
-    [[noreturn]] void error(const std::string &msg) const {
-      throw std::runtime_error(msg);
-    }
+// Parsed nodes for the file at `path` as of `stamp`, from memory, then the
+// on-disk cache, then the parser. Returned by value so a source re-parsed
+// while it runs (a file that requires itself) does not free its own tree.
+NodeList Interpreter::load_source(const std::string &path,
+                                  const SourceStamp &stamp) {
+  auto it = parsed_sources.find(path);
+  if (it != parsed_sources.end() && it->second.stamp == stamp) {
+    it->second.used = true;
+    return it->second.nodes;
+  }
 
-    void skip_space() {
-      while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos])))
-        ++pos;
+  std::optional<NodeList> nodes;
+  if (!cache_dir.empty()) nodes = load_cached_module(cache_dir, path, stamp);
+  if (!nodes) {
+    std::string code;
+    if (fs::path(path).extension() == ".baar") {
+      Archive archive(path);
+      const Archive::Entry *entry = archive.main_entry();
+      if (!entry)
+        throw std::runtime_error("Archive contains no Bloa entry: " + path);
+      code = archive.read(*entry);
+    } else {
+      auto source = read_source(path);
+      if (!source) throw std::runtime_error("Require failed: " + path);
+      code = std::move(*source);
     }
+    nodes = parse(code);
+    if (!cache_dir.empty()) store_cached_module(cache_dir, path, stamp, *nodes);
+  }
+  parsed_sources[path] = ParsedSource{stamp, *nodes};
+  return std::move(*nodes);
+}
 
-    bool match(char c) {
-      skip_space();
-      if (pos < s.size() && s[pos] == c) {
-        ++pos;
-        return true;
-      }
-      return false;
-    }
+void Interpreter::run_file(const std::string &path) {
+  auto stamp = stamp_source(path);
+  if (!stamp) throw std::runtime_error("Unable to open file: " + path);
+  run_nodes([&] { return load_source(canonical_key(path), *stamp); }, path);
+}
 
-    bool match_keyword(const std::string &kw) {
-      skip_space();
-      if (pos + kw.size() <= s.size() && s.substr(pos, kw.size()) == kw) {
-        if (pos + kw.size() == s.size() ||
-            !is_ident_continue(s[pos + kw.size()])) {
-          pos += kw.size();
-          return true;
-        }
-      }
-      return false;
-    }
+std::vector<std::string> Interpreter::used_paths() const {
+  std::vector<std::string> paths;
+  for (const auto &[path, source] : parsed_sources)
+    if (source.used) paths.push_back(path);
+  return paths;
+}
 
-    Value parse_primary() {
-      skip_space();
-      if (pos >= s.size()) error("Unexpected end of expression");
+// A source that no longer exists just drops out; one that fails to parse
+// is left for the run that needs it to report.
+void Interpreter::preload(const std::string &path) {
+  auto stamp = stamp_source(path);
+  if (!stamp) {
+    parsed_sources.erase(path);
+    return;
+  }
+  std::string key = canonical_key(path);
+  try {
+    load_source(key, *stamp);
+    parsed_sources[key].used = false;
+  } catch (const std::exception &) {
+  }
+}
 
-      if (match('(')) {
-        Value v = parse_expr();
-        if (!match(')')) error("Expected ')'");
-        return v;
-      }
+void Interpreter::forget(const std::string &path) {
+  parsed_sources.erase(canonical_key(path));
+}
 
-      if (match('[')) {
-        std::vector<Value> elems;
-        if (match(']')) return Value::make_list(elems);
-        while (true) {
-          elems.push_back(parse_expr());
-          if (match(']')) break;
-          if (!match(',')) error("Expected ',' or ']' in list literal");
-        }
-        return Value::make_list(elems);
-      }
+Value Interpreter::load_name(const std::string &name, SlotRef slot,
+                             const std::shared_ptr<Environment> &env) {
+  if (slot.resolved()) {
+    if (const Value *v = env->find_slot(slot)) return *v;
+  }
+  auto valopt = env->get(name);
+  if (valopt) return std::move(*valopt);
+  if (functions.find(name) != functions.end())
+    return Value::make_str("<function '" + name + "'>");
+  if (classes.find(name) != classes.end())
+    return Value::make_str("<class '" + name + "'>");
+  throw std::runtime_error("Name '" + name + "' is not defined");
+}
 
-      if (s[pos] == '\"' || s[pos] == '\'') {
-        char quote = s[pos++];
-        std::string out;
-        while (pos < s.size() && s[pos] != quote) {
-          if (s[pos] == '\\' && pos + 1 < s.size()) {
-            ++pos;
-            switch (s[pos]) {
-              case 'n':
-                out.push_back('\n');
-                break;
-              case 't':
-                out.push_back('\t');
-                break;
-              case 'r':
-                out.push_back('\r');
-                break;
-              case '\\':
-                out.push_back('\\');
-                break;
-              case '\'':
-                out.push_back('\'');
-                break;
-              case '\"':
-                out.push_back('\"');
-                break;
-              default:
-                out.push_back('\\');
-                out.push_back(s[pos]);
-                break;
-            }
-            ++pos;
-          } else {
-            out.push_back(s[pos++]);
-          }
-        }
-        if (pos >= s.size()) error("Unterminated string literal");
-        ++pos;
-        return Value::make_str(out);
-      }
+Value Interpreter::load_object(const std::string &name, SlotRef slot,
+                               const std::shared_ptr<Environment> &env) {
+  std::optional<Value> obj_val;
+  const Value *local = slot.resolved() ? env->find_slot(slot) : nullptr;
+  if (local)
+    obj_val = *local;
+  else
+    obj_val = env->get(name);
+  if (!obj_val) throw std::runtime_error("Undefined object '" + name + "'");
+  if (!std::holds_alternative<std::shared_ptr<ObjectInstance>>(obj_val->v) &&
+      !std::holds_alternative<std::shared_ptr<Dict>>(obj_val->v))
+    throw std::runtime_error("Cannot assign to member of non-object");
+  return std::move(*obj_val);
+}
 
-      if (std::isdigit(static_cast<unsigned char>(s[pos])) ||
-          (s[pos] == '-' && pos + 1 < s.size() &&
-           std::isdigit(static_cast<unsigned char>(s[pos + 1])))) {
-        size_t start = pos;
-        if (s[pos] == '-') ++pos;
-        while (pos < s.size() &&
-               std::isdigit(static_cast<unsigned char>(s[pos])))
-          ++pos;
-
-        bool is_float = false;
-        if (pos < s.size() && s[pos] == '.') {
-          is_float = true;
-          ++pos;
-          while (pos < s.size() &&
-                 std::isdigit(static_cast<unsigned char>(s[pos])))
-            ++pos;
-        }
+void Interpreter::store_name(const std::string &name, SlotRef slot, Value val,
+                             const std::shared_ptr<Environment> &env) {
+  if (slot.resolved()) {
+    if (Value *v = env->find_slot(slot)) {
+      *v = std::move(val);
+      return;
+    }
+  }
+  env->set(name, std::move(val));
+}
 
-        std::string num_str = s.substr(start, pos - start);
-        if (num_str.empty() || num_str == "-" || num_str == ".")
-          error("Invalid number");
-
-        try {
-          if (is_float) {
-            double d = std::stod(num_str);
-            return Value::make_double(d);
-          } else {
-            int64_t i = std::stoll(num_str);
-            return Value::make_int(i);
-          }
-        } catch (...) {
-          error("Invalid number: '" + num_str + "'");
-        }
-      }
+Value *Interpreter::find_binding(const std::string &name, SlotRef slot,
+                                 const std::shared_ptr<Environment> &env) {
+  Value *target = slot.resolved() ? env->find_slot(slot) : nullptr;
+  return target ? target : env->find(name);
+}
 
-      if (match_keyword("new")) {
-        skip_space();
-        if (pos >= s.size() || !is_ident_start(s[pos]))
-          error("Expected class name after 'new'");
-        size_t start = pos;
-        ++pos;
-        while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
-        std::string class_name = s.substr(start, pos - start);
-        std::vector<Value> constructor_args;
-        if (match('(')) {
-          if (!match(')')) {
-            while (true) {
-              constructor_args.push_back(parse_expr());
-              if (match(')')) break;
-              if (!match(',')) error("Expected ',' or ')' in argument list");
-            }
-          }
-        }
+Value *Interpreter::place_of(const Expr &e,
+                             const std::shared_ptr<Environment> &env) {
+  switch (e.kind) {
+    case ExprKind::Name: {
+      const auto &n = static_cast<const NameExpr &>(e);
+      return find_binding(n.name, n.slot, env);
+    }
+    case ExprKind::Member: {
+      const auto &m = static_cast<const MemberExpr &>(e);
+      Value base = resolve_reference(evaluate(*m.object, env));
+      if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&base.v))
+        return (*dict)->find(Value::make_str(m.member));
+      if (const auto *obj =
+              std::get_if<std::shared_ptr<ObjectInstance>>(&base.v))
+        return (*obj)->properties->find(m.member);
+      return nullptr;
+    }
+    case ExprKind::Index: {
+      const auto &ix = static_cast<const IndexExpr &>(e);
+      Value *base = place_of(*ix.object, env);
+      if (!base) return nullptr;
+      return index_place(*base, evaluate(*ix.index, env));
+    }
+    default:
+      return nullptr;
+  }
+}
 
-        auto class_it = interp->classes.find(class_name);
-        if (class_it == interp->classes.end())
-          error("Class '" + class_name + "' not found");
-
-        const auto &class_def = class_it->second;
-        auto instance_env = std::make_shared<Environment>(class_def.class_env);
-        auto instance = Value::make_object(class_name, instance_env);
-
-        const FunctionDefEntry *init_method = nullptr;
-        std::string current_class = class_name;
-        while (!current_class.empty()) {
-          auto cls_it = interp->classes.find(current_class);
-          if (cls_it != interp->classes.end()) {
-            auto meth_it = cls_it->second.methods.find("__init__");
-            if (meth_it != cls_it->second.methods.end()) {
-              init_method = &meth_it->second;
-              break;
-            }
-            current_class = cls_it->second.parent.value_or("");
-          } else {
-            break;
-          }
-        }
+void Interpreter::append_name(const std::string &name, SlotRef slot,
+                              std::span<const Value> pieces,
+                              const std::shared_ptr<Environment> &env) {
+  Value *target = find_binding(name, slot, env);
+  if (!target) {
+    Value sum = load_name(name, slot, env);
+    for (const auto &piece : pieces)
+      sum = apply_binary(BinaryOp::Add, sum, piece);
+    store_name(name, slot, std::move(sum), env);
+    return;
+  }
+  if (auto *s = std::get_if<std::string>(&target->v)) {
+    for (const auto &piece : pieces) {
+      if (const auto *p = std::get_if<std::string>(&piece.v))
+        s->append(*p);
+      else
+        s->append(value_to_string(piece));
+    }
+    return;
+  }
+  // Not a string: plain `+`, still with a single lookup of the binding.
+  for (const auto &piece : pieces)
+    *target = apply_binary(BinaryOp::Add, *target, piece);
+}
 
-        if (init_method) {
-          if (init_method->params.size() != constructor_args.size() + 1)
-            error("__init__() expects " +
-                  std::to_string(static_cast<int>(init_method->params.size()) -
-                                 1) +
-                  " arguments but got " +
-                  std::to_string(constructor_args.size()));
-          auto init_env = std::make_shared<Environment>(init_method->def_env);
-          init_env->set(init_method->params[0], instance);
-          for (size_t i = 0; i < constructor_args.size(); ++i) {
-            init_env->set(init_method->params[i + 1], constructor_args[i]);
-          }
-          try {
-            interp->execute_block(init_method->block, init_env);
-          } catch (const std::string &) {
-          }
-        } else if (!constructor_args.empty()) {
-          error("Class '" + class_name + "' does not accept arguments");
-        }
-        return instance;
-      }
+void append_pieces(const Expr &sum, std::vector<const Expr *> &out) {
+  if (sum.kind != ExprKind::Binary) return;
+  const auto &add = static_cast<const BinaryExpr &>(sum);
+  append_pieces(*add.left, out);
+  out.push_back(add.right.get());
+}
 
-      if (is_ident_start(s[pos])) {
-        size_t start = pos;
-        ++pos;
-        while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
-        std::string id = s.substr(start, pos - start);
+void Interpreter::declare_name(const std::string &name, SlotRef slot,
+                               Value val,
+                               const std::shared_ptr<Environment> &env) {
+  if (slot.resolved())
+    env->bind_slot(slot.index, std::move(val));
+  else
+    env->set_local(name, std::move(val));
+}
 
-        if (id == "true") return Value::make_bool(true);
-        if (id == "false") return Value::make_bool(false);
-        if (id == "null") return Value();
+Value Interpreter::address_of_arg(const std::string &name,
+                                  const std::string *builtin,
+                                  const std::shared_ptr<Environment> &env) {
+  if (builtin && shadows_builtin(*builtin))
+    return load_name(name, SlotRef(), env);
+  return address_of(name, env);
+}
 
-        auto valopt = env->get(id);
+Value Interpreter::invoke_name(const std::string &name, SlotRef slot,
+                               const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &env) {
+  std::optional<Value> valopt;
+  const Value *local = slot.resolved() ? env->find_slot(slot) : nullptr;
+  if (local)
+    valopt = *local;
+  else
+    valopt = env->get(name);
+  // A function the script defines shadows the builtin of the same name.
+  if (valopt && valopt->is_builtin() && !shadows_builtin(name))
+    return call_builtin(*std::get<const BuiltinFunction *>(valopt->v), args,
+                        env);
+  if (classes.find(name) != classes.end()) return instantiate(name, args);
+
+  auto fn_it = functions.find(name);
+  if (fn_it == functions.end()) {
+    if (!valopt) {
+      if (name == "parallel_map") return parallel_map(args);
+      if (name == "parallel_for") return parallel_for(args);
+      if (name == "spawn") return spawn(args);
+      if (name == "await") return await_task(args);
+      if (name == "await_all") return await_all(args);
+      throw std::runtime_error("Name '" + name + "' is not defined");
+    }
+    throw std::runtime_error("'" + name + "' is not callable");
+  }
+  const auto &entry = fn_it->second;
+  if (entry.params.size() != args.size()) {
+    throw std::runtime_error("Function '" + name + "' expects " +
+                             std::to_string(entry.params.size()) +
+                             " arguments but got " +
+                             std::to_string(args.size()));
+  }
+  return call_function(entry, nullptr, args);
+}
 
-        // Check if identifier exists in environment
-        bool found_in_env = valopt.has_value();
-        // Check if it's a class
-        bool is_class = interp->classes.find(id) != interp->classes.end();
-        // Check if it's a function
-        bool is_function =
-            interp->functions.find(id) != interp->functions.end();
+Value Interpreter::invoke_value(const Value &callee,
+                                const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &env) {
+  if (callee.is_builtin())
+    return call_builtin(*std::get<const BuiltinFunction *>(callee.v), args,
+                        env);
+  throw std::runtime_error("Value is not callable");
+}
 
-        if (!found_in_env && !is_class && !is_function) {
-          error("Name '" + id + "' is not defined");
-        }
+Value Interpreter::invoke_method(const Value &base, const std::string &method,
+                                 const std::vector<Value> &args,
+                                 MethodCache &cache) {
+  if (!std::holds_alternative<std::shared_ptr<ObjectInstance>>(base.v))
+    throw std::runtime_error("Cannot access member on non-object");
+  const auto &obj_inst = std::get<std::shared_ptr<ObjectInstance>>(base.v);
+  const FunctionDefEntry *fn = cache.method;
+  if (!cache.hit(obj_inst->klass)) {
+    if (!obj_inst->klass)
+      throw std::runtime_error("Class '" + obj_inst->class_name +
+                               "' not found");
+    const auto &table = obj_inst->klass->method_table;
+    auto meth_it = table.find(method);
+    if (meth_it == table.end()) {
+      throw std::runtime_error("Method '" + method + "' not found in class '" +
+                               obj_inst->class_name + "' or its parents");
+    }
+    fn = meth_it->second;
+    cache.klass = obj_inst->klass;
+    cache.method = fn;
+  }
 
-        Value base_val;
-        if (found_in_env) {
-          base_val = std::move(*valopt);
-        } else if (is_function) {
-          // Mark as function for call check
-          base_val = Value::make_str("<function '" + id + "'>");
-        } else {
-          // Mark as class for instantiation check
-          base_val = Value::make_str("<class '" + id + "'>");
-        }
+  if (fn->params.size() != args.size() + 1) {
+    throw std::runtime_error(
+        "Method '" + method + "' expects " +
+        std::to_string(static_cast<int>(fn->params.size()) - 1) +
+        " arguments but got " + std::to_string(args.size()));
+  }
+  return call_function(*fn, &base, args);
+}
 
-        while (true) {
-          skip_space();
-
-          if (match('(')) {
-            std::vector<Value> args;
-            if (!match(')')) {
-              while (true) {
-                args.push_back(parse_expr());
-                if (match(')')) break;
-                if (!match(',')) error("Expected ',' or ')' in argument list");
-              }
-            }
-
-            if (std::holds_alternative<std::string>(base_val.v)) {
-              std::string marker = std::get<std::string>(base_val.v);
-              if (marker.starts_with("__builtin_")) {
-                base_val = handle_builtin(marker, args, env);
-                continue;
-              }
-            }
-
-            // Check if it's a class instantiation
-            auto class_it = interp->classes.find(id);
-            if (class_it != interp->classes.end()) {
-              // Create new instance
-              const auto &class_def = class_it->second;
-              auto instance_env =
-                  std::make_shared<Environment>(class_def.class_env);
-              auto instance = Value::make_object(id, instance_env);
-
-              // Call __init__ if it exists (with inheritance)
-              const FunctionDefEntry *init_method = nullptr;
-              std::string current_class = id;
-              while (!current_class.empty()) {
-                auto cls_it = interp->classes.find(current_class);
-                if (cls_it != interp->classes.end()) {
-                  auto meth_it = cls_it->second.methods.find("__init__");
-                  if (meth_it != cls_it->second.methods.end()) {
-                    init_method = &meth_it->second;
-                    break;
-                  }
-                  current_class = cls_it->second.parent.value_or("");
-                } else {
-                  break;
-                }
-              }
-
-              if (init_method) {
-                if (init_method->params.size() != args.size() + 1) {
-                  error("__init__() expects " +
-                        std::to_string(
-                            static_cast<int>(init_method->params.size()) - 1) +
-                        " arguments but got " + std::to_string(args.size()));
-                }
-                auto init_env =
-                    std::make_shared<Environment>(init_method->def_env);
-                init_env->set(init_method->params[0], instance);  // self
-                for (size_t i = 0; i < args.size(); ++i) {
-                  init_env->set(init_method->params[i + 1], args[i]);
-                }
-                try {
-                  interp->execute_block(init_method->block, init_env);
-                } catch (const std::string &) {
-                }
-              } else if (!args.empty()) {
-                error("Class '" + id + "' does not accept arguments");
-              }
-              base_val = instance;
-              continue;
-            }
-
-            auto it = interp->functions.find(id);
-            if (it == interp->functions.end()) {
-              error("'" + id + "' is not callable");
-            }
-            const auto &entry = it->second;
-            if (entry.params.size() != args.size()) {
-              error("Function '" + id + "' expects " +
-                    std::to_string(entry.params.size()) +
-                    " arguments but got " + std::to_string(args.size()));
-            }
-
-            auto call_env = std::make_shared<Environment>(entry.def_env);
-            for (size_t i = 0; i < args.size(); ++i) {
-              call_env->set(entry.params[i], args[i]);
-            }
-            try {
-              base_val = interp->execute_block(entry.block, call_env);
-            } catch (const std::string &) {
-              base_val = Value();
-            }
-            continue;
-          }
-
-          if (match('[')) {
-            if (!is_list_value(base_val)) {
-              error("Object is not subscriptable (not a list)");
-            }
-            Value idx_val = parse_expr();
-            if (!match(']')) error("Expected ']'");
-            int64_t idx = static_cast<int64_t>(value_as_number(idx_val));
-            const auto &list = as_list(base_val);
-            if (idx < 0 || idx >= static_cast<int64_t>(list.size())) {
-              error("List index " + std::to_string(idx) + " out of range [0, " +
-                    std::to_string(list.size()) + ")");
-            }
-            base_val = list[static_cast<size_t>(idx)];
-            continue;
-          }
-
-          if (match('.')) {
-            if (!std::holds_alternative<std::shared_ptr<ObjectInstance>>(
-                    base_val.v)) {
-              error("Cannot access member on non-object");
-            }
-
-            skip_space();
-            size_t member_start = pos;
-            while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
-            if (member_start == pos) error("Expected member name after '.'");
-            std::string member = s.substr(member_start, pos - member_start);
-
-            skip_space();
-            if (match('(')) {
-              // Method call
-              std::vector<Value> args;
-              if (!match(')')) {
-                while (true) {
-                  args.push_back(parse_expr());
-                  if (match(')')) break;
-                  if (!match(','))
-                    error("Expected ',' or ')' in argument list");
-                }
-              }
-
-              auto obj_inst =
-                  std::get<std::shared_ptr<ObjectInstance>>(base_val.v);
-              auto class_it = interp->classes.find(obj_inst->class_name);
-              if (class_it == interp->classes.end()) {
-                error("Class '" + obj_inst->class_name + "' not found");
-              }
-
-              // Find method with inheritance
-              const FunctionDefEntry *method = nullptr;
-              std::string current_class = obj_inst->class_name;
-              while (!current_class.empty()) {
-                auto cls_it = interp->classes.find(current_class);
-                if (cls_it != interp->classes.end()) {
-                  auto meth_it = cls_it->second.methods.find(member);
-                  if (meth_it != cls_it->second.methods.end()) {
-                    method = &meth_it->second;
-                    break;
-                  }
-                  current_class = cls_it->second.parent.value_or("");
-                } else {
-                  break;
-                }
-              }
-
-              if (!method) {
-                error("Method '" + member + "' not found in class '" +
-                      obj_inst->class_name + "' or its parents");
-              }
-
-              if (method->params.size() != args.size() + 1) {
-                error("Method '" + member + "' expects " +
-                      std::to_string(static_cast<int>(method->params.size()) -
-                                     1) +
-                      " arguments but got " + std::to_string(args.size()));
-              }
-
-              auto method_env = std::make_shared<Environment>(method->def_env);
-              method_env->set(method->params[0], base_val);  // self
-              for (size_t i = 0; i < args.size(); ++i) {
-                method_env->set(method->params[i + 1], args[i]);
-              }
-              try {
-                base_val = interp->execute_block(method->block, method_env);
-              } catch (const std::string &) {
-                base_val = Value();
-              }
-              continue;
-            } else {
-              // Property access
-              auto obj_inst =
-                  std::get<std::shared_ptr<ObjectInstance>>(base_val.v);
-              auto prop_val = obj_inst->properties->get(member);
-              if (!prop_val.has_value()) {
-                error("Property '" + member + "' not found in object");
-              }
-              base_val = *prop_val;
-              continue;
-            }
-          }
-
-          break;
-        }
+// The method `name` of a class instance, or null.
+static const FunctionDefEntry *find_method(const ObjectInstance &obj,
+                                           const std::string &name) {
+  if (!obj.klass) return nullptr;
+  auto it = obj.klass->method_table.find(name);
+  return it == obj.klass->method_table.end() ? nullptr : it->second;
+}
 
-        return base_val;
-      }
+Value Interpreter::begin_iteration(const Value &iterable) {
+  Value v = resolve_reference(iterable);
+  if (std::holds_alternative<List>(v.v) ||
+      std::holds_alternative<std::shared_ptr<const NumArray>>(v.v))
+    return v;
+  // A dict iterates over a snapshot of its keys.
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&v.v)) {
+    std::vector<Value> keys;
+    keys.reserve((*dict)->size());
+    (*dict)->for_each([&](const Value &key, const Value &) {
+      keys.push_back(key);
+    });
+    return Value::make_list(std::move(keys));
+  }
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v)) {
+    const auto &obj = *std::get<std::shared_ptr<ObjectInstance>>(v.v);
+    if (const auto *iter = find_method(obj, "__iter__")) {
+      Value it = resolve_reference(call_function(*iter, &v, {}));
+      if (std::holds_alternative<List>(it.v)) return it;
+      const auto *inst = std::get_if<std::shared_ptr<ObjectInstance>>(&it.v);
+      if (!inst || !find_method(**inst, "__next__"))
+        throw std::runtime_error(
+            "__iter__ must return a list or an object with __next__");
+      return it;
+    }
+    if (find_method(obj, "__next__")) return v;
+    if (!obj.klass) {
+      auto next = obj.properties->get_local("__next__");
+      if (next && next->is_builtin()) return v;
+    }
+  }
+  throw std::runtime_error("For-in requires a list or an iterator");
+}
+
+bool Interpreter::next_item(const Value &iterator, int64_t &index,
+                            Value &item) {
+  if (const auto *list = std::get_if<List>(&iterator.v)) {
+    if (index >= static_cast<int64_t>(list->size())) return false;
+    item = list->at(static_cast<size_t>(index++));
+    return true;
+  }
+  if (const auto *array =
+          std::get_if<std::shared_ptr<const NumArray>>(&iterator.v)) {
+    if (index >= static_cast<int64_t>((*array)->size())) return false;
+    item = (*array)->at(static_cast<size_t>(index++));
+    return true;
+  }
+  const auto &obj = *std::get<std::shared_ptr<ObjectInstance>>(iterator.v);
+  if (const auto *next = find_method(obj, "__next__")) {
+    item = resolve_reference(call_function(*next, &iterator, {}));
+  } else {
+    auto fn = obj.properties->get_local("__next__");
+    item = call_builtin(*std::get<const BuiltinFunction *>(fn->v), {iterator});
+  }
+  return !std::holds_alternative<std::monostate>(item.v);
+}
 
-      error("Unexpected token: '" + std::string(1, s[pos]) + "'");
+Value Interpreter::evaluate(const Expr &expr,
+                            const std::shared_ptr<Environment> &env) {
+  switch (expr.kind) {
+    case ExprKind::Literal:
+      return static_cast<const LiteralExpr &>(expr).value;
+
+    case ExprKind::List: {
+      const auto &list = static_cast<const ListExpr &>(expr);
+      return Value::make_list(evaluate_args(list.elements, env));
     }
 
-    Value parse_power() {
-      Value left = parse_unary();
-      while (match('^')) {
-        Value right = parse_unary();
-        double a = value_as_number(left);
-        double b = value_as_number(right);
-        left = Value::make_double(std::pow(a, b));
+    case ExprKind::Dict: {
+      const auto &d = static_cast<const DictExpr &>(expr);
+      auto dict = std::make_shared<Dict>();
+      dict->reserve(d.keys.size());
+      for (size_t i = 0; i < d.keys.size(); ++i) {
+        Value key = evaluate(*d.keys[i], env);
+        dict->set(key, evaluate(*d.values[i], env));
       }
-      return left;
+      return Value::make_dict(std::move(dict));
     }
 
-    Value parse_unary() {
-      skip_space();
-      if (match('!')) {
-        Value operand = parse_unary();  // Recursive for !!x
-        return Value::make_bool(!value_is_true(operand));
-      }
-      if (match('&')) {
-        skip_space();
-        if (pos >= s.size() || !is_ident_start(s[pos]))
-          error("Expected identifier after '&'");
-        size_t start = pos;
-        ++pos;
-        while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
-        std::string name = s.substr(start, pos - start);
-        auto ref_env = env;
-        while (ref_env && !ref_env->has_local(name)) ref_env = ref_env->parent;
-        if (!ref_env) error("Undefined variable '" + name + "'");
-        return Value::make_ref(ref_env, name);
-      }
-      if (match('*')) {
-        Value operand = parse_unary();
-        if (!operand.is_reference())
-          error("Cannot dereference non-pointer value");
-        const auto &ref = operand.as_reference();
-        auto target = ref.env->get(ref.name);
-        if (!target) error("Invalid reference target: " + ref.name);
-        return *target;
-      }
-      return parse_primary();
+    case ExprKind::Name: {
+      const auto &n = static_cast<const NameExpr &>(expr);
+      return load_name(n.name, n.slot, env);
     }
 
-    Value parse_term() {
-      Value left = parse_power();
-      while (true) {
-        skip_space();
-        if (pos < s.size() &&
-            (s[pos] == '*' || s[pos] == '/' || s[pos] == '%')) {
-          char op = s[pos++];
-          Value right = parse_power();
-          double a = value_as_number(left);
-          double b = value_as_number(right);
-          if (op == '*') {
-            left = Value::make_double(a * b);
-          } else if (op == '/') {
-            if (b == 0.0) error("Division by zero");
-            left = Value::make_double(a / b);
-          } else if (op == '%') {
-            if (b == 0.0) error("Modulo by zero");
-            left = Value::make_double(std::fmod(a, b));
-          }
-          continue;
-        }
-        break;
-      }
-      return left;
+    case ExprKind::Not: {
+      const auto &n = static_cast<const NotExpr &>(expr);
+      return Value::make_bool(!value_is_true(evaluate(*n.operand, env)));
     }
 
-    Value parse_or() {
-      Value left = parse_and();
-      while (true) {
-        skip_space();
-        if (pos + 1 < s.size() && s[pos] == '|' && s[pos + 1] == '|') {
-          pos += 2;
-          // Short-circuit: if left is true, don't evaluate right
-          if (value_is_true(left)) return Value::make_bool(true);
-          Value right = parse_and();
-          left = Value::make_bool(value_is_true(right));
-        } else {
-          break;
-        }
-      }
-      return left;
+    case ExprKind::AddressOf: {
+      const auto &a = static_cast<const AddressOfExpr &>(expr);
+      return address_of_arg(a.name, a.builtin.empty() ? nullptr : &a.builtin,
+                            env);
     }
 
-    Value parse_and() {
-      Value left = parse_comparison();
-      while (true) {
-        skip_space();
-        if (pos + 1 < s.size() && s[pos] == '&' && s[pos + 1] == '&') {
-          pos += 2;
-          // Short-circuit: if left is false, don't evaluate right
-          if (!value_is_true(left)) return Value::make_bool(false);
-          Value right = parse_comparison();
-          left = Value::make_bool(value_is_true(right));
-        } else {
-          break;
-        }
+    case ExprKind::Deref:
+      return dereference(
+          evaluate(*static_cast<const DerefExpr &>(expr).operand, env));
+
+    case ExprKind::Binary: {
+      const auto &bin = static_cast<const BinaryExpr &>(expr);
+      // Short-circuit operators evaluate the right side only when needed.
+      if (bin.op == BinaryOp::And) {
+        if (!value_is_true(evaluate(*bin.left, env)))
+          return Value::make_bool(false);
+        return Value::make_bool(value_is_true(evaluate(*bin.right, env)));
       }
-      return left;
+      if (bin.op == BinaryOp::Or) {
+        if (value_is_true(evaluate(*bin.left, env)))
+          return Value::make_bool(true);
+        return Value::make_bool(value_is_true(evaluate(*bin.right, env)));
+      }
+      Value left = evaluate(*bin.left, env);
+      return apply_binary(bin.op, left, evaluate(*bin.right, env));
     }
 
-    Value parse_comparison() {
-      Value left = parse_expr();
-      while (true) {
-        skip_space();
-        // Check two-character operators first
-        if (pos + 1 < s.size()) {
-          std::string two_char = s.substr(pos, 2);
-          if (two_char == "==") {
-            pos += 2;
-            Value right = parse_expr();
-            bool result = false;
-            if (std::holds_alternative<int64_t>(left.v) &&
-                std::holds_alternative<int64_t>(right.v)) {
-              result = std::get<int64_t>(left.v) == std::get<int64_t>(right.v);
-            } else if (std::holds_alternative<double>(left.v) ||
-                       std::holds_alternative<double>(right.v)) {
-              result = value_as_number(left) == value_as_number(right);
-            } else if (std::holds_alternative<std::string>(left.v) &&
-                       std::holds_alternative<std::string>(right.v)) {
-              result = std::get<std::string>(left.v) ==
-                       std::get<std::string>(right.v);
-            } else if (std::holds_alternative<bool>(left.v) &&
-                       std::holds_alternative<bool>(right.v)) {
-              result = std::get<bool>(left.v) == std::get<bool>(right.v);
-            } else {
-              result = false;
-            }
-            left = Value::make_bool(result);
-            continue;
-          } else if (two_char == "!=") {
-            pos += 2;
-            Value right = parse_expr();
-            bool result = true;
-            if (std::holds_alternative<int64_t>(left.v) &&
-                std::holds_alternative<int64_t>(right.v)) {
-              result = std::get<int64_t>(left.v) != std::get<int64_t>(right.v);
-            } else if (std::holds_alternative<double>(left.v) ||
-                       std::holds_alternative<double>(right.v)) {
-              result = value_as_number(left) != value_as_number(right);
-            } else if (std::holds_alternative<std::string>(left.v) &&
-                       std::holds_alternative<std::string>(right.v)) {
-              result = std::get<std::string>(left.v) !=
-                       std::get<std::string>(right.v);
-            } else if (std::holds_alternative<bool>(left.v) &&
-                       std::holds_alternative<bool>(right.v)) {
-              result = std::get<bool>(left.v) != std::get<bool>(right.v);
-            }
-            left = Value::make_bool(result);
-            continue;
-          } else if (two_char == "<=") {
-            pos += 2;
-            Value right = parse_expr();
-            bool result = value_as_number(left) <= value_as_number(right);
-            left = Value::make_bool(result);
-            continue;
-          } else if (two_char == ">=") {
-            pos += 2;
-            Value right = parse_expr();
-            bool result = value_as_number(left) >= value_as_number(right);
-            left = Value::make_bool(result);
-            continue;
-          }
-        }
-        // Check single-character operators
-        if (pos < s.size() && s[pos] == '<') {
-          pos++;
-          Value right = parse_expr();
-          bool result = value_as_number(left) < value_as_number(right);
-          left = Value::make_bool(result);
-          continue;
-        }
-        if (pos < s.size() && s[pos] == '>') {
-          pos++;
-          Value right = parse_expr();
-          bool result = value_as_number(left) > value_as_number(right);
-          left = Value::make_bool(result);
-          continue;
-        }
-        break;
+    case ExprKind::Call: {
+      const auto &call = static_cast<const CallExpr &>(expr);
+      if (call.callee->kind == ExprKind::Name) {
+        const auto &callee = static_cast<const NameExpr &>(*call.callee);
+        return invoke_name(callee.name, callee.slot,
+                           evaluate_args(call.args, env), env);
       }
-      return left;
+      Value callee = evaluate(*call.callee, env);
+      return invoke_value(callee, evaluate_args(call.args, env), env);
     }
 
-    Value parse_expr() {
-      Value left = parse_term();
-      while (true) {
-        skip_space();
-        if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
-          char op = s[pos++];
-          Value right = parse_term();
-          if (op == '+') {
-            if (std::holds_alternative<std::string>(left.v) ||
-                std::holds_alternative<std::string>(right.v)) {
-              left = Value::make_str(value_to_string(left) +
-                                     value_to_string(right));
-            } else {
-              double a = value_as_number(left);
-              double b = value_as_number(right);
-              left = Value::make_double(a + b);
-            }
-          } else {
-            double a = value_as_number(left);
-            double b = value_as_number(right);
-            left = Value::make_double(a - b);
-          }
-          continue;
-        }
-        break;
-      }
-      return left;
+    case ExprKind::Member: {
+      const auto &m = static_cast<const MemberExpr &>(expr);
+      return get_member(evaluate(*m.object, env), m.member);
+    }
+
+    case ExprKind::MethodCall: {
+      const auto &mc = static_cast<const MethodCallExpr &>(expr);
+      Value base = evaluate(*mc.object, env);
+      return invoke_method(base, mc.method, evaluate_args(mc.args, env),
+                           mc.cache);
     }
-  };
 
-  Parser p(expr, this, env);
-  return p.parse_or();
+    case ExprKind::Index: {
+      const auto &ix = static_cast<const IndexExpr &>(expr);
+      Value base = evaluate(*ix.object, env);
+      return index_value(base, evaluate(*ix.index, env));
+    }
+
+    case ExprKind::New: {
+      const auto &n = static_cast<const NewExpr &>(expr);
+      return instantiate(n.class_name, evaluate_args(n.args, env));
+    }
+  }
+  throw std::runtime_error("Unknown expression node");
 }
 
 Value Interpreter::eval_expr(const std::string &expr,
                              std::shared_ptr<Environment> env) {
-  return parse_expression(trim(expr), env);
+  return evaluate(*parse_expression(trim(expr)), env);
 }
 
-Value Interpreter::execute_block(const NodeList &nodes,
-                                 std::shared_ptr<Environment> env) {
+Completion Interpreter::execute_block(const NodeList &nodes,
+                                      std::shared_ptr<Environment> env) {
   for (const auto &node : nodes) {
-    try {
-      if (auto s = std::dynamic_pointer_cast<Say>(node)) {
-        Value v = eval_expr(s->expr, env);
-        std::cout << value_to_string(v) << '\n';
-      } else if (auto a = std::dynamic_pointer_cast<Ask>(node)) {
-        Value prompt = eval_expr(a->prompt, env);
-        std::cout << value_to_string(prompt) << " ";
-        std::string input;
-        std::getline(std::cin, input);
-        try {
-          std::size_t pos;
-          long long xi = std::stoll(input, &pos);
-          if (pos == input.size()) {
-            env->set(a->var, Value::make_int(xi));
-            continue;
-          }
-          double xd = std::stod(input, &pos);
-          if (pos == input.size()) {
-            env->set(a->var, Value::make_double(xd));
-            continue;
-          }
-        } catch (...) {
-        }
-        env->set(a->var, Value::make_str(input));
-      } else if (auto decl = std::dynamic_pointer_cast<Declare>(node)) {
-        Value val = eval_expr(decl->expr, env);
-        env->set_local(decl->name, val);
-      } else if (auto asg = std::dynamic_pointer_cast<Assign>(node)) {
-        Value val = eval_expr(asg->expr, env);
-        env->set(asg->name, val);
-      } else if (auto masg = std::dynamic_pointer_cast<MemberAssign>(node)) {
-        // Get the object
-        auto obj_val_opt = env->get(masg->object);
-        if (!obj_val_opt.has_value()) {
-          throw std::runtime_error("Undefined object '" + masg->object + "'");
-        }
-        Value obj_val = *obj_val_opt;
-        if (!std::holds_alternative<std::shared_ptr<ObjectInstance>>(
-                obj_val.v)) {
-          throw std::runtime_error("Cannot assign to member of non-object");
-        }
-
-        // Evaluate the right-hand side expression
-        Value rhs = eval_expr(masg->expr, env);
-
-        // Set the property on the object
-        auto obj_inst = std::get<std::shared_ptr<ObjectInstance>>(obj_val.v);
-        obj_inst->properties->set(masg->member, rhs);
-      } else if (auto iff = std::dynamic_pointer_cast<If>(node)) {
-        Value cond = eval_expr(iff->cond, env);
-        if (value_is_true(cond)) {
-          execute_block(iff->then_block, std::make_shared<Environment>(env));
-        } else if (!iff->else_block.empty()) {
-          execute_block(iff->else_block, std::make_shared<Environment>(env));
-        }
-      } else if (auto rep = std::dynamic_pointer_cast<Repeat>(node)) {
-        Value timesv = eval_expr(rep->times_expr, env);
-        int64_t times = static_cast<int64_t>(value_as_number(timesv));
-        if (times < 0)
-          throw std::runtime_error("repeat count must be non-negative");
-        for (int64_t j = 0; j < times; ++j) {
-          auto loop_env = std::make_shared<Environment>(env);
-          loop_env->set("count", Value::make_int(j + 1));
-          try {
-            execute_block(rep->block, loop_env);
-          } catch (const ContinueException &) {
-            continue;
-          } catch (const BreakException &) {
-            break;
-          }
-        }
-      } else if (auto b = std::dynamic_pointer_cast<Break>(node)) {
-        throw BreakException();
-      } else if (auto c = std::dynamic_pointer_cast<Continue>(node)) {
-        throw ContinueException();
-      } else if (auto fd = std::dynamic_pointer_cast<FunctionDef>(node)) {
-        FunctionDefEntry entry;
-        entry.params = fd->params;
-        entry.block = fd->block;
-        entry.def_env = env;
-        functions[fd->name] = std::move(entry);
-      } else if (auto fc = std::dynamic_pointer_cast<FunctionCall>(node)) {
-        std::ostringstream fake_expr;
-        fake_expr << fc->name << '(';
-        for (size_t i = 0; i < fc->args.size(); ++i) {
-          if (i > 0) fake_expr << ", ";
-          fake_expr << fc->args[i];
-        }
-        fake_expr << ')';
-        eval_expr(fake_expr.str(), env);
-      } else if (auto ret = std::dynamic_pointer_cast<Return>(node)) {
-        if (ret->expr.has_value()) {
-          return eval_expr(ret->expr.value(), env);
-        } else {
-          return Value();
-        }
-      } else if (auto imp = std::dynamic_pointer_cast<Import>(node)) {
-        std::string mod = imp->name;
-        std::replace(mod.begin(), mod.end(), '\\',
-                     static_cast<char>(fs::path::preferred_separator));
-        fs::path p = std::filesystem::path(stdlib_path).empty()
-                         ? (fs::path(mod) += ".bloa")
-                         : (fs::path(stdlib_path) / mod) += ".bloa";
-        if (!fs::exists(p)) {
-          throw std::runtime_error("Module not found: '" + imp->name + "'");
-        }
-        std::ifstream ifs(p);
-        std::string code((std::istreambuf_iterator<char>(ifs)),
-                         std::istreambuf_iterator<char>());
-        auto mod_nodes = parse(code);
+    profiler::LineProbe probe(node->line);
+    if (auto s = std::dynamic_pointer_cast<Say>(node)) {
+      Value v = evaluate(*s->expr, env);
+      std::string line = value_to_string(v);
+      line.push_back('\n');
+      write_output(line);
+    } else if (auto a = std::dynamic_pointer_cast<Ask>(node)) {
+      Value prompt = evaluate(*a->prompt, env);
+      std::string text = value_to_string(prompt);
+      text.push_back(' ');
+      write_output(text);
+      flush_output();
+      std::string input;
+      std::getline(std::cin, input);
+      store_name(a->var, a->slot, parse_input_value(input), env);
+    } else if (auto decl = std::dynamic_pointer_cast<Declare>(node)) {
+      declare_name(decl->name, decl->slot, evaluate(*decl->expr, env), env);
+    } else if (auto asg = std::dynamic_pointer_cast<Assign>(node)) {
+      const auto &add = static_cast<const BinaryExpr &>(*asg->expr);
+      if (asg->append && add.left->kind == ExprKind::Name) {
+        Value piece = evaluate(*add.right, env);
+        append_name(asg->name, asg->slot, {&piece, 1}, env);
+      } else if (asg->append) {
+        std::vector<const Expr *> operands;
+        append_pieces(add, operands);
+        std::vector<Value> pieces;
+        pieces.reserve(operands.size());
+        for (const Expr *e : operands) pieces.push_back(evaluate(*e, env));
+        append_name(asg->name, asg->slot, pieces, env);
+      } else {
+        store_name(asg->name, asg->slot, evaluate(*asg->expr, env), env);
+      }
+    } else if (auto masg = std::dynamic_pointer_cast<MemberAssign>(node)) {
+      // Get the object
+      Value obj_val = load_object(masg->object, masg->object_slot, env);
+
+      // Evaluate the right-hand side expression
+      Value rhs = evaluate(*masg->expr, env);
+
+      // Set the property on the object, or the key of a dict
+      set_member(obj_val, masg->member, std::move(rhs));
+    } else if (auto iasg = std::dynamic_pointer_cast<IndexAssign>(node)) {
+      Value index = evaluate(*iasg->index, env);
+      Value rhs = evaluate(*iasg->expr, env);
+      if (Value *target = place_of(*iasg->object, env))
+        set_index(*target, index, std::move(rhs));
+      else
+        set_index_temporary(evaluate(*iasg->object, env), index,
+                            std::move(rhs));
+    } else if (auto iff = std::dynamic_pointer_cast<If>(node)) {
+      Value cond = evaluate(*iff->cond, env);
+      Completion c;
+      if (value_is_true(cond)) {
+        c = execute_scoped(iff->then_block, iff->then_scope, env);
+      } else if (!iff->else_block.empty()) {
+        c = execute_scoped(iff->else_block, iff->else_scope, env);
+      }
+      if (c.kind != Completion::Kind::Normal) return c;
+    } else if (auto rep = std::dynamic_pointer_cast<Repeat>(node)) {
+      Value timesv = evaluate(*rep->times_expr, env);
+      int64_t times = static_cast<int64_t>(value_as_number(timesv));
+      if (times < 0)
+        throw std::runtime_error("repeat count must be non-negative");
+      std::shared_ptr<Environment> body_env;
+      Completion c;
+      for (int64_t j = 0; j < times; ++j) {
+        const auto &loop_env = iteration_scope(body_env, env, rep->scope);
+        store_name("count", rep->count_slot, Value::make_int(j + 1),
+                   loop_env);
+        c = execute_block(rep->block, loop_env);
+        if (loop_exit(c)) break;
+      }
+      if (body_env) release_scope(std::move(body_env));
+      if (c.kind == Completion::Kind::Return) return c;
+    } else if (std::dynamic_pointer_cast<Break>(node)) {
+      return Completion{Completion::Kind::Break, Value()};
+    } else if (std::dynamic_pointer_cast<Continue>(node)) {
+      return Completion{Completion::Kind::Continue, Value()};
+    } else if (auto fd = std::dynamic_pointer_cast<FunctionDef>(node)) {
+      FunctionDefEntry entry;
+      entry.name = fd->name;
+      entry.params = fd->params;
+      entry.block = fd->block;
+      entry.scope = fd->scope;
+      entry.def_env = env;
+      if (find_builtin(fd->name)) builtin_shadowed = true;
+      functions[fd->name] = std::move(entry);
+      record_definition(node);
+    } else if (auto fc = std::dynamic_pointer_cast<FunctionCall>(node)) {
+      invoke_name(fc->name, fc->slot, evaluate_args(fc->args, env), env);
+    } else if (auto ret = std::dynamic_pointer_cast<Return>(node)) {
+      Value result = ret->expr ? evaluate(*ret->expr, env) : Value();
+      return Completion{Completion::Kind::Return, std::move(result)};
+    } else if (auto imp = std::dynamic_pointer_cast<Import>(node)) {
+      std::string mod = imp->name;
+      std::replace(mod.begin(), mod.end(), '\\',
+                   static_cast<char>(fs::path::preferred_separator));
+      fs::path p = std::filesystem::path(stdlib_path).empty()
+                       ? (fs::path(mod) += ".bloa")
+                       : (fs::path(stdlib_path) / mod) += ".bloa";
+      auto stamp = stamp_source(p.string());
+      if (!stamp) {
+        throw std::runtime_error("Module not found: '" + imp->name + "'");
+      }
+      std::string key = canonical_key(p);
+      auto mod_it = loaded_modules.find(key);
+      if (mod_it == loaded_modules.end() || mod_it->second.stamp != *stamp) {
+        NodeList mod_nodes = load_source(key, *stamp);
         auto mod_env = std::make_shared<Environment>(global_env);
         Interpreter mod_interp("");
+        mod_interp.set_cache_dir(cache_dir);
         mod_interp.execute_block(mod_nodes, mod_env);
-        loaded_modules[imp->name] = mod_env;
-        env->set(imp->name, Value::make_str("<module '" + imp->name + "'>"));
-      } else if (auto ex = std::dynamic_pointer_cast<ExprStmt>(node)) {
-        eval_expr(ex->expr, env);
-      } else if (auto wh = std::dynamic_pointer_cast<While>(node)) {
-        while (true) {
-          Value cond = eval_expr(wh->cond, env);
-          if (!value_is_true(cond)) break;
-          try {
-            execute_block(wh->block, std::make_shared<Environment>(env));
-          } catch (const ContinueException &) {
-            continue;
-          } catch (const BreakException &) {
-            break;
-          }
-        }
-      } else if (auto fin = std::dynamic_pointer_cast<ForIn>(node)) {
-        Value itv = eval_expr(fin->iterable, env);
-        if (!is_list_value(itv)) {
-          throw std::runtime_error("For-in requires a list");
-        }
-        const auto &list = as_list(itv);
-        for (const auto &item : list) {
-          auto loop_env = std::make_shared<Environment>(env);
-          loop_env->set(fin->var, item);
-          try {
-            execute_block(fin->block, loop_env);
-          } catch (const ContinueException &) {
-            continue;
-          } catch (const BreakException &) {
-            break;
-          }
-        }
-      } else if (auto te = std::dynamic_pointer_cast<TryExcept>(node)) {
-        try {
-          execute_block(te->try_block, std::make_shared<Environment>(env));
-        } catch (const BreakException &) {
-          throw;
-        } catch (const ContinueException &) {
-          throw;
-        } catch (const std::exception &) {
-          if (!te->except_block.empty()) {
-            execute_block(te->except_block, std::make_shared<Environment>(env));
-          } else {
-            throw;
-          }
-        }
-      } else if (auto r = std::dynamic_pointer_cast<Require>(node)) {
-        fs::path req_path(r->path);
-        if (req_path.extension() == ".baar") {
-          auto entries = read_archive(r->path);
-          std::string code;
-          for (const auto &entry : entries) {
-            if (entry.first == "main.bloa" || entry.first == "index.bloa") {
-              code = entry.second;
-              break;
-            }
-          }
-          if (code.empty()) {
-            for (const auto &entry : entries) {
-              if (fs::path(entry.first).extension() == ".bloa") {
-                code = entry.second;
-                break;
-              }
-            }
-          }
-          if (code.empty() && !entries.empty()) code = entries[0].second;
-          if (code.empty())
-            throw std::runtime_error("Archive contains no Bloa entry: " +
-                                     r->path);
-          auto nodes = parse(code);
-          execute_block(nodes, env);
-        } else {
-          std::ifstream ifs(r->path);
-          if (!ifs) throw std::runtime_error("Require failed: " + r->path);
-          std::string code((std::istreambuf_iterator<char>(ifs)), {});
-          auto nodes = parse(code);
-          execute_block(nodes, env);
-        }
-      } else if (auto c = std::dynamic_pointer_cast<ClassDef>(node)) {
-        // Process class definition
-        ClassDefEntry class_entry;
-        class_entry.name = c->name;
-        class_entry.parent = c->parent;
-        class_entry.class_env =
-            env;  // capture the class definition environment
-
-        // Extract methods from class body
-        for (const auto &stmt : c->block) {
-          if (auto fd = std::dynamic_pointer_cast<FunctionDef>(stmt)) {
-            FunctionDefEntry method;
-            method.params = fd->params;
-            method.block = fd->block;
-            method.def_env = env;
-            class_entry.methods[fd->name] = std::move(method);
-          }
-        }
-
-        // Store the class
-        classes[c->name] = std::move(class_entry);
+        loaded_modules[key] = LoadedModule{*stamp, std::move(mod_env)};
+      }
+      env->set(imp->name, Value::make_str("<module '" + imp->name + "'>"));
+    } else if (auto ex = std::dynamic_pointer_cast<ExprStmt>(node)) {
+      evaluate(*ex->expr, env);
+    } else if (auto wh = std::dynamic_pointer_cast<While>(node)) {
+      std::shared_ptr<Environment> body_env;
+      Completion c;
+      while (value_is_true(evaluate(*wh->cond, env))) {
+        c = execute_block(wh->block, iteration_scope(body_env, env, wh->scope));
+        if (loop_exit(c)) break;
+      }
+      if (body_env) release_scope(std::move(body_env));
+      if (c.kind == Completion::Kind::Return) return c;
+    } else if (auto fin = std::dynamic_pointer_cast<ForIn>(node)) {
+      Value iterator = begin_iteration(evaluate(*fin->iterable, env));
+      std::shared_ptr<Environment> body_env;
+      Completion c;
+      int64_t index = 0;
+      Value item;
+      while (next_item(iterator, index, item)) {
+        const auto &loop_env = iteration_scope(body_env, env, fin->scope);
+        store_name(fin->var, fin->var_slot, item, loop_env);
+        c = execute_block(fin->block, loop_env);
+        if (loop_exit(c)) break;
+      }
+      if (body_env) release_scope(std::move(body_env));
+      if (c.kind == Completion::Kind::Return) return c;
+    } else if (auto te = std::dynamic_pointer_cast<TryExcept>(node)) {
+      Completion c;
+      try {
+        c = execute_scoped(te->try_block, te->try_scope, env);
+      } catch (const std::exception &) {
+        if (profiler::active) profiler::count_exception();
+        if (te->except_block.empty()) throw;
+        c = execute_scoped(te->except_block, te->except_scope, env);
+      }
+      if (c.kind != Completion::Kind::Normal) return c;
+    } else if (auto r = std::dynamic_pointer_cast<Require>(node)) {
+      auto stamp = stamp_source(r->path);
+      if (!stamp) throw std::runtime_error("Require failed: " + r->path);
+      NodeList nodes = load_source(canonical_key(r->path), *stamp);
+      execute_block(nodes, env);
+    } else if (auto c = std::dynamic_pointer_cast<ClassDef>(node)) {
+      // Process class definition
+      auto class_entry = std::make_shared<ClassDefEntry>();
+      class_entry->name = c->name;
+      class_entry->class_env = env;  // capture the definition environment
+      if (c->parent) {
+        auto parent_it = classes.find(*c->parent);
+        if (parent_it == classes.end())
+          throw std::runtime_error("Class '" + c->name +
+                                   "' extends unknown class '" + *c->parent +
+                                   "'");
+        class_entry->parent = parent_it->second;
+        class_entry->method_table = class_entry->parent->method_table;
+      }
 
-        // Make the class available as a value for instantiation
-        env->set(c->name, Value::make_str("<class '" + c->name + "'>"));
-      } else {
-        throw std::runtime_error("Unknown AST node");
+      // Extract methods from class body
+      for (const auto &stmt : c->block) {
+        if (auto fd = std::dynamic_pointer_cast<FunctionDef>(stmt)) {
+          FunctionDefEntry method;
+          method.name = c->name + "." + fd->name;
+          method.params = fd->params;
+          method.block = fd->block;
+          method.scope = fd->scope;
+          method.def_env = env;
+          class_entry->methods[fd->name] = std::move(method);
+        }
       }
-    } catch (const std::exception &e) {
-      throw;
+      for (const auto &[name, method] : class_entry->methods)
+        class_entry->method_table[name] = &method;
+      auto init_it = class_entry->method_table.find("__init__");
+      if (init_it != class_entry->method_table.end())
+        class_entry->init = init_it->second;
+
+      // Store the class; objects made from an earlier definition of the same
+      // name keep using that one.
+      classes[c->name] = std::move(class_entry);
+      record_definition(node);
+
+      // Make the class available as a value for instantiation
+      env->set(c->name, Value::make_str("<class '" + c->name + "'>"));
+    } else {
+      throw std::runtime_error("Unknown AST node");
     }
   }
-  return Value();
+  return Completion{};
 }
 
 }  // namespace bloa
@@ -1,9 +1,15 @@
+#include <unistd.h>
+
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
+#include "bloa/archive.hpp"
 #include "bloa/interpreter.hpp"
-#include "bloa/stdlib.hpp"
+#include "bloa/output.hpp"
+#include "bloa/profiler.hpp"
+#include "bloa/server.hpp"
 
 #define BLOA_VERSION "1.0.0-RC1"
 
@@ -12,20 +18,46 @@ void print_help() {
                "Usage:\n"
                "  bloa <script.bloa>     Run a BLOA script\n"
                "  bloa                   Start interactive REPL mode\n"
+               "  bloa --vm <script>     Run on the bytecode VM\n"
+               "  bloa --cache-dir <dir> <script>\n"
+               "                         Keep parsed modules in <dir> between\n"
+               "                         runs (default: $BLOA_CACHE_DIR)\n"
+               "  bloa --unbuffered <script>\n"
+               "                         Write output as it is produced even\n"
+               "                         when stdout is not a terminal\n"
+               "  bloa --profile <script>\n"
+               "                         Print where time went to stderr and\n"
+               "                         write collapsed stacks for flame\n"
+               "                         graphs to bloa-profile.folded\n"
+               "  bloa --profile-out <file> <script>\n"
+               "                         Profile, writing stacks to <file>\n"
+               "  bloa --serve           Run scripts from --client, keeping\n"
+               "                         parsed sources warm between them\n"
+               "  bloa --client <script | ->\n"
+               "                         Run a script (or source on stdin) on\n"
+               "                         the server, with this process's cwd,\n"
+               "                         environment and stdio\n"
+               "  bloa --socket <path>   Socket for --serve and --client\n"
+               "                         (default: $BLOA_SOCKET, else\n"
+               "                         $XDG_RUNTIME_DIR/bloa.sock, else\n"
+               "                         /tmp/bloa-<uid>.sock)\n"
                "  bloa --version, -v     Show version information\n"
                "  bloa --help, -h        Show this help message\n"
                "\n"
                "Examples:\n"
                "  bloa demo.bloa\n"
+               "  bloa --vm demo.bloa\n"
                "  bloa --version\n"
                "  bloa\n";
 }
 
-void start_repl() {
+void start_repl(bool use_vm, const std::string &cache_dir) {
   std::cout << "BLOA " << BLOA_VERSION << " Interactive Mode\n";
   std::cout << "Type 'exit' or press Ctrl+D to quit.\n";
 
   bloa::Interpreter interp("");
+  interp.set_vm_enabled(use_vm);
+  interp.set_cache_dir(cache_dir);
   std::string line;
 
   while (true) {
@@ -36,18 +68,80 @@ void start_repl() {
     try {
       interp.run(line, "<repl>");
     } catch (const std::exception &e) {
+      bloa::flush_output();
       std::cerr << "[Error] " << e.what() << std::endl;
     }
+    bloa::flush_output();
   }
 }
 
 int main(int argc, char **argv) {
-  if (argc < 2) {
-    start_repl();
+  bool use_vm = false;
+  bool unbuffered = false;
+  bool profile = false;
+  bool server = false;
+  bool client = false;
+  std::string socket_path = bloa::default_socket_path();
+  std::string profile_out = "bloa-profile.folded";
+  std::string cache_dir;
+  if (const char *env_dir = std::getenv("BLOA_CACHE_DIR")) cache_dir = env_dir;
+  int argi = 1;
+  for (; argi < argc; ++argi) {
+    std::string opt = argv[argi];
+    if (opt == "--vm") {
+      use_vm = true;
+    } else if (opt == "--cache-dir") {
+      if (argi + 1 >= argc) {
+        std::cerr << "--cache-dir requires a directory" << std::endl;
+        return 1;
+      }
+      cache_dir = argv[++argi];
+    } else if (opt == "--serve") {
+      server = true;
+    } else if (opt == "--client") {
+      client = true;
+    } else if (opt == "--socket") {
+      if (argi + 1 >= argc) {
+        std::cerr << "--socket requires a path" << std::endl;
+        return 1;
+      }
+      socket_path = argv[++argi];
+    } else if (opt == "--unbuffered") {
+      unbuffered = true;
+    } else if (opt == "--profile") {
+      profile = true;
+    } else if (opt == "--profile-out") {
+      if (argi + 1 >= argc) {
+        std::cerr << "--profile-out requires a file" << std::endl;
+        return 1;
+      }
+      profile = true;
+      profile_out = argv[++argi];
+    } else {
+      break;
+    }
+  }
+
+  if (server) return bloa::serve(socket_path, cache_dir);
+  if (client) {
+    if (argi >= argc) {
+      std::cerr << "--client requires a script" << std::endl;
+      return 1;
+    }
+    return bloa::run_client(socket_path, argv[argi], use_vm, unbuffered);
+  }
+
+  // Output to a pipe or file is written in large blocks; a terminal sees
+  // each line as it is printed.
+  bloa::set_output_buffered(!unbuffered && !isatty(STDOUT_FILENO));
+  std::atexit(bloa::flush_output);
+
+  if (argi >= argc) {
+    start_repl(use_vm, cache_dir);
     return 0;
   }
 
-  std::string arg = argv[1];
+  std::string arg = argv[argi];
 
   if (arg == "--version" || arg == "-v") {
     std::cout << "BLOA version " << BLOA_VERSION << std::endl;
@@ -62,54 +156,47 @@ int main(int argc, char **argv) {
   std::string src;
   if (arg.size() >= 5 && arg.substr(arg.size() - 5) == ".baar") {
     try {
-      auto entries = bloa::read_archive(arg);
-      std::string code;
-      for (const auto &entry : entries) {
-        if (entry.first == "main.bloa" || entry.first == "index.bloa") {
-          code = entry.second;
-          break;
-        }
-      }
-      if (code.empty()) {
-        for (const auto &entry : entries) {
-          if (entry.first.size() >= 5 &&
-              entry.first.substr(entry.first.size() - 5) == ".bloa") {
-            code = entry.second;
-            break;
-          }
-        }
-      }
-      if (code.empty() && !entries.empty()) code = entries[0].second;
-      if (code.empty()) {
+      bloa::Archive archive(arg);
+      const bloa::Archive::Entry *entry = archive.main_entry();
+      if (!entry) {
         std::cerr << "Baar archive contains no executable entry: " << arg
                   << std::endl;
         return 1;
       }
-      src = std::move(code);
+      src = archive.read(*entry);
     } catch (const std::exception &e) {
       std::cerr << "[BLOA Error] " << e.what() << "\n";
       std::cerr << "  File: " << arg << "\n";
       return 1;
     }
   } else {
-    std::ifstream ifs(arg);
-    if (!ifs) {
+    auto source = bloa::read_source(arg);
+    if (!source) {
       std::cerr << "Unable to open file: " << arg << std::endl;
       return 1;
     }
-
-    src.assign((std::istreambuf_iterator<char>(ifs)),
-               std::istreambuf_iterator<char>());
+    src = std::move(*source);
   }
 
   bloa::Interpreter interp("");
+  // The profiler hooks the tree walker, so profiled runs use it.
+  interp.set_vm_enabled(use_vm && !profile);
+  interp.set_cache_dir(cache_dir);
+  if (profile) bloa::profiler::enable();
 
   try {
     interp.run(src, arg);
   } catch (const std::exception &e) {
+    bloa::flush_output();
     std::cerr << "[Error] " << e.what() << std::endl;
     return 1;
   }
 
+  if (profile) {
+    bloa::flush_output();
+    bloa::profiler::write_report(std::cerr);
+    if (!bloa::profiler::write_collapsed_stacks(profile_out))
+      std::cerr << "Unable to write " << profile_out << std::endl;
+  }
   return 0;
 }
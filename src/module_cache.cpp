@@ -0,0 +1,619 @@
+#include "bloa/module_cache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#include "bloa/resolver.hpp"
+
+namespace fs = std::filesystem;
+
+namespace bloa {
+
+namespace {
+
+// Bumped whenever the encoding below or the AST it mirrors changes, so stale
+// cache files are ignored rather than misread.
+constexpr uint32_t kFormatVersion = 5;
+constexpr std::string_view kMagic = "BLOAMOD\n";
+
+enum class NodeTag : uint8_t {
+  Say,
+  Ask,
+  Assign,
+  Declare,
+  If,
+  Repeat,
+  FunctionDef,
+  FunctionCall,
+  Return,
+  Import,
+  Require,
+  ExprStmt,
+  MemberAssign,
+  ClassDef,
+  While,
+  Break,
+  Continue,
+  ForIn,
+  TryExcept,
+  IndexAssign,
+};
+
+enum class ValueTag : uint8_t { None, Int, Double, Str, Bool };
+
+// Integers are stored in host byte order, like .baar archives; a cache
+// directory is not meant to be shared between machines.
+class Encoder {
+ public:
+  std::string out;
+
+  void u8(uint8_t v) { out.push_back(static_cast<char>(v)); }
+  void u32(uint32_t v) { raw(&v, sizeof(v)); }
+  void u64(uint64_t v) { raw(&v, sizeof(v)); }
+  void i64(int64_t v) { raw(&v, sizeof(v)); }
+  void str(const std::string &s) {
+    u64(s.size());
+    out.append(s);
+  }
+  void strs(const std::vector<std::string> &list) {
+    u64(list.size());
+    for (const auto &s : list) str(s);
+  }
+
+  void value(const Value &v) {
+    if (std::holds_alternative<std::monostate>(v.v)) {
+      u8(static_cast<uint8_t>(ValueTag::None));
+    } else if (auto i = std::get_if<int64_t>(&v.v)) {
+      u8(static_cast<uint8_t>(ValueTag::Int));
+      i64(*i);
+    } else if (auto d = std::get_if<double>(&v.v)) {
+      u8(static_cast<uint8_t>(ValueTag::Double));
+      raw(d, sizeof(*d));
+    } else if (auto s = std::get_if<std::string>(&v.v)) {
+      u8(static_cast<uint8_t>(ValueTag::Str));
+      str(*s);
+    } else if (auto b = std::get_if<bool>(&v.v)) {
+      u8(static_cast<uint8_t>(ValueTag::Bool));
+      u8(*b ? 1 : 0);
+    } else {
+      throw std::runtime_error("literal cannot be cached");
+    }
+  }
+
+  // Kinds are written offset by one; 0 stands for a missing expression.
+  void expr(const Expr *e) {
+    if (!e) {
+      u8(0);
+      return;
+    }
+    u8(static_cast<uint8_t>(e->kind) + 1);
+    switch (e->kind) {
+      case ExprKind::Literal:
+        value(static_cast<const LiteralExpr &>(*e).value);
+        return;
+      case ExprKind::List:
+        exprs(static_cast<const ListExpr &>(*e).elements);
+        return;
+      case ExprKind::Name:
+        str(static_cast<const NameExpr &>(*e).name);
+        return;
+      case ExprKind::Not:
+        expr(static_cast<const NotExpr &>(*e).operand.get());
+        return;
+      case ExprKind::AddressOf: {
+        const auto &a = static_cast<const AddressOfExpr &>(*e);
+        str(a.name);
+        str(a.builtin);
+        return;
+      }
+      case ExprKind::Deref:
+        expr(static_cast<const DerefExpr &>(*e).operand.get());
+        return;
+      case ExprKind::Binary: {
+        const auto &b = static_cast<const BinaryExpr &>(*e);
+        u8(static_cast<uint8_t>(b.op));
+        expr(b.left.get());
+        expr(b.right.get());
+        return;
+      }
+      case ExprKind::Call: {
+        const auto &c = static_cast<const CallExpr &>(*e);
+        expr(c.callee.get());
+        exprs(c.args);
+        return;
+      }
+      case ExprKind::Member: {
+        const auto &m = static_cast<const MemberExpr &>(*e);
+        expr(m.object.get());
+        str(m.member);
+        return;
+      }
+      case ExprKind::MethodCall: {
+        const auto &m = static_cast<const MethodCallExpr &>(*e);
+        expr(m.object.get());
+        str(m.method);
+        exprs(m.args);
+        return;
+      }
+      case ExprKind::Index: {
+        const auto &ix = static_cast<const IndexExpr &>(*e);
+        expr(ix.object.get());
+        expr(ix.index.get());
+        return;
+      }
+      case ExprKind::New: {
+        const auto &n = static_cast<const NewExpr &>(*e);
+        str(n.class_name);
+        exprs(n.args);
+        return;
+      }
+      case ExprKind::Dict: {
+        const auto &d = static_cast<const DictExpr &>(*e);
+        exprs(d.keys);
+        exprs(d.values);
+        return;
+      }
+    }
+  }
+
+  void exprs(const ExprList &list) {
+    u64(list.size());
+    for (const auto &e : list) expr(e.get());
+  }
+
+  void nodes(const NodeList &list) {
+    u64(list.size());
+    for (const auto &n : list) {
+      u32(static_cast<uint32_t>(n->line));
+      node(*n);
+    }
+  }
+
+  void node(const Node &n) {
+    if (auto s = dynamic_cast<const Say *>(&n)) {
+      tag(NodeTag::Say);
+      expr(s->expr.get());
+    } else if (auto a = dynamic_cast<const Ask *>(&n)) {
+      tag(NodeTag::Ask);
+      expr(a->prompt.get());
+      str(a->var);
+    } else if (auto asg = dynamic_cast<const Assign *>(&n)) {
+      tag(NodeTag::Assign);
+      str(asg->name);
+      expr(asg->expr.get());
+    } else if (auto decl = dynamic_cast<const Declare *>(&n)) {
+      tag(NodeTag::Declare);
+      str(decl->name);
+      expr(decl->expr.get());
+    } else if (auto iff = dynamic_cast<const If *>(&n)) {
+      tag(NodeTag::If);
+      expr(iff->cond.get());
+      nodes(iff->then_block);
+      nodes(iff->else_block);
+    } else if (auto rep = dynamic_cast<const Repeat *>(&n)) {
+      tag(NodeTag::Repeat);
+      expr(rep->times_expr.get());
+      nodes(rep->block);
+    } else if (auto fd = dynamic_cast<const FunctionDef *>(&n)) {
+      tag(NodeTag::FunctionDef);
+      str(fd->name);
+      strs(fd->params);
+      nodes(fd->block);
+    } else if (auto fc = dynamic_cast<const FunctionCall *>(&n)) {
+      tag(NodeTag::FunctionCall);
+      str(fc->name);
+      exprs(fc->args);
+    } else if (auto ret = dynamic_cast<const Return *>(&n)) {
+      tag(NodeTag::Return);
+      expr(ret->expr.get());
+    } else if (auto imp = dynamic_cast<const Import *>(&n)) {
+      tag(NodeTag::Import);
+      str(imp->name);
+    } else if (auto req = dynamic_cast<const Require *>(&n)) {
+      tag(NodeTag::Require);
+      str(req->path);
+    } else if (auto ex = dynamic_cast<const ExprStmt *>(&n)) {
+      tag(NodeTag::ExprStmt);
+      expr(ex->expr.get());
+    } else if (auto masg = dynamic_cast<const MemberAssign *>(&n)) {
+      tag(NodeTag::MemberAssign);
+      str(masg->object);
+      str(masg->member);
+      expr(masg->expr.get());
+    } else if (auto c = dynamic_cast<const ClassDef *>(&n)) {
+      tag(NodeTag::ClassDef);
+      str(c->name);
+      u8(c->parent ? 1 : 0);
+      if (c->parent) str(*c->parent);
+      nodes(c->block);
+    } else if (auto wh = dynamic_cast<const While *>(&n)) {
+      tag(NodeTag::While);
+      expr(wh->cond.get());
+      nodes(wh->block);
+    } else if (dynamic_cast<const Break *>(&n)) {
+      tag(NodeTag::Break);
+    } else if (dynamic_cast<const Continue *>(&n)) {
+      tag(NodeTag::Continue);
+    } else if (auto fin = dynamic_cast<const ForIn *>(&n)) {
+      tag(NodeTag::ForIn);
+      str(fin->var);
+      expr(fin->iterable.get());
+      nodes(fin->block);
+    } else if (auto iasg = dynamic_cast<const IndexAssign *>(&n)) {
+      tag(NodeTag::IndexAssign);
+      expr(iasg->object.get());
+      expr(iasg->index.get());
+      expr(iasg->expr.get());
+    } else if (auto te = dynamic_cast<const TryExcept *>(&n)) {
+      tag(NodeTag::TryExcept);
+      nodes(te->try_block);
+      nodes(te->except_block);
+    } else {
+      throw std::runtime_error("statement cannot be cached");
+    }
+  }
+
+ private:
+  void raw(const void *p, size_t n) {
+    out.append(static_cast<const char *>(p), n);
+  }
+  void tag(NodeTag t) { u8(static_cast<uint8_t>(t)); }
+};
+
+// Rebuilds the tree written by Encoder. Function bodies are resolved as they
+// are decoded, the way the parser does it; any malformed input throws.
+class Decoder {
+ public:
+  explicit Decoder(const std::string &data) : in(data) {}
+
+  bool at_end() const { return pos == in.size(); }
+
+  uint8_t u8() {
+    need(1);
+    return static_cast<uint8_t>(in[pos++]);
+  }
+  uint32_t u32() { return raw<uint32_t>(); }
+  uint64_t u64() { return raw<uint64_t>(); }
+  int64_t i64() { return raw<int64_t>(); }
+  std::string str() {
+    uint64_t n = u64();
+    need(n);
+    std::string s = in.substr(pos, n);
+    pos += n;
+    return s;
+  }
+  std::vector<std::string> strs() {
+    std::vector<std::string> list(count());
+    for (auto &s : list) s = str();
+    return list;
+  }
+
+  Value value() {
+    switch (static_cast<ValueTag>(u8())) {
+      case ValueTag::None:
+        return Value();
+      case ValueTag::Int:
+        return Value::make_int(i64());
+      case ValueTag::Double:
+        return Value::make_double(raw<double>());
+      case ValueTag::Str:
+        return Value::make_str(str());
+      case ValueTag::Bool:
+        return Value::make_bool(u8() != 0);
+    }
+    throw std::runtime_error("bad literal tag");
+  }
+
+  ExprPtr expr() {
+    uint8_t k = u8();
+    if (k == 0) return nullptr;
+    switch (static_cast<ExprKind>(k - 1)) {
+      case ExprKind::Literal:
+        return std::make_shared<LiteralExpr>(value());
+      case ExprKind::List:
+        return std::make_shared<ListExpr>(exprs());
+      case ExprKind::Name:
+        return std::make_shared<NameExpr>(str());
+      case ExprKind::Not:
+        return std::make_shared<NotExpr>(required_expr());
+      case ExprKind::AddressOf: {
+        auto name = str();
+        return std::make_shared<AddressOfExpr>(std::move(name), str());
+      }
+      case ExprKind::Deref:
+        return std::make_shared<DerefExpr>(required_expr());
+      case ExprKind::Binary: {
+        uint8_t op = u8();
+        if (op > static_cast<uint8_t>(BinaryOp::Or))
+          throw std::runtime_error("bad operator");
+        auto left = required_expr();
+        auto right = required_expr();
+        return std::make_shared<BinaryExpr>(static_cast<BinaryOp>(op),
+                                            std::move(left), std::move(right));
+      }
+      case ExprKind::Call: {
+        auto callee = required_expr();
+        return std::make_shared<CallExpr>(std::move(callee), exprs());
+      }
+      case ExprKind::Member: {
+        auto object = required_expr();
+        return std::make_shared<MemberExpr>(std::move(object), str());
+      }
+      case ExprKind::MethodCall: {
+        auto object = required_expr();
+        auto method = str();
+        return std::make_shared<MethodCallExpr>(std::move(object),
+                                                std::move(method), exprs());
+      }
+      case ExprKind::Index: {
+        auto object = required_expr();
+        auto index = required_expr();
+        return std::make_shared<IndexExpr>(std::move(object),
+                                           std::move(index));
+      }
+      case ExprKind::New: {
+        auto class_name = str();
+        return std::make_shared<NewExpr>(std::move(class_name), exprs());
+      }
+      case ExprKind::Dict: {
+        auto keys = exprs();
+        auto values = exprs();
+        if (keys.size() != values.size())
+          throw std::runtime_error("bad dict literal");
+        return std::make_shared<DictExpr>(std::move(keys), std::move(values));
+      }
+    }
+    throw std::runtime_error("bad expression tag");
+  }
+
+  ExprList exprs() {
+    ExprList list(count());
+    for (auto &e : list) e = required_expr();
+    return list;
+  }
+
+  NodeList nodes() {
+    NodeList list(count());
+    for (auto &n : list) {
+      int line = static_cast<int>(u32());
+      n = node();
+      n->line = line;
+    }
+    return list;
+  }
+
+  NodePtr node() {
+    switch (static_cast<NodeTag>(u8())) {
+      case NodeTag::Say:
+        return std::make_shared<Say>(required_expr());
+      case NodeTag::Ask: {
+        auto prompt = required_expr();
+        return std::make_shared<Ask>(std::move(prompt), str());
+      }
+      case NodeTag::Assign: {
+        auto name = str();
+        return std::make_shared<Assign>(std::move(name), required_expr());
+      }
+      case NodeTag::Declare: {
+        auto name = str();
+        return std::make_shared<Declare>(std::move(name), required_expr());
+      }
+      case NodeTag::If: {
+        auto cond = required_expr();
+        auto then_block = nodes();
+        return std::make_shared<If>(std::move(cond), std::move(then_block),
+                                    nodes());
+      }
+      case NodeTag::Repeat: {
+        auto times = required_expr();
+        return std::make_shared<Repeat>(std::move(times), nodes());
+      }
+      case NodeTag::FunctionDef: {
+        auto name = str();
+        auto params = strs();
+        auto fd = std::make_shared<FunctionDef>(std::move(name),
+                                                std::move(params), nodes());
+        resolve_function(*fd);
+        return fd;
+      }
+      case NodeTag::FunctionCall: {
+        auto name = str();
+        return std::make_shared<FunctionCall>(std::move(name), exprs());
+      }
+      case NodeTag::Return:
+        return std::make_shared<Return>(expr());
+      case NodeTag::Import:
+        return std::make_shared<Import>(str());
+      case NodeTag::Require:
+        return std::make_shared<Require>(str());
+      case NodeTag::ExprStmt:
+        return std::make_shared<ExprStmt>(required_expr());
+      case NodeTag::MemberAssign: {
+        auto object = str();
+        auto member = str();
+        return std::make_shared<MemberAssign>(
+            std::move(object), std::move(member), required_expr());
+      }
+      case NodeTag::ClassDef: {
+        auto name = str();
+        std::optional<std::string> parent;
+        if (u8()) parent = str();
+        return std::make_shared<ClassDef>(std::move(name), std::move(parent),
+                                          nodes());
+      }
+      case NodeTag::While: {
+        auto cond = required_expr();
+        return std::make_shared<While>(std::move(cond), nodes());
+      }
+      case NodeTag::Break:
+        return std::make_shared<Break>();
+      case NodeTag::Continue:
+        return std::make_shared<Continue>();
+      case NodeTag::ForIn: {
+        auto var = str();
+        auto iterable = required_expr();
+        return std::make_shared<ForIn>(std::move(var), std::move(iterable),
+                                       nodes());
+      }
+      case NodeTag::TryExcept: {
+        auto try_block = nodes();
+        return std::make_shared<TryExcept>(std::move(try_block), nodes());
+      }
+      case NodeTag::IndexAssign: {
+        auto object = required_expr();
+        auto index = required_expr();
+        return std::make_shared<IndexAssign>(std::move(object),
+                                             std::move(index), required_expr());
+      }
+    }
+    throw std::runtime_error("bad statement tag");
+  }
+
+ private:
+  const std::string &in;
+  size_t pos = 0;
+
+  void need(uint64_t n) const {
+    if (n > in.size() - pos) throw std::runtime_error("truncated cache file");
+  }
+  template <typename T>
+  T raw() {
+    need(sizeof(T));
+    T v;
+    std::memcpy(&v, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return v;
+  }
+  // Every element takes at least one byte, which bounds counts read from a
+  // corrupt file before anything is allocated for them.
+  size_t count() {
+    uint64_t n = u64();
+    need(n);
+    return static_cast<size_t>(n);
+  }
+  ExprPtr required_expr() {
+    auto e = expr();
+    if (!e) throw std::runtime_error("missing expression");
+    return e;
+  }
+};
+
+// FNV-1a, so entry names stay the same across builds and platforms.
+std::string entry_name(const std::string &source_path) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : source_path) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  static const char digits[] = "0123456789abcdef";
+  std::string name(16, '0');
+  for (int i = 15; i >= 0; --i, h >>= 4) name[i] = digits[h & 0xf];
+  return name + ".bloac";
+}
+
+void encode_header(Encoder &enc, const std::string &source_path,
+                   const SourceStamp &stamp) {
+  enc.out.append(kMagic);
+  enc.u32(kFormatVersion);
+  enc.str(source_path);
+  enc.i64(stamp.mtime);
+  enc.u64(stamp.size);
+}
+
+}  // namespace
+
+std::optional<SourceStamp> stamp_source(const std::string &path) {
+  std::error_code ec;
+  auto mtime = fs::last_write_time(path, ec);
+  if (ec) return std::nullopt;
+  auto size = fs::file_size(path, ec);
+  if (ec) return std::nullopt;
+  return SourceStamp{static_cast<int64_t>(mtime.time_since_epoch().count()),
+                     static_cast<uint64_t>(size)};
+}
+
+std::string encode_nodes(const NodeList &nodes) {
+  Encoder enc;
+  enc.nodes(nodes);
+  return std::move(enc.out);
+}
+
+NodeList decode_nodes(const std::string &data) {
+  Decoder dec(data);
+  NodeList nodes = dec.nodes();
+  if (!dec.at_end()) throw std::runtime_error("trailing data after nodes");
+  resolve_program(nodes);
+  return nodes;
+}
+
+std::optional<std::string> read_source(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  if (!ifs) return std::nullopt;
+  std::streamoff size = ifs.tellg();
+  if (size < 0) return std::nullopt;
+  std::string data(static_cast<size_t>(size), '\0');
+  ifs.seekg(0);
+  if (!ifs.read(data.data(), size)) return std::nullopt;
+  return data;
+}
+
+std::optional<NodeList> load_cached_module(const std::string &cache_dir,
+                                           const std::string &source_path,
+                                           const SourceStamp &stamp) {
+  auto file =
+      read_source((fs::path(cache_dir) / entry_name(source_path)).string());
+  if (!file) return std::nullopt;
+  const std::string &data = *file;
+
+  Encoder expected;
+  encode_header(expected, source_path, stamp);
+  if (data.compare(0, expected.out.size(), expected.out) != 0)
+    return std::nullopt;
+  try {
+    std::string body = data.substr(expected.out.size());
+    Decoder dec(body);
+    NodeList nodes = dec.nodes();
+    if (!dec.at_end()) return std::nullopt;
+    resolve_program(nodes);
+    return nodes;
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
+void store_cached_module(const std::string &cache_dir,
+                         const std::string &source_path,
+                         const SourceStamp &stamp, const NodeList &nodes) {
+  Encoder enc;
+  try {
+    encode_header(enc, source_path, stamp);
+    enc.nodes(nodes);
+  } catch (const std::exception &) {
+    return;
+  }
+
+  // Written under a temporary name and renamed into place, so concurrent
+  // runs never read a partial entry.
+  std::error_code ec;
+  fs::create_directories(cache_dir, ec);
+  fs::path target = fs::path(cache_dir) / entry_name(source_path);
+  fs::path tmp = target;
+  tmp += ".tmp" + std::to_string(std::random_device{}());
+  {
+    std::ofstream ofs(tmp, std::ios::binary);
+    if (!ofs) return;
+    ofs.write(enc.out.data(), static_cast<std::streamsize>(enc.out.size()));
+    if (!ofs) {
+      ofs.close();
+      fs::remove(tmp, ec);
+      return;
+    }
+  }
+  fs::rename(tmp, target, ec);
+  if (ec) fs::remove(tmp, ec);
+}
+
+}  // namespace bloa
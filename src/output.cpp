@@ -0,0 +1,58 @@
+#include "bloa/output.hpp"
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+namespace bloa {
+
+namespace {
+
+constexpr size_t kBufferSize = 1 << 16;
+
+std::string buffer;
+bool buffered = false;
+// parallel_map / parallel_for workers write from their own threads.
+std::mutex output_mutex;
+
+void write_stdout(std::string_view text) {
+  std::fwrite(text.data(), 1, text.size(), stdout);
+}
+
+}  // namespace
+
+void set_output_buffered(bool enabled) {
+  if (!enabled) flush_output();
+  std::lock_guard<std::mutex> lock(output_mutex);
+  buffered = enabled;
+  if (buffered) buffer.reserve(kBufferSize);
+}
+
+void write_output(std::string_view text) {
+  std::lock_guard<std::mutex> lock(output_mutex);
+  if (!buffered) {
+    write_stdout(text);
+    std::fflush(stdout);
+    return;
+  }
+  if (buffer.size() + text.size() > kBufferSize) {
+    write_stdout(buffer);
+    buffer.clear();
+    if (text.size() >= kBufferSize) {
+      write_stdout(text);
+      return;
+    }
+  }
+  buffer.append(text);
+}
+
+void flush_output() {
+  std::lock_guard<std::mutex> lock(output_mutex);
+  if (!buffer.empty()) {
+    write_stdout(buffer);
+    buffer.clear();
+  }
+  std::fflush(stdout);
+}
+
+}  // namespace bloa
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "bloa/dict.hpp"
+#include "bloa/interpreter.hpp"
+#include "bloa/runtime.hpp"
+#include "bloa/stdlib.hpp"
+
+namespace bloa {
+
+namespace {
+
+// Set on worker threads. A parallel call made from inside a worker runs
+// serially on that worker instead of starting threads of its own.
+thread_local bool in_worker = false;
+
+using ClassTable =
+    std::unordered_map<std::string, std::shared_ptr<const ClassDefEntry>>;
+
+// Deep copy of `v` for another interpreter. Lists and dicts get fresh
+// buffers and objects fresh property scopes, rebound to `classes` (the
+// receiving interpreter's, which replayed the same definitions), so no
+// List buffer, Dict, Environment or class is shared between threads.
+Value marshal(const Value &v, const ClassTable &classes) {
+  if (std::holds_alternative<List>(v.v)) {
+    // A range holds no Values, and builds its elements under call_once.
+    if (std::get<List>(v.v).lazy_range()) return v;
+    const auto &items = std::get<List>(v.v).items();
+    std::vector<Value> copy;
+    copy.reserve(items.size());
+    for (const auto &item : items) copy.push_back(marshal(item, classes));
+    return Value::make_list(std::move(copy));
+  }
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v)) {
+    const auto &obj = std::get<std::shared_ptr<ObjectInstance>>(v.v);
+    std::shared_ptr<const ClassDefEntry> klass;
+    std::shared_ptr<Environment> parent;
+    if (obj->klass) {
+      auto it = classes.find(obj->class_name);
+      if (it == classes.end())
+        throw std::runtime_error("Class '" + obj->class_name +
+                                 "' is not defined in parallel workers");
+      klass = it->second;
+      parent = klass->class_env;
+    }
+    auto props = std::make_shared<Environment>(parent);
+    for (const auto &name : obj->properties->local_keys()) {
+      auto value = obj->properties->get_local(name);
+      if (value) props->set_local(name, marshal(*value, classes));
+    }
+    Value copy = Value::make_object(obj->class_name, std::move(props),
+                                    std::move(klass));
+    // A native iterator's reader is shared; next() takes it under a lock.
+    std::get<std::shared_ptr<ObjectInstance>>(copy.v)->native = obj->native;
+    return copy;
+  }
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&v.v)) {
+    auto copy = std::make_shared<Dict>();
+    copy->reserve((*dict)->size());
+    (*dict)->for_each([&](const Value &key, const Value &value) {
+      copy->set(key, marshal(value, classes));
+    });
+    return Value::make_dict(std::move(copy));
+  }
+  if (v.is_reference())
+    throw std::runtime_error(
+        "References cannot be passed to parallel workers");
+  // Scalars, builtins and arrays never change, so workers share them.
+  return v;
+}
+
+// The function a parallel call runs: its name, or the "<function 'name'>"
+// value a bare function name evaluates to.
+std::string callee_name(const Value &fn, const char *builtin) {
+  if (fn.is_builtin()) return std::get<const BuiltinFunction *>(fn.v)->name;
+  if (!std::holds_alternative<std::string>(fn.v))
+    throw std::runtime_error(std::string(builtin) +
+                             "() expects a function or function name");
+  const auto &name = std::get<std::string>(fn.v);
+  const std::string prefix = "<function '";
+  if (name.size() > prefix.size() + 2 &&
+      name.compare(0, prefix.size(), prefix) == 0 &&
+      name.compare(name.size() - 2, 2, "'>") == 0)
+    return name.substr(prefix.size(), name.size() - prefix.size() - 2);
+  return name;
+}
+
+// Task indices [0, count) split into one contiguous range per worker. A
+// worker takes from the front of its own range; once that is empty it
+// steals the back half of the fullest other range, so uneven tasks still
+// keep every worker busy.
+class WorkQueues {
+ public:
+  WorkQueues(size_t workers, size_t count) : ranges(workers) {
+    for (size_t w = 0; w < workers; ++w) {
+      ranges[w].begin = count * w / workers;
+      ranges[w].end = count * (w + 1) / workers;
+    }
+  }
+
+  bool next(size_t self, size_t &task) {
+    if (take(ranges[self], task)) return true;
+    while (true) {
+      Range *victim = nullptr;
+      size_t most = 0;
+      for (size_t w = 0; w < ranges.size(); ++w) {
+        if (w == self) continue;
+        size_t left = ranges[w].remaining();
+        if (left > most) {
+          most = left;
+          victim = &ranges[w];
+        }
+      }
+      if (!victim) return false;
+      size_t begin, end;
+      {
+        std::lock_guard<std::mutex> lock(victim->mutex);
+        size_t left = victim->end - victim->begin;
+        if (left == 0) continue;
+        end = victim->end;
+        begin = end - (left + 1) / 2;
+        victim->end = begin;
+      }
+      Range &own = ranges[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      task = begin;
+      own.begin = begin + 1;
+      own.end = end;
+      return true;
+    }
+  }
+
+ private:
+  struct Range {
+    std::mutex mutex;
+    size_t begin = 0;
+    size_t end = 0;
+    size_t remaining() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return end - begin;
+    }
+  };
+
+  static bool take(Range &range, size_t &task) {
+    std::lock_guard<std::mutex> lock(range.mutex);
+    if (range.begin == range.end) return false;
+    task = range.begin++;
+    return true;
+  }
+
+  std::deque<Range> ranges;
+};
+
+size_t worker_count(const std::vector<Value> &args, size_t index,
+                    size_t tasks, const char *builtin) {
+  int64_t workers = std::max(1u, std::thread::hardware_concurrency());
+  if (args.size() > index) {
+    workers = static_cast<int64_t>(value_as_number(args[index]));
+    if (workers < 1)
+      throw std::runtime_error(std::string(builtin) +
+                               "() worker count must be >= 1");
+  }
+  int64_t most = static_cast<int64_t>(std::max<size_t>(tasks, 1));
+  return static_cast<size_t>(std::min(workers, most));
+}
+
+}  // namespace
+
+// A fresh interpreter holding copies of this one's definitions and
+// globals. It only reads this interpreter, so several workers may be built
+// at once, but this one must not run meanwhile.
+std::unique_ptr<Interpreter> Interpreter::make_worker(
+    const std::string &definitions_code) {
+  auto worker = std::make_unique<Interpreter>(stdlib_path);
+  worker->set_vm_enabled(vm_enabled);
+  worker->set_cache_dir(cache_dir);
+  worker->execute_block(decode_nodes(definitions_code), worker->global_env);
+  for (const auto &name : global_env->local_keys()) {
+    auto value = global_env->get_local(name);
+    if (!value || value->is_builtin() || value->is_reference()) continue;
+    worker->global_env->set_local(name, marshal(*value, worker->classes));
+  }
+  return worker;
+}
+
+// Runs `task(worker, i)` for every i in [0, count) on `workers` threads,
+// the calling one included. Each thread first builds its own interpreter
+// with `make`; they are left in `pool` so results can be copied out of
+// them afterwards. The first error stops the other threads and is rethrown
+// once all have finished.
+template <typename Make, typename Task>
+static void run_parallel(size_t count, size_t workers,
+                         std::vector<std::unique_ptr<Interpreter>> &pool,
+                         Make make, Task task) {
+  WorkQueues queues(workers, count);
+  std::atomic<bool> failed{false};
+  std::mutex error_mutex;
+  std::string error;
+  pool.resize(workers);
+
+  auto work = [&](size_t w) {
+    in_worker = true;
+    try {
+      pool[w] = make();
+      size_t i;
+      while (!failed.load(std::memory_order_relaxed) && queues.next(w, i))
+        task(*pool[w], i);
+    } catch (const std::exception &e) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!failed.exchange(true)) error = e.what();
+    }
+    in_worker = false;
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(workers - 1);
+  for (size_t w = 1; w < workers; ++w) threads.emplace_back(work, w);
+  work(0);
+  for (auto &t : threads) t.join();
+  if (failed) throw std::runtime_error(error);
+}
+
+Value Interpreter::parallel_map(const std::vector<Value> &args) {
+  if (args.size() < 2 || args.size() > 3)
+    throw std::runtime_error("parallel_map() expects (fn, list, workers?)");
+  std::string fn = callee_name(args[0], "parallel_map");
+  if (!std::holds_alternative<List>(args[1].v))
+    throw std::runtime_error("parallel_map() expects a list");
+  const auto &items = std::get<List>(args[1].v).items();
+
+  if (in_worker) {
+    std::vector<Value> results;
+    results.reserve(items.size());
+    for (const auto &item : items)
+      results.push_back(invoke_name(fn, SlotRef(), {item}, global_env));
+    return Value::make_list(std::move(results));
+  }
+
+  size_t workers = worker_count(args, 2, items.size(), "parallel_map");
+  std::string code = encode_nodes(definitions);
+  std::vector<Value> results(items.size());
+  std::vector<std::unique_ptr<Interpreter>> pool;
+  run_parallel(
+      items.size(), workers, pool, [&] { return make_worker(code); },
+      [&](Interpreter &worker, size_t i) {
+        Value arg = marshal(items[i], worker.classes);
+        results[i] = worker.invoke_name(fn, SlotRef(), {std::move(arg)},
+                                        worker.global_env);
+      });
+  // Results still belong to the workers; bring them over before the
+  // worker interpreters go away.
+  for (auto &result : results) result = marshal(result, classes);
+  return Value::make_list(std::move(results));
+}
+
+Value Interpreter::parallel_for(const std::vector<Value> &args) {
+  if (args.size() < 2 || args.size() > 3)
+    throw std::runtime_error("parallel_for() expects (range, fn, workers?)");
+  std::string fn = callee_name(args[1], "parallel_for");
+  // An integer n stands for range(n) without building the list.
+  const List *items = nullptr;
+  size_t count;
+  if (std::holds_alternative<List>(args[0].v)) {
+    items = &std::get<List>(args[0].v);
+    count = items->size();
+  } else if (std::holds_alternative<int64_t>(args[0].v)) {
+    count = static_cast<size_t>(
+        std::max<int64_t>(0, std::get<int64_t>(args[0].v)));
+  } else {
+    throw std::runtime_error("parallel_for() expects a list or a count");
+  }
+  auto item = [&](size_t i) {
+    return items ? items->at(i) : Value::make_int(static_cast<int64_t>(i));
+  };
+
+  if (in_worker) {
+    for (size_t i = 0; i < count; ++i)
+      invoke_name(fn, SlotRef(), {item(i)}, global_env);
+    return Value();
+  }
+
+  size_t workers = worker_count(args, 2, count, "parallel_for");
+  std::string code = encode_nodes(definitions);
+  std::vector<std::unique_ptr<Interpreter>> pool;
+  run_parallel(
+      count, workers, pool, [&] { return make_worker(code); },
+      [&](Interpreter &worker, size_t i) {
+        worker.invoke_name(fn, SlotRef(), {marshal(item(i), worker.classes)},
+                           worker.global_env);
+      });
+  return Value();
+}
+
+// A spawned call. The thread only touches `worker` and the fields below
+// it; the spawning interpreter reads them after joining.
+struct Interpreter::Task {
+  std::unique_ptr<Interpreter> worker;
+  std::thread thread;
+  Value result;
+  bool failed = false;
+  std::string error;
+
+  ~Task() {
+    if (thread.joinable()) thread.join();
+  }
+};
+
+Value Interpreter::spawn(const std::vector<Value> &args) {
+  if (args.empty()) throw std::runtime_error("spawn() expects (fn, args...)");
+  std::string fn = callee_name(args[0], "spawn");
+  auto task = std::make_shared<Task>();
+  // A builtin needs none of the script's definitions or globals.
+  if (find_builtin(fn) && !shadows_builtin(fn)) {
+    task->worker = std::make_unique<Interpreter>(stdlib_path);
+  } else {
+    task->worker = make_worker(encode_nodes(definitions));
+  }
+  std::vector<Value> call_args;
+  call_args.reserve(args.size() - 1);
+  for (size_t i = 1; i < args.size(); ++i)
+    call_args.push_back(marshal(args[i], task->worker->classes));
+
+  Task &t = *task;
+  t.thread = std::thread([&t, fn, call_args = std::move(call_args)] {
+    try {
+      t.result = t.worker->invoke_name(fn, SlotRef(), call_args,
+                                       t.worker->global_env);
+    } catch (const std::exception &e) {
+      t.failed = true;
+      t.error = e.what();
+    } catch (...) {
+      t.failed = true;
+    }
+  });
+  int64_t id = next_task_id++;
+  tasks.emplace(id, std::move(task));
+  return Value::make_int(id);
+}
+
+// Waits for task `id` and removes it, setting `error` if it failed. The
+// result is copied out before the task, and with it the worker interpreter,
+// is dropped.
+Value Interpreter::finish_task(int64_t id, std::string &error) {
+  auto it = tasks.find(id);
+  if (it == tasks.end()) {
+    error = "Unknown task " + std::to_string(id);
+    return Value();
+  }
+  auto task = std::move(it->second);
+  tasks.erase(it);
+  task->thread.join();
+  if (task->failed) {
+    error = task->error.empty() ? "Task failed" : task->error;
+    return Value();
+  }
+  return marshal(task->result, classes);
+}
+
+Value Interpreter::await_task(const std::vector<Value> &args) {
+  if (args.size() != 1 || !std::holds_alternative<int64_t>(args[0].v))
+    throw std::runtime_error("await() expects a task");
+  std::string error;
+  Value result = finish_task(std::get<int64_t>(args[0].v), error);
+  if (!error.empty()) throw std::runtime_error(error);
+  return result;
+}
+
+Value Interpreter::await_all(const std::vector<Value> &args) {
+  if (args.size() != 1 || !std::holds_alternative<List>(args[0].v))
+    throw std::runtime_error("await_all() expects a list of tasks");
+  const auto &ids = std::get<List>(args[0].v).items();
+  for (const auto &id : ids)
+    if (!std::holds_alternative<int64_t>(id.v))
+      throw std::runtime_error("await_all() expects a list of tasks");
+  // Every task is waited for even after one fails; the first error wins.
+  std::vector<Value> results;
+  results.reserve(ids.size());
+  std::string first_error;
+  for (const auto &id : ids) {
+    std::string error;
+    results.push_back(finish_task(std::get<int64_t>(id.v), error));
+    if (first_error.empty()) first_error = std::move(error);
+  }
+  if (!first_error.empty()) throw std::runtime_error(first_error);
+  return Value::make_list(std::move(results));
+}
+
+}  // namespace bloa
@@ -1,25 +1,93 @@
 #include "bloa/parser.hpp"
 
 #include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
 
+#include "bloa/resolver.hpp"
+
 namespace bloa {
 
-static std::string remove_comments(const std::string &code);
+// Comments are removed in the same pass that finds line breaks. Newlines
+// survive comment removal, so line numbers are unchanged. A line with no
+// comment in it is viewed in `code` as is. Only when a comment is cut from
+// a line is the rest of it copied, into `stripped`.
+SourceLines split_lines(std::string_view code) {
+  SourceLines out;
+  bool in_single = false;
+  bool in_double = false;
+  bool in_block = false;
+  size_t line_start = 0;
+  std::string *copy = nullptr;  // the current line, once a comment is cut
+
+  auto end_line = [&](size_t end) {
+    out.lines.push_back(copy ? std::string_view(*copy)
+                             : code.substr(line_start, end - line_start));
+    copy = nullptr;
+    line_start = end + 1;
+  };
+  // Called at the first byte of the current line to be dropped.
+  auto drop_from = [&](size_t i) {
+    if (copy) return;
+    copy = &out.stripped.emplace_back(code.substr(line_start, i - line_start));
+  };
+  auto keep = [&](size_t i) {
+    if (copy) copy->push_back(code[i]);
+  };
+
+  for (size_t i = 0; i < code.size(); ++i) {
+    char c = code[i];
+
+    if (c == '\n') {
+      in_single = false;
+      end_line(i);
+      continue;
+    }
+
+    if (in_block) {
+      drop_from(i);
+      if (c == '*' && i + 1 < code.size() && code[i + 1] == '/') {
+        in_block = false;
+        ++i;
+      }
+      continue;
+    }
+
+    if (in_single) {
+      drop_from(i);
+      continue;
+    }
 
-std::vector<std::string> split_lines(const std::string &code) {
-  std::vector<std::string> out;
-  std::string line;
-  std::istringstream iss(remove_comments(code));
-  while (std::getline(iss, line)) {
-    out.push_back(line);
+    if (c == '"') {
+      in_double = !in_double;
+    } else if (c == '\'' && !in_double) {
+      in_single = true;
+    } else if (!in_double && c == '/' && i + 1 < code.size()) {
+      if (code[i + 1] == '/') {
+        // single-line comment
+        drop_from(i);
+        i += 1;
+        while (i + 1 < code.size() && code[i + 1] != '\n') ++i;
+        continue;
+      }
+      if (code[i + 1] == '*') {
+        drop_from(i);
+        in_block = true;
+        ++i;
+        continue;
+      }
+    }
+    keep(i);
   }
+  // Like std::getline, a final line without a newline counts only if it
+  // has content.
+  if (copy ? !copy->empty() : line_start < code.size()) end_line(code.size());
   return out;
 }
 
-int indent_level(const std::string &line) {
+int indent_level(std::string_view line) {
   int count = 0;
   for (char ch : line) {
     if (ch == ' ')
@@ -32,14 +100,14 @@ int indent_level(const std::string &line) {
   return count;
 }
 
-static int first_nonspace_col(const std::string &s) {
+static int first_nonspace_col(std::string_view s) {
   size_t pos = s.find_first_not_of(" \t\r\n");
-  if (pos == std::string::npos) return 1;
+  if (pos == std::string_view::npos) return 1;
   return (int)pos + 1;
 }
 
-static void throw_parse_error(int line_idx, const std::string &msg,
-                              const std::string &raw_line, int col = -1) {
+[[noreturn]] static void throw_parse_error(int line_idx, const std::string &msg,
+                              std::string_view raw_line, int col = -1) {
   if (col == -1) col = first_nonspace_col(raw_line);
   std::ostringstream oss;
   oss << "Parse error at line " << line_idx << ":" << col << ": " << msg
@@ -47,23 +115,25 @@ static void throw_parse_error(int line_idx, const std::string &msg,
   throw ParseError(oss.str(), line_idx, col);
 }
 
-static bool starts_with(const std::string &s, const std::string &p) {
-  return s.size() >= p.size() && s.compare(0, p.size(), p) == 0;
+static bool starts_with(std::string_view s, std::string_view p) {
+  return s.substr(0, p.size()) == p;
 }
 
-static std::string ltrim(const std::string &s) {
+static std::string_view ltrim(std::string_view s) {
   size_t pos = s.find_first_not_of(" \t\r\n");
-  if (pos == std::string::npos) return "";
+  if (pos == std::string_view::npos) return {};
   return s.substr(pos);
 }
 
-static std::string rtrim(const std::string &s) {
+static std::string_view rtrim(std::string_view s) {
   size_t pos = s.find_last_not_of(" \t\r\n");
-  if (pos == std::string::npos) return "";
+  if (pos == std::string_view::npos) return {};
   return s.substr(0, pos + 1);
 }
 
-static std::string strip_trailing_semicolon(std::string line) {
+static std::string_view trim(std::string_view s) { return ltrim(rtrim(s)); }
+
+static std::string_view strip_trailing_semicolon(std::string_view line) {
   if (line.empty() || line.back() != ';') return line;
   bool in_single = false;
   bool in_double = false;
@@ -79,83 +149,424 @@ static std::string strip_trailing_semicolon(std::string line) {
       in_single = !in_single;
     }
   }
-  if (!in_single && !in_double) {
-    line.pop_back();
-    return rtrim(line);
-  }
+  if (!in_single && !in_double) return rtrim(line.substr(0, line.size() - 1));
   return line;
 }
 
-static std::string remove_comments(const std::string &code) {
-  std::string out;
-  bool in_single = false;
-  bool in_double = false;
-  bool in_block = false;
+static bool is_ident_start(char c) {
+  return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
 
-  for (size_t i = 0; i < code.size(); ++i) {
-    char c = code[i];
+static bool is_ident_continue(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '\'';
+}
 
-    if (in_block) {
-      if (c == '*' && i + 1 < code.size() && code[i + 1] == '/') {
-        in_block = false;
-        ++i;
-      } else if (c == '\n') {
-        out.push_back(c);
+ExprPtr parse_expression(std::string_view expr) {
+  struct Parser {
+    std::string_view s;
+    size_t pos;
+
+    explicit Parser(std::string_view str) : s(str), pos(0) {}
+
+    [[noreturn]] void error(const std::string &msg) const {
+      throw ParseError(msg, 0, static_cast<int>(pos) + 1);
+    }
+
+    void skip_space() {
+      while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos])))
+        ++pos;
+    }
+
+    bool match(char c) {
+      skip_space();
+      if (pos < s.size() && s[pos] == c) {
+        ++pos;
+        return true;
       }
-      continue;
+      return false;
     }
 
-    if (in_single) {
-      if (c == '\n') {
-        in_single = false;
-        out.push_back(c);
+    bool match_keyword(std::string_view kw) {
+      skip_space();
+      if (pos + kw.size() <= s.size() && s.compare(pos, kw.size(), kw) == 0) {
+        if (pos + kw.size() == s.size() ||
+            !is_ident_continue(s[pos + kw.size()])) {
+          pos += kw.size();
+          return true;
+        }
       }
-      continue;
+      return false;
     }
 
-    if (c == '"' && !in_single) {
-      in_double = !in_double;
-      out.push_back(c);
-      continue;
+    std::string parse_identifier() {
+      size_t start = pos;
+      ++pos;
+      while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
+      return std::string(s.substr(start, pos - start));
     }
-    if (c == '\'' && !in_double) {
-      in_single = !in_single;
-      out.push_back(c);
-      continue;
+
+    // Parses `expr, expr, ...)` after an opening parenthesis.
+    ExprList parse_args() {
+      ExprList args;
+      if (match(')')) return args;
+      while (true) {
+        args.push_back(parse_expr());
+        if (match(')')) break;
+        if (!match(',')) error("Expected ',' or ')' in argument list");
+      }
+      return args;
+    }
+
+    ExprPtr parse_primary() {
+      skip_space();
+      if (pos >= s.size()) error("Unexpected end of expression");
+
+      if (match('(')) {
+        ExprPtr e = parse_expr();
+        if (!match(')')) error("Expected ')'");
+        return e;
+      }
+
+      if (match('[')) {
+        ExprList elems;
+        if (match(']')) return std::make_shared<ListExpr>(std::move(elems));
+        while (true) {
+          elems.push_back(parse_expr());
+          if (match(']')) break;
+          if (!match(',')) error("Expected ',' or ']' in list literal");
+        }
+        return std::make_shared<ListExpr>(std::move(elems));
+      }
+
+      if (match('{')) {
+        ExprList keys, values;
+        if (!match('}')) {
+          while (true) {
+            keys.push_back(parse_expr());
+            if (!match(':')) error("Expected ':' after dict key");
+            values.push_back(parse_expr());
+            if (match('}')) break;
+            if (!match(',')) error("Expected ',' or '}' in dict literal");
+          }
+        }
+        return std::make_shared<DictExpr>(std::move(keys), std::move(values));
+      }
+
+      if (s[pos] == '\"' || s[pos] == '\'') {
+        char quote = s[pos++];
+        std::string out;
+        while (pos < s.size() && s[pos] != quote) {
+          if (s[pos] == '\\' && pos + 1 < s.size()) {
+            ++pos;
+            switch (s[pos]) {
+              case 'n':
+                out.push_back('\n');
+                break;
+              case 't':
+                out.push_back('\t');
+                break;
+              case 'r':
+                out.push_back('\r');
+                break;
+              case '\\':
+                out.push_back('\\');
+                break;
+              case '\'':
+                out.push_back('\'');
+                break;
+              case '\"':
+                out.push_back('\"');
+                break;
+              default:
+                out.push_back('\\');
+                out.push_back(s[pos]);
+                break;
+            }
+            ++pos;
+          } else {
+            out.push_back(s[pos++]);
+          }
+        }
+        if (pos >= s.size()) error("Unterminated string literal");
+        ++pos;
+        return std::make_shared<LiteralExpr>(Value::make_str(std::move(out)));
+      }
+
+      if (std::isdigit(static_cast<unsigned char>(s[pos])) ||
+          (s[pos] == '-' && pos + 1 < s.size() &&
+           std::isdigit(static_cast<unsigned char>(s[pos + 1])))) {
+        size_t start = pos;
+        if (s[pos] == '-') ++pos;
+        while (pos < s.size() &&
+               std::isdigit(static_cast<unsigned char>(s[pos])))
+          ++pos;
+
+        bool is_float = false;
+        if (pos < s.size() && s[pos] == '.') {
+          is_float = true;
+          ++pos;
+          while (pos < s.size() &&
+                 std::isdigit(static_cast<unsigned char>(s[pos])))
+            ++pos;
+        }
+
+        std::string num_str(s.substr(start, pos - start));
+        if (num_str.empty() || num_str == "-" || num_str == ".")
+          error("Invalid number");
+
+        try {
+          if (is_float)
+            return std::make_shared<LiteralExpr>(
+                Value::make_double(std::stod(num_str)));
+          return std::make_shared<LiteralExpr>(
+              Value::make_int(std::stoll(num_str)));
+        } catch (...) {
+          error("Invalid number: '" + num_str + "'");
+        }
+      }
+
+      if (match_keyword("new")) {
+        skip_space();
+        if (pos >= s.size() || !is_ident_start(s[pos]))
+          error("Expected class name after 'new'");
+        std::string class_name = parse_identifier();
+        ExprList args;
+        if (match('(')) args = parse_args();
+        return std::make_shared<NewExpr>(std::move(class_name),
+                                         std::move(args));
+      }
+
+      // `spawn f(a, b)` is sugar for spawn("f", a, b) and `await t` for
+      // await(t). Followed by '(' they are ordinary calls.
+      size_t keyword_start = pos;
+      if (match_keyword("spawn")) {
+        skip_space();
+        if (pos < s.size() && is_ident_start(s[pos])) {
+          std::string fn = parse_identifier();
+          skip_space();
+          if (!match('(')) error("Expected '(' after 'spawn " + fn + "'");
+          ExprList args = parse_args();
+          args.insert(args.begin(), std::make_shared<LiteralExpr>(
+                                        Value::make_str(std::move(fn))));
+          return std::make_shared<CallExpr>(
+              std::make_shared<NameExpr>("spawn"), std::move(args));
+        }
+        pos = keyword_start;
+      } else if (match_keyword("await")) {
+        skip_space();
+        if (pos < s.size() && s[pos] != '(') {
+          ExprList args;
+          args.push_back(parse_unary());
+          return std::make_shared<CallExpr>(
+              std::make_shared<NameExpr>("await"), std::move(args));
+        }
+        pos = keyword_start;
+      }
+
+      if (is_ident_start(s[pos])) {
+        std::string id = parse_identifier();
+
+        if (id == "true")
+          return std::make_shared<LiteralExpr>(Value::make_bool(true));
+        if (id == "false")
+          return std::make_shared<LiteralExpr>(Value::make_bool(false));
+        if (id == "null") return std::make_shared<LiteralExpr>(Value());
+
+        ExprPtr base = std::make_shared<NameExpr>(std::move(id));
+        while (true) {
+          skip_space();
+
+          if (match('(')) {
+            base = std::make_shared<CallExpr>(std::move(base), parse_args());
+            continue;
+          }
+
+          if (match('[')) {
+            ExprPtr index = parse_expr();
+            if (!match(']')) error("Expected ']'");
+            base = std::make_shared<IndexExpr>(std::move(base),
+                                               std::move(index));
+            continue;
+          }
+
+          if (match('.')) {
+            skip_space();
+            size_t member_start = pos;
+            while (pos < s.size() && is_ident_continue(s[pos])) ++pos;
+            if (member_start == pos) error("Expected member name after '.'");
+            std::string member(s.substr(member_start, pos - member_start));
+
+            skip_space();
+            if (match('(')) {
+              base = std::make_shared<MethodCallExpr>(
+                  std::move(base), std::move(member), parse_args());
+            } else {
+              base = std::make_shared<MemberExpr>(std::move(base),
+                                                  std::move(member));
+            }
+            continue;
+          }
+
+          break;
+        }
+        return base;
+      }
+
+      error("Unexpected token: '" + std::string(1, s[pos]) + "'");
+    }
+
+    ExprPtr parse_power() {
+      ExprPtr left = parse_unary();
+      while (match('^')) {
+        left = std::make_shared<BinaryExpr>(BinaryOp::Pow, std::move(left),
+                                            parse_unary());
+      }
+      return left;
     }
 
-    if (!in_single && !in_double) {
-      if (c == '/' && i + 1 < code.size()) {
-        if (code[i + 1] == '/') {
-          // single-line comment
-          i += 1;
-          while (i + 1 < code.size() && code[i + 1] != '\n') ++i;
+    ExprPtr parse_unary() {
+      skip_space();
+      if (match('!')) return std::make_shared<NotExpr>(parse_unary());
+      if (match('&')) {
+        skip_space();
+        if (pos >= s.size() || !is_ident_start(s[pos]))
+          error("Expected identifier after '&'");
+        return std::make_shared<AddressOfExpr>(parse_identifier());
+      }
+      if (match('*')) return std::make_shared<DerefExpr>(parse_unary());
+      return parse_primary();
+    }
+
+    ExprPtr parse_term() {
+      ExprPtr left = parse_power();
+      while (true) {
+        skip_space();
+        if (pos < s.size() &&
+            (s[pos] == '*' || s[pos] == '/' || s[pos] == '%')) {
+          char c = s[pos++];
+          BinaryOp op = c == '*'   ? BinaryOp::Mul
+                        : c == '/' ? BinaryOp::Div
+                                   : BinaryOp::Mod;
+          left = std::make_shared<BinaryExpr>(op, std::move(left),
+                                              parse_power());
           continue;
         }
-        if (code[i + 1] == '*') {
-          in_block = true;
-          ++i;
+        break;
+      }
+      return left;
+    }
+
+    ExprPtr parse_or() {
+      ExprPtr left = parse_and();
+      while (true) {
+        skip_space();
+        if (pos + 1 < s.size() && s[pos] == '|' && s[pos + 1] == '|') {
+          pos += 2;
+          left = std::make_shared<BinaryExpr>(BinaryOp::Or, std::move(left),
+                                              parse_and());
+        } else {
+          break;
+        }
+      }
+      return left;
+    }
+
+    ExprPtr parse_and() {
+      ExprPtr left = parse_comparison();
+      while (true) {
+        skip_space();
+        if (pos + 1 < s.size() && s[pos] == '&' && s[pos + 1] == '&') {
+          pos += 2;
+          left = std::make_shared<BinaryExpr>(BinaryOp::And, std::move(left),
+                                              parse_comparison());
+        } else {
+          break;
+        }
+      }
+      return left;
+    }
+
+    ExprPtr parse_comparison() {
+      ExprPtr left = parse_expr();
+      while (true) {
+        skip_space();
+        BinaryOp op;
+        if (s.compare(pos, 2, "==") == 0) {
+          op = BinaryOp::Eq;
+          pos += 2;
+        } else if (s.compare(pos, 2, "!=") == 0) {
+          op = BinaryOp::Ne;
+          pos += 2;
+        } else if (s.compare(pos, 2, "<=") == 0) {
+          op = BinaryOp::Le;
+          pos += 2;
+        } else if (s.compare(pos, 2, ">=") == 0) {
+          op = BinaryOp::Ge;
+          pos += 2;
+        } else if (pos < s.size() && s[pos] == '<') {
+          op = BinaryOp::Lt;
+          ++pos;
+        } else if (pos < s.size() && s[pos] == '>') {
+          op = BinaryOp::Gt;
+          ++pos;
+        } else {
+          break;
+        }
+        left = std::make_shared<BinaryExpr>(op, std::move(left), parse_expr());
+      }
+      return left;
+    }
+
+    ExprPtr parse_expr() {
+      ExprPtr left = parse_term();
+      while (true) {
+        skip_space();
+        if (pos < s.size() && (s[pos] == '+' || s[pos] == '-')) {
+          BinaryOp op = s[pos++] == '+' ? BinaryOp::Add : BinaryOp::Sub;
+          left = std::make_shared<BinaryExpr>(op, std::move(left),
+                                              parse_term());
           continue;
         }
+        break;
       }
+      return left;
     }
+  };
 
-    out.push_back(c);
-  }
+  Parser p(expr);
+  return p.parse_or();
+}
 
-  return out;
+static ExprPtr compile_expr(std::string_view text, int line_idx,
+                            std::string_view raw_line) {
+  try {
+    return parse_expression(text);
+  } catch (const ParseError &e) {
+    size_t at = raw_line.find(text);
+    int col = at == std::string_view::npos ? -1 : static_cast<int>(at) + e.col;
+    throw_parse_error(line_idx, e.what(), raw_line, col);
+  }
 }
 
-std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
+std::pair<NodeList, int> parse_block(const std::vector<std::string_view> &lines,
                                      int start_idx, int base_indent) {
   int idx = start_idx;
   NodeList nodes;
+  // Nodes are stamped with their line on the pass after the one that
+  // added them, so every `continue` below needs no bookkeeping.
+  size_t stamped = 0;
+  int stmt_line = 0;
+  auto stamp = [&] {
+    for (; stamped < nodes.size(); ++stamped) nodes[stamped]->line = stmt_line;
+  };
 
   while (idx < (int)lines.size()) {
-    const std::string raw_line = lines[idx];
-    std::string line = strip_trailing_semicolon(ltrim(rtrim(raw_line)));
+    stamp();
+    stmt_line = idx + 1;
+    std::string_view raw_line = lines[idx];
+    std::string_view line = strip_trailing_semicolon(trim(raw_line));
 
-    if (line.empty() || line.rfind("#", 0) == 0) {
+    if (line.empty() || line.front() == '#') {
       idx++;
       continue;
     }
@@ -171,14 +582,16 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
 
     /* say */
     if (starts_with(line, "say ")) {
-      nodes.push_back(std::make_shared<Say>(line.substr(4)));
+      nodes.push_back(std::make_shared<Say>(
+          compile_expr(line.substr(4), idx + 1, raw_line)));
       idx++;
       continue;
     }
 
     /* echo */
     if (starts_with(line, "echo ")) {
-      nodes.push_back(std::make_shared<Say>(line.substr(5)));
+      nodes.push_back(std::make_shared<Say>(
+          compile_expr(line.substr(5), idx + 1, raw_line)));
       idx++;
       continue;
     }
@@ -186,55 +599,58 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
     /* ask */
     if (starts_with(line, "ask ")) {
       auto pos = line.find("->");
-      if (pos == std::string::npos)
+      if (pos == std::string_view::npos)
         throw_parse_error(idx + 1, "Invalid ask syntax (expected '->')",
                           raw_line, first_nonspace_col(raw_line));
-      nodes.push_back(std::make_shared<Ask>(ltrim(line.substr(4, pos - 4)),
-                                            ltrim(line.substr(pos + 2))));
+      nodes.push_back(std::make_shared<Ask>(
+          compile_expr(ltrim(line.substr(4, pos - 4)), idx + 1, raw_line),
+          std::string(ltrim(line.substr(pos + 2)))));
       idx++;
       continue;
     }
 
     /* use */
-    if (starts_with(line, "use ") && line.back() == ';') {
-      std::string mod = line.substr(4, line.size() - 5);
-      nodes.push_back(std::make_shared<Import>(mod));
+    if (starts_with(line, "use ")) {
+      std::string_view mod = line.substr(4);
+      if (!mod.empty() && mod.back() == ';') mod.remove_suffix(1);
+      nodes.push_back(std::make_shared<Import>(std::string(mod)));
       idx++;
       continue;
     }
 
     /* require */
     if (starts_with(line, "require ")) {
-      std::string path = line.substr(8);
-      if (!path.empty() && path.back() == ';') path.pop_back();
-      nodes.push_back(std::make_shared<Require>(path));
+      std::string_view path = line.substr(8);
+      if (!path.empty() && path.back() == ';') path.remove_suffix(1);
+      nodes.push_back(std::make_shared<Require>(std::string(path)));
       idx++;
       continue;
     }
 
-    /* return */
-    if (line == "return;") {
-      nodes.push_back(std::make_shared<Return>(std::optional<std::string>{}));
+    /* return (a trailing ';' was already stripped) */
+    if (line == "return") {
+      nodes.push_back(std::make_shared<Return>(nullptr));
       idx++;
       continue;
     }
     if (starts_with(line, "return ")) {
-      std::string expr = line.substr(7);
-      if (!expr.empty() && expr.back() == ';') expr.pop_back();
-      nodes.push_back(std::make_shared<Return>(expr));
+      std::string_view expr = line.substr(7);
+      if (!expr.empty() && expr.back() == ';') expr.remove_suffix(1);
+      nodes.push_back(
+          std::make_shared<Return>(compile_expr(expr, idx + 1, raw_line)));
       idx++;
       continue;
     }
 
     /* if */
     if (starts_with(line, "if (") && line.back() == '{') {
-      std::string cond = line.substr(4, line.size() - 6);
+      ExprPtr cond =
+          compile_expr(line.substr(4, line.size() - 6), idx + 1, raw_line);
       auto [then_block, next] = parse_block(lines, idx + 1, base_indent);
       NodeList else_block;
 
       if (next < (int)lines.size()) {
-        std::string next_line = ltrim(rtrim(lines[next]));
-        if (next_line == "else {") {
+        if (trim(lines[next]) == "else {") {
           auto res = parse_block(lines, next + 1, base_indent);
           else_block = res.first;
           next = res.second;
@@ -248,7 +664,8 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
 
     /* while */
     if (starts_with(line, "while (") && line.back() == '{') {
-      std::string cond = line.substr(7, line.size() - 9);
+      ExprPtr cond =
+          compile_expr(line.substr(7, line.size() - 9), idx + 1, raw_line);
       auto res = parse_block(lines, idx + 1, base_indent);
       nodes.push_back(std::make_shared<While>(cond, res.first));
       idx = res.second;
@@ -260,12 +677,12 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
          starts_with(line, "for (")) &&
         line.back() == '{') {
       size_t start = line.find('(');
-      std::string header = line.substr(start + 1, line.size() - start - 4);
-      std::string iterable;
-      std::string var;
+      std::string_view header = line.substr(start + 1, line.size() - start - 4);
+      std::string_view iterable;
+      std::string_view var;
       if (starts_with(line, "for (")) {
         auto pos = header.find(" in ");
-        if (pos == std::string::npos)
+        if (pos == std::string_view::npos)
           throw_parse_error(idx + 1,
                             "Invalid for syntax (expected 'in' in header)",
                             raw_line, first_nonspace_col(raw_line));
@@ -273,7 +690,7 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
         iterable = header.substr(pos + 4);
       } else {
         auto pos = header.find(" as ");
-        if (pos == std::string::npos)
+        if (pos == std::string_view::npos)
           throw_parse_error(
               idx + 1,
               "Invalid foreach/for-in syntax (expected 'as' in header)",
@@ -281,51 +698,61 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
         iterable = header.substr(0, pos);
         var = header.substr(pos + 4);
       }
+      ExprPtr iterable_expr = compile_expr(trim(iterable), idx + 1, raw_line);
       auto res = parse_block(lines, idx + 1, base_indent);
       nodes.push_back(std::make_shared<ForIn>(
-          ltrim(rtrim(var)), ltrim(rtrim(iterable)), res.first));
+          std::string(trim(var)), std::move(iterable_expr), res.first));
       idx = res.second;
       continue;
     }
 
     /* function */
     if (starts_with(line, "function ") && line.back() == '{') {
-      std::string header_raw = line.substr(9, line.size() - 10);
-      std::string header = ltrim(rtrim(header_raw));
+      std::string_view header = trim(line.substr(9, line.size() - 10));
       auto pos = header.find('(');
-      if (pos == std::string::npos)
+      if (pos == std::string_view::npos)
         throw_parse_error(idx + 1,
                           "Invalid function syntax (expected '(' after name)",
                           raw_line, first_nonspace_col(raw_line));
 
-      std::string name = header.substr(0, pos);
-      std::string params_raw = header.substr(pos + 1, header.size() - pos - 2);
+      std::string name(header.substr(0, pos));
+      std::string_view params_raw =
+          header.substr(pos + 1, header.size() - pos - 2);
 
       std::vector<std::string> params;
-      std::istringstream iss(params_raw);
-      std::string tok;
-      while (std::getline(iss, tok, ',')) {
-        tok = ltrim(rtrim(tok));
-        if (!tok.empty()) params.push_back(tok);
+      while (!params_raw.empty()) {
+        size_t comma = params_raw.find(',');
+        std::string_view tok = trim(params_raw.substr(0, comma));
+        params_raw = comma == std::string_view::npos
+                         ? std::string_view()
+                         : params_raw.substr(comma + 1);
+        if (tok.empty()) continue;
+        if (std::find(params.begin(), params.end(), tok) != params.end())
+          throw_parse_error(idx + 1,
+                            "Duplicate parameter '" + std::string(tok) + "'",
+                            raw_line, first_nonspace_col(raw_line));
+        params.emplace_back(tok);
       }
 
       auto res = parse_block(lines, idx + 1, base_indent);
-      nodes.push_back(std::make_shared<FunctionDef>(name, params, res.first));
+      auto fd = std::make_shared<FunctionDef>(std::move(name), params,
+                                              res.first);
+      resolve_function(*fd);
+      nodes.push_back(std::move(fd));
       idx = res.second;
       continue;
     }
 
     /* class */
     if (starts_with(line, "class ") && line.back() == '{') {
-      std::string header_raw = line.substr(6, line.size() - 7);
-      std::string header = ltrim(rtrim(header_raw));
+      std::string_view header = trim(line.substr(6, line.size() - 7));
       std::optional<std::string> parent;
       std::string name;
 
       auto extends_pos = header.find(" extends ");
-      if (extends_pos != std::string::npos) {
-        name = ltrim(rtrim(header.substr(0, extends_pos)));
-        parent = ltrim(rtrim(header.substr(extends_pos + 9)));
+      if (extends_pos != std::string_view::npos) {
+        name = trim(header.substr(0, extends_pos));
+        parent = std::string(trim(header.substr(extends_pos + 9)));
       } else {
         name = header;
       }
@@ -342,8 +769,7 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
       NodeList except_block;
       int next = try_res.second;
       if (next < (int)lines.size()) {
-        std::string next_line = ltrim(rtrim(lines[next]));
-        if (next_line == "except {") {
+        if (trim(lines[next]) == "except {") {
           auto except_res = parse_block(lines, next + 1, base_indent);
           except_block = except_res.first;
           next = except_res.second;
@@ -358,24 +784,24 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
     }
 
     /* break / continue */
-    if (line == "break;") {
+    if (line == "break") {
       nodes.push_back(std::make_shared<Break>());
       idx++;
       continue;
     }
-    if (line == "continue;") {
+    if (line == "continue") {
       nodes.push_back(std::make_shared<Continue>());
       idx++;
       continue;
     }
 
     /* assignment */
-    if (line.find('=') != std::string::npos &&
-        line.find("==") == std::string::npos) {
+    if (line.find('=') != std::string_view::npos &&
+        line.find("==") == std::string_view::npos) {
       auto pos = line.find('=');
-      std::string left = ltrim(rtrim(line.substr(0, pos)));
-      std::string right = ltrim(rtrim(line.substr(pos + 1)));
-      if (!right.empty() && right.back() == ';') right.pop_back();
+      std::string_view left = trim(line.substr(0, pos));
+      std::string_view right = trim(line.substr(pos + 1));
+      if (!right.empty() && right.back() == ';') right.remove_suffix(1);
 
       bool is_declaration = false;
       if (starts_with(left, "let ")) {
@@ -388,9 +814,9 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
 
       // Check for member assignment (obj.field = value)
       size_t dot_pos = left.find('.');
-      if (dot_pos != std::string::npos) {
-        std::string obj = ltrim(rtrim(left.substr(0, dot_pos)));
-        std::string member = ltrim(rtrim(left.substr(dot_pos + 1)));
+      if (dot_pos != std::string_view::npos) {
+        std::string_view obj = trim(left.substr(0, dot_pos));
+        std::string_view member = trim(left.substr(dot_pos + 1));
 
         // Validate object name
         bool obj_ok = !obj.empty() && (isalpha(obj[0]) || obj[0] == '_');
@@ -404,7 +830,22 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
           if (!(isalnum(c) || c == '_')) mem_ok = false;
 
         if (obj_ok && mem_ok) {
-          nodes.push_back(std::make_shared<MemberAssign>(obj, member, right));
+          nodes.push_back(std::make_shared<MemberAssign>(
+              std::string(obj), std::string(member),
+              compile_expr(right, idx + 1, raw_line)));
+          idx++;
+          continue;
+        }
+      }
+
+      // Index assignment (d[key] = value)
+      if (!is_declaration && !left.empty() && left.back() == ']' &&
+          left.find('[') != std::string_view::npos) {
+        ExprPtr target = compile_expr(left, idx + 1, raw_line);
+        if (target->kind == ExprKind::Index) {
+          auto &ix = static_cast<IndexExpr &>(*target);
+          nodes.push_back(std::make_shared<IndexAssign>(
+              ix.object, ix.index, compile_expr(right, idx + 1, raw_line)));
           idx++;
           continue;
         }
@@ -416,10 +857,13 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
         for (char c : left)
           if (!(isalnum(c) || c == '_')) ok = false;
         if (ok) {
+          ExprPtr value = compile_expr(right, idx + 1, raw_line);
           if (is_declaration) {
-            nodes.push_back(std::make_shared<Declare>(left, right));
+            nodes.push_back(
+                std::make_shared<Declare>(std::string(left), std::move(value)));
           } else {
-            nodes.push_back(std::make_shared<Assign>(left, right));
+            nodes.push_back(
+                std::make_shared<Assign>(std::string(left), std::move(value)));
           }
           idx++;
           continue;
@@ -428,33 +872,34 @@ std::pair<NodeList, int> parse_block(const std::vector<std::string> &lines,
     }
 
     /* function call */
-    if (line.find('(') != std::string::npos && line.back() == ';') {
-      std::string call = line.substr(0, line.size() - 1);
+    if (line.find('(') != std::string_view::npos && line.back() == ';') {
+      std::string_view call = line.substr(0, line.size() - 1);
       auto pos = call.find('(');
-      std::string name = ltrim(rtrim(call.substr(0, pos)));
+      std::string_view name = trim(call.substr(0, pos));
 
       bool ok = !name.empty();
       for (char c : name)
         if (!(isalnum(c) || c == '_')) ok = false;
 
       if (ok) {
-        std::string args_raw = call.substr(pos + 1, call.size() - pos - 2);
-        std::vector<std::string> args;
-        std::istringstream iss(args_raw);
-        std::string tok;
-        while (std::getline(iss, tok, ',')) {
-          tok = ltrim(rtrim(tok));
-          if (!tok.empty()) args.push_back(tok);
+        ExprPtr expr = compile_expr(call, idx + 1, raw_line);
+        auto *ce = dynamic_cast<CallExpr *>(expr.get());
+        if (ce && ce->callee->kind == ExprKind::Name) {
+          nodes.push_back(std::make_shared<FunctionCall>(std::string(name),
+                                                         std::move(ce->args)));
+        } else {
+          nodes.push_back(std::make_shared<ExprStmt>(std::move(expr)));
         }
-        nodes.push_back(std::make_shared<FunctionCall>(name, args));
         idx++;
         continue;
       }
     }
 
-    nodes.push_back(std::make_shared<ExprStmt>(line));
+    nodes.push_back(
+        std::make_shared<ExprStmt>(compile_expr(line, idx + 1, raw_line)));
     idx++;
   }
+  stamp();
 
   return {nodes, idx};
 }
@@ -0,0 +1,192 @@
+#include "bloa/profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bloa {
+
+namespace profiler {
+
+struct Stats {
+  uint64_t count = 0;
+  Clock::duration total{};
+  Clock::duration self{};
+  int depth = 0;  // active calls; recursion adds to `total` only once
+};
+
+namespace {
+
+struct Frame {
+  std::string name;
+  Clock::time_point start;
+  Clock::duration nested{};
+  size_t key_length;  // of `stack_key` up to and including this frame
+};
+
+// Touched only by the thread that called enable().
+Clock::time_point started;
+std::vector<Frame> calls;
+std::string stack_key;
+std::unordered_map<std::string, Stats> functions;
+std::map<std::pair<std::string, int>, Stats> lines;
+std::unordered_map<const char *, Stats> builtins;
+std::map<std::string, Clock::duration> stacks;
+LineProbe *current_line = nullptr;
+uint64_t scopes_allocated = 0;
+uint64_t scopes_reused = 0;
+uint64_t exceptions = 0;
+
+double ms(Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+template <typename Map>
+std::vector<typename Map::const_iterator> by_self_time(const Map &map) {
+  std::vector<typename Map::const_iterator> order;
+  order.reserve(map.size());
+  for (auto it = map.begin(); it != map.end(); ++it) order.push_back(it);
+  std::sort(order.begin(), order.end(), [](auto a, auto b) {
+    return a->second.self > b->second.self;
+  });
+  return order;
+}
+
+// Self time of the top-level code so far; <main> never exits.
+Clock::duration main_self() {
+  return Clock::now() - calls.front().start - calls.front().nested;
+}
+
+}  // namespace
+
+void enable() {
+  active = true;
+  started = Clock::now();
+  stack_key = "<main>";
+  calls.push_back({stack_key, started, {}, stack_key.size()});
+}
+
+void enter_function(const std::string &name) {
+  stack_key.push_back(';');
+  stack_key.append(name);
+  calls.push_back({name, Clock::now(), {}, stack_key.size()});
+  Stats &stats = functions[name];
+  ++stats.count;
+  ++stats.depth;
+}
+
+void exit_function() {
+  Frame &frame = calls.back();
+  Clock::duration total = Clock::now() - frame.start;
+  Clock::duration self = total - frame.nested;
+  Stats &stats = functions[frame.name];
+  stats.self += self;
+  if (--stats.depth == 0) stats.total += total;
+  stacks[stack_key] += self;
+  calls.pop_back();
+  stack_key.resize(calls.back().key_length);
+  calls.back().nested += total;
+}
+
+void LineProbe::begin() {
+  stats_ = &lines[{calls.back().name, line_}];
+  ++stats_->depth;
+  parent_ = current_line;
+  current_line = this;
+  start_ = Clock::now();
+}
+
+void LineProbe::end() {
+  Clock::duration total = Clock::now() - start_;
+  ++stats_->count;
+  if (--stats_->depth == 0) stats_->total += total;
+  stats_->self += total - nested_;
+  current_line = parent_;
+  if (parent_) parent_->nested_ += total;
+}
+
+void count_builtin(const char *name, Clock::duration time) {
+  Stats &stats = builtins[name];
+  ++stats.count;
+  stats.total += time;
+  stats.self += time;
+}
+
+void count_scope(bool reused) { ++(reused ? scopes_reused : scopes_allocated); }
+
+void count_exception() { ++exceptions; }
+
+void write_report(std::ostream &out) {
+  char row[256];
+  std::snprintf(row, sizeof(row), "== bloa profile: %.3f ms ==\n",
+                ms(Clock::now() - started));
+  out << row;
+
+  out << "\nFunctions by self time\n";
+  std::snprintf(row, sizeof(row), "%10s %12s %12s  %s\n", "calls", "total ms",
+                "self ms", "function");
+  out << row;
+  std::snprintf(row, sizeof(row), "%10d %12.3f %12.3f  %s\n", 1,
+                ms(Clock::now() - started), ms(main_self()), "<main>");
+  out << row;
+  for (auto it : by_self_time(functions)) {
+    std::snprintf(row, sizeof(row), "%10llu %12.3f %12.3f  ",
+                  static_cast<unsigned long long>(it->second.count),
+                  ms(it->second.total), ms(it->second.self));
+    out << row << it->first << "\n";
+  }
+
+  constexpr size_t kTopLines = 40;
+  out << "\nLines by self time (top " << kTopLines << ")\n";
+  std::snprintf(row, sizeof(row), "%10s %12s %12s  %s\n", "hits", "total ms",
+                "self ms", "function:line");
+  out << row;
+  auto line_order = by_self_time(lines);
+  if (line_order.size() > kTopLines) line_order.resize(kTopLines);
+  for (auto it : line_order) {
+    std::snprintf(row, sizeof(row), "%10llu %12.3f %12.3f  ",
+                  static_cast<unsigned long long>(it->second.count),
+                  ms(it->second.total), ms(it->second.self));
+    out << row << it->first.first << ":" << it->first.second << "\n";
+  }
+
+  out << "\nBuiltins by time\n";
+  std::snprintf(row, sizeof(row), "%10s %12s  %s\n", "calls", "time ms",
+                "builtin");
+  out << row;
+  for (auto it : by_self_time(builtins)) {
+    std::snprintf(row, sizeof(row), "%10llu %12.3f  %s\n",
+                  static_cast<unsigned long long>(it->second.count),
+                  ms(it->second.total), it->first);
+    out << row;
+  }
+
+  out << "\nInterpreter counters\n";
+  std::snprintf(row, sizeof(row),
+                "%10llu  scopes allocated\n%10llu  scopes reused\n"
+                "%10llu  exceptions caught\n",
+                static_cast<unsigned long long>(scopes_allocated),
+                static_cast<unsigned long long>(scopes_reused),
+                static_cast<unsigned long long>(exceptions));
+  out << row;
+}
+
+bool write_collapsed_stacks(const std::string &path) {
+  std::ofstream out(path);
+  if (!out) return false;
+  auto micros = [](Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+  out << "<main> " << micros(main_self()) << "\n";
+  for (const auto &[stack, self] : stacks)
+    out << stack << " " << micros(self) << "\n";
+  return static_cast<bool>(out);
+}
+
+}  // namespace profiler
+
+}  // namespace bloa
@@ -0,0 +1,325 @@
+#include "bloa/resolver.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "bloa/stdlib.hpp"
+
+namespace bloa {
+
+namespace {
+
+// Mirrors the environment chain the interpreter builds: one scope for a
+// function call, plus one for every if/else branch, loop body, try or except
+// block that binds a name. Blocks that bind nothing get no layout and run
+// directly in the enclosing Environment.
+class Resolver {
+ public:
+  void function(FunctionDef &fn) {
+    fn.scope = open_scope(fn.params, fn.block);
+    statements(fn.block);
+    close_scope();
+  }
+
+  // Top-level code binds into the caller's Environment by name; only the
+  // blocks below it get layouts.
+  void program(const NodeList &nodes) { statements(nodes); }
+
+ private:
+  struct Scope {
+    std::shared_ptr<ScopeLayout> layout;
+    std::unordered_map<std::string, int16_t> slots;
+  };
+
+  std::vector<Scope> scopes;
+
+  static bool is_constant(const std::string &name) {
+    return name == "true" || name == "false" || name == "none";
+  }
+
+  // Innermost binding of `name`, counting hops from the current scope.
+  SlotRef lookup(const std::string &name) const {
+    for (int i = static_cast<int>(scopes.size()) - 1; i >= 0; --i) {
+      auto it = scopes[i].slots.find(name);
+      if (it != scopes[i].slots.end()) {
+        int hops = static_cast<int>(scopes.size()) - 1 - i;
+        return SlotRef{static_cast<int16_t>(hops), it->second};
+      }
+    }
+    return SlotRef{};
+  }
+
+  static void collect(const NodeList &block, std::vector<std::string> &out) {
+    for (const auto &node : block) {
+      if (auto a = std::dynamic_pointer_cast<Assign>(node))
+        out.push_back(a->name);
+      else if (auto d = std::dynamic_pointer_cast<Declare>(node))
+        out.push_back(d->name);
+      else if (auto ask = std::dynamic_pointer_cast<Ask>(node))
+        out.push_back(ask->var);
+    }
+  }
+
+  // Statements that bind names the resolver cannot see (module names,
+  // classes, required code) still need a scope of their own.
+  static bool binds_dynamically(const NodeList &block) {
+    for (const auto &node : block) {
+      if (std::dynamic_pointer_cast<Import>(node) ||
+          std::dynamic_pointer_cast<Require>(node) ||
+          std::dynamic_pointer_cast<ClassDef>(node))
+        return true;
+    }
+    return false;
+  }
+
+  // Pushes a scope holding `bound` plus every name assigned directly in
+  // `block`. Each slot records where its name resolves while unbound.
+  ScopeLayoutPtr open_scope(std::vector<std::string> bound,
+                            const NodeList &block) {
+    collect(block, bound);
+    Scope scope;
+    scope.layout = std::make_shared<ScopeLayout>();
+    for (const auto &name : bound) {
+      if (is_constant(name) || scope.slots.count(name)) continue;
+      if (scope.layout->names.size() >=
+          static_cast<size_t>(std::numeric_limits<int16_t>::max()))
+        throw std::runtime_error("Too many local variables in one scope");
+      SlotRef outer = lookup(name);
+      if (outer.resolved()) ++outer.hops;
+      scope.slots.emplace(name,
+                          static_cast<int16_t>(scope.layout->names.size()));
+      scope.layout->names.push_back(name);
+      scope.layout->outer.push_back(outer);
+    }
+    scopes.push_back(std::move(scope));
+    return scopes.back().layout;
+  }
+
+  void close_scope() { scopes.pop_back(); }
+
+  ScopeLayoutPtr block(const NodeList &nodes) {
+    std::vector<std::string> bound;
+    collect(nodes, bound);
+    if (bound.empty() && !binds_dynamically(nodes)) {
+      statements(nodes);
+      return nullptr;
+    }
+    ScopeLayoutPtr layout = open_scope({}, nodes);
+    statements(nodes);
+    close_scope();
+    return layout;
+  }
+
+  void exprs(const ExprList &list) {
+    for (const auto &e : list) expr(*e);
+  }
+
+  // A variable handed to an in-place builtin (`append(rows, row)`) is
+  // passed as a reference to its binding, so the builtin updates the
+  // caller's list instead of a copy of it. Whether the script defines its
+  // own function of that name is only known when the call runs, so the
+  // reference records the builtin it was made for.
+  static void pass_by_reference(const std::string &callee, ExprList &args) {
+    if (args.empty() || args[0]->kind != ExprKind::Name) return;
+    const BuiltinFunction *fn = find_builtin(callee);
+    if (!fn || !fn->in_place) return;
+    const auto &name = static_cast<const NameExpr &>(*args[0]).name;
+    if (!is_constant(name))
+      args[0] = std::make_shared<AddressOfExpr>(name, callee);
+  }
+
+  // True when evaluating `e` runs no user code, so cannot assign to any
+  // variable: no method calls or constructors, and calls only to builtins
+  // that are not in-place and not shadowed by a local.
+  bool runs_no_user_code(const Expr &e) const {
+    switch (e.kind) {
+      case ExprKind::Literal:
+      case ExprKind::Name:
+      case ExprKind::AddressOf:
+        return true;
+      case ExprKind::List:
+        for (const auto &el : static_cast<const ListExpr &>(e).elements)
+          if (!runs_no_user_code(*el)) return false;
+        return true;
+      case ExprKind::Dict: {
+        const auto &d = static_cast<const DictExpr &>(e);
+        for (size_t i = 0; i < d.keys.size(); ++i)
+          if (!runs_no_user_code(*d.keys[i]) ||
+              !runs_no_user_code(*d.values[i]))
+            return false;
+        return true;
+      }
+      case ExprKind::Not:
+        return runs_no_user_code(*static_cast<const NotExpr &>(e).operand);
+      case ExprKind::Deref:
+        return runs_no_user_code(*static_cast<const DerefExpr &>(e).operand);
+      case ExprKind::Binary: {
+        const auto &b = static_cast<const BinaryExpr &>(e);
+        return runs_no_user_code(*b.left) && runs_no_user_code(*b.right);
+      }
+      case ExprKind::Member:
+        return runs_no_user_code(*static_cast<const MemberExpr &>(e).object);
+      case ExprKind::Index: {
+        const auto &ix = static_cast<const IndexExpr &>(e);
+        return runs_no_user_code(*ix.object) && runs_no_user_code(*ix.index);
+      }
+      case ExprKind::Call: {
+        const auto &c = static_cast<const CallExpr &>(e);
+        if (c.callee->kind != ExprKind::Name) return false;
+        const auto &name = static_cast<const NameExpr &>(*c.callee).name;
+        const BuiltinFunction *fn = find_builtin(name);
+        if (!fn || fn->in_place || lookup(name).resolved()) return false;
+        for (const auto &arg : c.args)
+          if (!runs_no_user_code(*arg)) return false;
+        return true;
+      }
+      case ExprKind::MethodCall:
+      case ExprKind::New:
+        return false;
+    }
+    return false;
+  }
+
+  bool is_append(const Assign &asg) const {
+    const Expr *e = asg.expr.get();
+    if (e->kind != ExprKind::Binary || is_constant(asg.name)) return false;
+    while (e->kind == ExprKind::Binary) {
+      const auto &add = static_cast<const BinaryExpr &>(*e);
+      if (add.op != BinaryOp::Add || !runs_no_user_code(*add.right))
+        return false;
+      e = add.left.get();
+    }
+    return e->kind == ExprKind::Name &&
+           static_cast<const NameExpr &>(*e).name == asg.name;
+  }
+
+  void expr(Expr &e) {
+    switch (e.kind) {
+      case ExprKind::Literal:
+      case ExprKind::AddressOf:
+        return;
+      case ExprKind::List:
+        exprs(static_cast<ListExpr &>(e).elements);
+        return;
+      case ExprKind::Name: {
+        auto &n = static_cast<NameExpr &>(e);
+        n.slot = lookup(n.name);
+        return;
+      }
+      case ExprKind::Not:
+        expr(*static_cast<NotExpr &>(e).operand);
+        return;
+      case ExprKind::Deref:
+        expr(*static_cast<DerefExpr &>(e).operand);
+        return;
+      case ExprKind::Binary: {
+        auto &b = static_cast<BinaryExpr &>(e);
+        expr(*b.left);
+        expr(*b.right);
+        return;
+      }
+      case ExprKind::Call: {
+        auto &c = static_cast<CallExpr &>(e);
+        if (c.callee->kind == ExprKind::Name)
+          pass_by_reference(static_cast<NameExpr &>(*c.callee).name, c.args);
+        expr(*c.callee);
+        exprs(c.args);
+        return;
+      }
+      case ExprKind::Member:
+        expr(*static_cast<MemberExpr &>(e).object);
+        return;
+      case ExprKind::MethodCall: {
+        auto &m = static_cast<MethodCallExpr &>(e);
+        expr(*m.object);
+        exprs(m.args);
+        return;
+      }
+      case ExprKind::Index: {
+        auto &ix = static_cast<IndexExpr &>(e);
+        expr(*ix.object);
+        expr(*ix.index);
+        return;
+      }
+      case ExprKind::New:
+        exprs(static_cast<NewExpr &>(e).args);
+        return;
+      case ExprKind::Dict: {
+        auto &d = static_cast<DictExpr &>(e);
+        exprs(d.keys);
+        exprs(d.values);
+        return;
+      }
+    }
+  }
+
+  void statements(const NodeList &nodes) {
+    for (const auto &node : nodes) statement(node);
+  }
+
+  void statement(const NodePtr &node) {
+    if (auto s = std::dynamic_pointer_cast<Say>(node)) {
+      expr(*s->expr);
+    } else if (auto a = std::dynamic_pointer_cast<Ask>(node)) {
+      expr(*a->prompt);
+      a->slot = lookup(a->var);
+    } else if (auto decl = std::dynamic_pointer_cast<Declare>(node)) {
+      expr(*decl->expr);
+      decl->slot = lookup(decl->name);
+    } else if (auto asg = std::dynamic_pointer_cast<Assign>(node)) {
+      expr(*asg->expr);
+      asg->slot = lookup(asg->name);
+      asg->append = is_append(*asg);
+    } else if (auto masg = std::dynamic_pointer_cast<MemberAssign>(node)) {
+      masg->object_slot = lookup(masg->object);
+      expr(*masg->expr);
+    } else if (auto iasg = std::dynamic_pointer_cast<IndexAssign>(node)) {
+      expr(*iasg->object);
+      expr(*iasg->index);
+      expr(*iasg->expr);
+    } else if (auto iff = std::dynamic_pointer_cast<If>(node)) {
+      expr(*iff->cond);
+      iff->then_scope = block(iff->then_block);
+      if (!iff->else_block.empty()) iff->else_scope = block(iff->else_block);
+    } else if (auto rep = std::dynamic_pointer_cast<Repeat>(node)) {
+      expr(*rep->times_expr);
+      rep->scope = open_scope({"count"}, rep->block);
+      rep->count_slot = lookup("count");
+      statements(rep->block);
+      close_scope();
+    } else if (auto fc = std::dynamic_pointer_cast<FunctionCall>(node)) {
+      pass_by_reference(fc->name, fc->args);
+      exprs(fc->args);
+      fc->slot = lookup(fc->name);
+    } else if (auto ret = std::dynamic_pointer_cast<Return>(node)) {
+      if (ret->expr) expr(*ret->expr);
+    } else if (auto ex = std::dynamic_pointer_cast<ExprStmt>(node)) {
+      expr(*ex->expr);
+    } else if (auto wh = std::dynamic_pointer_cast<While>(node)) {
+      expr(*wh->cond);
+      wh->scope = block(wh->block);
+    } else if (auto fin = std::dynamic_pointer_cast<ForIn>(node)) {
+      expr(*fin->iterable);
+      fin->scope = open_scope({fin->var}, fin->block);
+      fin->var_slot = lookup(fin->var);
+      statements(fin->block);
+      close_scope();
+    } else if (auto te = std::dynamic_pointer_cast<TryExcept>(node)) {
+      te->try_scope = block(te->try_block);
+      if (!te->except_block.empty())
+        te->except_scope = block(te->except_block);
+    }
+    // FunctionDef and ClassDef bodies were resolved when they were parsed;
+    // Import, Require, Break and Continue reference no locals.
+  }
+};
+
+}  // namespace
+
+void resolve_function(FunctionDef &fn) { Resolver().function(fn); }
+
+void resolve_program(const NodeList &nodes) { Resolver().program(nodes); }
+
+}  // namespace bloa
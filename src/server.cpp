@@ -0,0 +1,326 @@
+#include "bloa/server.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "bloa/interpreter.hpp"
+#include "bloa/output.hpp"
+
+namespace bloa {
+
+namespace {
+
+volatile sig_atomic_t stopping = 0;
+
+void on_stop(int) { stopping = 1; }
+
+struct Request {
+  std::string flags;
+  std::string cwd;
+  std::string script;
+  std::vector<std::string> env;
+  std::string source;
+  int fds[3] = {-1, -1, -1};
+
+  bool has(char flag) const { return flags.find(flag) != std::string::npos; }
+};
+
+bool read_request(int conn, Request &req) {
+  std::string data;
+  char buf[1 << 16];
+  bool first = true;
+  while (true) {
+    ssize_t n;
+    if (first) {
+      alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+      iovec iov{buf, sizeof(buf)};
+      msghdr msg{};
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+      if (n > 0) {
+        first = false;
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+          if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+          size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          std::memcpy(req.fds, CMSG_DATA(c),
+                      std::min<size_t>(count, 3) * sizeof(int));
+        }
+      }
+    } else {
+      n = read(conn, buf, sizeof(buf));
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (n == 0) break;
+    data.append(buf, static_cast<size_t>(n));
+  }
+
+  size_t pos = 0;
+  auto field = [&](std::string &out) {
+    size_t end = data.find('\0', pos);
+    if (end == std::string::npos) return false;
+    out.assign(data, pos, end - pos);
+    pos = end + 1;
+    return true;
+  };
+  std::string magic, count;
+  if (!field(magic) || magic != kServeMagic || !field(req.flags) ||
+      !field(req.cwd) || !field(req.script) || !field(count))
+    return false;
+  req.env.resize(std::strtoul(count.c_str(), nullptr, 10));
+  for (auto &entry : req.env)
+    if (!field(entry)) return false;
+  req.source = data.substr(pos);
+  return req.fds[0] >= 0 && req.fds[1] >= 0 && req.fds[2] >= 0;
+}
+
+// Runs in the forked child. Takes over the client's descriptors, cwd and
+// environment, runs the script in `interp`, and writes the paths of the
+// sources it parsed to `report` for the daemon to warm.
+int run_request(int conn, int report, Interpreter &interp) {
+  Request req;
+  if (!read_request(conn, req)) return 2;
+  for (int fd = 0; fd < 3; ++fd) {
+    if (req.fds[fd] == fd) continue;
+    dup2(req.fds[fd], fd);
+    close(req.fds[fd]);
+  }
+  if (chdir(req.cwd.c_str()) != 0) {
+    std::cerr << "Unable to enter " << req.cwd << ": " << std::strerror(errno)
+              << std::endl;
+    return 1;
+  }
+  clearenv();
+  for (const auto &entry : req.env) {
+    size_t eq = entry.find('=');
+    if (eq != std::string::npos && eq > 0)
+      setenv(entry.substr(0, eq).c_str(), entry.c_str() + eq + 1, 1);
+  }
+
+  set_output_buffered(!req.has('u') && !isatty(STDOUT_FILENO));
+  interp.set_vm_enabled(req.has('v'));
+  int status = 0;
+  try {
+    if (req.has('s'))
+      interp.run(req.source, req.script);
+    else
+      interp.run_file(req.script);
+  } catch (const std::exception &e) {
+    flush_output();
+    std::cerr << e.what() << std::endl;
+    status = 1;
+  }
+  flush_output();
+
+  std::string paths;
+  for (const auto &path : interp.used_paths()) paths += path + '\n';
+  write_all(report, paths.data(), paths.size());
+  return status;
+}
+
+// The sources kept parsed in the daemon, most recently used first. The
+// count is capped, so a daemon running generated one-off scripts does not
+// grow without bound.
+class WarmSources {
+ public:
+  static constexpr size_t kMaxSources = 256;
+
+  explicit WarmSources(Interpreter &warm) : warm(warm) {}
+
+  void use(const std::string &path) {
+    auto it = by_path.find(path);
+    if (it != by_path.end()) order.erase(it->second);
+    order.push_front(path);
+    by_path[path] = order.begin();
+    warm.preload(path);
+    while (order.size() > kMaxSources) {
+      warm.forget(order.back());
+      by_path.erase(order.back());
+      order.pop_back();
+    }
+  }
+
+ private:
+  Interpreter &warm;
+  std::list<std::string> order;
+  std::unordered_map<std::string, std::list<std::string>::iterator> by_path;
+};
+
+struct Child {
+  pid_t pid;
+  int conn;
+  int report;
+  std::string paths;  // reported so far
+};
+
+// Reaps a request whose report has ended, replies with its status, and
+// parses what it loaded into `warm`.
+void finish(Child &child, WarmSources &warm) {
+  int status = 0;
+  while (waitpid(child.pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  int32_t code = WIFEXITED(status)     ? WEXITSTATUS(status)
+                 : WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                       : 1;
+  write_all(child.conn, reinterpret_cast<const char *>(&code), sizeof(code));
+  close(child.conn);
+  close(child.report);
+  size_t start = 0;
+  for (size_t end; (end = child.paths.find('\n', start)) != std::string::npos;
+       start = end + 1)
+    warm.use(child.paths.substr(start, end - start));
+}
+
+}  // namespace
+
+int serve(const std::string &socket_path, const std::string &cache_dir) {
+  sockaddr_un addr;
+  if (!socket_address(socket_path, addr)) return 1;
+  const auto *sa = reinterpret_cast<const sockaddr *>(&addr);
+  // A socket file nobody answers on is left over from a server that died.
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool live = probe >= 0 && connect(probe, sa, sizeof(addr)) == 0;
+  if (probe >= 0) close(probe);
+  if (live) {
+    std::cerr << "A bloa server is already listening on " << socket_path
+              << std::endl;
+    return 1;
+  }
+  struct stat st;
+  if (lstat(socket_path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      std::cerr << "Not a socket: " << socket_path << std::endl;
+      return 1;
+    }
+    unlink(socket_path.c_str());
+  }
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    std::cerr << "socket: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  // Set through the umask, so the socket is never connectable by others.
+  mode_t old_mask = umask(0177);
+  bool bound = bind(listener, sa, sizeof(addr)) == 0;
+  umask(old_mask);
+  if (!bound || listen(listener, SOMAXCONN) != 0) {
+    std::cerr << "Unable to listen on " << socket_path << ": "
+              << std::strerror(errno) << std::endl;
+    close(listener);
+    return 1;
+  }
+
+  struct sigaction stop {};
+  stop.sa_handler = on_stop;
+  sigaction(SIGINT, &stop, nullptr);
+  sigaction(SIGTERM, &stop, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  auto warm = std::make_unique<Interpreter>("");
+  warm->set_cache_dir(cache_dir);
+  WarmSources sources(*warm);
+  std::cerr << "bloa: serving on " << socket_path << std::endl;
+
+  std::vector<Child> children;
+  std::vector<pollfd> fds;
+  while (!stopping) {
+    fds.assign(1, pollfd{listener, POLLIN, 0});
+    for (const auto &child : children)
+      fds.push_back(pollfd{child.report, POLLIN, 0});
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "poll: " << std::strerror(errno) << std::endl;
+      break;
+    }
+
+    for (size_t i = children.size(); i-- > 0;) {
+      if (!fds[i + 1].revents) continue;
+      Child &child = children[i];
+      char buf[4096];
+      ssize_t n = read(child.report, buf, sizeof(buf));
+      if (n > 0) {
+        child.paths.append(buf, static_cast<size_t>(n));
+      } else if (n == 0 || errno != EINTR) {
+        finish(child, sources);
+        children.erase(children.begin() + static_cast<std::ptrdiff_t>(i));
+      }
+    }
+
+    if (!(fds[0].revents & POLLIN)) continue;
+    int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0) continue;
+    if (!peer_is_self(conn)) {
+      close(conn);
+      continue;
+    }
+    int report[2];
+    if (pipe2(report, O_CLOEXEC) != 0) {
+      close(conn);
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listener);
+      close(report[0]);
+      for (const auto &child : children) {
+        close(child.conn);
+        close(child.report);
+      }
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      int status = run_request(conn, report[1], *warm);
+      // Tasks the script spawned and never awaited finish here, as they
+      // do when bloa exits.
+      warm.reset();
+      flush_output();
+      _exit(status);
+    }
+    close(report[1]);
+    if (pid < 0) {
+      close(report[0]);
+      close(conn);
+      continue;
+    }
+    children.push_back(Child{pid, conn, report[0], {}});
+  }
+
+  // Let running requests finish before going away.
+  for (auto &child : children) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(child.report, buf, sizeof(buf))) > 0 ||
+           (n < 0 && errno == EINTR))
+      if (n > 0) child.paths.append(buf, static_cast<size_t>(n));
+    finish(child, sources);
+  }
+  close(listener);
+  unlink(socket_path.c_str());
+  return 0;
+}
+
+}  // namespace bloa
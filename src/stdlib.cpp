@@ -1,12 +1,16 @@
 #include "bloa/stdlib.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <charconv>
 #include <cctype>
 #include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <list>
+#include <mutex>
 #include <set>
 #include <thread>
 #include <unordered_set>
@@ -20,6 +24,7 @@
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <random>
 #ifdef BLOA_USE_SQLITE
 #include <sqlite3.h>
@@ -27,6 +32,18 @@
 #include <iomanip>
 #include <regex>
 #include <sstream>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bloa/archive.hpp"
+#include "bloa/array.hpp"
+#include "bloa/dict.hpp"
+#include "bloa/int_math.hpp"
+#include "bloa/output.hpp"
+#include "bloa/profiler.hpp"
 
 namespace fs = std::filesystem;
 
@@ -50,7 +67,7 @@ static std::string value_to_string(const Value &v) {
     return std::to_string(std::get<int64_t>(v.v));
   if (std::holds_alternative<double>(v.v)) {
     double d = std::get<double>(v.v);
-    if (std::floor(d) == d) {
+    if (std::floor(d) == d && std::fabs(d) < 1e18) {
       return std::to_string(static_cast<int64_t>(d));
     }
     return std::to_string(d);
@@ -59,9 +76,9 @@ static std::string value_to_string(const Value &v) {
     return std::get<std::string>(v.v);
   if (std::holds_alternative<bool>(v.v))
     return std::get<bool>(v.v) ? "true" : "false";
-  if (std::holds_alternative<std::vector<Value>>(v.v)) {
+  if (std::holds_alternative<List>(v.v)) {
     std::string out = "[";
-    const auto &list = std::get<std::vector<Value>>(v.v);
+    const auto &list = std::get<List>(v.v);
     for (size_t i = 0; i < list.size(); ++i) {
       if (i > 0) out += ", ";
       out += value_to_string(list[i]);
@@ -69,18 +86,18 @@ static std::string value_to_string(const Value &v) {
     out += "]";
     return out;
   }
+  if (v.is_builtin()) return v.to_string();
   return "<unknown>";
 }
 
 static const std::vector<Value> &as_list(const Value &v) {
-  return std::get<std::vector<Value>>(v.v);
+  return std::get<List>(v.v).items();
 }
 
 static Value copy_value(const Value &v);
-static void skip_json_ws(const std::string &s, size_t &pos);
-static std::string parse_json_string(const std::string &s, size_t &pos);
-static Value parse_json_value(const std::string &s, size_t &pos);
-static std::string json_stringify_value(const Value &v);
+static void skip_json_ws(std::string_view s, size_t &pos);
+static Value parse_json_value(std::string_view s, size_t &pos);
+static void json_write_value(const Value &v, std::string &out);
 static std::string base64_encode(const std::string &data);
 static std::string base64_decode(const std::string &data);
 static std::string uuid4();
@@ -95,8 +112,8 @@ static std::vector<Value> copy_list(const std::vector<Value> &list) {
 }
 
 static Value copy_value(const Value &v) {
-  if (std::holds_alternative<std::vector<Value>>(v.v)) {
-    return Value::make_list(copy_list(std::get<std::vector<Value>>(v.v)));
+  if (std::holds_alternative<List>(v.v)) {
+    return Value::make_list(copy_list(std::get<List>(v.v).items()));
   }
   if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v)) {
     const auto &obj = std::get<std::shared_ptr<ObjectInstance>>(v.v);
@@ -105,7 +122,15 @@ static Value copy_value(const Value &v) {
       auto value_opt = obj->properties->get_local(name);
       if (value_opt) props->set_local(name, *value_opt);
     }
-    return Value::make_object(obj->class_name, std::move(props));
+    return Value::make_object(obj->class_name, std::move(props), obj->klass);
+  }
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&v.v)) {
+    auto copy = std::make_shared<Dict>();
+    copy->reserve((*dict)->size());
+    (*dict)->for_each([&](const Value &key, const Value &value) {
+      copy->set(key, copy_value(value));
+    });
+    return Value::make_dict(std::move(copy));
   }
   if (std::holds_alternative<std::shared_ptr<Reference>>(v.v)) {
     const auto &ref = std::get<std::shared_ptr<Reference>>(v.v);
@@ -124,71 +149,145 @@ static size_t curl_write_callback(void *contents, size_t size, size_t nmemb,
 }
 #endif
 
-#ifdef BLOA_USE_SQLITE
-static void sqlite_throw_if_error(int result, sqlite3 *db) {
-  if (result != SQLITE_OK) {
-    std::string err = sqlite3_errmsg(db);
-    sqlite3_close(db);
-    throw std::runtime_error("SQLite error: " + err);
+// Whitespace runs (indentation in pretty-printed input) are skipped 16
+// bytes at a time with SSE2, falling back to std::isspace for the rest.
+static void skip_json_ws(std::string_view s, size_t &pos) {
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  while (pos + 16 <= s.size()) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + pos));
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+        _mm_or_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(block, lf)));
+    unsigned other = ~static_cast<unsigned>(_mm_movemask_epi8(ws)) & 0xFFFF;
+    if (other) {
+      pos += std::countr_zero(other);
+      break;
+    }
+    pos += 16;
+  }
+#endif
+  while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos]))) {
+    ++pos;
   }
 }
+
+// Offset of the first `"` or `\` in `s`, or s.size().
+static size_t json_scan_string(std::string_view s) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + i));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash))));
+    if (mask) return i + std::countr_zero(mask);
+  }
 #endif
+  for (; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') return i;
+  }
+  return s.size();
+}
 
-static const std::string archive_magic = "BLOAARCHIVE\n";
+static unsigned parse_json_hex4(std::string_view s, size_t &pos) {
+  if (pos + 4 > s.size()) throw std::runtime_error("Invalid JSON escape");
+  unsigned code = 0;
+  auto [end, ec] =
+      std::from_chars(s.data() + pos, s.data() + pos + 4, code, 16);
+  if (ec != std::errc() || end != s.data() + pos + 4)
+    throw std::runtime_error("Invalid JSON escape");
+  pos += 4;
+  return code;
+}
 
-static void skip_json_ws(const std::string &s, size_t &pos) {
-  while (pos < s.size() && std::isspace(static_cast<unsigned char>(s[pos]))) {
-    ++pos;
+static void append_utf8(std::string &out, unsigned code) {
+  if (code < 0x80) {
+    out.push_back(static_cast<char>(code));
+  } else if (code < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+  } else if (code < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
   }
 }
 
-static std::string parse_json_string(const std::string &s, size_t &pos) {
+// Unescaped runs are copied in one append; only escapes are handled a
+// character at a time.
+static std::string parse_json_string(std::string_view s, size_t &pos) {
   if (pos >= s.size() || s[pos] != '"')
     throw std::runtime_error("Invalid JSON string");
   ++pos;
   std::string result;
   while (pos < s.size()) {
+    size_t run = json_scan_string(s.substr(pos));
+    result.append(s.data() + pos, run);
+    pos += run;
+    if (pos >= s.size()) break;
     char c = s[pos++];
     if (c == '"') return result;
-    if (c == '\\') {
-      if (pos >= s.size()) throw std::runtime_error("Invalid JSON escape");
-      char esc = s[pos++];
-      switch (esc) {
-        case '"':
-          result.push_back('"');
-          break;
-        case '\\':
-          result.push_back('\\');
-          break;
-        case '/':
-          result.push_back('/');
-          break;
-        case 'b':
-          result.push_back('\b');
-          break;
-        case 'f':
-          result.push_back('\f');
-          break;
-        case 'n':
-          result.push_back('\n');
-          break;
-        case 'r':
-          result.push_back('\r');
-          break;
-        case 't':
-          result.push_back('\t');
-          break;
-        default:
-          throw std::runtime_error("Unsupported JSON escape sequence");
+    if (pos >= s.size()) throw std::runtime_error("Invalid JSON escape");
+    char esc = s[pos++];
+    switch (esc) {
+      case '"':
+        result.push_back('"');
+        break;
+      case '\\':
+        result.push_back('\\');
+        break;
+      case '/':
+        result.push_back('/');
+        break;
+      case 'b':
+        result.push_back('\b');
+        break;
+      case 'f':
+        result.push_back('\f');
+        break;
+      case 'n':
+        result.push_back('\n');
+        break;
+      case 'r':
+        result.push_back('\r');
+        break;
+      case 't':
+        result.push_back('\t');
+        break;
+      case 'u': {
+        unsigned code = parse_json_hex4(s, pos);
+        if (code >= 0xD800 && code < 0xDC00 && pos + 1 < s.size() &&
+            s[pos] == '\\' && s[pos + 1] == 'u') {
+          size_t low_pos = pos + 2;
+          unsigned low = parse_json_hex4(s, low_pos);
+          if (low >= 0xDC00 && low < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            pos = low_pos;
+          }
+        }
+        append_utf8(result, code);
+        break;
       }
-    } else {
-      result.push_back(c);
+      default:
+        throw std::runtime_error("Unsupported JSON escape sequence");
     }
   }
   throw std::runtime_error("Unterminated JSON string");
 }
 
-static Value parse_json_value(const std::string &s, size_t &pos) {
+static Value parse_json_value(std::string_view s, size_t &pos) {
   skip_json_ws(s, pos);
   if (pos >= s.size()) throw std::runtime_error("Unexpected end of JSON");
   char c = s[pos];
@@ -197,11 +296,11 @@ static Value parse_json_value(const std::string &s, size_t &pos) {
   }
   if (c == '{') {
     ++pos;
-    auto obj = std::make_shared<Environment>(nullptr);
+    auto obj = std::make_shared<Dict>();
     skip_json_ws(s, pos);
     if (pos < s.size() && s[pos] == '}') {
       ++pos;
-      return Value::make_object("json", obj);
+      return Value::make_dict(std::move(obj));
     }
     while (true) {
       skip_json_ws(s, pos);
@@ -211,7 +310,7 @@ static Value parse_json_value(const std::string &s, size_t &pos) {
         throw std::runtime_error("Invalid JSON object separator");
       ++pos;
       Value value = parse_json_value(s, pos);
-      obj->set_local(key, value);
+      obj->set(Value::make_str(std::move(key)), std::move(value));
       skip_json_ws(s, pos);
       if (pos >= s.size()) throw std::runtime_error("Invalid JSON object");
       if (s[pos] == '}') {
@@ -222,7 +321,7 @@ static Value parse_json_value(const std::string &s, size_t &pos) {
         throw std::runtime_error("Invalid JSON object delimiter");
       ++pos;
     }
-    return Value::make_object("json", obj);
+    return Value::make_dict(std::move(obj));
   }
   if (c == '[') {
     ++pos;
@@ -277,102 +376,130 @@ static Value parse_json_value(const std::string &s, size_t &pos) {
       ++pos;
   }
   if (start == pos) throw std::runtime_error("Invalid JSON value");
-  std::string token = s.substr(start, pos - start);
-  try {
-    if (is_float) {
-      return Value::make_double(std::stod(token));
-    }
-    return Value::make_int(std::stoll(token));
-  } catch (...) {
-    throw std::runtime_error("Invalid JSON number: " + token);
-  }
+  const char *first = s.data() + start;
+  const char *last = s.data() + pos;
+  if (is_float) {
+    double d = 0;
+    auto [end, ec] = std::from_chars(first, last, d);
+    if (ec == std::errc() && end == last) return Value::make_double(d);
+  } else {
+    int64_t n = 0;
+    auto [end, ec] = std::from_chars(first, last, n);
+    if (ec == std::errc() && end == last) return Value::make_int(n);
+  }
+  throw std::runtime_error("Invalid JSON number: " + std::string(first, last));
 }
 
-static std::string json_escape_string(const std::string &value) {
-  std::string escaped;
-  for (char c : value) {
+// Appends `value` escaped for a JSON string. Runs that need no escaping
+// are copied in one append.
+static void json_write_escaped(const std::string &value, std::string &out) {
+  size_t run = 0;
+  for (size_t i = 0; i < value.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    out.append(value, run, i - run);
+    run = i + 1;
     switch (c) {
       case '"':
-        escaped += "\\\"";
+        out += "\\\"";
         break;
       case '\\':
-        escaped += "\\\\";
+        out += "\\\\";
         break;
       case '\b':
-        escaped += "\\b";
+        out += "\\b";
         break;
       case '\f':
-        escaped += "\\f";
+        out += "\\f";
         break;
       case '\n':
-        escaped += "\\n";
+        out += "\\n";
         break;
       case '\r':
-        escaped += "\\r";
+        out += "\\r";
         break;
       case '\t':
-        escaped += "\\t";
+        out += "\\t";
         break;
-      default:
-        if (static_cast<unsigned char>(c) < 0x20) {
-          char buf[8];
-          std::snprintf(buf, sizeof(buf), "\\u%04x",
-                        static_cast<unsigned char>(c));
-          escaped += buf;
-        } else {
-          escaped.push_back(c);
-        }
+      default: {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      }
     }
   }
-  return escaped;
+  out.append(value, run, std::string::npos);
 }
 
-static std::string json_stringify_value(const Value &v) {
-  if (std::holds_alternative<std::monostate>(v.v)) return "null";
-  if (std::holds_alternative<bool>(v.v))
-    return std::get<bool>(v.v) ? "true" : "false";
-  if (std::holds_alternative<int64_t>(v.v))
-    return std::to_string(std::get<int64_t>(v.v));
-  if (std::holds_alternative<double>(v.v)) {
-    std::ostringstream oss;
-    oss << std::setprecision(15) << std::get<double>(v.v);
-    std::string out = oss.str();
-    if (out.find('.') == std::string::npos &&
-        out.find('e') == std::string::npos &&
-        out.find('E') == std::string::npos) {
-      out += ".0";
-    }
-    return out;
-  }
-  if (std::holds_alternative<std::string>(v.v)) {
-    return std::string("\"") + json_escape_string(std::get<std::string>(v.v)) +
-           "\"";
-  }
-  if (std::holds_alternative<std::vector<Value>>(v.v)) {
-    const auto &list = std::get<std::vector<Value>>(v.v);
-    std::string out = "[";
+// Writes the JSON text of `v` onto the end of `out`, so a whole document
+// is built in one growing buffer.
+static void json_write_value(const Value &v, std::string &out) {
+  if (std::holds_alternative<std::monostate>(v.v)) {
+    out += "null";
+  } else if (std::holds_alternative<bool>(v.v)) {
+    out += std::get<bool>(v.v) ? "true" : "false";
+  } else if (std::holds_alternative<int64_t>(v.v)) {
+    char buf[24];
+    auto end =
+        std::to_chars(buf, buf + sizeof(buf), std::get<int64_t>(v.v)).ptr;
+    out.append(buf, end);
+  } else if (std::holds_alternative<double>(v.v)) {
+    char buf[32];
+    int len = std::snprintf(buf, sizeof(buf), "%.15g", std::get<double>(v.v));
+    std::string_view text(buf, static_cast<size_t>(len));
+    out += text;
+    if (text.find_first_of(".eE") == std::string_view::npos) out += ".0";
+  } else if (std::holds_alternative<std::string>(v.v)) {
+    out.push_back('"');
+    json_write_escaped(std::get<std::string>(v.v), out);
+    out.push_back('"');
+  } else if (std::holds_alternative<List>(v.v)) {
+    const auto &list = std::get<List>(v.v);
+    out.push_back('[');
     for (size_t i = 0; i < list.size(); ++i) {
-      if (i) out += ",";
-      out += json_stringify_value(list[i]);
+      if (i) out.push_back(',');
+      json_write_value(list[i], out);
     }
-    out += "]";
-    return out;
-  }
-  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v)) {
+    out.push_back(']');
+  } else if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(v.v)) {
     auto obj = std::get<std::shared_ptr<ObjectInstance>>(v.v);
-    std::string out = "{";
+    out.push_back('{');
     const auto keys = obj->properties->local_keys();
     for (size_t i = 0; i < keys.size(); ++i) {
-      if (i) out += ",";
-      out += json_stringify_value(Value::make_str(keys[i]));
-      out += ":";
+      if (i) out.push_back(',');
+      out.push_back('"');
+      json_write_escaped(keys[i], out);
+      out += "\":";
       auto val = obj->properties->get_local(keys[i]);
-      out += json_stringify_value(val ? *val : Value());
+      json_write_value(val ? *val : Value(), out);
     }
-    out += "}";
-    return out;
+    out.push_back('}');
+  } else if (const auto *array =
+                 std::get_if<std::shared_ptr<const NumArray>>(&v.v)) {
+    out.push_back('[');
+    for (size_t i = 0; i < (*array)->size(); ++i) {
+      if (i) out.push_back(',');
+      json_write_value((*array)->at(i), out);
+    }
+    out.push_back(']');
+  } else if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&v.v)) {
+    out.push_back('{');
+    bool first = true;
+    (*dict)->for_each([&](const Value &key, const Value &value) {
+      if (!first) out.push_back(',');
+      first = false;
+      out.push_back('"');
+      if (const auto *s = std::get_if<std::string>(&key.v))
+        json_write_escaped(*s, out);
+      else
+        out += key.to_string();
+      out += "\":";
+      json_write_value(value, out);
+    });
+    out.push_back('}');
+  } else {
+    out += "null";
   }
-  return "null";
 }
 
 static const std::string base64_chars =
@@ -422,7 +549,7 @@ static std::string base64_decode(const std::string &data) {
 
 static std::string uuid4() {
   static std::random_device rd;
-  static std::mt19937_64 gen(rd());
+  static thread_local std::mt19937_64 gen(rd());
   std::uniform_int_distribution<uint64_t> dist(0, 0xFFFFFFFFFFFFFFFFULL);
   uint64_t a = dist(gen);
   uint64_t b = dist(gen);
@@ -438,86 +565,186 @@ static std::string uuid4() {
   return oss.str();
 }
 
+// `*` matches any run of characters and `?` any single one; everything else
+// is literal. On a mismatch only the most recent `*` is retried one
+// character further on, so matching is O(pattern * text) at worst and never
+// backtracks exponentially.
 static bool glob_match(const std::string &pattern, const std::string &text) {
-  std::string regex_pattern;
-  regex_pattern.reserve(pattern.size() * 2 + 4);
-  regex_pattern.push_back('^');
-  for (char c : pattern) {
-    switch (c) {
-      case '*':
-        regex_pattern += ".*";
-        break;
-      case '?':
-        regex_pattern += '.';
-        break;
-      case '.':
-        regex_pattern += "\\.";
-        break;
-      case '\\':
-        regex_pattern += "\\\\";
-        break;
-      case '+':
-      case '(':
-      case ')':
-      case '[':
-      case ']':
-      case '{':
-      case '}':
-      case '^':
-      case '$':
-      case '|':
-        regex_pattern.push_back('\\');
-        regex_pattern.push_back(c);
-        break;
-      default:
-        regex_pattern.push_back(c);
-        break;
+  size_t p = 0, t = 0;
+  size_t star = std::string::npos, star_text = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_text = t;
+    } else if (p < pattern.size() &&
+               (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      t = ++star_text;
+    } else {
+      return false;
     }
   }
-  regex_pattern.push_back('$');
-  return std::regex_match(text, std::regex(regex_pattern));
+  while (p < pattern.size() && pattern[p] == '*') ++p;
+  return p == pattern.size();
 }
 
-static std::vector<Value> parse_csv_text(const std::string &text, char delim) {
-  std::vector<Value> rows;
-  std::vector<Value> current_row;
-  std::string field;
-  bool in_quotes = false;
-  for (size_t i = 0; i <= text.size(); ++i) {
-    char c = i < text.size() ? text[i] : '\n';
-    if (in_quotes) {
-      if (c == '"') {
-        if (i + 1 < text.size() && text[i + 1] == '"') {
-          field.push_back('"');
-          ++i;
-        } else {
+// Compiled patterns, most recently used first. Building a std::regex costs
+// far more than matching a short string against it, so a pattern used in a
+// loop is compiled once.
+class RegexCache {
+ public:
+  static constexpr size_t kMaxPatterns = 64;
+
+  const std::regex &get(const std::string &pattern) {
+    auto it = by_pattern.find(pattern);
+    if (it != by_pattern.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      return entries.front().second;
+    }
+    std::regex compiled;
+    try {
+      compiled = std::regex(pattern);
+    } catch (const std::regex_error &e) {
+      throw std::runtime_error(std::string("Invalid regex: ") + e.what());
+    }
+    entries.emplace_front(pattern, std::move(compiled));
+    by_pattern[pattern] = entries.begin();
+    if (entries.size() > kMaxPatterns) {
+      by_pattern.erase(entries.back().first);
+      entries.pop_back();
+    }
+    return entries.front().second;
+  }
+
+ private:
+  std::list<std::pair<std::string, std::regex>> entries;
+  std::unordered_map<std::string, decltype(entries)::iterator> by_pattern;
+};
+
+static thread_local RegexCache regex_cache;
+
+// Offset of the first byte in [data, data + size) that ends an unquoted CSV
+// run (`delim`, a quote, CR or LF), or `size` if there is none. With SSE2
+// sixteen bytes are tested per step.
+static size_t csv_scan_unquoted(const char *data, size_t size, char delim) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i d = _mm_set1_epi8(delim);
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i hits =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, d),
+                                  _mm_cmpeq_epi8(block, quote)),
+                     _mm_or_si128(_mm_cmpeq_epi8(block, cr),
+                                  _mm_cmpeq_epi8(block, lf)));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+    if (mask) return i + std::countr_zero(mask);
+  }
+#endif
+  for (; i < size; ++i) {
+    char c = data[i];
+    if (c == delim || c == '"' || c == '\r' || c == '\n') return i;
+  }
+  return size;
+}
+
+// Incremental CSV parser. Input may arrive in arbitrary pieces: a field or
+// row split across two buffers is carried over in `field` and `row`. Plain
+// runs of field bytes are located with csv_scan_unquoted or memchr and
+// appended in one go.
+class CsvParser {
+ public:
+  explicit CsvParser(char delim) : delim(delim) {}
+
+  // Parses data[pos, size) until a row is complete and stores it in `out`.
+  // Returns false, with all input consumed, if the row continues past
+  // `size`.
+  bool next_row(const char *data, size_t size, size_t &pos, Value &out) {
+    while (pos < size) {
+      if (in_quotes) {
+        if (quote_pending) {
+          // The previous buffer ended on a quote: `""` is an escaped
+          // quote, anything else closes the field.
+          quote_pending = false;
+          if (data[pos] == '"') {
+            field.push_back('"');
+            ++pos;
+            continue;
+          }
           in_quotes = false;
+          continue;
         }
-      } else {
-        field.push_back(c);
+        const void *hit = std::memchr(data + pos, '"', size - pos);
+        size_t end = hit ? static_cast<const char *>(hit) - data : size;
+        field.append(data + pos, end - pos);
+        pos = end;
+        if (!hit) continue;
+        ++pos;
+        quote_pending = true;
+        continue;
       }
-    } else {
+      size_t end = pos + csv_scan_unquoted(data + pos, size - pos, delim);
+      field.append(data + pos, end - pos);
+      pos = end;
+      if (pos == size) break;
+      char c = data[pos++];
       if (c == '"') {
         in_quotes = true;
       } else if (c == delim) {
-        current_row.push_back(Value::make_str(field));
+        row.push_back(Value::make_str(std::move(field)));
         field.clear();
-      } else if (c == '\r') {
-        continue;
       } else if (c == '\n') {
-        current_row.push_back(Value::make_str(field));
-        if (!current_row.empty() || !field.empty()) {
-          if (!(current_row.size() == 1 && field.empty())) {
-            rows.push_back(Value::make_list(std::move(current_row)));
-          }
-        }
-        current_row.clear();
-        field.clear();
-      } else {
-        field.push_back(c);
+        if (end_row(out)) return true;
       }
+      // '\r' outside quotes is dropped.
+    }
+    return false;
+  }
+
+  // Completes the last row once the input is exhausted. Returns false if
+  // nothing was left.
+  bool finish(Value &out) {
+    in_quotes = quote_pending = false;
+    return end_row(out);
+  }
+
+ private:
+  // Blank lines produce no row.
+  bool end_row(Value &out) {
+    bool blank = row.empty() && field.empty();
+    row.push_back(Value::make_str(std::move(field)));
+    field.clear();
+    if (blank) {
+      row.clear();
+      return false;
     }
+    out = Value::make_list(std::move(row));
+    row = {};
+    return true;
   }
+
+  char delim;
+  bool in_quotes = false;
+  bool quote_pending = false;
+  std::string field;
+  std::vector<Value> row;
+};
+
+static std::vector<Value> parse_csv_text(const std::string &text, char delim) {
+  std::vector<Value> rows;
+  CsvParser parser(delim);
+  size_t pos = 0;
+  Value row;
+  while (parser.next_row(text.data(), text.size(), pos, row))
+    rows.push_back(std::move(row));
+  if (parser.finish(row)) rows.push_back(std::move(row));
   return rows;
 }
 
@@ -540,1226 +767,2682 @@ static std::string csv_escape_field(const std::string &field, char delim) {
   return out;
 }
 
-std::vector<std::pair<std::string, std::string>> read_archive(
-    const std::string &path) {
-  std::ifstream ifs(path, std::ios::binary);
-  if (!ifs) throw std::runtime_error("Cannot open archive: " + path);
-  std::string magic(archive_magic.size(), '\0');
-  ifs.read(&magic[0], static_cast<std::streamsize>(magic.size()));
-  if (magic != archive_magic)
-    throw std::runtime_error("Invalid archive: " + path);
-  uint64_t count = 0;
-  ifs.read(reinterpret_cast<char *>(&count), sizeof(count));
-  std::vector<std::pair<std::string, std::string>> entries;
-  for (uint64_t i = 0; i < count; ++i) {
-    uint64_t name_len = 0;
-    uint64_t data_len = 0;
-    ifs.read(reinterpret_cast<char *>(&name_len), sizeof(name_len));
-    ifs.read(reinterpret_cast<char *>(&data_len), sizeof(data_len));
-    std::string name(name_len, '\0');
-    std::string data(data_len, '\0');
-    ifs.read(&name[0], static_cast<std::streamsize>(name_len));
-    ifs.read(&data[0], static_cast<std::streamsize>(data_len));
-    entries.emplace_back(std::move(name), std::move(data));
-  }
-  return entries;
-}
-
-void write_archive(
-    const std::string &path,
-    const std::vector<std::pair<std::string, std::string>> &entries) {
-  std::ofstream ofs(path, std::ios::binary);
-  if (!ofs) throw std::runtime_error("Cannot create archive: " + path);
-  ofs.write(archive_magic.data(),
-            static_cast<std::streamsize>(archive_magic.size()));
-  uint64_t count = entries.size();
-  ofs.write(reinterpret_cast<const char *>(&count), sizeof(count));
-  for (const auto &entry : entries) {
-    uint64_t name_len = entry.first.size();
-    uint64_t data_len = entry.second.size();
-    ofs.write(reinterpret_cast<const char *>(&name_len), sizeof(name_len));
-    ofs.write(reinterpret_cast<const char *>(&data_len), sizeof(data_len));
-    ofs.write(entry.first.data(), static_cast<std::streamsize>(name_len));
-    ofs.write(entry.second.data(), static_cast<std::streamsize>(data_len));
-  }
-}
-
-void register_stdlib(std::shared_ptr<Environment> env) {
-  // Core functions
-  env->set("print", Value::make_str("__builtin_print"));
-  env->set("range", Value::make_str("__builtin_range"));
-  env->set("len", Value::make_str("__builtin_len"));
-  env->set("str", Value::make_str("__builtin_str"));
-  env->set("int", Value::make_str("__builtin_int"));
-  env->set("float", Value::make_str("__builtin_float"));
-  env->set("append", Value::make_str("__builtin_append"));
-
-  // Math functions
-  env->set("sqrt", Value::make_str("__builtin_sqrt"));
-  env->set("pow", Value::make_str("__builtin_pow"));
-  env->set("sin", Value::make_str("__builtin_sin"));
-  env->set("cos", Value::make_str("__builtin_cos"));
-  env->set("tan", Value::make_str("__builtin_tan"));
-  env->set("log", Value::make_str("__builtin_log"));
-  env->set("exp", Value::make_str("__builtin_exp"));
-  env->set("abs", Value::make_str("__builtin_abs"));
-  env->set("floor", Value::make_str("__builtin_floor"));
-  env->set("ceil", Value::make_str("__builtin_ceil"));
-  env->set("round", Value::make_str("__builtin_round"));
-  env->set("pi", Value::make_str("__builtin_pi"));
-  env->set("e", Value::make_str("__builtin_e"));
-
-  // I/O functions
-  env->set("read_file", Value::make_str("__builtin_read_file"));
-  env->set("write_file", Value::make_str("__builtin_write_file"));
-  env->set("exists", Value::make_str("__builtin_exists"));
-  env->set("list_dir", Value::make_str("__builtin_list_dir"));
-  env->set("mkdir", Value::make_str("__builtin_mkdir"));
-  env->set("rmdir", Value::make_str("__builtin_rmdir"));
-  env->set("remove", Value::make_str("__builtin_remove"));
-  env->set("copy_file", Value::make_str("__builtin_copy_file"));
-  env->set("move", Value::make_str("__builtin_move"));
-  env->set("file_size", Value::make_str("__builtin_file_size"));
-  env->set("is_dir", Value::make_str("__builtin_is_dir"));
-
-  // String functions
-  env->set("split", Value::make_str("__builtin_split"));
-  env->set("join", Value::make_str("__builtin_join"));
-  env->set("substr", Value::make_str("__builtin_substr"));
-  env->set("find", Value::make_str("__builtin_find"));
-  env->set("replace", Value::make_str("__builtin_replace"));
-  env->set("to_upper", Value::make_str("__builtin_to_upper"));
-  env->set("to_lower", Value::make_str("__builtin_to_lower"));
-  env->set("trim", Value::make_str("__builtin_trim"));
-  env->set("starts_with", Value::make_str("__builtin_starts_with"));
-  env->set("ends_with", Value::make_str("__builtin_ends_with"));
-  env->set("contains", Value::make_str("__builtin_contains"));
-  env->set("reverse", Value::make_str("__builtin_reverse"));
-  env->set("repeat", Value::make_str("__builtin_repeat"));
-
-  // Utility functions
-  env->set("random_int", Value::make_str("__builtin_random_int"));
-  env->set("random_float", Value::make_str("__builtin_random_float"));
-  env->set("now", Value::make_str("__builtin_now"));
-  env->set("copy", Value::make_str("__builtin_copy"));
-  env->set("clone", Value::make_str("__builtin_clone"));
-  env->set("slice", Value::make_str("__builtin_slice"));
-  env->set("sorted", Value::make_str("__builtin_sorted"));
-  env->set("sum", Value::make_str("__builtin_sum"));
-  env->set("min", Value::make_str("__builtin_min"));
-  env->set("max", Value::make_str("__builtin_max"));
-  env->set("type", Value::make_str("__builtin_type"));
-  env->set("vars", Value::make_str("__builtin_vars"));
-  env->set("keys", Value::make_str("__builtin_keys"));
-  env->set("get", Value::make_str("__builtin_get"));
-  env->set("set", Value::make_str("__builtin_set"));
-  env->set("system", Value::make_str("__builtin_system"));
-  env->set("shell", Value::make_str("__builtin_shell"));
-  env->set("getenv", Value::make_str("__builtin_getenv"));
-  env->set("setenv", Value::make_str("__builtin_setenv"));
-  env->set("sleep", Value::make_str("__builtin_sleep"));
-  env->set("pwd", Value::make_str("__builtin_pwd"));
-  env->set("cwd", Value::make_str("__builtin_pwd"));
-  env->set("path_join", Value::make_str("__builtin_path_join"));
-  env->set("path_is_absolute", Value::make_str("__builtin_path_is_absolute"));
-  env->set("path_normalize", Value::make_str("__builtin_path_normalize"));
-  env->set("file_ext", Value::make_str("__builtin_file_ext"));
-  env->set("basename", Value::make_str("__builtin_basename"));
-  env->set("dirname", Value::make_str("__builtin_dirname"));
-  env->set("mkdirs", Value::make_str("__builtin_mkdirs"));
-  env->set("json_parse", Value::make_str("__builtin_json_parse"));
-  env->set("json_stringify", Value::make_str("__builtin_json_stringify"));
-  env->set("csv_parse", Value::make_str("__builtin_csv_parse"));
-  env->set("csv_stringify", Value::make_str("__builtin_csv_stringify"));
-  env->set("base64_encode", Value::make_str("__builtin_base64_encode"));
-  env->set("base64_decode", Value::make_str("__builtin_base64_decode"));
-  env->set("uuid4", Value::make_str("__builtin_uuid4"));
-  env->set("glob", Value::make_str("__builtin_glob"));
-  env->set("regex_match", Value::make_str("__builtin_regex_match"));
-  env->set("regex_replace", Value::make_str("__builtin_regex_replace"));
-#ifdef BLOA_USE_MYSQL
-  env->set("mysql_connect", Value::make_str("__builtin_mysql_connect"));
-  env->set("mysql_query", Value::make_str("__builtin_mysql_query"));
-  env->set("mysql_exec", Value::make_str("__builtin_mysql_exec"));
-  env->set("mysql_close", Value::make_str("__builtin_mysql_close"));
-  env->set("mysql_escape", Value::make_str("__builtin_mysql_escape"));
-#endif
+static Value builtin_print(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  std::string line;
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i > 0) line.push_back(' ');
+    line += value_to_string(args[i]);
+  }
+  line.push_back('\n');
+  write_output(line);
+  return Value();
+}
 
-  // PHP / Java-like helpers
-  env->set("echo", Value::make_str("__builtin_echo"));
-  env->set("isset", Value::make_str("__builtin_isset"));
-  env->set("unset", Value::make_str("__builtin_unset"));
-  env->set("ref", Value::make_str("__builtin_ref"));
-  env->set("deref", Value::make_str("__builtin_deref"));
-  env->set("set_ref", Value::make_str("__builtin_set_ref"));
-  env->set("is_ref", Value::make_str("__builtin_is_ref"));
-  env->set("baar_create", Value::make_str("__builtin_baar_create"));
-  env->set("baar_extract", Value::make_str("__builtin_baar_extract"));
-  env->set("baar_list", Value::make_str("__builtin_baar_list"));
-  env->set("baar_read", Value::make_str("__builtin_baar_read"));
-
-  // HTTP and network helpers
-#ifdef BLOA_USE_CURL
-  env->set("curl_get", Value::make_str("__builtin_curl_get"));
-  env->set("curl_post", Value::make_str("__builtin_curl_post"));
-  env->set("curl_request", Value::make_str("__builtin_curl_request"));
-#endif
+static Value builtin_flush(const std::vector<Value> &,
+                           const std::shared_ptr<Environment> &) {
+  flush_output();
+  return Value();
+}
 
-  // SQLite helpers
-#ifdef BLOA_USE_SQLITE
-  env->set("sqlite_query", Value::make_str("__builtin_sqlite_query"));
-  env->set("sqlite_exec", Value::make_str("__builtin_sqlite_exec"));
-#endif
+static Value builtin_isset(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &env) {
+  if (!env) throw std::runtime_error("isset() requires environment access");
+  if (args.size() == 1 && std::holds_alternative<std::string>(args[0].v)) {
+    return Value::make_bool(env->has(std::get<std::string>(args[0].v)));
+  }
+  if (args.size() == 2 &&
+      std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
+      std::holds_alternative<std::string>(args[1].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    return Value::make_bool(
+        obj->properties->has(std::get<std::string>(args[1].v)));
+  }
+  if (args.size() == 2 &&
+      std::holds_alternative<std::shared_ptr<Dict>>(args[0].v))
+    return Value::make_bool(
+        std::get<std::shared_ptr<Dict>>(args[0].v)->find(args[1]) != nullptr);
+  throw std::runtime_error(
+      "isset() requires 1 string argument, (object, member) or (dict, key)");
 }
 
-Value handle_builtin(const std::string &marker, const std::vector<Value> &args,
-                     std::shared_ptr<Environment> env) {
-  if (marker == "__builtin_print" || marker == "__builtin_echo") {
-    for (size_t i = 0; i < args.size(); ++i) {
-      if (i > 0) std::cout << ' ';
-      std::cout << value_to_string(args[i]);
-    }
-    std::cout << '\n';
-    return Value();
+static Value builtin_unset(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &env) {
+  if (!env) throw std::runtime_error("unset() requires environment access");
+  if (args.size() == 1 && std::holds_alternative<std::string>(args[0].v)) {
+    return Value::make_bool(env->remove(std::get<std::string>(args[0].v)));
+  }
+  if (args.size() == 2 &&
+      std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
+      std::holds_alternative<std::string>(args[1].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    return Value::make_bool(
+        obj->properties->remove(std::get<std::string>(args[1].v)));
   }
-  if (marker == "__builtin_isset") {
-    if (!env) throw std::runtime_error("isset() requires environment access");
-    if (args.size() == 1 && std::holds_alternative<std::string>(args[0].v)) {
-      return Value::make_bool(env->has(std::get<std::string>(args[0].v)));
-    }
-    if (args.size() == 2 &&
-        std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
-        std::holds_alternative<std::string>(args[1].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      return Value::make_bool(
-          obj->properties->has(std::get<std::string>(args[1].v)));
-    }
+  if (args.size() == 2 &&
+      std::holds_alternative<std::shared_ptr<Dict>>(args[0].v))
+    return Value::make_bool(
+        std::get<std::shared_ptr<Dict>>(args[0].v)->erase(args[1]));
+  throw std::runtime_error(
+      "unset() requires 1 string argument, (object, member) or (dict, key)");
+}
+
+static Value builtin_ref(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &env) {
+  if (!env || args.size() != 1 ||
+      !std::holds_alternative<std::string>(args[0].v))
+    throw std::runtime_error("ref() requires 1 string argument");
+  std::string name = std::get<std::string>(args[0].v);
+  auto current = env;
+  while (current && !current->has_local(name)) current = current->parent;
+  if (!current)
+    throw std::runtime_error("Undefined variable for ref(): " + name);
+  return Value::make_ref(current, name);
+}
+
+static Value builtin_deref(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  if (args.size() != 1 ||
+      !std::holds_alternative<std::shared_ptr<Reference>>(args[0].v))
+    throw std::runtime_error("deref() requires 1 reference argument");
+  auto ref = std::get<std::shared_ptr<Reference>>(args[0].v);
+  auto target = ref->env->get(ref->name);
+  if (!target)
+    throw std::runtime_error("Invalid reference target: " + ref->name);
+  return *target;
+}
+
+static Value builtin_set_ref(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  if (args.size() != 2 ||
+      !std::holds_alternative<std::shared_ptr<Reference>>(args[0].v))
+    throw std::runtime_error("set_ref() requires 1 reference and 1 value");
+  auto ref = std::get<std::shared_ptr<Reference>>(args[0].v);
+  ref->env->set(ref->name, args[1]);
+  return Value();
+}
+
+static Value builtin_is_ref(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  return Value::make_bool(
+      std::holds_alternative<std::shared_ptr<Reference>>(args[0].v));
+}
+
+static Value builtin_range(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  int64_t start = 0;
+  int64_t stop = 0;
+  int64_t step = 1;
+  if (args.size() == 1) {
+    stop = static_cast<int64_t>(value_as_number(args[0]).as_number());
+  } else if (args.size() == 2) {
+    start = static_cast<int64_t>(value_as_number(args[0]).as_number());
+    stop = static_cast<int64_t>(value_as_number(args[1]).as_number());
+  } else if (args.size() == 3) {
+    start = static_cast<int64_t>(value_as_number(args[0]).as_number());
+    stop = static_cast<int64_t>(value_as_number(args[1]).as_number());
+    step = static_cast<int64_t>(value_as_number(args[2]).as_number());
+  } else {
+    throw std::runtime_error("range() requires 1 to 3 numeric arguments");
+  }
+  if (step == 0) throw std::runtime_error("range() step cannot be zero");
+  // Elements are produced on demand; see List::Range.
+  uint64_t span = 0;
+  if (step > 0 && stop > start)
+    span = static_cast<uint64_t>(stop) - static_cast<uint64_t>(start);
+  else if (step < 0 && stop < start)
+    span = static_cast<uint64_t>(start) - static_cast<uint64_t>(stop);
+  uint64_t stride = step > 0 ? static_cast<uint64_t>(step)
+                             : 0 - static_cast<uint64_t>(step);
+  size_t count = static_cast<size_t>(span / stride + (span % stride != 0));
+  Value result;
+  result.v = List::range(start, step, count);
+  return result;
+}
+
+static Value builtin_len(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  const auto &arg = args[0];
+  if (std::holds_alternative<std::string>(arg.v)) {
+    return Value::make_int(
+        static_cast<int64_t>(std::get<std::string>(arg.v).size()));
+  } else if (std::holds_alternative<List>(arg.v)) {
+    return Value::make_int(
+        static_cast<int64_t>(std::get<List>(arg.v).size()));
+  } else if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(arg.v)) {
+    return Value::make_int(
+        static_cast<int64_t>(std::get<std::shared_ptr<ObjectInstance>>(arg.v)
+                                 ->properties->local_keys()
+                                 .size()));
+  } else if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&arg.v)) {
+    return Value::make_int(static_cast<int64_t>((*dict)->size()));
+  } else if (const auto *array =
+                 std::get_if<std::shared_ptr<const NumArray>>(&arg.v)) {
+    return Value::make_int(static_cast<int64_t>((*array)->size()));
+  } else {
     throw std::runtime_error(
-        "isset() requires 1 string argument or (object, member)");
+        "len() argument must be string, list, dict, array, or object");
   }
-  if (marker == "__builtin_unset") {
-    if (!env) throw std::runtime_error("unset() requires environment access");
-    if (args.size() == 1 && std::holds_alternative<std::string>(args[0].v)) {
-      return Value::make_bool(env->remove(std::get<std::string>(args[0].v)));
-    }
-    if (args.size() == 2 &&
-        std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
-        std::holds_alternative<std::string>(args[1].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      return Value::make_bool(
-          obj->properties->remove(std::get<std::string>(args[1].v)));
+}
+
+static Value builtin_copy(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  return copy_value(args[0]);
+}
+
+static Value builtin_slice(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  const auto &source = args[0];
+  int64_t start = static_cast<int64_t>(value_as_number(args[1]).as_number());
+  int64_t length = -1;
+  if (args.size() == 3)
+    length = static_cast<int64_t>(value_as_number(args[2]).as_number());
+  if (std::holds_alternative<std::string>(source.v)) {
+    std::string s = std::get<std::string>(source.v);
+    if (start < 0) start = static_cast<int64_t>(s.size()) + start;
+    if (start < 0) start = 0;
+    if (length < 0)
+      return Value::make_str(s.substr(static_cast<size_t>(start)));
+    return Value::make_str(
+        s.substr(static_cast<size_t>(start), static_cast<size_t>(length)));
+  }
+  if (std::holds_alternative<List>(source.v)) {
+    const auto &list = std::get<List>(source.v);
+    if (start < 0) start = static_cast<int64_t>(list.size()) + start;
+    if (start < 0) start = 0;
+    int64_t end =
+        (length < 0) ? static_cast<int64_t>(list.size()) : start + length;
+    if (end > static_cast<int64_t>(list.size()))
+      end = static_cast<int64_t>(list.size());
+    std::vector<Value> out;
+    for (int64_t i = start; i < end; ++i)
+      out.push_back(list[static_cast<size_t>(i)]);
+    return Value::make_list(std::move(out));
+  }
+  if (const auto *array =
+          std::get_if<std::shared_ptr<const NumArray>>(&source.v)) {
+    int64_t size = static_cast<int64_t>((*array)->size());
+    if (start < 0) start = size + start;
+    start = std::clamp<int64_t>(start, 0, size);
+    int64_t end = (length < 0) ? size : std::min(start + length, size);
+    return array_slice(**array, static_cast<size_t>(start),
+                       static_cast<size_t>(end));
+  }
+  throw std::runtime_error("slice() source must be string, list or array");
+}
+
+static Value builtin_sorted(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  if (const auto *array =
+          std::get_if<std::shared_ptr<const NumArray>>(&args[0].v))
+    return array_sorted(**array);
+  if (!std::holds_alternative<List>(args[0].v))
+    throw std::runtime_error("sorted() requires a list");
+  const List &source = std::get<List>(args[0].v);
+  // A list of ints sorts unboxed, without the per-comparison type checks.
+  std::vector<int64_t> ints;
+  ints.reserve(source.size());
+  for (const auto &item : source) {
+    const auto *i = std::get_if<int64_t>(&item.v);
+    if (!i) break;
+    ints.push_back(*i);
+  }
+  if (ints.size() == source.size()) {
+    std::sort(ints.begin(), ints.end());
+    std::vector<Value> out;
+    out.reserve(ints.size());
+    for (int64_t i : ints) out.push_back(Value::make_int(i));
+    return Value::make_list(std::move(out));
+  }
+  std::vector<Value> list = source.items();
+  std::sort(list.begin(), list.end(), [](const Value &a, const Value &b) {
+    if (std::holds_alternative<std::string>(a.v) &&
+        std::holds_alternative<std::string>(b.v)) {
+      return std::get<std::string>(a.v) < std::get<std::string>(b.v);
     }
-    throw std::runtime_error(
-        "unset() requires 1 string argument or (object, member)");
-  }
-  if (marker == "__builtin_ref") {
-    if (!env || args.size() != 1 ||
-        !std::holds_alternative<std::string>(args[0].v))
-      throw std::runtime_error("ref() requires 1 string argument");
-    std::string name = std::get<std::string>(args[0].v);
-    auto current = env;
-    while (current && !current->has_local(name)) current = current->parent;
-    if (!current)
-      throw std::runtime_error("Undefined variable for ref(): " + name);
-    return Value::make_ref(current, name);
-  }
-  if (marker == "__builtin_deref") {
-    if (args.size() != 1 ||
-        !std::holds_alternative<std::shared_ptr<Reference>>(args[0].v))
-      throw std::runtime_error("deref() requires 1 reference argument");
-    auto ref = std::get<std::shared_ptr<Reference>>(args[0].v);
-    auto target = ref->env->get(ref->name);
+    return value_as_number(a).as_number() < value_as_number(b).as_number();
+  });
+  return Value::make_list(std::move(list));
+}
+
+// The value an in-place list builtin modifies. The argument must be a
+// reference, which the resolver passes for a bare variable; it resolves to
+// the caller's binding, so the buffer is only cloned if another value
+// shares it. Anything else (a field, an element, a call result) would be
+// modified as a copy and the change lost, so it is refused.
+static Value &list_target(const Value &arg, const char *fn) {
+  if (!arg.is_reference())
+    throw std::runtime_error(std::string(fn) + "() requires a variable");
+  const Reference *ref = &arg.as_reference();
+  Value *target;
+  while (true) {
+    target = ref->env->find(ref->name);
     if (!target)
       throw std::runtime_error("Invalid reference target: " + ref->name);
-    return *target;
-  }
-  if (marker == "__builtin_set_ref") {
-    if (args.size() != 2 ||
-        !std::holds_alternative<std::shared_ptr<Reference>>(args[0].v))
-      throw std::runtime_error("set_ref() requires 1 reference and 1 value");
-    auto ref = std::get<std::shared_ptr<Reference>>(args[0].v);
-    ref->env->set(ref->name, args[1]);
-    return Value();
+    if (!target->is_reference()) break;
+    ref = &target->as_reference();
   }
-  if (marker == "__builtin_is_ref") {
-    if (args.size() != 1)
-      throw std::runtime_error("is_ref() requires 1 argument");
-    return Value::make_bool(
-        std::holds_alternative<std::shared_ptr<Reference>>(args[0].v));
-  }
-  if (marker == "__builtin_range") {
-    int64_t start = 0;
-    int64_t stop = 0;
-    int64_t step = 1;
-    if (args.size() == 1) {
-      stop = static_cast<int64_t>(value_as_number(args[0]).as_number());
-    } else if (args.size() == 2) {
-      start = static_cast<int64_t>(value_as_number(args[0]).as_number());
-      stop = static_cast<int64_t>(value_as_number(args[1]).as_number());
-    } else if (args.size() == 3) {
-      start = static_cast<int64_t>(value_as_number(args[0]).as_number());
-      stop = static_cast<int64_t>(value_as_number(args[1]).as_number());
-      step = static_cast<int64_t>(value_as_number(args[2]).as_number());
+  if (!std::holds_alternative<List>(target->v))
+    throw std::runtime_error(std::string(fn) + "() requires a list");
+  return *target;
+}
+
+static size_t list_position(const Value &index, size_t size, bool inclusive,
+                            const char *fn) {
+  int64_t i = static_cast<int64_t>(value_as_number(index).as_number());
+  int64_t n = static_cast<int64_t>(size);
+  if (i < 0) i += n;
+  if (i < 0 || i > n || (i == n && !inclusive))
+    throw std::runtime_error(std::string(fn) + "() index out of range");
+  return static_cast<size_t>(i);
+}
+
+static Value builtin_append(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  Value &target = list_target(args[0], "append");
+  auto &items = std::get<List>(target.v).mutate();
+  items.insert(items.end(), args.begin() + 1, args.end());
+  return target;
+}
+
+static Value builtin_pop(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  Value &target = list_target(args[0], "pop");
+  auto &items = std::get<List>(target.v).mutate();
+  if (items.empty()) throw std::runtime_error("pop() from empty list");
+  size_t i = items.size() - 1;
+  if (args.size() == 2) i = list_position(args[1], items.size(), false, "pop");
+  Value item = std::move(items[i]);
+  items.erase(items.begin() + static_cast<std::ptrdiff_t>(i));
+  return item;
+}
+
+static Value builtin_insert(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  Value &target = list_target(args[0], "insert");
+  auto &items = std::get<List>(target.v).mutate();
+  size_t i = list_position(args[1], items.size(), true, "insert");
+  items.insert(items.begin() + static_cast<std::ptrdiff_t>(i), args[2]);
+  return target;
+}
+
+static Value builtin_extend(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  if (!std::holds_alternative<List>(args[1].v))
+    throw std::runtime_error("extend() requires a list to append");
+  // args[1] keeps its own hold on the source buffer, so extend(xs, xs)
+  // clones the target before appending from it.
+  const List &source = std::get<List>(args[1].v);
+  Value &target = list_target(args[0], "extend");
+  auto &items = std::get<List>(target.v).mutate();
+  items.insert(items.end(), source.begin(), source.end());
+  return target;
+}
+
+static Value builtin_reserve(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  Value &target = list_target(args[0], "reserve");
+  int64_t n = static_cast<int64_t>(value_as_number(args[1]).as_number());
+  if (n > 0) std::get<List>(target.v).mutate().reserve(static_cast<size_t>(n));
+  return Value();
+}
+
+// Folds a non-empty numeric list, or what a native iterator yields, for
+// sum(), min() and max(). Ints are folded as int64_t with `int_op` until a
+// double appears or `int_op` fails (overflows), as in apply_binary; from
+// there on the fold continues in double with `op`. A range is folded
+// without building it.
+template <typename IntOp, typename Op>
+static Value fold_numbers(const Value &arg, IntOp int_op, Op op) {
+  bool any = false;
+  bool exact = true;
+  int64_t int_result = 0;
+  double result = 0;
+  auto to_double = [&] {
+    if (exact) result = static_cast<double>(int_result);
+    exact = false;
+  };
+  auto add_int = [&](int64_t x) {
+    int64_t r;
+    if (!any) {
+      int_result = x;
+    } else if (exact && int_op(int_result, x, r)) {
+      int_result = r;
     } else {
-      throw std::runtime_error("range() requires 1 to 3 numeric arguments");
+      to_double();
+      result = op(result, static_cast<double>(x));
     }
-    if (step == 0) throw std::runtime_error("range() step cannot be zero");
-    std::vector<Value> list;
-    if (step > 0) {
-      for (int64_t i = start; i < stop; i += step)
-        list.push_back(Value::make_int(i));
+    any = true;
+  };
+  auto add = [&](const Value &item) {
+    if (const auto *i = std::get_if<int64_t>(&item.v)) return add_int(*i);
+    double x = value_as_number(item).as_number();
+    if (!any) {
+      exact = false;
+      result = x;
     } else {
-      for (int64_t i = start; i > stop; i += step)
-        list.push_back(Value::make_int(i));
+      to_double();
+      result = op(result, x);
+    }
+    any = true;
+  };
+  if (const auto *obj = std::get_if<std::shared_ptr<ObjectInstance>>(&arg.v)) {
+    auto next = (*obj)->properties->get_local("__next__");
+    if ((*obj)->klass || !next || !next->is_builtin())
+      throw std::runtime_error("sum/min/max() requires a list or an iterator");
+    const auto &fn = *std::get<const BuiltinFunction *>(next->v);
+    while (true) {
+      Value item = call_builtin(fn, {arg});
+      if (std::holds_alternative<std::monostate>(item.v)) break;
+      add(item);
     }
-    return Value::make_list(list);
-  }
-  if (marker == "__builtin_len") {
-    if (args.size() != 1) throw std::runtime_error("len() requires 1 argument");
-    const auto &arg = args[0];
-    if (std::holds_alternative<std::string>(arg.v)) {
-      return Value::make_int(
-          static_cast<int64_t>(std::get<std::string>(arg.v).size()));
-    } else if (std::holds_alternative<std::vector<Value>>(arg.v)) {
-      return Value::make_int(
-          static_cast<int64_t>(std::get<std::vector<Value>>(arg.v).size()));
-    } else if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(arg.v)) {
-      return Value::make_int(
-          static_cast<int64_t>(std::get<std::shared_ptr<ObjectInstance>>(arg.v)
-                                   ->properties->local_keys()
-                                   .size()));
+  } else if (const auto *list = std::get_if<List>(&arg.v)) {
+    if (const auto *range = list->lazy_range()) {
+      for (size_t i = 0; i < range->count; ++i) add_int((*range)[i]);
     } else {
-      throw std::runtime_error(
-          "len() argument must be string, list, or object");
+      for (const auto &item : *list) add(item);
     }
+  } else {
+    throw std::runtime_error("sum/min/max() requires a list or an iterator");
   }
-  if (marker == "__builtin_copy" || marker == "__builtin_clone") {
-    if (args.size() != 1)
-      throw std::runtime_error("copy() requires 1 argument");
-    return copy_value(args[0]);
-  }
-  if (marker == "__builtin_slice") {
-    if (args.size() < 2 || args.size() > 3)
-      throw std::runtime_error("slice() requires 2 or 3 arguments");
-    const auto &source = args[0];
-    int64_t start = static_cast<int64_t>(value_as_number(args[1]).as_number());
-    int64_t length = -1;
-    if (args.size() == 3)
-      length = static_cast<int64_t>(value_as_number(args[2]).as_number());
-    if (std::holds_alternative<std::string>(source.v)) {
-      std::string s = std::get<std::string>(source.v);
-      if (start < 0) start = static_cast<int64_t>(s.size()) + start;
-      if (start < 0) start = 0;
-      if (length < 0)
-        return Value::make_str(s.substr(static_cast<size_t>(start)));
-      return Value::make_str(
-          s.substr(static_cast<size_t>(start), static_cast<size_t>(length)));
-    }
-    if (std::holds_alternative<std::vector<Value>>(source.v)) {
-      const auto &list = std::get<std::vector<Value>>(source.v);
-      if (start < 0) start = static_cast<int64_t>(list.size()) + start;
-      if (start < 0) start = 0;
-      int64_t end =
-          (length < 0) ? static_cast<int64_t>(list.size()) : start + length;
-      if (end > static_cast<int64_t>(list.size()))
-        end = static_cast<int64_t>(list.size());
-      std::vector<Value> out;
-      for (int64_t i = start; i < end; ++i)
-        out.push_back(list[static_cast<size_t>(i)]);
-      return Value::make_list(std::move(out));
+  if (!any) throw std::runtime_error("List cannot be empty");
+  return exact ? Value::make_int(int_result) : Value::make_double(result);
+}
+
+static const NumArray *array_arg(const Value &arg) {
+  const auto *array = std::get_if<std::shared_ptr<const NumArray>>(&arg.v);
+  return array ? array->get() : nullptr;
+}
+
+static Value builtin_sum(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0])) return array_sum(*array);
+  auto add_ints = [](int64_t a, int64_t b, int64_t &out) {
+    return !add_overflows(a, b, out);
+  };
+  return fold_numbers(args[0], add_ints,
+                      [](double a, double b) { return a + b; });
+}
+
+static Value builtin_min(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0])) return array_min(*array);
+  auto min_ints = [](int64_t a, int64_t b, int64_t &out) {
+    out = std::min(a, b);
+    return true;
+  };
+  return fold_numbers(args[0], min_ints,
+                      [](double a, double b) { return std::min(a, b); });
+}
+
+static Value builtin_max(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0])) return array_max(*array);
+  auto max_ints = [](int64_t a, int64_t b, int64_t &out) {
+    out = std::max(a, b);
+    return true;
+  };
+  return fold_numbers(args[0], max_ints,
+                      [](double a, double b) { return std::max(a, b); });
+}
+
+static Value builtin_type(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  const auto &arg = args[0];
+  if (std::holds_alternative<std::monostate>(arg.v))
+    return Value::make_str("none");
+  if (std::holds_alternative<int64_t>(arg.v)) return Value::make_str("int");
+  if (std::holds_alternative<double>(arg.v)) return Value::make_str("float");
+  if (std::holds_alternative<std::string>(arg.v))
+    return Value::make_str("string");
+  if (std::holds_alternative<bool>(arg.v)) return Value::make_str("bool");
+  if (std::holds_alternative<List>(arg.v))
+    return Value::make_str("list");
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(arg.v))
+    return Value::make_str("object");
+  if (std::holds_alternative<std::shared_ptr<Dict>>(arg.v))
+    return Value::make_str("dict");
+  if (const NumArray *array = array_arg(arg))
+    return Value::make_str(array->is_int() ? "array_i64" : "array_f64");
+  if (std::holds_alternative<std::shared_ptr<Reference>>(arg.v))
+    return Value::make_str("ref");
+  if (arg.is_builtin()) return Value::make_str("builtin");
+  return Value::make_str("unknown");
+}
+
+static Value builtin_vars(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &env) {
+  if (!env) throw std::runtime_error("vars() requires environment access");
+  if (args.empty()) {
+    std::vector<std::string> names;
+    std::unordered_set<std::string> seen;
+    for (const auto &name : env->keys()) {
+      if (seen.insert(name).second) names.push_back(name);
     }
-    throw std::runtime_error("slice() source must be string or list");
-  }
-  if (marker == "__builtin_sorted") {
-    if (args.size() != 1)
-      throw std::runtime_error("sorted() requires 1 list argument");
-    if (!std::holds_alternative<std::vector<Value>>(args[0].v))
-      throw std::runtime_error("sorted() requires a list");
-    auto list = std::get<std::vector<Value>>(args[0].v);
-    std::sort(list.begin(), list.end(), [](const Value &a, const Value &b) {
-      if (std::holds_alternative<std::string>(a.v) &&
-          std::holds_alternative<std::string>(b.v)) {
-        return std::get<std::string>(a.v) < std::get<std::string>(b.v);
-      }
-      return value_as_number(a).as_number() < value_as_number(b).as_number();
-    });
+    std::vector<Value> list;
+    for (const auto &name : names) list.push_back(Value::make_str(name));
     return Value::make_list(std::move(list));
   }
-  if (marker == "__builtin_sum" || marker == "__builtin_min" ||
-      marker == "__builtin_max") {
-    if (args.size() != 1)
-      throw std::runtime_error("sum/min/max() requires 1 list argument");
-    if (!std::holds_alternative<std::vector<Value>>(args[0].v))
-      throw std::runtime_error("sum/min/max() requires a list");
-    const auto &list = std::get<std::vector<Value>>(args[0].v);
-    if (list.empty()) throw std::runtime_error("List cannot be empty");
-    double result = value_as_number(list[0]).as_number();
-    if (marker == "__builtin_sum") {
-      for (size_t i = 1; i < list.size(); ++i)
-        result += value_as_number(list[i]).as_number();
-      return Value::make_double(result);
-    }
-    for (size_t i = 1; i < list.size(); ++i) {
-      double current = value_as_number(list[i]).as_number();
-      if (marker == "__builtin_min") result = std::min(result, current);
-      if (marker == "__builtin_max") result = std::max(result, current);
-    }
-    return Value::make_double(result);
-  }
-  if (marker == "__builtin_type") {
-    if (args.size() != 1)
-      throw std::runtime_error("type() requires 1 argument");
-    const auto &arg = args[0];
-    if (std::holds_alternative<std::monostate>(arg.v))
-      return Value::make_str("none");
-    if (std::holds_alternative<int64_t>(arg.v)) return Value::make_str("int");
-    if (std::holds_alternative<double>(arg.v)) return Value::make_str("float");
-    if (std::holds_alternative<std::string>(arg.v))
-      return Value::make_str("string");
-    if (std::holds_alternative<bool>(arg.v)) return Value::make_str("bool");
-    if (std::holds_alternative<std::vector<Value>>(arg.v))
-      return Value::make_str("list");
-    if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(arg.v))
-      return Value::make_str("object");
-    if (std::holds_alternative<std::shared_ptr<Reference>>(arg.v))
-      return Value::make_str("ref");
-    return Value::make_str("unknown");
-  }
-  if (marker == "__builtin_vars") {
-    if (!env) throw std::runtime_error("vars() requires environment access");
-    if (args.empty()) {
-      std::vector<std::string> names;
-      std::unordered_set<std::string> seen;
-      for (const auto &name : env->keys()) {
-        if (seen.insert(name).second) names.push_back(name);
-      }
-      std::vector<Value> list;
-      for (const auto &name : names) list.push_back(Value::make_str(name));
-      return Value::make_list(std::move(list));
-    }
-    if (args.size() == 1 &&
-        std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      std::vector<Value> list;
-      for (const auto &name : obj->properties->local_keys()) {
-        list.push_back(Value::make_str(name));
-      }
-      return Value::make_list(std::move(list));
-    }
-    throw std::runtime_error("vars() accepts no args or an object instance");
-  }
-  if (marker == "__builtin_keys") {
-    if (args.size() != 1)
-      throw std::runtime_error("keys() requires 1 argument");
-    if (std::holds_alternative<std::vector<Value>>(args[0].v)) {
-      const auto &list = std::get<std::vector<Value>>(args[0].v);
-      std::vector<Value> result;
-      for (size_t i = 0; i < list.size(); ++i) {
-        result.push_back(Value::make_int(static_cast<int64_t>(i)));
-      }
-      return Value::make_list(std::move(result));
-    }
-    if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      std::vector<Value> result;
-      for (const auto &name : obj->properties->local_keys()) {
-        result.push_back(Value::make_str(name));
-      }
-      return Value::make_list(std::move(result));
-    }
-    throw std::runtime_error("keys() requires a list or object");
-  }
-  if (marker == "__builtin_get") {
-    if (args.size() != 2)
-      throw std::runtime_error("get() requires 2 arguments (object, key)");
-    if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
-        std::holds_alternative<std::string>(args[1].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      auto prop = obj->properties->get(std::get<std::string>(args[1].v));
-      if (!prop) return Value();
-      return *prop;
-    }
-    throw std::runtime_error("get() requires (object, string)");
-  }
-  if (marker == "__builtin_set") {
-    if (args.size() != 3)
-      throw std::runtime_error(
-          "set() requires 3 arguments (object, key, value)");
-    if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
-        std::holds_alternative<std::string>(args[1].v)) {
-      auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
-      obj->properties->set(std::get<std::string>(args[1].v), args[2]);
-      return Value();
-    }
-    throw std::runtime_error("set() requires (object, string, value)");
-  }
-  if (marker == "__builtin_system") {
-    if (args.size() != 1)
-      throw std::runtime_error("system() requires 1 argument");
-    std::string cmd = std::get<std::string>(args[0].v);
-    int code = std::system(cmd.c_str());
-    return Value::make_int(static_cast<int64_t>(code));
-  }
-  if (marker == "__builtin_shell") {
-    if (args.size() != 1)
-      throw std::runtime_error("shell() requires 1 argument");
-    std::string cmd = std::get<std::string>(args[0].v);
-    std::string output;
-    FILE *pipe = popen(cmd.c_str(), "r");
-    if (!pipe) throw std::runtime_error("shell() failed to open pipe");
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), pipe)) {
-      output += buffer;
+  if (args.size() == 1 &&
+      std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    std::vector<Value> list;
+    for (const auto &name : obj->properties->local_keys()) {
+      list.push_back(Value::make_str(name));
     }
-    int status = pclose(pipe);
-    if (status == -1) throw std::runtime_error("shell() failed to close pipe");
-    return Value::make_str(output);
-  }
-  if (marker == "__builtin_getenv") {
-    if (args.size() != 1)
-      throw std::runtime_error("getenv() requires 1 argument");
-    std::string name = std::get<std::string>(args[0].v);
-    const char *value = std::getenv(name.c_str());
-    return value ? Value::make_str(value) : Value();
-  }
-  if (marker == "__builtin_setenv") {
-    if (args.size() != 2)
-      throw std::runtime_error("setenv() requires 2 arguments");
-    std::string name = std::get<std::string>(args[0].v);
-    std::string value = std::get<std::string>(args[1].v);
-    if (setenv(name.c_str(), value.c_str(), 1) != 0)
-      throw std::runtime_error("setenv() failed");
-    return Value();
-  }
-  if (marker == "__builtin_sleep") {
-    if (args.size() != 1)
-      throw std::runtime_error("sleep() requires 1 argument");
-    int64_t ms = static_cast<int64_t>(value_as_number(args[0]).as_number());
-    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
-    return Value();
-  }
-  if (marker == "__builtin_pwd") {
-    if (!args.empty()) throw std::runtime_error("pwd() takes no arguments");
-    return Value::make_str(fs::current_path().string());
+    return Value::make_list(std::move(list));
   }
-  if (marker == "__builtin_path_join") {
-    if (args.empty())
-      throw std::runtime_error("path_join() requires at least 1 argument");
-    fs::path result;
-    for (const auto &arg : args) {
-      result /= std::get<std::string>(arg.v);
-    }
-    return Value::make_str(result.string());
-  }
-  if (marker == "__builtin_basename") {
-    if (args.size() != 1)
-      throw std::runtime_error("basename() requires 1 argument");
-    fs::path p = std::get<std::string>(args[0].v);
-    return Value::make_str(p.filename().string());
-  }
-  if (marker == "__builtin_dirname") {
-    if (args.size() != 1)
-      throw std::runtime_error("dirname() requires 1 argument");
-    fs::path p = std::get<std::string>(args[0].v);
-    return Value::make_str(p.parent_path().string());
-  }
-  if (marker == "__builtin_path_is_absolute") {
-    if (args.size() != 1)
-      throw std::runtime_error("path_is_absolute() requires 1 argument");
-    fs::path p = std::get<std::string>(args[0].v);
-    return Value::make_bool(p.is_absolute());
-  }
-  if (marker == "__builtin_path_normalize") {
-    if (args.size() != 1)
-      throw std::runtime_error("path_normalize() requires 1 argument");
-    fs::path p = std::get<std::string>(args[0].v);
-    return Value::make_str(p.lexically_normal().string());
-  }
-  if (marker == "__builtin_file_ext") {
-    if (args.size() != 1)
-      throw std::runtime_error("file_ext() requires 1 argument");
-    fs::path p = std::get<std::string>(args[0].v);
-    return Value::make_str(p.extension().string());
-  }
-  if (marker == "__builtin_json_parse") {
-    if (args.size() != 1)
-      throw std::runtime_error("json_parse() requires 1 argument");
-    const std::string &text = std::get<std::string>(args[0].v);
-    size_t pos = 0;
-    Value result = parse_json_value(text, pos);
-    skip_json_ws(text, pos);
-    if (pos != text.size()) throw std::runtime_error("Invalid JSON input");
-    return result;
-  }
-  if (marker == "__builtin_json_stringify") {
-    if (args.size() != 1)
-      throw std::runtime_error("json_stringify() requires 1 argument");
-    return Value::make_str(json_stringify_value(args[0]));
-  }
-  if (marker == "__builtin_csv_parse") {
-    if (args.size() < 1 || args.size() > 2)
-      throw std::runtime_error("csv_parse() requires 1 or 2 arguments");
-    std::string text = std::get<std::string>(args[0].v);
-    std::string delim =
-        (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
-    if (delim.empty())
-      throw std::runtime_error("csv_parse() delimiter cannot be empty");
-    auto rows = parse_csv_text(text, delim[0]);
-    return Value::make_list(std::move(rows));
-  }
-  if (marker == "__builtin_csv_stringify") {
-    if (args.size() < 1 || args.size() > 2)
-      throw std::runtime_error("csv_stringify() requires 1 or 2 arguments");
-    const auto &rows = as_list(args[0]);
-    std::string delim =
-        (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
-    if (delim.empty())
-      throw std::runtime_error("csv_stringify() delimiter cannot be empty");
-    std::string output;
-    for (size_t ri = 0; ri < rows.size(); ++ri) {
-      const auto &row = rows[ri];
-      if (!std::holds_alternative<std::vector<Value>>(row.v))
-        throw std::runtime_error("csv_stringify() requires a list of rows");
-      const auto &fields = std::get<std::vector<Value>>(row.v);
-      for (size_t fi = 0; fi < fields.size(); ++fi) {
-        if (fi) output += delim;
-        output += csv_escape_field(value_to_string(fields[fi]), delim[0]);
-      }
-      if (ri + 1 < rows.size()) output += '\n';
-    }
-    return Value::make_str(output);
-  }
-  if (marker == "__builtin_mkdirs") {
-    if (args.size() != 1)
-      throw std::runtime_error("mkdirs() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::create_directories(path));
-  }
-  if (marker == "__builtin_base64_encode") {
-    if (args.size() != 1)
-      throw std::runtime_error("base64_encode() requires 1 argument");
-    return Value::make_str(base64_encode(std::get<std::string>(args[0].v)));
-  }
-  if (marker == "__builtin_base64_decode") {
-    if (args.size() != 1)
-      throw std::runtime_error("base64_decode() requires 1 argument");
-    return Value::make_str(base64_decode(std::get<std::string>(args[0].v)));
-  }
-  if (marker == "__builtin_uuid4") {
-    if (!args.empty()) throw std::runtime_error("uuid4() takes no arguments");
-    return Value::make_str(uuid4());
-  }
-  if (marker == "__builtin_glob") {
-    if (args.size() != 1)
-      throw std::runtime_error("glob() requires 1 argument");
-    std::string pattern = std::get<std::string>(args[0].v);
-    fs::path p(pattern);
-    fs::path dir = p.parent_path();
-    std::string filename_pattern = p.filename().string();
-    if (dir.empty()) dir = fs::current_path();
-    std::vector<Value> matches;
-    if (fs::exists(dir) && fs::is_directory(dir)) {
-      for (auto &entry : fs::directory_iterator(dir)) {
-        if (glob_match(filename_pattern, entry.path().filename().string())) {
-          matches.push_back(Value::make_str(entry.path().string()));
-        }
-      }
+  throw std::runtime_error("vars() accepts no args or an object instance");
+}
+
+static Value builtin_keys(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  if (std::holds_alternative<List>(args[0].v)) {
+    const auto &list = std::get<List>(args[0].v);
+    std::vector<Value> result;
+    for (size_t i = 0; i < list.size(); ++i) {
+      result.push_back(Value::make_int(static_cast<int64_t>(i)));
     }
-    return Value::make_list(std::move(matches));
+    return Value::make_list(std::move(result));
   }
-  if (marker == "__builtin_regex_match") {
-    if (args.size() != 2)
-      throw std::runtime_error("regex_match() requires 2 arguments");
-    std::string text = std::get<std::string>(args[0].v);
-    std::string pattern = std::get<std::string>(args[1].v);
-    try {
-      return Value::make_bool(std::regex_match(text, std::regex(pattern)));
-    } catch (const std::regex_error &e) {
-      throw std::runtime_error(std::string("Invalid regex: ") + e.what());
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    std::vector<Value> result;
+    for (const auto &name : obj->properties->local_keys()) {
+      result.push_back(Value::make_str(name));
     }
+    return Value::make_list(std::move(result));
   }
-  if (marker == "__builtin_regex_replace") {
-    if (args.size() != 3)
-      throw std::runtime_error("regex_replace() requires 3 arguments");
-    std::string text = std::get<std::string>(args[0].v);
-    std::string pattern = std::get<std::string>(args[1].v);
-    std::string replacement = std::get<std::string>(args[2].v);
-    try {
-      return Value::make_str(
-          std::regex_replace(text, std::regex(pattern), replacement));
-    } catch (const std::regex_error &e) {
-      throw std::runtime_error(std::string("Invalid regex: ") + e.what());
-    }
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&args[0].v)) {
+    std::vector<Value> result;
+    result.reserve((*dict)->size());
+    (*dict)->for_each(
+        [&](const Value &key, const Value &) { result.push_back(key); });
+    return Value::make_list(std::move(result));
   }
-#ifdef BLOA_USE_MYSQL
-  if (marker == "__builtin_mysql_connect") {
-    if (args.size() < 4 || args.size() > 5)
-      throw std::runtime_error("mysql_connect() requires 4 or 5 arguments");
-    std::string host = std::get<std::string>(args[0].v);
-    std::string user = std::get<std::string>(args[1].v);
-    std::string pass = std::get<std::string>(args[2].v);
-    std::string db = std::get<std::string>(args[3].v);
-    unsigned int port = 3306;
-    if (args.size() == 5)
-      port = static_cast<unsigned int>(value_as_number(args[4]).as_number());
-    MYSQL *conn = mysql_init(nullptr);
-    if (!conn) throw std::runtime_error("mysql_init() failed");
-    if (!mysql_real_connect(conn, host.c_str(), user.c_str(), pass.c_str(),
-                            db.c_str(), port, nullptr, 0)) {
-      std::string err = mysql_error(conn);
-      mysql_close(conn);
-      throw std::runtime_error("MySQL connection failed: " + err);
-    }
-    int id = next_mysql_connection_id++;
-    mysql_connections[id] = conn;
-    return Value::make_int(id);
-  }
-  if (marker == "__builtin_mysql_close") {
-    if (args.size() != 1)
-      throw std::runtime_error("mysql_close() requires 1 connection id");
-    int id = static_cast<int>(value_as_number(args[0]).as_number());
-    auto it = mysql_connections.find(id);
-    if (it == mysql_connections.end())
-      throw std::runtime_error("Invalid MySQL connection id");
-    mysql_close(it->second);
-    mysql_connections.erase(it);
+  throw std::runtime_error("keys() requires a list, dict or object");
+}
+
+static Value builtin_values(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  const auto *dict = std::get_if<std::shared_ptr<Dict>>(&args[0].v);
+  if (!dict) throw std::runtime_error("values() requires a dict");
+  std::vector<Value> result;
+  result.reserve((*dict)->size());
+  (*dict)->for_each(
+      [&](const Value &, const Value &value) { result.push_back(value); });
+  return Value::make_list(std::move(result));
+}
+
+static Value builtin_dict(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  auto dict = std::make_shared<Dict>();
+  if (!args.empty())
+    dict->reserve(static_cast<size_t>(
+        std::max(0.0, value_as_number(args[0]).as_number())));
+  return Value::make_dict(std::move(dict));
+}
+
+static Value builtin_get(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
+      std::holds_alternative<std::string>(args[1].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    auto prop = obj->properties->get(std::get<std::string>(args[1].v));
+    if (!prop) return Value();
+    return *prop;
+  }
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&args[0].v)) {
+    const Value *found = (*dict)->find(args[1]);
+    return found ? *found : Value();
+  }
+  throw std::runtime_error("get() requires (object, string) or (dict, key)");
+}
+
+static Value builtin_set(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (std::holds_alternative<std::shared_ptr<ObjectInstance>>(args[0].v) &&
+      std::holds_alternative<std::string>(args[1].v)) {
+    auto obj = std::get<std::shared_ptr<ObjectInstance>>(args[0].v);
+    obj->properties->set(std::get<std::string>(args[1].v), args[2]);
     return Value();
   }
-  if (marker == "__builtin_mysql_escape") {
-    if (args.size() != 2)
-      throw std::runtime_error("mysql_escape() requires 2 arguments");
-    int id = static_cast<int>(value_as_number(args[0]).as_number());
-    auto it = mysql_connections.find(id);
-    if (it == mysql_connections.end())
-      throw std::runtime_error("Invalid MySQL connection id");
-    std::string value = std::get<std::string>(args[1].v);
-    std::string out(value.size() * 2 + 1, '\0');
-    unsigned long len =
-        mysql_real_escape_string(it->second, out.data(), value.c_str(),
-                                 static_cast<unsigned long>(value.size()));
-    out.resize(len);
-    return Value::make_str(out);
-  }
-  if (marker == "__builtin_mysql_query") {
-    if (args.size() != 2)
-      throw std::runtime_error("mysql_query() requires 2 arguments");
-    int id = static_cast<int>(value_as_number(args[0]).as_number());
-    auto it = mysql_connections.find(id);
-    if (it == mysql_connections.end())
-      throw std::runtime_error("Invalid MySQL connection id");
-    std::string sql = std::get<std::string>(args[1].v);
-    if (mysql_query(it->second, sql.c_str()) != 0) {
-      throw std::runtime_error(std::string("MySQL query failed: ") +
-                               mysql_error(it->second));
-    }
-    MYSQL_RES *result = mysql_store_result(it->second);
-    if (!result) return Value::make_list({});
-    std::vector<Value> rows;
-    MYSQL_ROW row;
-    unsigned int num_fields = mysql_num_fields(result);
-    while ((row = mysql_fetch_row(result))) {
-      std::vector<Value> row_values;
-      unsigned long *lengths = mysql_fetch_lengths(result);
-      for (unsigned int i = 0; i < num_fields; ++i) {
-        if (row[i])
-          row_values.push_back(
-              Value::make_str(std::string(row[i], lengths[i])));
-        else
-          row_values.push_back(Value());
-      }
-      rows.push_back(Value::make_list(std::move(row_values)));
-    }
-    mysql_free_result(result);
-    return Value::make_list(std::move(rows));
-  }
-  if (marker == "__builtin_mysql_exec") {
-    if (args.size() != 2)
-      throw std::runtime_error("mysql_exec() requires 2 arguments");
-    int id = static_cast<int>(value_as_number(args[0]).as_number());
-    auto it = mysql_connections.find(id);
-    if (it == mysql_connections.end())
-      throw std::runtime_error("Invalid MySQL connection id");
-    std::string sql = std::get<std::string>(args[1].v);
-    if (mysql_query(it->second, sql.c_str()) != 0) {
-      throw std::runtime_error(std::string("MySQL exec failed: ") +
-                               mysql_error(it->second));
-    }
-    auto affected = mysql_affected_rows(it->second);
-    return Value::make_int(static_cast<int64_t>(affected));
-  }
-#endif
-  if (marker == "__builtin_str") {
-    if (args.size() != 1) throw std::runtime_error("str() requires 1 argument");
-    return Value::make_str(value_to_string(args[0]));
-  }
-  if (marker == "__builtin_sqrt") {
-    if (args.size() != 1)
-      throw std::runtime_error("sqrt() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::sqrt(x));
-  }
-  if (marker == "__builtin_pow") {
-    if (args.size() != 2)
-      throw std::runtime_error("pow() requires 2 arguments");
-    double base = value_as_number(args[0]).as_number();
-    double exp = value_as_number(args[1]).as_number();
-    return Value::make_double(std::pow(base, exp));
-  }
-  if (marker == "__builtin_sin") {
-    if (args.size() != 1) throw std::runtime_error("sin() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::sin(x));
-  }
-  if (marker == "__builtin_cos") {
-    if (args.size() != 1) throw std::runtime_error("cos() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::cos(x));
-  }
-  if (marker == "__builtin_tan") {
-    if (args.size() != 1) throw std::runtime_error("tan() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::tan(x));
-  }
-  if (marker == "__builtin_log") {
-    if (args.size() != 1) throw std::runtime_error("log() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::log(x));
-  }
-  if (marker == "__builtin_exp") {
-    if (args.size() != 1) throw std::runtime_error("exp() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::exp(x));
-  }
-  if (marker == "__builtin_abs") {
-    if (args.size() != 1) throw std::runtime_error("abs() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::abs(x));
-  }
-  if (marker == "__builtin_floor") {
-    if (args.size() != 1)
-      throw std::runtime_error("floor() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::floor(x));
-  }
-  if (marker == "__builtin_ceil") {
-    if (args.size() != 1)
-      throw std::runtime_error("ceil() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::ceil(x));
-  }
-  if (marker == "__builtin_round") {
-    if (args.size() != 1)
-      throw std::runtime_error("round() requires 1 argument");
-    double x = value_as_number(args[0]).as_number();
-    return Value::make_double(std::round(x));
-  }
-  if (marker == "__builtin_pi") {
-    return Value::make_double(3.141592653589793);
-  }
-  if (marker == "__builtin_e") {
-    return Value::make_double(2.718281828459045);
-  }
-  if (marker == "__builtin_read_file") {
-    if (args.size() != 1)
-      throw std::runtime_error("read_file() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    std::ifstream ifs(path);
-    if (!ifs) throw std::runtime_error("Cannot open file: " + path);
-    std::string content((std::istreambuf_iterator<char>(ifs)),
-                        std::istreambuf_iterator<char>());
-    return Value::make_str(content);
-  }
-  if (marker == "__builtin_write_file") {
-    if (args.size() != 2)
-      throw std::runtime_error("write_file() requires 2 arguments");
-    std::string path = std::get<std::string>(args[0].v);
-    std::string content = std::get<std::string>(args[1].v);
-    std::ofstream ofs(path);
-    if (!ofs) throw std::runtime_error("Cannot open file for writing: " + path);
-    ofs << content;
+  if (const auto *dict = std::get_if<std::shared_ptr<Dict>>(&args[0].v)) {
+    (*dict)->set(args[1], args[2]);
     return Value();
   }
-  if (marker == "__builtin_exists") {
-    if (args.size() != 1)
-      throw std::runtime_error("exists() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::exists(path));
-  }
-  if (marker == "__builtin_list_dir") {
-    if (args.size() != 1)
-      throw std::runtime_error("list_dir() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    std::vector<Value> list;
-    std::transform(fs::directory_iterator(path), fs::directory_iterator{},
-                   std::back_inserter(list), [](const auto &entry) {
-                     return Value::make_str(entry.path().string());
-                   });
-    return Value::make_list(list);
-  }
-  if (marker == "__builtin_mkdir") {
-    if (args.size() != 1)
-      throw std::runtime_error("mkdir() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::create_directory(path));
-  }
-  if (marker == "__builtin_rmdir") {
-    if (args.size() != 1)
-      throw std::runtime_error("rmdir() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::remove(path));
-  }
-  if (marker == "__builtin_remove") {
-    if (args.size() != 1)
-      throw std::runtime_error("remove() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::remove(path));
-  }
-  if (marker == "__builtin_copy_file") {
-    if (args.size() != 2)
-      throw std::runtime_error("copy_file() requires 2 arguments");
-    std::string from = std::get<std::string>(args[0].v);
-    std::string to = std::get<std::string>(args[1].v);
-    fs::copy_file(from, to);
-    return Value();
+  throw std::runtime_error(
+      "set() requires (object, string, value) or (dict, key, value)");
+}
+
+static Value builtin_system(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string cmd = std::get<std::string>(args[0].v);
+  flush_output();
+  int code = std::system(cmd.c_str());
+  return Value::make_int(static_cast<int64_t>(code));
+}
+
+static Value builtin_shell(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  std::string cmd = std::get<std::string>(args[0].v);
+  std::string output;
+  flush_output();
+  FILE *pipe = popen(cmd.c_str(), "r");
+  if (!pipe) throw std::runtime_error("shell() failed to open pipe");
+  char buffer[256];
+  while (fgets(buffer, sizeof(buffer), pipe)) {
+    output += buffer;
+  }
+  int status = pclose(pipe);
+  if (status == -1) throw std::runtime_error("shell() failed to close pipe");
+  return Value::make_str(output);
+}
+
+static Value builtin_getenv(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string name = std::get<std::string>(args[0].v);
+  const char *value = std::getenv(name.c_str());
+  return value ? Value::make_str(value) : Value();
+}
+
+static Value builtin_setenv(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string name = std::get<std::string>(args[0].v);
+  std::string value = std::get<std::string>(args[1].v);
+  if (setenv(name.c_str(), value.c_str(), 1) != 0)
+    throw std::runtime_error("setenv() failed");
+  return Value();
+}
+
+static Value builtin_sleep(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  int64_t ms = static_cast<int64_t>(value_as_number(args[0]).as_number());
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  return Value();
+}
+
+static Value builtin_pwd(const std::vector<Value> &,
+                         const std::shared_ptr<Environment> &) {
+  return Value::make_str(fs::current_path().string());
+}
+
+static Value builtin_path_join(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  fs::path result;
+  for (const auto &arg : args) {
+    result /= std::get<std::string>(arg.v);
   }
-  if (marker == "__builtin_move") {
-    if (args.size() != 2)
-      throw std::runtime_error("move() requires 2 arguments");
-    std::string from = std::get<std::string>(args[0].v);
-    std::string to = std::get<std::string>(args[1].v);
-    fs::rename(from, to);
-    return Value();
+  return Value::make_str(result.string());
+}
+
+static Value builtin_basename(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  fs::path p = std::get<std::string>(args[0].v);
+  return Value::make_str(p.filename().string());
+}
+
+static Value builtin_dirname(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  fs::path p = std::get<std::string>(args[0].v);
+  return Value::make_str(p.parent_path().string());
+}
+
+static Value builtin_path_is_absolute(const std::vector<Value> &args,
+                                      const std::shared_ptr<Environment> &) {
+  fs::path p = std::get<std::string>(args[0].v);
+  return Value::make_bool(p.is_absolute());
+}
+
+static Value builtin_path_normalize(const std::vector<Value> &args,
+                                    const std::shared_ptr<Environment> &) {
+  fs::path p = std::get<std::string>(args[0].v);
+  return Value::make_str(p.lexically_normal().string());
+}
+
+static Value builtin_file_ext(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  fs::path p = std::get<std::string>(args[0].v);
+  return Value::make_str(p.extension().string());
+}
+
+static Value builtin_json_parse(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  const std::string &text = std::get<std::string>(args[0].v);
+  size_t pos = 0;
+  Value result = parse_json_value(text, pos);
+  skip_json_ws(text, pos);
+  if (pos != text.size()) throw std::runtime_error("Invalid JSON input");
+  return result;
+}
+
+static Value builtin_json_stringify(const std::vector<Value> &args,
+                                    const std::shared_ptr<Environment> &) {
+  std::string out;
+  json_write_value(args[0], out);
+  return Value::make_str(std::move(out));
+}
+
+// A newline-delimited JSON file read in fixed-size chunks. Lines are parsed
+// in place in the chunk; only a line that crosses a chunk boundary is
+// copied, into `partial`.
+struct NdjsonReader {
+  static constexpr size_t kChunkSize = 1 << 20;
+
+  std::ifstream in;
+  std::vector<char> buffer;
+  std::string partial;
+  size_t pos = 0;
+  size_t size = 0;
+  size_t line_number = 0;
+  bool done = false;
+
+  explicit NdjsonReader(const std::string &path)
+      : in(path, std::ios::binary), buffer(kChunkSize) {
+    if (!in) throw std::runtime_error("Cannot open NDJSON file: " + path);
   }
-  if (marker == "__builtin_file_size") {
-    if (args.size() != 1)
-      throw std::runtime_error("file_size() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_int(fs::file_size(path));
-  }
-  if (marker == "__builtin_is_dir") {
-    if (args.size() != 1)
-      throw std::runtime_error("is_dir() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    return Value::make_bool(fs::is_directory(path));
-  }
-  if (marker == "__builtin_split") {
-    if (args.size() < 1 || args.size() > 2)
-      throw std::runtime_error("split() requires 1 or 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string delim =
-        (args.size() == 2) ? std::get<std::string>(args[1].v) : " ";
-    std::vector<Value> list;
-    size_t pos = 0;
-    while ((pos = s.find(delim)) != std::string::npos) {
-      list.push_back(Value::make_str(s.substr(0, pos)));
-      s.erase(0, pos + delim.length());
+
+  // The value on the next non-blank line, or false at the end of the file.
+  bool next(Value &out) {
+    while (true) {
+      std::string_view line;
+      if (pos < size) {
+        const char *start = buffer.data() + pos;
+        const void *newline = std::memchr(start, '\n', size - pos);
+        if (!newline) {
+          partial.append(start, size - pos);
+          pos = size;
+          continue;
+        }
+        size_t len = static_cast<const char *>(newline) - start;
+        pos += len + 1;
+        if (partial.empty()) {
+          line = std::string_view(start, len);
+        } else {
+          partial.append(start, len);
+          line = partial;
+        }
+      } else if (!done) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        size = static_cast<size_t>(in.gcount());
+        pos = 0;
+        if (size > 0) continue;
+        if (in.bad()) throw std::runtime_error("NDJSON read failed");
+        done = true;
+        if (partial.empty()) return false;
+        line = partial;
+      } else {
+        return false;
+      }
+      ++line_number;
+      bool parsed = parse_line(line, out);
+      partial.clear();
+      if (parsed) return true;
     }
-    list.push_back(Value::make_str(s));
-    return Value::make_list(list);
-  }
-  if (marker == "__builtin_join") {
-    if (args.size() != 2)
-      throw std::runtime_error("join() requires 2 arguments");
-    const auto &list = as_list(args[0]);
-    std::string sep = std::get<std::string>(args[1].v);
-    std::string result;
-    for (size_t i = 0; i < list.size(); ++i) {
-      if (i > 0) result += sep;
-      result += value_to_string(list[i]);
+  }
+
+ private:
+  bool parse_line(std::string_view line, Value &out) {
+    size_t at = 0;
+    skip_json_ws(line, at);
+    if (at == line.size()) return false;
+    try {
+      out = parse_json_value(line, at);
+      skip_json_ws(line, at);
+      if (at != line.size()) throw std::runtime_error("Invalid JSON input");
+    } catch (const std::runtime_error &e) {
+      throw std::runtime_error("NDJSON line " + std::to_string(line_number) +
+                               ": " + e.what());
     }
-    return Value::make_str(result);
-  }
-  if (marker == "__builtin_substr") {
-    if (args.size() < 2 || args.size() > 3)
-      throw std::runtime_error("substr() requires 2 or 3 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    size_t start = static_cast<size_t>(value_as_number(args[1]).as_number());
-    size_t len = (args.size() == 3)
-                     ? static_cast<size_t>(value_as_number(args[2]).as_number())
-                     : std::string::npos;
-    return Value::make_str(s.substr(start, len));
-  }
-  if (marker == "__builtin_find") {
-    if (args.size() != 2)
-      throw std::runtime_error("find() requires 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string sub = std::get<std::string>(args[1].v);
-    size_t pos = s.find(sub);
-    return Value::make_int(
-        pos == std::string::npos ? -1 : static_cast<int64_t>(pos));
-  }
-  if (marker == "__builtin_replace") {
-    if (args.size() != 3)
-      throw std::runtime_error("replace() requires 3 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string old_str = std::get<std::string>(args[1].v);
-    std::string new_str = std::get<std::string>(args[2].v);
-    size_t pos = 0;
-    while ((pos = s.find(old_str, pos)) != std::string::npos) {
-      s.replace(pos, old_str.length(), new_str);
-      pos += new_str.length();
+    return true;
+  }
+};
+
+static std::unordered_map<int, std::unique_ptr<NdjsonReader>> ndjson_readers;
+static int next_ndjson_reader_id = 1;
+
+static Value builtin_ndjson_open(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  auto reader =
+      std::make_unique<NdjsonReader>(std::get<std::string>(args[0].v));
+  int id = next_ndjson_reader_id++;
+  ndjson_readers[id] = std::move(reader);
+  return Value::make_int(id);
+}
+
+// Returns up to `n` values, one per line. As with csv_next, the call that
+// finds nothing left closes the reader and returns an empty list.
+static Value builtin_ndjson_next(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  auto it = ndjson_readers.find(id);
+  if (it == ndjson_readers.end())
+    throw std::runtime_error("Invalid NDJSON reader id");
+  int64_t n = args.size() > 1
+                  ? static_cast<int64_t>(value_as_number(args[1]).as_number())
+                  : 1000;
+  if (n <= 0) throw std::runtime_error("ndjson_next() batch size must be > 0");
+  std::vector<Value> values;
+  values.reserve(static_cast<size_t>(std::min<int64_t>(n, 4096)));
+  Value value;
+  while (static_cast<int64_t>(values.size()) < n && it->second->next(value))
+    values.push_back(std::move(value));
+  if (values.empty()) ndjson_readers.erase(it);
+  return Value::make_list(std::move(values));
+}
+
+static Value builtin_ndjson_close(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  if (ndjson_readers.erase(id) == 0)
+    throw std::runtime_error("Invalid NDJSON reader id");
+  return Value();
+}
+
+static Value builtin_csv_parse(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string text = std::get<std::string>(args[0].v);
+  std::string delim =
+      (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
+  if (delim.empty())
+    throw std::runtime_error("csv_parse() delimiter cannot be empty");
+  auto rows = parse_csv_text(text, delim[0]);
+  return Value::make_list(std::move(rows));
+}
+
+static Value builtin_csv_stringify(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  const auto &rows = as_list(args[0]);
+  std::string delim =
+      (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
+  if (delim.empty())
+    throw std::runtime_error("csv_stringify() delimiter cannot be empty");
+  std::string output;
+  for (size_t ri = 0; ri < rows.size(); ++ri) {
+    const auto &row = rows[ri];
+    if (!std::holds_alternative<List>(row.v))
+      throw std::runtime_error("csv_stringify() requires a list of rows");
+    const auto &fields = std::get<List>(row.v);
+    for (size_t fi = 0; fi < fields.size(); ++fi) {
+      if (fi) output += delim;
+      output += csv_escape_field(value_to_string(fields[fi]), delim[0]);
     }
-    return Value::make_str(s);
-  }
-  if (marker == "__builtin_to_upper") {
-    if (args.size() != 1)
-      throw std::runtime_error("to_upper() requires 1 argument");
-    std::string s = std::get<std::string>(args[0].v);
-    std::transform(s.begin(), s.end(), s.begin(), ::toupper);
-    return Value::make_str(s);
-  }
-  if (marker == "__builtin_to_lower") {
-    if (args.size() != 1)
-      throw std::runtime_error("to_lower() requires 1 argument");
-    std::string s = std::get<std::string>(args[0].v);
-    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
-    return Value::make_str(s);
-  }
-  if (marker == "__builtin_trim") {
-    if (args.size() != 1)
-      throw std::runtime_error("trim() requires 1 argument");
-    std::string s = std::get<std::string>(args[0].v);
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-              return !std::isspace(ch);
-            }));
-    s.erase(std::find_if(s.rbegin(), s.rend(),
-                         [](unsigned char ch) { return !std::isspace(ch); })
-                .base(),
-            s.end());
-    return Value::make_str(s);
-  }
-  if (marker == "__builtin_starts_with") {
-    if (args.size() != 2)
-      throw std::runtime_error("starts_with() requires 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string prefix = std::get<std::string>(args[1].v);
-    return Value::make_bool(s.starts_with(prefix));
-  }
-  if (marker == "__builtin_ends_with") {
-    if (args.size() != 2)
-      throw std::runtime_error("ends_with() requires 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string suffix = std::get<std::string>(args[1].v);
-    return Value::make_bool(s.ends_with(suffix));
-  }
-  if (marker == "__builtin_contains") {
-    if (args.size() != 2)
-      throw std::runtime_error("contains() requires 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    std::string sub = std::get<std::string>(args[1].v);
-    return Value::make_bool(s.find(sub) != std::string::npos);
-  }
-  if (marker == "__builtin_reverse") {
-    if (args.size() != 1)
-      throw std::runtime_error("reverse() requires 1 argument");
-    std::string s = std::get<std::string>(args[0].v);
-    std::reverse(s.begin(), s.end());
-    return Value::make_str(s);
-  }
-  if (marker == "__builtin_repeat") {
-    if (args.size() != 2)
-      throw std::runtime_error("repeat() requires 2 arguments");
-    std::string s = std::get<std::string>(args[0].v);
-    int64_t n = static_cast<int64_t>(value_as_number(args[1]).as_number());
-    std::string result;
-    for (int64_t i = 0; i < n; ++i) result += s;
-    return Value::make_str(result);
-  }
-  if (marker == "__builtin_baar_create") {
-    if (args.size() != 2)
-      throw std::runtime_error("baar_create() requires 2 arguments");
-    std::string path = std::get<std::string>(args[0].v);
-    const auto &files = as_list(args[1]);
-    std::vector<std::pair<std::string, std::string>> entries;
-    for (const auto &entry_val : files) {
-      if (!std::holds_alternative<std::vector<Value>>(entry_val.v))
-        throw std::runtime_error(
-            "baar_create() file list must contain [name, data] entries");
-      const auto &entry = std::get<std::vector<Value>>(entry_val.v);
-      if (entry.size() != 2)
-        throw std::runtime_error("baar_create() entry must be [name, data]");
-      if (!std::holds_alternative<std::string>(entry[0].v))
-        throw std::runtime_error("baar_create() entry name must be a string");
-      entries.emplace_back(std::get<std::string>(entry[0].v),
-                           value_to_string(entry[1]));
+    if (ri + 1 < rows.size()) output += '\n';
+  }
+  return Value::make_str(output);
+}
+
+// A CSV file read in fixed-size chunks. Only the current chunk and the row
+// being assembled are held, so memory does not grow with the file.
+struct CsvReader {
+  static constexpr size_t kChunkSize = 1 << 20;
+
+  std::ifstream in;
+  CsvParser parser;
+  std::vector<char> buffer;
+  size_t pos = 0;
+  size_t size = 0;
+  bool done = false;
+
+  CsvReader(const std::string &path, char delim)
+      : in(path, std::ios::binary), parser(delim), buffer(kChunkSize) {
+    if (!in) throw std::runtime_error("Cannot open CSV file: " + path);
+  }
+
+  // The next row, or false once the file is exhausted.
+  bool next(Value &row) {
+    while (!done) {
+      if (parser.next_row(buffer.data(), size, pos, row)) return true;
+      in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      size = static_cast<size_t>(in.gcount());
+      pos = 0;
+      if (size == 0) {
+        if (in.bad()) throw std::runtime_error("CSV read failed");
+        done = true;
+        return parser.finish(row);
+      }
     }
-    write_archive(path, entries);
-    return Value();
+    return false;
   }
-  if (marker == "__builtin_baar_extract") {
-    if (args.size() != 2)
-      throw std::runtime_error("baar_extract() requires 2 arguments");
-    std::string path = std::get<std::string>(args[0].v);
-    std::string dest = std::get<std::string>(args[1].v);
-    auto entries = read_archive(path);
-    fs::create_directories(dest);
-    for (const auto &entry : entries) {
-      fs::path out_path = fs::path(dest) / entry.first;
-      fs::create_directories(out_path.parent_path());
-      std::ofstream ofs(out_path, std::ios::binary);
-      ofs << entry.second;
+};
+
+static std::unordered_map<int, std::unique_ptr<CsvReader>> csv_readers;
+static int next_csv_reader_id = 1;
+
+static Value builtin_csv_open(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string delim =
+      (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
+  if (delim.empty())
+    throw std::runtime_error("csv_open() delimiter cannot be empty");
+  auto reader =
+      std::make_unique<CsvReader>(std::get<std::string>(args[0].v), delim[0]);
+  int id = next_csv_reader_id++;
+  csv_readers[id] = std::move(reader);
+  return Value::make_int(id);
+}
+
+// Returns up to `n` rows. The reader is closed by the call that finds no
+// rows left, which returns an empty list.
+static Value builtin_csv_next(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  auto it = csv_readers.find(id);
+  if (it == csv_readers.end())
+    throw std::runtime_error("Invalid CSV reader id");
+  int64_t n = args.size() > 1
+                  ? static_cast<int64_t>(value_as_number(args[1]).as_number())
+                  : 1000;
+  if (n <= 0) throw std::runtime_error("csv_next() batch size must be > 0");
+  std::vector<Value> rows;
+  rows.reserve(static_cast<size_t>(std::min<int64_t>(n, 4096)));
+  Value row;
+  while (static_cast<int64_t>(rows.size()) < n && it->second->next(row))
+    rows.push_back(std::move(row));
+  if (rows.empty()) csv_readers.erase(it);
+  return Value::make_list(std::move(rows));
+}
+
+static Value builtin_csv_close(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  if (csv_readers.erase(id) == 0)
+    throw std::runtime_error("Invalid CSV reader id");
+  return Value();
+}
+
+// One numeric column of a CSV file as an array, streamed without building
+// the rows. A column named by a string is looked up in the header row; a
+// column index means the file has no header. Empty or missing fields are
+// NaN.
+static Value builtin_csv_column(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  std::string delim =
+      (args.size() == 3) ? std::get<std::string>(args[2].v) : ",";
+  if (delim.empty())
+    throw std::runtime_error("csv_column() delimiter cannot be empty");
+  CsvReader reader(std::get<std::string>(args[0].v), delim[0]);
+  Value row;
+  size_t column;
+  if (const auto *name = std::get_if<std::string>(&args[1].v)) {
+    if (!reader.next(row)) throw std::runtime_error("CSV file is empty");
+    const auto &header = row.as_list();
+    auto it = std::find_if(header.begin(), header.end(), [&](const Value &v) {
+      return std::get<std::string>(v.v) == *name;
+    });
+    if (it == header.end())
+      throw std::runtime_error("CSV has no column '" + *name + "'");
+    column = static_cast<size_t>(it - header.begin());
+  } else {
+    int64_t index = static_cast<int64_t>(value_as_number(args[1]).as_number());
+    if (index < 0) throw std::runtime_error("csv_column() index must be >= 0");
+    column = static_cast<size_t>(index);
+  }
+  ArrayBuilder out;
+  while (reader.next(row)) {
+    const auto &fields = row.as_list();
+    if (column < fields.size())
+      out.add(fields[column]);
+    else
+      out.add(std::numeric_limits<double>::quiet_NaN());
+  }
+  return out.build();
+}
+
+static Value builtin_mkdirs(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::create_directories(path));
+}
+
+static Value builtin_base64_encode(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  return Value::make_str(base64_encode(std::get<std::string>(args[0].v)));
+}
+
+static Value builtin_base64_decode(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  return Value::make_str(base64_decode(std::get<std::string>(args[0].v)));
+}
+
+static Value builtin_uuid4(const std::vector<Value> &,
+                           const std::shared_ptr<Environment> &) {
+  return Value::make_str(uuid4());
+}
+
+static Value builtin_glob(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  std::string pattern = std::get<std::string>(args[0].v);
+  fs::path p(pattern);
+  fs::path dir = p.parent_path();
+  std::string filename_pattern = p.filename().string();
+  if (dir.empty()) dir = fs::current_path();
+  std::vector<Value> matches;
+  if (fs::exists(dir) && fs::is_directory(dir)) {
+    for (auto &entry : fs::directory_iterator(dir)) {
+      if (glob_match(filename_pattern, entry.path().filename().string())) {
+        matches.push_back(Value::make_str(entry.path().string()));
+      }
     }
-    return Value();
   }
-  if (marker == "__builtin_baar_list") {
-    if (args.size() != 1)
-      throw std::runtime_error("baar_list() requires 1 argument");
-    std::string path = std::get<std::string>(args[0].v);
-    auto entries = read_archive(path);
-    std::vector<Value> list;
-    for (const auto &entry : entries) {
-      list.push_back(Value::make_str(entry.first));
+  return Value::make_list(std::move(matches));
+}
+
+static Value builtin_regex_match(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  const auto &text = std::get<std::string>(args[0].v);
+  const auto &pattern = std::get<std::string>(args[1].v);
+  const std::regex &re = regex_cache.get(pattern);
+  try {
+    return Value::make_bool(std::regex_match(text, re));
+  } catch (const std::regex_error &e) {
+    throw std::runtime_error(std::string("Invalid regex: ") + e.what());
+  }
+}
+
+static Value builtin_regex_replace(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  const auto &text = std::get<std::string>(args[0].v);
+  const auto &pattern = std::get<std::string>(args[1].v);
+  const auto &replacement = std::get<std::string>(args[2].v);
+  const std::regex &re = regex_cache.get(pattern);
+  try {
+    return Value::make_str(std::regex_replace(text, re, replacement));
+  } catch (const std::regex_error &e) {
+    throw std::runtime_error(std::string("Invalid regex: ") + e.what());
+  }
+}
+
+#ifdef BLOA_USE_MYSQL
+// A streaming result. Rows are pulled from the server as mysql_fetch asks
+// for them, so its connection cannot run anything else until the cursor is
+// exhausted or closed.
+struct MysqlCursor {
+  int connection = 0;
+  MYSQL_RES *result = nullptr;
+};
+
+// A server-side prepared statement. The bind buffers are reused for every
+// row of a batch.
+struct MysqlStatement {
+  int connection = 0;
+  MYSQL_STMT *stmt = nullptr;
+  std::vector<MYSQL_BIND> binds;
+  std::vector<int64_t> ints;
+  std::vector<double> doubles;
+  std::vector<unsigned long> lengths;
+};
+
+static std::unordered_map<int, MysqlCursor> mysql_cursors;
+static std::unordered_map<int, MysqlStatement> mysql_statements;
+static int next_mysql_cursor_id = 1;
+static int next_mysql_statement_id = 1;
+
+static int mysql_id(const Value &v) {
+  return static_cast<int>(value_as_number(v).as_number());
+}
+
+// The connection `id` names. Unless `idle_only` is false, a connection
+// still streaming a cursor is refused, since the server would reject the
+// command as out of sync.
+static MYSQL *mysql_connection(const Value &id, bool idle_only = true) {
+  int key = mysql_id(id);
+  auto it = mysql_connections.find(key);
+  if (it == mysql_connections.end())
+    throw std::runtime_error("Invalid MySQL connection id");
+  if (idle_only) {
+    for (const auto &[cursor_id, cursor] : mysql_cursors) {
+      if (cursor.connection == key)
+        throw std::runtime_error("MySQL connection has an open cursor (" +
+                                 std::to_string(cursor_id) + ")");
     }
-    return Value::make_list(list);
-  }
-  if (marker == "__builtin_baar_read") {
-    if (args.size() != 2)
-      throw std::runtime_error("baar_read() requires 2 arguments");
-    std::string path = std::get<std::string>(args[0].v);
-    std::string name = std::get<std::string>(args[1].v);
-    auto entries = read_archive(path);
-    for (const auto &entry : entries) {
-      if (entry.first == name) return Value::make_str(entry.second);
+  }
+  return it->second;
+}
+
+static Value mysql_row_value(MYSQL_ROW row, unsigned long *lengths,
+                             unsigned int num_fields) {
+  std::vector<Value> row_values;
+  row_values.reserve(num_fields);
+  for (unsigned int i = 0; i < num_fields; ++i) {
+    if (row[i])
+      row_values.push_back(Value::make_str(std::string(row[i], lengths[i])));
+    else
+      row_values.push_back(Value());
+  }
+  return Value::make_list(std::move(row_values));
+}
+
+static void mysql_close_cursor(
+    std::unordered_map<int, MysqlCursor>::iterator it) {
+  // Freeing an unbuffered result reads and discards the rows still pending.
+  mysql_free_result(it->second.result);
+  mysql_cursors.erase(it);
+}
+
+static Value builtin_mysql_connect(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  std::string host = std::get<std::string>(args[0].v);
+  std::string user = std::get<std::string>(args[1].v);
+  std::string pass = std::get<std::string>(args[2].v);
+  std::string db = std::get<std::string>(args[3].v);
+  unsigned int port = 3306;
+  if (args.size() == 5)
+    port = static_cast<unsigned int>(value_as_number(args[4]).as_number());
+  MYSQL *conn = mysql_init(nullptr);
+  if (!conn) throw std::runtime_error("mysql_init() failed");
+  if (!mysql_real_connect(conn, host.c_str(), user.c_str(), pass.c_str(),
+                          db.c_str(), port, nullptr, 0)) {
+    std::string err = mysql_error(conn);
+    mysql_close(conn);
+    throw std::runtime_error("MySQL connection failed: " + err);
+  }
+  int id = next_mysql_connection_id++;
+  mysql_connections[id] = conn;
+  return Value::make_int(id);
+}
+
+static Value builtin_mysql_close(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  int id = mysql_id(args[0]);
+  MYSQL *conn = mysql_connection(args[0], false);
+  for (auto it = mysql_cursors.begin(); it != mysql_cursors.end();) {
+    auto next = std::next(it);
+    if (it->second.connection == id) mysql_close_cursor(it);
+    it = next;
+  }
+  std::erase_if(mysql_statements, [id](auto &entry) {
+    if (entry.second.connection != id) return false;
+    mysql_stmt_close(entry.second.stmt);
+    return true;
+  });
+  mysql_close(conn);
+  mysql_connections.erase(id);
+  return Value();
+}
+
+static Value builtin_mysql_escape(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  MYSQL *conn = mysql_connection(args[0], false);
+  std::string value = std::get<std::string>(args[1].v);
+  std::string out(value.size() * 2 + 1, '\0');
+  unsigned long len =
+      mysql_real_escape_string(conn, out.data(), value.c_str(),
+                               static_cast<unsigned long>(value.size()));
+  out.resize(len);
+  return Value::make_str(out);
+}
+
+static Value builtin_mysql_query(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  MYSQL *conn = mysql_connection(args[0]);
+  std::string sql = std::get<std::string>(args[1].v);
+  if (mysql_query(conn, sql.c_str()) != 0) {
+    throw std::runtime_error(std::string("MySQL query failed: ") +
+                             mysql_error(conn));
+  }
+  MYSQL_RES *result = mysql_store_result(conn);
+  if (!result) return Value::make_list({});
+  std::vector<Value> rows;
+  rows.reserve(static_cast<size_t>(mysql_num_rows(result)));
+  MYSQL_ROW row;
+  unsigned int num_fields = mysql_num_fields(result);
+  while ((row = mysql_fetch_row(result)))
+    rows.push_back(
+        mysql_row_value(row, mysql_fetch_lengths(result), num_fields));
+  mysql_free_result(result);
+  return Value::make_list(std::move(rows));
+}
+
+static Value builtin_mysql_exec(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  MYSQL *conn = mysql_connection(args[0]);
+  std::string sql = std::get<std::string>(args[1].v);
+  if (mysql_query(conn, sql.c_str()) != 0) {
+    throw std::runtime_error(std::string("MySQL exec failed: ") +
+                             mysql_error(conn));
+  }
+  auto affected = mysql_affected_rows(conn);
+  return Value::make_int(static_cast<int64_t>(affected));
+}
+
+static Value builtin_mysql_cursor(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  MYSQL *conn = mysql_connection(args[0]);
+  std::string sql = std::get<std::string>(args[1].v);
+  if (mysql_query(conn, sql.c_str()) != 0) {
+    throw std::runtime_error(std::string("MySQL query failed: ") +
+                             mysql_error(conn));
+  }
+  MYSQL_RES *result = mysql_use_result(conn);
+  if (!result) {
+    if (mysql_field_count(conn) != 0)
+      throw std::runtime_error(std::string("MySQL query failed: ") +
+                               mysql_error(conn));
+    throw std::runtime_error("mysql_cursor() query returned no result set");
+  }
+  int id = next_mysql_cursor_id++;
+  mysql_cursors[id] = MysqlCursor{mysql_id(args[0]), result};
+  return Value::make_int(id);
+}
+
+// Up to `n` more rows; an empty list once the result is exhausted, at which
+// point the cursor is closed and its connection is free again.
+static Value builtin_mysql_fetch(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  auto it = mysql_cursors.find(mysql_id(args[0]));
+  if (it == mysql_cursors.end())
+    throw std::runtime_error("Invalid MySQL cursor id");
+  int64_t n = args.size() > 1
+                  ? static_cast<int64_t>(value_as_number(args[1]).as_number())
+                  : 1000;
+  if (n <= 0) throw std::runtime_error("mysql_fetch() batch size must be > 0");
+  MYSQL_RES *result = it->second.result;
+  unsigned int num_fields = mysql_num_fields(result);
+  std::vector<Value> rows;
+  rows.reserve(static_cast<size_t>(std::min<int64_t>(n, 4096)));
+  MYSQL_ROW row = nullptr;
+  while (static_cast<int64_t>(rows.size()) < n &&
+         (row = mysql_fetch_row(result)))
+    rows.push_back(
+        mysql_row_value(row, mysql_fetch_lengths(result), num_fields));
+  if (!row) {
+    MYSQL *conn = mysql_connections.at(it->second.connection);
+    std::string err = mysql_errno(conn) ? mysql_error(conn) : "";
+    mysql_close_cursor(it);
+    if (!err.empty()) throw std::runtime_error("MySQL fetch failed: " + err);
+  }
+  return Value::make_list(std::move(rows));
+}
+
+static Value builtin_mysql_cursor_close(const std::vector<Value> &args,
+                                        const std::shared_ptr<Environment> &) {
+  auto it = mysql_cursors.find(mysql_id(args[0]));
+  if (it != mysql_cursors.end()) mysql_close_cursor(it);
+  return Value();
+}
+
+static Value builtin_mysql_prepare(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  MYSQL *conn = mysql_connection(args[0]);
+  std::string sql = std::get<std::string>(args[1].v);
+  MYSQL_STMT *stmt = mysql_stmt_init(conn);
+  if (!stmt) throw std::runtime_error("mysql_stmt_init() failed");
+  if (mysql_stmt_prepare(stmt, sql.c_str(),
+                         static_cast<unsigned long>(sql.size())) != 0) {
+    std::string err = mysql_stmt_error(stmt);
+    mysql_stmt_close(stmt);
+    throw std::runtime_error("MySQL prepare failed: " + err);
+  }
+  size_t params = mysql_stmt_param_count(stmt);
+  MysqlStatement entry;
+  entry.connection = mysql_id(args[0]);
+  entry.stmt = stmt;
+  entry.binds.resize(params);
+  entry.ints.resize(params);
+  entry.doubles.resize(params);
+  entry.lengths.resize(params);
+  int id = next_mysql_statement_id++;
+  mysql_statements[id] = std::move(entry);
+  return Value::make_int(id);
+}
+
+// Binds one row of parameters and runs the statement, returning the rows
+// it affected. String parameters point into `row`, which must outlive the
+// execute call.
+static uint64_t mysql_execute_row(MysqlStatement &s, const Value &row) {
+  if (!std::holds_alternative<List>(row.v))
+    throw std::runtime_error("MySQL parameters must be a list");
+  const auto &params = as_list(row);
+  if (params.size() != s.binds.size())
+    throw std::runtime_error("MySQL statement expects " +
+                             std::to_string(s.binds.size()) +
+                             " parameters but got " +
+                             std::to_string(params.size()));
+  for (size_t i = 0; i < params.size(); ++i) {
+    MYSQL_BIND &bind = s.binds[i];
+    std::memset(&bind, 0, sizeof(bind));
+    const Value &param = params[i];
+    if (std::holds_alternative<std::monostate>(param.v)) {
+      bind.buffer_type = MYSQL_TYPE_NULL;
+    } else if (auto n = std::get_if<int64_t>(&param.v)) {
+      s.ints[i] = *n;
+      bind.buffer_type = MYSQL_TYPE_LONGLONG;
+      bind.buffer = &s.ints[i];
+    } else if (auto b = std::get_if<bool>(&param.v)) {
+      s.ints[i] = *b ? 1 : 0;
+      bind.buffer_type = MYSQL_TYPE_LONGLONG;
+      bind.buffer = &s.ints[i];
+    } else if (auto d = std::get_if<double>(&param.v)) {
+      s.doubles[i] = *d;
+      bind.buffer_type = MYSQL_TYPE_DOUBLE;
+      bind.buffer = &s.doubles[i];
+    } else if (auto str = std::get_if<std::string>(&param.v)) {
+      s.lengths[i] = static_cast<unsigned long>(str->size());
+      bind.buffer_type = MYSQL_TYPE_STRING;
+      bind.buffer = const_cast<char *>(str->data());
+      bind.buffer_length = s.lengths[i];
+      bind.length = &s.lengths[i];
+    } else {
+      throw std::runtime_error("MySQL parameter " + std::to_string(i + 1) +
+                               " must be a number, string, bool or null");
     }
-    throw std::runtime_error("Baar entry not found: " + name);
   }
-#ifdef BLOA_USE_CURL
-  if (marker == "__builtin_curl_get" || marker == "__builtin_curl_post" ||
-      marker == "__builtin_curl_request") {
-    if (args.empty() || args.size() > 3)
-      throw std::runtime_error(
-          "curl_get/curl_post/curl_request() requires 1-3 arguments");
-    std::string url = std::get<std::string>(args[0].v);
-    std::string method = "GET";
-    std::string body;
-    if (marker == "__builtin_curl_post") {
-      method = "POST";
-      if (args.size() < 2)
-        throw std::runtime_error("curl_post() requires url and body");
-      body = std::get<std::string>(args[1].v);
+  if ((!s.binds.empty() && mysql_stmt_bind_param(s.stmt, s.binds.data())) ||
+      mysql_stmt_execute(s.stmt) != 0)
+    throw std::runtime_error(std::string("MySQL execute failed: ") +
+                             mysql_stmt_error(s.stmt));
+  uint64_t affected = mysql_stmt_affected_rows(s.stmt);
+  mysql_stmt_free_result(s.stmt);
+  return affected;
+}
+
+static MysqlStatement &mysql_statement(const Value &id) {
+  auto it = mysql_statements.find(mysql_id(id));
+  if (it == mysql_statements.end())
+    throw std::runtime_error("Invalid MySQL statement id");
+  mysql_connection(Value::make_int(it->second.connection));
+  return it->second;
+}
+
+static Value builtin_mysql_execute(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  MysqlStatement &s = mysql_statement(args[0]);
+  Value none_params = Value::make_list({});
+  const Value &params = args.size() > 1 ? args[1] : none_params;
+  return Value::make_int(static_cast<int64_t>(mysql_execute_row(s, params)));
+}
+
+// Runs the statement once per parameter row, reusing the prepared plan and
+// bind buffers, and returns the total affected rows. Wrap the call in a
+// transaction to commit the batch at once.
+static Value builtin_mysql_execute_batch(
+    const std::vector<Value> &args, const std::shared_ptr<Environment> &) {
+  MysqlStatement &s = mysql_statement(args[0]);
+  if (!std::holds_alternative<List>(args[1].v))
+    throw std::runtime_error("mysql_execute_batch() expects a list of rows");
+  uint64_t total = 0;
+  for (const auto &row : as_list(args[1])) total += mysql_execute_row(s, row);
+  return Value::make_int(static_cast<int64_t>(total));
+}
+
+static Value builtin_mysql_stmt_close(const std::vector<Value> &args,
+                                      const std::shared_ptr<Environment> &) {
+  auto it = mysql_statements.find(mysql_id(args[0]));
+  if (it == mysql_statements.end())
+    throw std::runtime_error("Invalid MySQL statement id");
+  mysql_stmt_close(it->second.stmt);
+  mysql_statements.erase(it);
+  return Value();
+}
+#endif
+
+static Value builtin_str(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  return Value::make_str(value_to_string(args[0]));
+}
+
+static Value builtin_int(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (std::holds_alternative<int64_t>(args[0].v)) return args[0];
+  if (std::holds_alternative<bool>(args[0].v))
+    return Value::make_int(std::get<bool>(args[0].v) ? 1 : 0);
+  if (std::holds_alternative<std::string>(args[0].v)) {
+    const std::string &text = std::get<std::string>(args[0].v);
+    try {
+      size_t used = 0;
+      int64_t n = std::stoll(text, &used);
+      if (used == text.size()) return Value::make_int(n);
+    } catch (...) {
     }
-    if (marker == "__builtin_curl_request") {
-      if (args.size() >= 2) method = std::get<std::string>(args[1].v);
-      if (args.size() == 3) body = std::get<std::string>(args[2].v);
+  }
+  return Value::make_int(
+      static_cast<int64_t>(value_as_number(args[0]).as_number()));
+}
+
+static Value builtin_float(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  if (std::holds_alternative<std::string>(args[0].v)) {
+    const std::string &text = std::get<std::string>(args[0].v);
+    try {
+      size_t used = 0;
+      double d = std::stod(text, &used);
+      if (used == text.size()) return Value::make_double(d);
+    } catch (...) {
+    }
+    throw std::runtime_error("float() cannot convert '" + text + "'");
+  }
+  return value_as_number(args[0]);
+}
+
+static Value builtin_sqrt(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0]))
+    return array_map(*array, ElementFn::Sqrt);
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::sqrt(x));
+}
+
+static Value builtin_pow(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  double base = value_as_number(args[0]).as_number();
+  double exp = value_as_number(args[1]).as_number();
+  return Value::make_double(std::pow(base, exp));
+}
+
+static Value builtin_sin(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::sin(x));
+}
+
+static Value builtin_cos(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::cos(x));
+}
+
+static Value builtin_tan(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::tan(x));
+}
+
+static Value builtin_log(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0]))
+    return array_map(*array, ElementFn::Log);
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::log(x));
+}
+
+static Value builtin_exp(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0]))
+    return array_map(*array, ElementFn::Exp);
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::exp(x));
+}
+
+static Value builtin_array_f64(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  return make_array(args[0], false);
+}
+
+static Value builtin_array_i64(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  return make_array(args[0], true);
+}
+
+static Value builtin_to_list(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  const NumArray *array = array_arg(args[0]);
+  if (!array) throw std::runtime_error("to_list() requires an array");
+  return array_to_list(*array);
+}
+
+static Value builtin_mean(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  if (const NumArray *array = array_arg(args[0])) return array_mean(*array);
+  const NumArray &array =
+      *std::get<std::shared_ptr<const NumArray>>(make_array(args[0], false).v);
+  return array_mean(array);
+}
+
+static Value builtin_dot(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  const NumArray *a = array_arg(args[0]);
+  const NumArray *b = array_arg(args[1]);
+  if (!a || !b) throw std::runtime_error("dot() requires two arrays");
+  return array_dot(*a, *b);
+}
+
+static Value builtin_abs(const std::vector<Value> &args,
+                         const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::abs(x));
+}
+
+static Value builtin_floor(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::floor(x));
+}
+
+static Value builtin_ceil(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::ceil(x));
+}
+
+static Value builtin_round(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  double x = value_as_number(args[0]).as_number();
+  return Value::make_double(std::round(x));
+}
+
+static Value builtin_pi(const std::vector<Value> &,
+                        const std::shared_ptr<Environment> &) {
+  return Value::make_double(3.141592653589793);
+}
+
+static Value builtin_e(const std::vector<Value> &,
+                       const std::shared_ptr<Environment> &) {
+  return Value::make_double(2.718281828459045);
+}
+
+static Value builtin_read_file(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  std::ifstream ifs(path);
+  if (!ifs) throw std::runtime_error("Cannot open file: " + path);
+  std::string content((std::istreambuf_iterator<char>(ifs)),
+                      std::istreambuf_iterator<char>());
+  return Value::make_str(content);
+}
+
+static Value builtin_write_file(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  std::string content = std::get<std::string>(args[1].v);
+  std::ofstream ofs(path);
+  if (!ofs) throw std::runtime_error("Cannot open file for writing: " + path);
+  ofs << content;
+  return Value();
+}
+
+static Value builtin_exists(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::exists(path));
+}
+
+static Value builtin_list_dir(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  std::vector<Value> list;
+  std::transform(fs::directory_iterator(path), fs::directory_iterator{},
+                 std::back_inserter(list), [](const auto &entry) {
+                   return Value::make_str(entry.path().string());
+                 });
+  return Value::make_list(list);
+}
+
+// Native iterators: what csv_rows, ndjson_rows, iter_dir and iter_glob
+// return. Each holds only its current position, so for-in over one runs in
+// constant memory however long the file or directory is.
+struct NativeIterator {
+  virtual ~NativeIterator() = default;
+  // The next item, or false once there are no more.
+  virtual bool next(Value &out) = 0;
+};
+
+template <typename Reader>
+struct ReaderIterator : NativeIterator {
+  Reader reader;
+  template <typename... Args>
+  explicit ReaderIterator(Args &&...args)
+      : reader(std::forward<Args>(args)...) {}
+  bool next(Value &out) override { return reader.next(out); }
+};
+
+// Entry paths of a directory, those whose file name matches `pattern` when
+// one is given.
+struct DirectoryIterator : NativeIterator {
+  fs::directory_iterator it;
+  std::optional<std::string> pattern;
+  DirectoryIterator(fs::directory_iterator i, std::optional<std::string> p)
+      : it(std::move(i)), pattern(std::move(p)) {}
+  bool next(Value &out) override {
+    for (; it != fs::directory_iterator{}; ++it) {
+      const fs::path &path = it->path();
+      if (pattern && !glob_match(*pattern, path.filename().string())) continue;
+      out = Value::make_str(path.string());
+      ++it;
+      return true;
+    }
+    return false;
+  }
+};
+
+// The record for-in walks: {__next__} where __next__ is next(). The record
+// owns the iterator, so it is closed however the loop ends.
+static Value make_iterator(std::shared_ptr<NativeIterator> iter) {
+  auto props = std::make_shared<Environment>(nullptr);
+  props->set_local("__next__", Value::make_builtin(find_builtin("next")));
+  Value record = Value::make_object("iterator", std::move(props));
+  std::get<std::shared_ptr<ObjectInstance>>(record.v)->native =
+      std::move(iter);
+  return record;
+}
+
+static ObjectInstance &iterator_arg(const Value &v, const char *fn) {
+  const auto *obj = std::get_if<std::shared_ptr<ObjectInstance>>(&v.v);
+  if (!obj || (*obj)->klass || (*obj)->class_name != "iterator")
+    throw std::runtime_error(std::string(fn) + "() requires an iterator");
+  return **obj;
+}
+
+static Value builtin_csv_rows(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string delim =
+      (args.size() == 2) ? std::get<std::string>(args[1].v) : ",";
+  if (delim.empty())
+    throw std::runtime_error("csv_rows() delimiter cannot be empty");
+  return make_iterator(std::make_shared<ReaderIterator<CsvReader>>(
+      std::get<std::string>(args[0].v), delim[0]));
+}
+
+static Value builtin_ndjson_rows(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  return make_iterator(std::make_shared<ReaderIterator<NdjsonReader>>(
+      std::get<std::string>(args[0].v)));
+}
+
+static Value builtin_iter_dir(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  return make_iterator(std::make_shared<DirectoryIterator>(
+      fs::directory_iterator(std::get<std::string>(args[0].v)),
+      std::nullopt));
+}
+
+static Value builtin_iter_glob(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  fs::path p(std::get<std::string>(args[0].v));
+  fs::path dir = p.parent_path();
+  if (dir.empty()) dir = fs::current_path();
+  // Like glob(), a missing directory matches nothing.
+  fs::directory_iterator entries;
+  if (fs::is_directory(dir)) entries = fs::directory_iterator(dir);
+  return make_iterator(std::make_shared<DirectoryIterator>(
+      std::move(entries), p.filename().string()));
+}
+
+// The next item, or null once the iterator is exhausted, which also
+// closes it.
+static Value builtin_next(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  ObjectInstance &iter = iterator_arg(args[0], "next");
+  Value out;
+  if (iter.native && iter.native->next(out)) return out;
+  iter.native.reset();
+  return Value();
+}
+
+static Value builtin_iter_close(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  iterator_arg(args[0], "iter_close").native.reset();
+  return Value();
+}
+
+static Value builtin_mkdir(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::create_directory(path));
+}
+
+static Value builtin_rmdir(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::remove(path));
+}
+
+static Value builtin_remove(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::remove(path));
+}
+
+static Value builtin_copy_file(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string from = std::get<std::string>(args[0].v);
+  std::string to = std::get<std::string>(args[1].v);
+  fs::copy_file(from, to);
+  return Value();
+}
+
+static Value builtin_move(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  std::string from = std::get<std::string>(args[0].v);
+  std::string to = std::get<std::string>(args[1].v);
+  fs::rename(from, to);
+  return Value();
+}
+
+static Value builtin_file_size(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_int(fs::file_size(path));
+}
+
+static Value builtin_is_dir(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  return Value::make_bool(fs::is_directory(path));
+}
+
+static Value builtin_split(const std::vector<Value> &args,
+                           const std::shared_ptr<Environment> &) {
+  std::string_view s = std::get<std::string>(args[0].v);
+  std::string_view delim =
+      (args.size() == 2) ? std::string_view(std::get<std::string>(args[1].v))
+                         : " ";
+  if (delim.empty())
+    throw std::runtime_error("split() delimiter cannot be empty");
+  std::vector<Value> list;
+  size_t start = 0, pos;
+  while ((pos = s.find(delim, start)) != std::string_view::npos) {
+    list.push_back(Value::make_str(std::string(s.substr(start, pos - start))));
+    start = pos + delim.size();
+  }
+  list.push_back(Value::make_str(std::string(s.substr(start))));
+  return Value::make_list(std::move(list));
+}
+
+static Value builtin_join(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  const auto &list = as_list(args[0]);
+  const auto &sep = std::get<std::string>(args[1].v);
+  // Size the result up front when every item is already a string.
+  size_t total = list.empty() ? 0 : sep.size() * (list.size() - 1);
+  for (const auto &item : list) {
+    const auto *s = std::get_if<std::string>(&item.v);
+    if (!s) break;
+    total += s->size();
+  }
+  std::string result;
+  result.reserve(total);
+  for (size_t i = 0; i < list.size(); ++i) {
+    if (i > 0) result += sep;
+    if (const auto *s = std::get_if<std::string>(&list[i].v))
+      result += *s;
+    else
+      result += value_to_string(list[i]);
+  }
+  return Value::make_str(std::move(result));
+}
+
+static Value builtin_substr(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  size_t start = static_cast<size_t>(value_as_number(args[1]).as_number());
+  size_t len = (args.size() == 3)
+                   ? static_cast<size_t>(value_as_number(args[2]).as_number())
+                   : std::string::npos;
+  return Value::make_str(s.substr(start, len));
+}
+
+static Value builtin_find(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::string sub = std::get<std::string>(args[1].v);
+  size_t pos = s.find(sub);
+  return Value::make_int(
+      pos == std::string::npos ? -1 : static_cast<int64_t>(pos));
+}
+
+static Value builtin_replace(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  const auto &s = std::get<std::string>(args[0].v);
+  const auto &old_str = std::get<std::string>(args[1].v);
+  const auto &new_str = std::get<std::string>(args[2].v);
+  if (old_str.empty())
+    throw std::runtime_error("replace() search string cannot be empty");
+  // One pass copying the text between matches, rather than replacing in
+  // place and shifting the tail on every match.
+  std::string result;
+  size_t start = 0, pos;
+  while ((pos = s.find(old_str, start)) != std::string::npos) {
+    if (result.empty()) result.reserve(s.size());
+    result.append(s, start, pos - start);
+    result += new_str;
+    start = pos + old_str.size();
+  }
+  if (start == 0) return args[0];
+  result.append(s, start, std::string::npos);
+  return Value::make_str(std::move(result));
+}
+
+static Value builtin_to_upper(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::transform(s.begin(), s.end(), s.begin(), ::toupper);
+  return Value::make_str(s);
+}
+
+static Value builtin_to_lower(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return Value::make_str(s);
+}
+
+static Value builtin_trim(const std::vector<Value> &args,
+                          const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+            return !std::isspace(ch);
+          }));
+  s.erase(std::find_if(s.rbegin(), s.rend(),
+                       [](unsigned char ch) { return !std::isspace(ch); })
+              .base(),
+          s.end());
+  return Value::make_str(s);
+}
+
+static Value builtin_starts_with(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::string prefix = std::get<std::string>(args[1].v);
+  return Value::make_bool(s.starts_with(prefix));
+}
+
+static Value builtin_ends_with(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::string suffix = std::get<std::string>(args[1].v);
+  return Value::make_bool(s.ends_with(suffix));
+}
+
+static Value builtin_contains(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::string sub = std::get<std::string>(args[1].v);
+  return Value::make_bool(s.find(sub) != std::string::npos);
+}
+
+static Value builtin_reverse(const std::vector<Value> &args,
+                             const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  std::reverse(s.begin(), s.end());
+  return Value::make_str(s);
+}
+
+static Value builtin_repeat(const std::vector<Value> &args,
+                            const std::shared_ptr<Environment> &) {
+  std::string s = std::get<std::string>(args[0].v);
+  int64_t n = static_cast<int64_t>(value_as_number(args[1]).as_number());
+  std::string result;
+  for (int64_t i = 0; i < n; ++i) result += s;
+  return Value::make_str(result);
+}
+
+// String builders: one growing buffer per id, so building a long string
+// piece by piece costs time linear in its length.
+static std::unordered_map<int, std::string> string_builders;
+static int next_string_builder_id = 1;
+
+static std::string &string_builder(const Value &id) {
+  auto it = string_builders.find(
+      static_cast<int>(value_as_number(id).as_number()));
+  if (it == string_builders.end())
+    throw std::runtime_error("Invalid string builder id");
+  return it->second;
+}
+
+static Value builtin_string_builder(const std::vector<Value> &args,
+                                    const std::shared_ptr<Environment> &) {
+  int id = next_string_builder_id++;
+  std::string &buffer = string_builders[id];
+  if (!args.empty()) buffer = value_to_string(args[0]);
+  return Value::make_int(id);
+}
+
+static Value builtin_sb_append(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string &buffer = string_builder(args[0]);
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (const auto *s = std::get_if<std::string>(&args[i].v))
+      buffer += *s;
+    else
+      buffer += value_to_string(args[i]);
+  }
+  return Value::make_int(static_cast<int64_t>(buffer.size()));
+}
+
+// The text so far; the builder stays open for more appends.
+static Value builtin_sb_build(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  return Value::make_str(string_builder(args[0]));
+}
+
+static Value builtin_sb_close(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  if (string_builders.erase(id) == 0)
+    throw std::runtime_error("Invalid string builder id");
+  return Value();
+}
+
+static Value builtin_baar_create(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  const auto &files = as_list(args[1]);
+  std::vector<std::pair<std::string, std::string>> entries;
+  for (const auto &entry_val : files) {
+    if (!std::holds_alternative<List>(entry_val.v))
+      throw std::runtime_error(
+          "baar_create() file list must contain [name, data] entries");
+    const auto &entry = std::get<List>(entry_val.v);
+    if (entry.size() != 2)
+      throw std::runtime_error("baar_create() entry must be [name, data]");
+    if (!std::holds_alternative<std::string>(entry[0].v))
+      throw std::runtime_error("baar_create() entry name must be a string");
+    entries.emplace_back(std::get<std::string>(entry[0].v),
+                         value_to_string(entry[1]));
+  }
+  bool compress = false;
+  if (args.size() > 2) {
+    if (!std::holds_alternative<bool>(args[2].v))
+      throw std::runtime_error("baar_create() compress flag must be a boolean");
+    compress = std::get<bool>(args[2].v);
+  }
+  write_archive(path, entries, compress);
+  return Value();
+}
+
+static Value builtin_baar_extract(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  std::string dest = std::get<std::string>(args[1].v);
+  Archive archive(path);
+  fs::create_directories(dest);
+  std::string scratch;
+  for (const auto &entry : archive.entries()) {
+    fs::path out_path = fs::path(dest) / entry.name;
+    fs::create_directories(out_path.parent_path());
+    std::ofstream ofs(out_path, std::ios::binary);
+    std::string_view data = archive.contents(entry, scratch);
+    ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+  }
+  return Value();
+}
+
+static Value builtin_baar_list(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  Archive archive(path);
+  std::vector<Value> list;
+  for (const auto &entry : archive.entries()) {
+    list.push_back(Value::make_str(entry.name));
+  }
+  return Value::make_list(list);
+}
+
+static Value builtin_baar_read(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  std::string path = std::get<std::string>(args[0].v);
+  std::string name = std::get<std::string>(args[1].v);
+  Archive archive(path);
+  const Archive::Entry *entry = archive.find(name);
+  if (!entry) throw std::runtime_error("Baar entry not found: " + name);
+  return Value::make_str(archive.read(*entry));
+}
+
+#ifdef BLOA_USE_CURL
+// scheme://host[:port] of `url`, the key handles are pooled under.
+static std::string curl_origin(const std::string &url) {
+  size_t scheme = url.find("://");
+  size_t host = scheme == std::string::npos ? 0 : scheme + 3;
+  return url.substr(0, url.find_first_of("/?#", host));
+}
+
+// Easy handles are kept per origin after a request instead of being cleaned
+// up. curl_easy_reset clears a handle's options but keeps its live
+// connections, DNS cache and TLS session, so the next request to the same
+// host skips the handshakes.
+class CurlPool {
+ public:
+  static constexpr size_t kMaxIdlePerOrigin = 16;
+
+  ~CurlPool() {
+    for (auto &[origin, handles] : idle)
+      for (CURL *curl : handles) curl_easy_cleanup(curl);
+  }
+
+  CURL *acquire(const std::string &origin) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = idle.find(origin);
+      if (it != idle.end() && !it->second.empty()) {
+        CURL *curl = it->second.back();
+        it->second.pop_back();
+        curl_easy_reset(curl);
+        return curl;
+      }
     }
     CURL *curl = curl_easy_init();
     if (!curl) throw std::runtime_error("Failed to initialize curl");
-    std::string response;
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    if (method == "POST") {
-      curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    return curl;
+  }
+
+  void release(const std::string &origin, CURL *curl) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &handles = idle[origin];
+    if (handles.size() < kMaxIdlePerOrigin)
+      handles.push_back(curl);
+    else
+      curl_easy_cleanup(curl);
+  }
+
+ private:
+  std::mutex mutex;
+  std::unordered_map<std::string, std::vector<CURL *>> idle;
+};
+
+static CurlPool curl_pool;
+
+static void curl_setup(CURL *curl, const std::string &url,
+                       const std::string &method, const std::string &body,
+                       std::string *response) {
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_callback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  if (method == "POST") {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                     static_cast<long>(body.size()));
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+  } else if (method != "GET") {
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
+    if (!body.empty()) {
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+                       static_cast<long>(body.size()));
       curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-    } else if (method != "GET") {
-      curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method.c_str());
-      if (!body.empty()) {
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-      }
     }
-    CURLcode res = curl_easy_perform(curl);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    curl_easy_cleanup(curl);
-    if (res != CURLE_OK) {
-      throw std::runtime_error(std::string("curl failed: ") +
-                               curl_easy_strerror(res));
+  }
+}
+
+static Value curl_perform(const std::string &url, const std::string &method,
+                          const std::string &body) {
+  std::string origin = curl_origin(url);
+  CURL *curl = curl_pool.acquire(origin);
+  std::string response;
+  curl_setup(curl, url, method, body, &response);
+  CURLcode res = curl_easy_perform(curl);
+  curl_pool.release(origin, curl);
+  if (res != CURLE_OK) {
+    throw std::runtime_error(std::string("curl failed: ") +
+                             curl_easy_strerror(res));
+  }
+  return Value::make_str(response);
+}
+
+// One multi handle for the process, so its connection cache carries over
+// from one curl_get_many call to the next.
+static CURLM *curl_multi() {
+  static CURLM *multi = curl_multi_init();
+  if (!multi) throw std::runtime_error("Failed to initialize curl multi");
+  return multi;
+}
+
+struct CurlTransfer {
+  std::string origin;
+  CURL *curl = nullptr;
+  std::string response;
+};
+
+// Fetches every URL with at most `concurrency` requests in flight and
+// returns the bodies in input order. The first failure is reported once the
+// transfers still running have been torn down.
+static Value builtin_curl_get_many(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  if (!std::holds_alternative<List>(args[0].v))
+    throw std::runtime_error("curl_get_many() expects a list of URLs");
+  const auto &urls = as_list(args[0]);
+  for (const auto &url : urls) {
+    if (!std::holds_alternative<std::string>(url.v))
+      throw std::runtime_error("curl_get_many() URLs must be strings");
+  }
+  long concurrency =
+      args.size() > 1 ? static_cast<long>(value_as_number(args[1]).as_number())
+                      : 8;
+  if (concurrency < 1)
+    throw std::runtime_error("curl_get_many() concurrency must be >= 1");
+
+  static std::mutex multi_mutex;
+  std::lock_guard<std::mutex> lock(multi_mutex);
+  CURLM *multi = curl_multi();
+  curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, concurrency);
+
+  std::vector<CurlTransfer> transfers(urls.size());
+  size_t next = 0;
+  long active = 0;
+  std::string error;
+  auto start = [&]() {
+    CurlTransfer &t = transfers[next];
+    const auto &url = std::get<std::string>(urls[next].v);
+    ++next;
+    t.origin = curl_origin(url);
+    t.curl = curl_pool.acquire(t.origin);
+    curl_setup(t.curl, url, "GET", "", &t.response);
+    curl_easy_setopt(t.curl, CURLOPT_PRIVATE, &t);
+    curl_easy_setopt(t.curl, CURLOPT_PIPEWAIT, 1L);
+    curl_multi_add_handle(multi, t.curl);
+    ++active;
+  };
+  auto finish = [&](CurlTransfer &t) {
+    curl_multi_remove_handle(multi, t.curl);
+    curl_pool.release(t.origin, t.curl);
+    t.curl = nullptr;
+    --active;
+  };
+
+  while (next < transfers.size() && active < concurrency) start();
+  while (active > 0) {
+    int running = 0;
+    CURLMcode mc = curl_multi_perform(multi, &running);
+    if (mc != CURLM_OK) {
+      error = std::string("curl failed: ") + curl_multi_strerror(mc);
+      break;
     }
-    return Value::make_str(response);
+    int queued = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      CurlTransfer *t = nullptr;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+      CURLcode res = msg->data.result;
+      finish(*t);
+      if (res != CURLE_OK && error.empty()) {
+        size_t index = static_cast<size_t>(t - transfers.data());
+        error = "curl failed for " + std::get<std::string>(urls[index].v) +
+                ": " + curl_easy_strerror(res);
+      }
+      if (error.empty() && next < transfers.size()) start();
+    }
+    if (!error.empty()) break;
+    if (active > 0) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+  }
+  for (auto &t : transfers) {
+    if (t.curl) finish(t);
   }
+  if (!error.empty()) throw std::runtime_error(error);
+
+  std::vector<Value> responses;
+  responses.reserve(transfers.size());
+  for (auto &t : transfers)
+    responses.push_back(Value::make_str(std::move(t.response)));
+  return Value::make_list(std::move(responses));
+}
+
+static Value builtin_curl_get(const std::vector<Value> &args,
+                              const std::shared_ptr<Environment> &) {
+  return curl_perform(std::get<std::string>(args[0].v), "GET", "");
+}
+
+static Value builtin_curl_post(const std::vector<Value> &args,
+                               const std::shared_ptr<Environment> &) {
+  return curl_perform(std::get<std::string>(args[0].v), "POST",
+                      std::get<std::string>(args[1].v));
+}
+
+static Value builtin_curl_request(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  std::string method = "GET";
+  std::string body;
+  if (args.size() >= 2) method = std::get<std::string>(args[1].v);
+  if (args.size() == 3) body = std::get<std::string>(args[2].v);
+  return curl_perform(std::get<std::string>(args[0].v), method, body);
+}
 #endif
+
 #ifdef BLOA_USE_SQLITE
-  if (marker == "__builtin_sqlite_query" || marker == "__builtin_sqlite_exec") {
-    if (args.size() != 2)
-      throw std::runtime_error(
-          "sqlite_query/sqlite_exec() requires 2 arguments");
-    std::string path = std::get<std::string>(args[0].v);
-    std::string sql = std::get<std::string>(args[1].v);
-    sqlite3 *db = nullptr;
-    int rc = sqlite3_open(path.c_str(), &db);
-    if (rc != SQLITE_OK) {
+// An open database with its prepared statements, most recently used first.
+// Statements are keyed by SQL text and reset for reuse, so a query run in a
+// loop is compiled once.
+struct SqliteConnection {
+  static constexpr size_t kMaxStatements = 64;
+
+  sqlite3 *db = nullptr;
+  std::list<std::pair<std::string, sqlite3_stmt *>> statements;
+  std::unordered_map<std::string, decltype(statements)::iterator> by_sql;
+
+  explicit SqliteConnection(const std::string &path) {
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
       std::string err = sqlite3_errmsg(db);
       sqlite3_close(db);
       throw std::runtime_error("SQLite open failed: " + err);
     }
-    if (marker == "__builtin_sqlite_exec") {
-      char *errmsg = nullptr;
-      rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errmsg);
-      if (rc != SQLITE_OK) {
-        std::string err = errmsg ? errmsg : "unknown";
-        sqlite3_free(errmsg);
-        sqlite3_close(db);
-        throw std::runtime_error("SQLite exec failed: " + err);
-      }
-      sqlite3_close(db);
-      return Value::make_int(1);
+  }
+  ~SqliteConnection() {
+    for (auto &entry : statements) sqlite3_finalize(entry.second);
+    sqlite3_close(db);
+  }
+  SqliteConnection(const SqliteConnection &) = delete;
+  SqliteConnection &operator=(const SqliteConnection &) = delete;
+
+  std::string error() const { return sqlite3_errmsg(db); }
+
+  // A ready-to-bind statement for `sql`, or null when `sql` holds more
+  // than one statement.
+  sqlite3_stmt *prepare(const std::string &sql) {
+    auto it = by_sql.find(sql);
+    if (it != by_sql.end()) {
+      statements.splice(statements.begin(), statements, it->second);
+      sqlite3_stmt *stmt = it->second->second;
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      return stmt;
     }
     sqlite3_stmt *stmt = nullptr;
-    rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-      std::string err = sqlite3_errmsg(db);
-      sqlite3_close(db);
-      throw std::runtime_error("SQLite prepare failed: " + err);
+    const char *tail = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()),
+                           &stmt, &tail) != SQLITE_OK)
+      throw std::runtime_error("SQLite prepare failed: " + error());
+    while (tail && std::isspace(static_cast<unsigned char>(*tail))) ++tail;
+    if (tail && *tail) {
+      sqlite3_finalize(stmt);
+      return nullptr;
     }
-    std::vector<Value> rows;
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-      std::vector<Value> row;
-      int cols = sqlite3_column_count(stmt);
-      for (int col = 0; col < cols; ++col) {
-        const unsigned char *text = sqlite3_column_text(stmt, col);
-        row.push_back(
-            Value::make_str(text ? reinterpret_cast<const char *>(text) : ""));
-      }
-      rows.push_back(Value::make_list(std::move(row)));
+    if (!stmt) return nullptr;  // only whitespace or comments
+    statements.emplace_front(sql, stmt);
+    by_sql[sql] = statements.begin();
+    if (statements.size() > kMaxStatements) {
+      sqlite3_finalize(statements.back().second);
+      by_sql.erase(statements.back().first);
+      statements.pop_back();
     }
-    if (rc != SQLITE_DONE) {
-      std::string err = sqlite3_errmsg(db);
-      sqlite3_finalize(stmt);
-      sqlite3_close(db);
-      throw std::runtime_error("SQLite step failed: " + err);
+    return stmt;
+  }
+};
+
+static std::unordered_map<int, std::unique_ptr<SqliteConnection>>
+    sqlite_connections;
+static int next_sqlite_connection_id = 1;
+
+// The connection named by a builtin's first argument: a handle from
+// sqlite_open, or a database path opened for this call only.
+static SqliteConnection &sqlite_target(
+    const Value &db, std::unique_ptr<SqliteConnection> &temporary) {
+  if (std::holds_alternative<std::string>(db.v)) {
+    temporary = std::make_unique<SqliteConnection>(std::get<std::string>(db.v));
+    return *temporary;
+  }
+  int id = static_cast<int>(value_as_number(db).as_number());
+  auto it = sqlite_connections.find(id);
+  if (it == sqlite_connections.end())
+    throw std::runtime_error("Invalid SQLite connection id");
+  return *it->second;
+}
+
+static void sqlite_bind(SqliteConnection &conn, sqlite3_stmt *stmt,
+                        const std::vector<Value> &args, size_t first) {
+  if (args.size() > first && !std::holds_alternative<List>(args[first].v))
+    throw std::runtime_error("SQLite parameters must be a list");
+  size_t count = args.size() > first ? as_list(args[first]).size() : 0;
+  int expected = sqlite3_bind_parameter_count(stmt);
+  if (count != static_cast<size_t>(expected))
+    throw std::runtime_error("SQLite statement expects " +
+                             std::to_string(expected) + " parameters but got " +
+                             std::to_string(count));
+  for (size_t i = 0; i < count; ++i) {
+    const Value &param = as_list(args[first])[i];
+    int index = static_cast<int>(i) + 1;
+    int rc;
+    if (std::holds_alternative<std::monostate>(param.v))
+      rc = sqlite3_bind_null(stmt, index);
+    else if (auto n = std::get_if<int64_t>(&param.v))
+      rc = sqlite3_bind_int64(stmt, index, *n);
+    else if (auto d = std::get_if<double>(&param.v))
+      rc = sqlite3_bind_double(stmt, index, *d);
+    else if (auto b = std::get_if<bool>(&param.v))
+      rc = sqlite3_bind_int(stmt, index, *b ? 1 : 0);
+    else if (auto str = std::get_if<std::string>(&param.v))
+      rc = sqlite3_bind_text(stmt, index, str->data(),
+                             static_cast<int>(str->size()), SQLITE_TRANSIENT);
+    else
+      throw std::runtime_error("SQLite parameter " + std::to_string(index) +
+                               " must be a number, string, bool or null");
+    if (rc != SQLITE_OK)
+      throw std::runtime_error("SQLite bind failed: " + conn.error());
+  }
+}
+
+// Column values keep their storage class: INTEGER as int, REAL as float,
+// TEXT and BLOB as strings, NULL as null.
+static Value sqlite_column(sqlite3_stmt *stmt, int col) {
+  switch (sqlite3_column_type(stmt, col)) {
+    case SQLITE_INTEGER:
+      return Value::make_int(sqlite3_column_int64(stmt, col));
+    case SQLITE_FLOAT:
+      return Value::make_double(sqlite3_column_double(stmt, col));
+    case SQLITE_NULL:
+      return Value();
+    case SQLITE_BLOB: {
+      const void *blob = sqlite3_column_blob(stmt, col);
+      int size = sqlite3_column_bytes(stmt, col);
+      return Value::make_str(
+          std::string(static_cast<const char *>(blob), size));
+    }
+    default: {
+      const unsigned char *text = sqlite3_column_text(stmt, col);
+      int size = sqlite3_column_bytes(stmt, col);
+      return Value::make_str(
+          std::string(reinterpret_cast<const char *>(text), size));
+    }
+  }
+}
+
+// Steps `stmt` to completion, collecting rows when `rows` is given. The
+// statement is reset afterwards so it holds no lock while cached.
+static void sqlite_run(SqliteConnection &conn, sqlite3_stmt *stmt,
+                       std::vector<Value> *rows) {
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    if (!rows) continue;
+    int cols = sqlite3_column_count(stmt);
+    std::vector<Value> row;
+    row.reserve(cols);
+    for (int col = 0; col < cols; ++col)
+      row.push_back(sqlite_column(stmt, col));
+    rows->push_back(Value::make_list(std::move(row)));
+  }
+  if (rc != SQLITE_DONE) {
+    std::string err = conn.error();
+    sqlite3_reset(stmt);
+    throw std::runtime_error("SQLite step failed: " + err);
+  }
+  sqlite3_reset(stmt);
+}
+
+static Value builtin_sqlite_open(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  auto conn =
+      std::make_unique<SqliteConnection>(std::get<std::string>(args[0].v));
+  int id = next_sqlite_connection_id++;
+  sqlite_connections[id] = std::move(conn);
+  return Value::make_int(id);
+}
+
+static Value builtin_sqlite_close(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  int id = static_cast<int>(value_as_number(args[0]).as_number());
+  if (sqlite_connections.erase(id) == 0)
+    throw std::runtime_error("Invalid SQLite connection id");
+  return Value();
+}
+
+// Returns the number of rows changed on a handle, and 1 when called with a
+// path, as it always has.
+static Value builtin_sqlite_exec(const std::vector<Value> &args,
+                                 const std::shared_ptr<Environment> &) {
+  std::unique_ptr<SqliteConnection> temporary;
+  SqliteConnection &conn = sqlite_target(args[0], temporary);
+  std::string sql = std::get<std::string>(args[1].v);
+  if (sqlite3_stmt *stmt = conn.prepare(sql)) {
+    sqlite_bind(conn, stmt, args, 2);
+    sqlite_run(conn, stmt, nullptr);
+  } else {
+    // Scripts of several statements go through sqlite3_exec uncached.
+    if (args.size() > 2)
+      throw std::runtime_error(
+          "SQLite parameters need a single-statement query");
+    char *errmsg = nullptr;
+    if (sqlite3_exec(conn.db, sql.c_str(), nullptr, nullptr, &errmsg) !=
+        SQLITE_OK) {
+      std::string err = errmsg ? errmsg : "unknown";
+      sqlite3_free(errmsg);
+      throw std::runtime_error("SQLite exec failed: " + err);
+    }
+  }
+  if (temporary) return Value::make_int(1);
+  return Value::make_int(sqlite3_changes(conn.db));
+}
+
+static Value builtin_sqlite_query(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  std::unique_ptr<SqliteConnection> temporary;
+  SqliteConnection &conn = sqlite_target(args[0], temporary);
+  sqlite3_stmt *stmt = conn.prepare(std::get<std::string>(args[1].v));
+  if (!stmt)
+    throw std::runtime_error("SQLite query must be a single statement");
+  sqlite_bind(conn, stmt, args, 2);
+  std::vector<Value> rows;
+  sqlite_run(conn, stmt, &rows);
+  return Value::make_list(std::move(rows));
+}
+
+// The first column of a query's rows as an array: INTEGER values stay
+// array_i64 until a REAL arrives, and NULL is NaN.
+static Value builtin_sqlite_column(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  std::unique_ptr<SqliteConnection> temporary;
+  SqliteConnection &conn = sqlite_target(args[0], temporary);
+  sqlite3_stmt *stmt = conn.prepare(std::get<std::string>(args[1].v));
+  if (!stmt)
+    throw std::runtime_error("SQLite query must be a single statement");
+  sqlite_bind(conn, stmt, args, 2);
+  ArrayBuilder out;
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    switch (sqlite3_column_type(stmt, 0)) {
+      case SQLITE_INTEGER:
+        out.add(static_cast<int64_t>(sqlite3_column_int64(stmt, 0)));
+        break;
+      case SQLITE_FLOAT:
+        out.add(sqlite3_column_double(stmt, 0));
+        break;
+      case SQLITE_NULL:
+        out.add(std::numeric_limits<double>::quiet_NaN());
+        break;
+      default:
+        out.add(sqlite_column(stmt, 0));
+        break;
     }
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return Value::make_list(rows);
   }
+  std::string err = rc == SQLITE_DONE ? "" : conn.error();
+  sqlite3_reset(stmt);
+  if (rc != SQLITE_DONE)
+    throw std::runtime_error("SQLite step failed: " + err);
+  return out.build();
+}
+
+static Value sqlite_control(const std::vector<Value> &args, const char *sql) {
+  std::unique_ptr<SqliteConnection> temporary;
+  if (std::holds_alternative<std::string>(args[0].v))
+    throw std::runtime_error(std::string(sql) +
+                             " needs a handle from sqlite_open()");
+  SqliteConnection &conn = sqlite_target(args[0], temporary);
+  sqlite_run(conn, conn.prepare(sql), nullptr);
+  return Value();
+}
+
+static Value builtin_sqlite_begin(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  return sqlite_control(args, "BEGIN");
+}
+
+static Value builtin_sqlite_commit(const std::vector<Value> &args,
+                                   const std::shared_ptr<Environment> &) {
+  return sqlite_control(args, "COMMIT");
+}
+
+static Value builtin_sqlite_rollback(const std::vector<Value> &args,
+                                     const std::shared_ptr<Environment> &) {
+  return sqlite_control(args, "ROLLBACK");
+}
+#endif
+
+static Value builtin_random_int(const std::vector<Value> &args,
+                                const std::shared_ptr<Environment> &) {
+  int64_t min =
+      (args.size() == 2)
+          ? static_cast<int64_t>(value_as_number(args[0]).as_number())
+          : 0;
+  int64_t max =
+      (args.size() == 2)
+          ? static_cast<int64_t>(value_as_number(args[1]).as_number())
+          : static_cast<int64_t>(value_as_number(args[0]).as_number());
+  static std::random_device rd;
+  static thread_local std::mt19937 gen(rd());
+  std::uniform_int_distribution<int64_t> dist(min, max);
+  return Value::make_int(dist(gen));
+}
+
+static Value builtin_random_float(const std::vector<Value> &args,
+                                  const std::shared_ptr<Environment> &) {
+  double min =
+      (args.size() == 2) ? value_as_number(args[0]).as_number() : 0.0;
+  double max = (args.size() == 2) ? value_as_number(args[1]).as_number()
+                                  : value_as_number(args[0]).as_number();
+  static std::random_device rd;
+  static thread_local std::mt19937 gen(rd());
+  std::uniform_real_distribution<double> dist(min, max);
+  return Value::make_double(dist(gen));
+}
+
+static Value builtin_now(const std::vector<Value> &,
+                         const std::shared_ptr<Environment> &) {
+  auto now = std::chrono::system_clock::now();
+  auto duration = now.time_since_epoch();
+  auto millis =
+      std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  return Value::make_int(millis);
+}
+
+// The handle tables behind the csv, ndjson, string builder and database
+// builtins are shared by every interpreter, including parallel_map workers
+// on other threads, and so are native iterators handed to a worker.
+static std::mutex handle_mutex;
+
+template <auto F>
+static Value serialized(const std::vector<Value> &args,
+                        const std::shared_ptr<Environment> &env) {
+  std::lock_guard<std::mutex> lock(handle_mutex);
+  return F(args, env);
+}
+
+// Every native function, in registration order. An entry's address is its
+// identity: Values holding a builtin point into this table.
+static constexpr BuiltinFunction builtin_table[] = {
+    // Core functions
+    {"print", builtin_print, 0, -1},
+    {"flush", builtin_flush, 0, 0},
+    {"range", builtin_range, 0, -1},
+    {"len", builtin_len, 1, 1},
+    {"str", builtin_str, 1, 1},
+    {"int", builtin_int, 1, 1},
+    {"float", builtin_float, 1, 1},
+
+    // List functions; these update the variable passed as the first argument
+    {"append", builtin_append, 2, 2, true},
+    {"push", builtin_append, 2, -1, true},
+    {"pop", builtin_pop, 1, 2, true},
+    {"insert", builtin_insert, 3, 3, true},
+    {"extend", builtin_extend, 2, 2, true},
+    {"reserve", builtin_reserve, 2, 2, true},
+
+    // Math functions
+    {"sqrt", builtin_sqrt, 1, 1},
+    {"pow", builtin_pow, 2, 2},
+    {"sin", builtin_sin, 1, 1},
+    {"cos", builtin_cos, 1, 1},
+    {"tan", builtin_tan, 1, 1},
+    {"log", builtin_log, 1, 1},
+    {"exp", builtin_exp, 1, 1},
+    {"abs", builtin_abs, 1, 1},
+    {"floor", builtin_floor, 1, 1},
+    {"ceil", builtin_ceil, 1, 1},
+    {"round", builtin_round, 1, 1},
+    {"pi", builtin_pi, 0, -1},
+    {"e", builtin_e, 0, -1},
+
+    // Array functions; sum, min, max, sorted, slice, len and the math
+    // functions above also take arrays
+    {"array_f64", builtin_array_f64, 1, 1},
+    {"array_i64", builtin_array_i64, 1, 1},
+    {"to_list", builtin_to_list, 1, 1},
+    {"mean", builtin_mean, 1, 1},
+    {"dot", builtin_dot, 2, 2},
+
+    // I/O functions
+    {"read_file", builtin_read_file, 1, 1},
+    {"write_file", builtin_write_file, 2, 2},
+    {"exists", builtin_exists, 1, 1},
+    {"list_dir", builtin_list_dir, 1, 1},
+    {"iter_dir", serialized<builtin_iter_dir>, 1, 1},
+    {"mkdir", builtin_mkdir, 1, 1},
+    {"rmdir", builtin_rmdir, 1, 1},
+    {"remove", builtin_remove, 1, 1},
+    {"copy_file", builtin_copy_file, 2, 2},
+    {"move", builtin_move, 2, 2},
+    {"file_size", builtin_file_size, 1, 1},
+    {"is_dir", builtin_is_dir, 1, 1},
+
+    // String functions
+    {"split", builtin_split, 1, 2},
+    {"join", builtin_join, 2, 2},
+    {"substr", builtin_substr, 2, 3},
+    {"find", builtin_find, 2, 2},
+    {"replace", builtin_replace, 3, 3},
+    {"to_upper", builtin_to_upper, 1, 1},
+    {"to_lower", builtin_to_lower, 1, 1},
+    {"trim", builtin_trim, 1, 1},
+    {"starts_with", builtin_starts_with, 2, 2},
+    {"ends_with", builtin_ends_with, 2, 2},
+    {"contains", builtin_contains, 2, 2},
+    {"reverse", builtin_reverse, 1, 1},
+    {"repeat", builtin_repeat, 2, 2},
+    {"string_builder", serialized<builtin_string_builder>, 0, 1},
+    {"sb_append", serialized<builtin_sb_append>, 2, -1},
+    {"sb_build", serialized<builtin_sb_build>, 1, 1},
+    {"sb_close", serialized<builtin_sb_close>, 1, 1},
+
+    // Utility functions
+    {"random_int", builtin_random_int, 1, 2},
+    {"random_float", builtin_random_float, 1, 2},
+    {"now", builtin_now, 0, -1},
+    {"copy", builtin_copy, 1, 1},
+    {"clone", builtin_copy, 1, 1},
+    {"slice", builtin_slice, 2, 3},
+    {"sorted", builtin_sorted, 1, 1},
+    {"sum", builtin_sum, 1, 1},
+    {"min", builtin_min, 1, 1},
+    {"max", builtin_max, 1, 1},
+    {"type", builtin_type, 1, 1},
+    {"vars", builtin_vars, 0, -1},
+    {"keys", builtin_keys, 1, 1},
+    {"values", builtin_values, 1, 1},
+    {"dict", builtin_dict, 0, 1},
+    {"get", builtin_get, 2, 2},
+    {"set", builtin_set, 3, 3},
+    {"system", builtin_system, 1, 1},
+    {"shell", builtin_shell, 1, 1},
+    {"getenv", builtin_getenv, 1, 1},
+    {"setenv", builtin_setenv, 2, 2},
+    {"sleep", builtin_sleep, 1, 1},
+    {"pwd", builtin_pwd, 0, 0},
+    {"cwd", builtin_pwd, 0, 0},
+    {"path_join", builtin_path_join, 1, -1},
+    {"path_is_absolute", builtin_path_is_absolute, 1, 1},
+    {"path_normalize", builtin_path_normalize, 1, 1},
+    {"file_ext", builtin_file_ext, 1, 1},
+    {"basename", builtin_basename, 1, 1},
+    {"dirname", builtin_dirname, 1, 1},
+    {"mkdirs", builtin_mkdirs, 1, 1},
+    {"json_parse", builtin_json_parse, 1, 1},
+    {"json_stringify", builtin_json_stringify, 1, 1},
+    {"ndjson_open", serialized<builtin_ndjson_open>, 1, 1},
+    {"ndjson_next", serialized<builtin_ndjson_next>, 1, 2},
+    {"ndjson_close", serialized<builtin_ndjson_close>, 1, 1},
+    {"ndjson_rows", serialized<builtin_ndjson_rows>, 1, 1},
+    {"csv_parse", builtin_csv_parse, 1, 2},
+    {"csv_stringify", builtin_csv_stringify, 1, 2},
+    {"csv_open", serialized<builtin_csv_open>, 1, 2},
+    {"csv_next", serialized<builtin_csv_next>, 1, 2},
+    {"csv_close", serialized<builtin_csv_close>, 1, 1},
+    {"csv_rows", serialized<builtin_csv_rows>, 1, 2},
+    {"csv_column", builtin_csv_column, 2, 3},
+    {"base64_encode", builtin_base64_encode, 1, 1},
+    {"base64_decode", builtin_base64_decode, 1, 1},
+    {"uuid4", builtin_uuid4, 0, 0},
+    {"glob", builtin_glob, 1, 1},
+    {"iter_glob", serialized<builtin_iter_glob>, 1, 1},
+    {"next", serialized<builtin_next>, 1, 1},
+    {"iter_close", serialized<builtin_iter_close>, 1, 1},
+    {"regex_match", builtin_regex_match, 2, 2},
+    {"regex_replace", builtin_regex_replace, 3, 3},
+#ifdef BLOA_USE_MYSQL
+    {"mysql_connect", serialized<builtin_mysql_connect>, 4, 5},
+    {"mysql_query", serialized<builtin_mysql_query>, 2, 2},
+    {"mysql_exec", serialized<builtin_mysql_exec>, 2, 2},
+    {"mysql_close", serialized<builtin_mysql_close>, 1, 1},
+    {"mysql_escape", serialized<builtin_mysql_escape>, 2, 2},
+    {"mysql_cursor", serialized<builtin_mysql_cursor>, 2, 2},
+    {"mysql_fetch", serialized<builtin_mysql_fetch>, 1, 2},
+    {"mysql_cursor_close", serialized<builtin_mysql_cursor_close>, 1, 1},
+    {"mysql_prepare", serialized<builtin_mysql_prepare>, 2, 2},
+    {"mysql_execute", serialized<builtin_mysql_execute>, 1, 2},
+    {"mysql_execute_batch", serialized<builtin_mysql_execute_batch>, 2, 2},
+    {"mysql_stmt_close", serialized<builtin_mysql_stmt_close>, 1, 1},
+#endif
+
+    // PHP / Java-like helpers
+    {"echo", builtin_print, 0, -1},
+    {"isset", builtin_isset, 0, -1},
+    {"unset", builtin_unset, 0, -1},
+    {"ref", builtin_ref, 0, -1},
+    {"deref", builtin_deref, 0, -1},
+    {"set_ref", builtin_set_ref, 0, -1},
+    {"is_ref", builtin_is_ref, 1, 1},
+    {"baar_create", builtin_baar_create, 2, 3},
+    {"baar_extract", builtin_baar_extract, 2, 2},
+    {"baar_list", builtin_baar_list, 1, 1},
+    {"baar_read", builtin_baar_read, 2, 2},
+
+    // HTTP and network helpers
+#ifdef BLOA_USE_CURL
+    {"curl_get", builtin_curl_get, 1, 3},
+    {"curl_post", builtin_curl_post, 2, 3},
+    {"curl_request", builtin_curl_request, 1, 3},
+    {"curl_get_many", builtin_curl_get_many, 1, 2},
 #endif
-  if (marker == "__builtin_random_int") {
-    if (args.size() < 1 || args.size() > 2)
-      throw std::runtime_error("random_int() requires 1 or 2 arguments");
-    int64_t min =
-        (args.size() == 2)
-            ? static_cast<int64_t>(value_as_number(args[0]).as_number())
-            : 0;
-    int64_t max =
-        (args.size() == 2)
-            ? static_cast<int64_t>(value_as_number(args[1]).as_number())
-            : static_cast<int64_t>(value_as_number(args[0]).as_number());
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_int_distribution<int64_t> dist(min, max);
-    return Value::make_int(dist(gen));
-  }
-  if (marker == "__builtin_random_float") {
-    if (args.size() < 1 || args.size() > 2)
-      throw std::runtime_error("random_float() requires 1 or 2 arguments");
-    double min =
-        (args.size() == 2) ? value_as_number(args[0]).as_number() : 0.0;
-    double max = (args.size() == 2) ? value_as_number(args[1]).as_number()
-                                    : value_as_number(args[0]).as_number();
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_real_distribution<double> dist(min, max);
-    return Value::make_double(dist(gen));
-  }
-  if (marker == "__builtin_now") {
-    auto now = std::chrono::system_clock::now();
-    auto duration = now.time_since_epoch();
-    auto millis =
-        std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-    return Value::make_int(millis);
-  }
-  throw std::runtime_error("Unknown built-in: " + marker);
+
+    // SQLite helpers
+#ifdef BLOA_USE_SQLITE
+    {"sqlite_open", serialized<builtin_sqlite_open>, 1, 1},
+    {"sqlite_close", serialized<builtin_sqlite_close>, 1, 1},
+    {"sqlite_query", serialized<builtin_sqlite_query>, 2, 3},
+    {"sqlite_column", serialized<builtin_sqlite_column>, 2, 3},
+    {"sqlite_exec", serialized<builtin_sqlite_exec>, 2, 3},
+    {"sqlite_begin", serialized<builtin_sqlite_begin>, 1, 1},
+    {"sqlite_commit", serialized<builtin_sqlite_commit>, 1, 1},
+    {"sqlite_rollback", serialized<builtin_sqlite_rollback>, 1, 1},
+#endif
+};
+
+std::span<const BuiltinFunction> builtin_functions() { return builtin_table; }
+
+const BuiltinFunction *find_builtin(const std::string &name) {
+  for (const auto &fn : builtin_table) {
+    if (name == fn.name) return &fn;
+  }
+  return nullptr;
+}
+
+const std::shared_ptr<Environment> &builtin_scope() {
+  static const std::shared_ptr<Environment> scope = [] {
+    auto env = std::make_shared<Environment>(nullptr);
+    env->set_local("null", Value());
+    env->set_local("true", Value::make_bool(true));
+    env->set_local("false", Value::make_bool(false));
+    for (const auto &fn : builtin_table)
+      env->set_local(fn.name, Value::make_builtin(&fn));
+    env->shared = true;
+    return env;
+  }();
+  return scope;
+}
+
+static std::string arity_message(const BuiltinFunction &fn) {
+  auto count = [](int n) {
+    return std::to_string(n) + (n == 1 ? " argument" : " arguments");
+  };
+  std::string name = std::string(fn.name) + "()";
+  if (fn.max_args == 0) return name + " takes no arguments";
+  if (fn.max_args < 0)
+    return name + " requires at least " + count(fn.min_args);
+  if (fn.min_args == fn.max_args)
+    return name + " requires " + count(fn.min_args);
+  if (fn.max_args == fn.min_args + 1)
+    return name + " requires " + std::to_string(fn.min_args) + " or " +
+           count(fn.max_args);
+  return name + " requires " + std::to_string(fn.min_args) + " to " +
+         count(fn.max_args);
+}
+
+Value call_builtin(const BuiltinFunction &fn, const std::vector<Value> &args,
+                   const std::shared_ptr<Environment> &env) {
+  int argc = static_cast<int>(args.size());
+  if (argc < fn.min_args || (fn.max_args >= 0 && argc > fn.max_args))
+    throw std::runtime_error(arity_message(fn));
+  if (!profiler::active) return fn.fn(args, env);
+  auto start = profiler::Clock::now();
+  Value result = fn.fn(args, env);
+  profiler::count_builtin(fn.name, profiler::Clock::now() - start);
+  return result;
 }
 
 }  // namespace bloa
\ No newline at end of file
@@ -0,0 +1,707 @@
+#include "bloa/vm.hpp"
+
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "bloa/interpreter.hpp"
+#include "bloa/output.hpp"
+#include "bloa/runtime.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BLOA_COMPUTED_GOTO 1
+#endif
+
+namespace bloa {
+
+namespace {
+
+class Compiler {
+ public:
+  explicit Compiler(Chunk &chunk) : chunk(chunk) {}
+
+  void compile_block(const NodeList &nodes) {
+    for (const auto &node : nodes) compile_stmt(node);
+  }
+
+  void finish() { emit(OpCode::ReturnNone); }
+
+ private:
+  struct Loop {
+    int32_t continue_target;
+    std::vector<size_t> breaks;
+    int scope_depth;
+    int try_depth;
+    int stack_items;
+    int32_t scope_register;
+  };
+
+  Chunk &chunk;
+  std::unordered_map<std::string, int32_t> name_ids;
+  std::vector<Loop> loops;
+  int scope_depth = 0;
+  int try_depth = 0;
+
+  size_t emit(OpCode op, int32_t a = 0, int32_t b = 0, SlotRef slot = {}) {
+    chunk.code.push_back(Instr{op, a, b, slot});
+    return chunk.code.size() - 1;
+  }
+
+  int32_t here() const { return static_cast<int32_t>(chunk.code.size()); }
+
+  void patch(size_t at) { chunk.code[at].a = here(); }
+
+  int32_t name(const std::string &n) {
+    auto it = name_ids.find(n);
+    if (it != name_ids.end()) return it->second;
+    int32_t id = static_cast<int32_t>(chunk.names.size());
+    chunk.names.push_back(n);
+    name_ids.emplace(n, id);
+    return id;
+  }
+
+  int32_t constant(const Value &v) {
+    chunk.constants.push_back(v);
+    return static_cast<int32_t>(chunk.constants.size() - 1);
+  }
+
+  // Blocks without a layout bind nothing and run in the enclosing scope.
+  // Loop bodies pass a register so one scope is reused across iterations.
+  bool push_scope(const ScopeLayoutPtr &layout, int32_t loop_scope = -1) {
+    if (!layout) return false;
+    int32_t index = static_cast<int32_t>(chunk.layouts.size());
+    chunk.layouts.push_back(layout);
+    if (loop_scope < 0)
+      emit(OpCode::PushScope, index);
+    else
+      emit(OpCode::PushLoopScope, index, loop_scope);
+    ++scope_depth;
+    return true;
+  }
+
+  void pop_scope() {
+    emit(OpCode::PopScope);
+    --scope_depth;
+  }
+
+  void scoped_block(const NodeList &nodes, const ScopeLayoutPtr &layout) {
+    bool scoped = push_scope(layout);
+    compile_block(nodes);
+    if (scoped) pop_scope();
+  }
+
+  void delegate(const NodePtr &node) {
+    chunk.nodes.push_back(NodeList{node});
+    emit(OpCode::ExecNode, static_cast<int32_t>(chunk.nodes.size() - 1));
+  }
+
+  // Leaves the scopes and try regions entered since `loop` began.
+  void unwind_to(const Loop &loop) {
+    for (int i = scope_depth; i > loop.scope_depth; --i)
+      emit(OpCode::PopScope);
+    for (int i = try_depth; i > loop.try_depth; --i) emit(OpCode::TryEnd);
+  }
+
+  // A break or continue with no loop to take it is only an error if it
+  // runs, as in the tree walker, which reports it at the function or script
+  // boundary; no handler in this chunk gets to catch it on the way.
+  void fail(const std::string &message) {
+    for (int i = try_depth; i > 0; --i) emit(OpCode::TryEnd);
+    emit(OpCode::Fail, name(message));
+  }
+
+  int32_t compile_args(const ExprList &args) {
+    for (const auto &arg : args) compile_expr(*arg);
+    return static_cast<int32_t>(args.size());
+  }
+
+  void compile_expr(const Expr &expr) {
+    switch (expr.kind) {
+      case ExprKind::Literal:
+        emit(OpCode::Const,
+             constant(static_cast<const LiteralExpr &>(expr).value));
+        return;
+      case ExprKind::List: {
+        const auto &list = static_cast<const ListExpr &>(expr);
+        emit(OpCode::MakeList, compile_args(list.elements));
+        return;
+      }
+      case ExprKind::Dict: {
+        const auto &d = static_cast<const DictExpr &>(expr);
+        for (size_t i = 0; i < d.keys.size(); ++i) {
+          compile_expr(*d.keys[i]);
+          compile_expr(*d.values[i]);
+        }
+        emit(OpCode::MakeDict, static_cast<int32_t>(d.keys.size()));
+        return;
+      }
+      case ExprKind::Name: {
+        const auto &n = static_cast<const NameExpr &>(expr);
+        emit(OpCode::LoadName, name(n.name), 0, n.slot);
+        return;
+      }
+      case ExprKind::Not:
+        compile_expr(*static_cast<const NotExpr &>(expr).operand);
+        emit(OpCode::Not);
+        return;
+      case ExprKind::AddressOf: {
+        const auto &a = static_cast<const AddressOfExpr &>(expr);
+        emit(OpCode::AddressOf, name(a.name),
+             a.builtin.empty() ? -1 : name(a.builtin));
+        return;
+      }
+      case ExprKind::Deref:
+        compile_expr(*static_cast<const DerefExpr &>(expr).operand);
+        emit(OpCode::Deref);
+        return;
+      case ExprKind::Binary: {
+        const auto &bin = static_cast<const BinaryExpr &>(expr);
+        compile_expr(*bin.left);
+        if (bin.op == BinaryOp::And || bin.op == BinaryOp::Or) {
+          size_t jump = emit(bin.op == BinaryOp::And ? OpCode::AndJump
+                                                     : OpCode::OrJump);
+          compile_expr(*bin.right);
+          emit(OpCode::ToBool);
+          patch(jump);
+          return;
+        }
+        compile_expr(*bin.right);
+        emit(binary_opcode(bin.op));
+        return;
+      }
+      case ExprKind::Call: {
+        const auto &call = static_cast<const CallExpr &>(expr);
+        if (call.callee->kind == ExprKind::Name) {
+          const auto &callee = static_cast<const NameExpr &>(*call.callee);
+          int32_t argc = compile_args(call.args);
+          emit(OpCode::CallName, name(callee.name), argc, callee.slot);
+          return;
+        }
+        compile_expr(*call.callee);
+        emit(OpCode::Call, 0, compile_args(call.args));
+        return;
+      }
+      case ExprKind::Member: {
+        const auto &m = static_cast<const MemberExpr &>(expr);
+        compile_expr(*m.object);
+        emit(OpCode::GetMember, name(m.member));
+        return;
+      }
+      case ExprKind::MethodCall: {
+        const auto &mc = static_cast<const MethodCallExpr &>(expr);
+        compile_expr(*mc.object);
+        int32_t argc = compile_args(mc.args);
+        auto site = static_cast<int32_t>(chunk.method_sites.size());
+        chunk.method_sites.push_back({name(mc.method), {}});
+        emit(OpCode::CallMethod, site, argc);
+        return;
+      }
+      case ExprKind::Index: {
+        const auto &ix = static_cast<const IndexExpr &>(expr);
+        compile_expr(*ix.object);
+        compile_expr(*ix.index);
+        emit(OpCode::Index);
+        return;
+      }
+      case ExprKind::New: {
+        const auto &n = static_cast<const NewExpr &>(expr);
+        int32_t argc = compile_args(n.args);
+        emit(OpCode::New, name(n.class_name), argc);
+        return;
+      }
+    }
+    throw std::runtime_error("Unknown expression node");
+  }
+
+  static OpCode binary_opcode(BinaryOp op) {
+    switch (op) {
+      case BinaryOp::Add:
+        return OpCode::Add;
+      case BinaryOp::Sub:
+        return OpCode::Sub;
+      case BinaryOp::Mul:
+        return OpCode::Mul;
+      case BinaryOp::Div:
+        return OpCode::Div;
+      case BinaryOp::Mod:
+        return OpCode::Mod;
+      case BinaryOp::Pow:
+        return OpCode::Pow;
+      case BinaryOp::Eq:
+        return OpCode::Eq;
+      case BinaryOp::Ne:
+        return OpCode::Ne;
+      case BinaryOp::Lt:
+        return OpCode::Lt;
+      case BinaryOp::Le:
+        return OpCode::Le;
+      case BinaryOp::Gt:
+        return OpCode::Gt;
+      case BinaryOp::Ge:
+        return OpCode::Ge;
+      default:
+        break;
+    }
+    throw std::runtime_error("Unknown binary operator");
+  }
+
+  void compile_stmt(const NodePtr &node) {
+    if (auto s = std::dynamic_pointer_cast<Say>(node)) {
+      compile_expr(*s->expr);
+      emit(OpCode::Say);
+    } else if (auto a = std::dynamic_pointer_cast<Ask>(node)) {
+      compile_expr(*a->prompt);
+      emit(OpCode::Ask, name(a->var), 0, a->slot);
+    } else if (auto decl = std::dynamic_pointer_cast<Declare>(node)) {
+      compile_expr(*decl->expr);
+      emit(OpCode::DeclareName, name(decl->name), 0, decl->slot);
+    } else if (auto asg = std::dynamic_pointer_cast<Assign>(node)) {
+      if (asg->append) {
+        std::vector<const Expr *> pieces;
+        append_pieces(*asg->expr, pieces);
+        for (const Expr *piece : pieces) compile_expr(*piece);
+        emit(OpCode::AppendName, name(asg->name),
+             static_cast<int32_t>(pieces.size()), asg->slot);
+      } else {
+        compile_expr(*asg->expr);
+        emit(OpCode::StoreName, name(asg->name), 0, asg->slot);
+      }
+    } else if (auto masg = std::dynamic_pointer_cast<MemberAssign>(node)) {
+      emit(OpCode::LoadObject, name(masg->object), 0, masg->object_slot);
+      compile_expr(*masg->expr);
+      emit(OpCode::SetMember, name(masg->member));
+    } else if (auto iasg = std::dynamic_pointer_cast<IndexAssign>(node)) {
+      // `xs[i] = v` writes through the variable's binding; deeper targets
+      // (`self.rows[i]`, `grid[y][x]`) go to the tree walker.
+      if (iasg->object->kind != ExprKind::Name) return delegate(node);
+      const auto &target = static_cast<const NameExpr &>(*iasg->object);
+      compile_expr(*iasg->index);
+      compile_expr(*iasg->expr);
+      emit(OpCode::SetIndex, name(target.name), 0, target.slot);
+    } else if (auto iff = std::dynamic_pointer_cast<If>(node)) {
+      compile_expr(*iff->cond);
+      size_t to_else = emit(OpCode::JumpIfFalse);
+      scoped_block(iff->then_block, iff->then_scope);
+      if (iff->else_block.empty()) {
+        patch(to_else);
+      } else {
+        size_t to_end = emit(OpCode::Jump);
+        patch(to_else);
+        scoped_block(iff->else_block, iff->else_scope);
+        patch(to_end);
+      }
+    } else if (auto wh = std::dynamic_pointer_cast<While>(node)) {
+      int32_t start = here();
+      compile_expr(*wh->cond);
+      size_t to_end = emit(OpCode::JumpIfFalse);
+      loop_body(wh->block, wh->scope, start, 0, nullptr, {});
+      emit(OpCode::Jump, start);
+      patch(to_end);
+      end_loop();
+    } else if (auto fin = std::dynamic_pointer_cast<ForIn>(node)) {
+      compile_expr(*fin->iterable);
+      emit(OpCode::IterInit);
+      int32_t next = here();
+      size_t to_end = emit(OpCode::IterNext);
+      loop_body(fin->block, fin->scope, next, 2, &fin->var, fin->var_slot);
+      emit(OpCode::Jump, next);
+      patch(to_end);
+      end_loop();
+    } else if (std::dynamic_pointer_cast<Break>(node)) {
+      if (loops.empty()) return fail("'break' outside loop");
+      Loop &loop = loops.back();
+      unwind_to(loop);
+      for (int i = 0; i < loop.stack_items; ++i) emit(OpCode::Pop);
+      loop.breaks.push_back(emit(OpCode::Jump));
+    } else if (std::dynamic_pointer_cast<Continue>(node)) {
+      if (loops.empty()) return fail("'continue' outside loop");
+      const Loop &loop = loops.back();
+      unwind_to(loop);
+      emit(OpCode::Jump, loop.continue_target);
+    } else if (auto fc = std::dynamic_pointer_cast<FunctionCall>(node)) {
+      int32_t argc = compile_args(fc->args);
+      emit(OpCode::CallName, name(fc->name), argc, fc->slot);
+      emit(OpCode::Pop);
+    } else if (auto ret = std::dynamic_pointer_cast<Return>(node)) {
+      if (ret->expr) {
+        compile_expr(*ret->expr);
+        emit(OpCode::Return);
+      } else {
+        emit(OpCode::ReturnNone);
+      }
+    } else if (auto ex = std::dynamic_pointer_cast<ExprStmt>(node)) {
+      compile_expr(*ex->expr);
+      emit(OpCode::Pop);
+    } else if (auto te = std::dynamic_pointer_cast<TryExcept>(node)) {
+      // An empty except block rethrows, which is the same as no handler.
+      if (te->except_block.empty()) {
+        scoped_block(te->try_block, te->try_scope);
+        return;
+      }
+      size_t to_handler = emit(OpCode::TryBegin);
+      ++try_depth;
+      scoped_block(te->try_block, te->try_scope);
+      --try_depth;
+      emit(OpCode::TryEnd);
+      size_t to_end = emit(OpCode::Jump);
+      patch(to_handler);
+      scoped_block(te->except_block, te->except_scope);
+      patch(to_end);
+    } else {
+      // FunctionDef, ClassDef, Import, Require and Repeat
+      delegate(node);
+    }
+  }
+
+  // Emits a loop body in its own scope. For-in bodies first bind the
+  // element pushed by IterNext to `var`.
+  void loop_body(const NodeList &block, const ScopeLayoutPtr &layout,
+                 int32_t continue_target, int stack_items,
+                 const std::string *var, SlotRef var_slot) {
+    int32_t reg = layout ? chunk.loop_scopes++ : -1;
+    loops.push_back(
+        Loop{continue_target, {}, scope_depth, try_depth, stack_items, reg});
+    bool scoped = push_scope(layout, reg);
+    if (var) emit(OpCode::StoreName, name(*var), 0, var_slot);
+    compile_block(block);
+    if (scoped) pop_scope();
+  }
+
+  void end_loop() {
+    for (size_t at : loops.back().breaks) patch(at);
+    if (loops.back().scope_register >= 0)
+      emit(OpCode::ReleaseScope, 0, loops.back().scope_register);
+    loops.pop_back();
+  }
+};
+
+}  // namespace
+
+std::shared_ptr<const Chunk> compile_chunk(const NodeList &nodes) {
+  auto chunk = std::make_shared<Chunk>();
+  Compiler compiler(*chunk);
+  compiler.compile_block(nodes);
+  compiler.finish();
+  return chunk;
+}
+
+Value Interpreter::execute_chunk(const Chunk &chunk,
+                                 std::shared_ptr<Environment> env) {
+  struct Handler {
+    int32_t target;
+    size_t stack_size;
+    std::shared_ptr<Environment> env;
+  };
+
+  const Instr *code = chunk.code.data();
+  const Instr *ip = code;
+  std::vector<Value> stack;
+  stack.reserve(16);
+  std::vector<Handler> handlers;
+  std::vector<std::shared_ptr<Environment>> loop_scopes(
+      static_cast<size_t>(chunk.loop_scopes));
+
+  auto pop = [&stack]() {
+    Value v = std::move(stack.back());
+    stack.pop_back();
+    return v;
+  };
+  auto pop_args = [&stack](int32_t argc) {
+    std::vector<Value> args(std::make_move_iterator(stack.end() - argc),
+                            std::make_move_iterator(stack.end()));
+    stack.resize(stack.size() - static_cast<size_t>(argc));
+    return args;
+  };
+
+#ifdef BLOA_COMPUTED_GOTO
+#define BLOA_OPCODE_LABEL(name) &&op_##name,
+  static const void *const labels[] = {BLOA_OPCODES(BLOA_OPCODE_LABEL)};
+#undef BLOA_OPCODE_LABEL
+#define VM_DISPATCH() goto *labels[static_cast<size_t>(ip->op)]
+#define VM_CASE(name) op_##name:
+#define VM_SWITCH_BEGIN VM_DISPATCH();
+#define VM_SWITCH_END
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_CASE(name) case OpCode::name:
+#define VM_SWITCH_BEGIN \
+  dispatch:             \
+  switch (ip->op) {
+#define VM_SWITCH_END }
+#endif
+#define VM_NEXT() \
+  ++ip;           \
+  VM_DISPATCH()
+
+  for (;;) {
+    try {
+      VM_SWITCH_BEGIN
+
+      VM_CASE(Const) {
+        stack.push_back(chunk.constants[ip->a]);
+        VM_NEXT();
+      }
+      VM_CASE(Pop) {
+        stack.pop_back();
+        VM_NEXT();
+      }
+      VM_CASE(LoadName) {
+        stack.push_back(load_name(chunk.names[ip->a], ip->slot, env));
+        VM_NEXT();
+      }
+      VM_CASE(StoreName) {
+        store_name(chunk.names[ip->a], ip->slot, pop(), env);
+        VM_NEXT();
+      }
+      VM_CASE(AppendName) {
+        size_t first = stack.size() - static_cast<size_t>(ip->b);
+        append_name(chunk.names[ip->a], ip->slot,
+                    std::span<const Value>(stack).subspan(first), env);
+        stack.resize(first);
+        VM_NEXT();
+      }
+      VM_CASE(DeclareName) {
+        declare_name(chunk.names[ip->a], ip->slot, pop(), env);
+        VM_NEXT();
+      }
+      VM_CASE(LoadObject) {
+        stack.push_back(load_object(chunk.names[ip->a], ip->slot, env));
+        VM_NEXT();
+      }
+      VM_CASE(SetMember) {
+        Value rhs = pop();
+        Value obj_val = pop();
+        set_member(obj_val, chunk.names[ip->a], std::move(rhs));
+        VM_NEXT();
+      }
+      VM_CASE(SetIndex) {
+        Value rhs = pop();
+        Value index = pop();
+        const std::string &name = chunk.names[ip->a];
+        if (Value *target = find_binding(name, ip->slot, env))
+          set_index(*target, index, std::move(rhs));
+        else
+          set_index_temporary(load_name(name, ip->slot, env), index,
+                              std::move(rhs));
+        VM_NEXT();
+      }
+      VM_CASE(MakeList) {
+        stack.push_back(Value::make_list(pop_args(ip->a)));
+        VM_NEXT();
+      }
+      VM_CASE(MakeDict) {
+        size_t first = stack.size() - 2 * static_cast<size_t>(ip->a);
+        Value dict = make_dict(std::span<Value>(stack).subspan(first));
+        stack.resize(first);
+        stack.push_back(std::move(dict));
+        VM_NEXT();
+      }
+      VM_CASE(Not) {
+        stack.back() = Value::make_bool(!value_is_true(stack.back()));
+        VM_NEXT();
+      }
+      VM_CASE(AddressOf) {
+        stack.push_back(address_of_arg(
+            chunk.names[ip->a], ip->b < 0 ? nullptr : &chunk.names[ip->b],
+            env));
+        VM_NEXT();
+      }
+      VM_CASE(Deref) {
+        stack.back() = dereference(stack.back());
+        VM_NEXT();
+      }
+// Int/int operands are handled inline; anything else, or a result that is
+// not an exact int64_t, goes through apply_binary.
+#define BLOA_VM_ARITH(name)                                       \
+  VM_CASE(name) {                                                 \
+    Value &left = stack[stack.size() - 2];                        \
+    const auto *a = std::get_if<int64_t>(&left.v);                \
+    const auto *b = std::get_if<int64_t>(&stack.back().v);        \
+    int64_t result;                                               \
+    if (a && b && int_arithmetic(BinaryOp::name, *a, *b, result)) \
+      left.v = result;                                            \
+    else                                                          \
+      left = apply_binary(BinaryOp::name, left, stack.back());    \
+    stack.pop_back();                                             \
+    VM_NEXT();                                                    \
+  }
+#define BLOA_VM_COMPARE(name, op)                              \
+  VM_CASE(name) {                                              \
+    Value &left = stack[stack.size() - 2];                     \
+    const auto *a = std::get_if<int64_t>(&left.v);             \
+    const auto *b = std::get_if<int64_t>(&stack.back().v);     \
+    if (a && b)                                                \
+      left.v = *a op *b;                                       \
+    else                                                       \
+      left = apply_binary(BinaryOp::name, left, stack.back()); \
+    stack.pop_back();                                          \
+    VM_NEXT();                                                 \
+  }
+      BLOA_VM_ARITH(Add)
+      BLOA_VM_ARITH(Sub)
+      BLOA_VM_ARITH(Mul)
+      BLOA_VM_ARITH(Div)
+      BLOA_VM_ARITH(Mod)
+      BLOA_VM_ARITH(Pow)
+      BLOA_VM_COMPARE(Eq, ==)
+      BLOA_VM_COMPARE(Ne, !=)
+      BLOA_VM_COMPARE(Lt, <)
+      BLOA_VM_COMPARE(Le, <=)
+      BLOA_VM_COMPARE(Gt, >)
+      BLOA_VM_COMPARE(Ge, >=)
+#undef BLOA_VM_COMPARE
+#undef BLOA_VM_ARITH
+      VM_CASE(AndJump) {
+        if (!value_is_true(stack.back())) {
+          stack.back() = Value::make_bool(false);
+          ip = code + ip->a;
+          VM_DISPATCH();
+        }
+        stack.pop_back();
+        VM_NEXT();
+      }
+      VM_CASE(OrJump) {
+        if (value_is_true(stack.back())) {
+          stack.back() = Value::make_bool(true);
+          ip = code + ip->a;
+          VM_DISPATCH();
+        }
+        stack.pop_back();
+        VM_NEXT();
+      }
+      VM_CASE(ToBool) {
+        stack.back() = Value::make_bool(value_is_true(stack.back()));
+        VM_NEXT();
+      }
+      VM_CASE(Jump) {
+        ip = code + ip->a;
+        VM_DISPATCH();
+      }
+      VM_CASE(JumpIfFalse) {
+        if (!value_is_true(pop())) {
+          ip = code + ip->a;
+          VM_DISPATCH();
+        }
+        VM_NEXT();
+      }
+      VM_CASE(CallName) {
+        std::vector<Value> args = pop_args(ip->b);
+        stack.push_back(invoke_name(chunk.names[ip->a], ip->slot, args, env));
+        VM_NEXT();
+      }
+      VM_CASE(Call) {
+        std::vector<Value> args = pop_args(ip->b);
+        stack.back() = invoke_value(stack.back(), args, env);
+        VM_NEXT();
+      }
+      VM_CASE(GetMember) {
+        stack.back() = get_member(stack.back(), chunk.names[ip->a]);
+        VM_NEXT();
+      }
+      VM_CASE(CallMethod) {
+        std::vector<Value> args = pop_args(ip->b);
+        const auto &site = chunk.method_sites[ip->a];
+        stack.back() = invoke_method(stack.back(), chunk.names[site.name], args,
+                                     site.cache);
+        VM_NEXT();
+      }
+      VM_CASE(Index) {
+        Value index = pop();
+        stack.back() = index_value(stack.back(), index);
+        VM_NEXT();
+      }
+      VM_CASE(New) {
+        std::vector<Value> args = pop_args(ip->b);
+        stack.push_back(instantiate(chunk.names[ip->a], args));
+        VM_NEXT();
+      }
+      VM_CASE(Say) {
+        std::string line = value_to_string(pop());
+        line.push_back('\n');
+        write_output(line);
+        VM_NEXT();
+      }
+      VM_CASE(Ask) {
+        std::string text = value_to_string(pop());
+        text.push_back(' ');
+        write_output(text);
+        flush_output();
+        std::string input;
+        std::getline(std::cin, input);
+        store_name(chunk.names[ip->a], ip->slot, parse_input_value(input),
+                   env);
+        VM_NEXT();
+      }
+      VM_CASE(PushScope) {
+        env = acquire_scope(std::move(env), chunk.layouts[ip->a]);
+        VM_NEXT();
+      }
+      VM_CASE(PushLoopScope) {
+        env = iteration_scope(loop_scopes[ip->b], env, chunk.layouts[ip->a]);
+        VM_NEXT();
+      }
+      VM_CASE(ReleaseScope) {
+        if (loop_scopes[ip->b]) release_scope(std::move(loop_scopes[ip->b]));
+        VM_NEXT();
+      }
+      VM_CASE(PopScope) {
+        auto scope = std::move(env);
+        env = scope->parent;
+        release_scope(std::move(scope));
+        VM_NEXT();
+      }
+      VM_CASE(IterInit) {
+        stack.back() = begin_iteration(stack.back());
+        stack.push_back(Value::make_int(0));
+        VM_NEXT();
+      }
+      VM_CASE(IterNext) {
+        Value item;
+        bool more = next_item(stack[stack.size() - 2],
+                              std::get<int64_t>(stack.back().v), item);
+        if (!more) {
+          stack.resize(stack.size() - 2);
+          ip = code + ip->a;
+          VM_DISPATCH();
+        }
+        stack.push_back(std::move(item));
+        VM_NEXT();
+      }
+      VM_CASE(TryBegin) {
+        handlers.push_back(Handler{ip->a, stack.size(), env});
+        VM_NEXT();
+      }
+      VM_CASE(TryEnd) {
+        handlers.pop_back();
+        VM_NEXT();
+      }
+      VM_CASE(ExecNode) {
+        // Delegated loops consume their own break/continue; a return from
+        // inside one ends this chunk too.
+        Completion c = execute_block(chunk.nodes[ip->a], env);
+        if (c.kind == Completion::Kind::Return) return std::move(c.value);
+        VM_NEXT();
+      }
+      VM_CASE(Fail) { throw std::runtime_error(chunk.names[ip->a]); }
+      VM_CASE(Return) { return pop(); }
+      VM_CASE(ReturnNone) { return Value(); }
+
+      VM_SWITCH_END
+    } catch (const std::exception &) {
+      if (handlers.empty()) throw;
+      Handler handler = std::move(handlers.back());
+      handlers.pop_back();
+      stack.resize(handler.stack_size);
+      env = std::move(handler.env);
+      ip = code + handler.target;
+    }
+  }
+
+#undef VM_NEXT
+#undef VM_SWITCH_END
+#undef VM_SWITCH_BEGIN
+#undef VM_CASE
+#undef VM_DISPATCH
+}
+
+}  // namespace bloa
@@ -12,25 +12,116 @@ TMP="$ROOT/tmp"
 rm -rf "$TMP"
 mkdir -p "$TMP"
 trap 'rm -rf "$TMP"' EXIT
+# Test scripts keep their fixtures in $BLOA_TEST_TMP, removed on exit.
+export BLOA_TEST_TMP="$TMP"
 
 run() {
   local script="${1}"
   local expected="${2}"
+  shift 2
   local name
   name="$(basename "$script")"
   echo "Running $name"
-  local output
-  output="$("$BLOA" "$script")"
-  if [[ "$output" != "$expected" ]]; then
-    echo "FAILED $name"
-    echo "Expected:"$'\n'"$expected"
-    echo "Got:"$'\n'"$output"
-    exit 1
-  fi
+  local output mode
+  for mode in "" "--vm"; do
+    output="$("$BLOA" "$@" $mode "$script")"
+    if [[ "$output" != "$expected" ]]; then
+      echo "FAILED $name ${mode:-(tree-walker)}"
+      echo "Expected:"$'\n'"$expected"
+      echo "Got:"$'\n'"$output"
+      exit 1
+    fi
+  done
 }
 
-run "$ROOT/test_json.bloa" '[["a","b","c"],["1","2","3"]]'
-run "$ROOT/test_csv.bloa" '[["a","b","c"],["1","2","3"]]'
-run "$ROOT/test_misc.bloa" $'true\nYWJj\nabc\ntrue\nfoo_bar\ntrue\nbar\n.txt\n/tmp\nfoo.txt\n3\ntrue'
+run "$ROOT/test_json.bloa" $'[["a","b","c"],["1","2","3"]]\n["tab\\tq\\"é😀",-12,2500.0,null,true]\n[{"id":1},[1,2]]\n["last"]'
+run "$ROOT/test_dict.bloa" $'{ann: 31, bob: 27, 7: seven}\n27\nseven\nNone\ntrue\n4\n[bob, 7, cy, dee]\nbob\n7\ncy\ndee\n300\n10\ndict\n[1, 2]\n{"id":4,"tags":{"a":[1,2]}}\n{x: 2, y: 1}\n{x: 2, y: 1, z: 3}\n[1, 20, 3]\n[1, 2, 3]\n[[1, 5], [3, 4]]\nout of range\n[9, 1, 2]\n[2, 21, 4]\n[99, 21, 4]\n[2, 21, 4]'
+# Under a low fd limit, so iterators left by `break` must be closed.
+(ulimit -n 64; run "$ROOT/test_csv.bloa" $'[["a","b","c"],["1","2","3"]]\n[["id","note"],["1","a, \\"quoted\\"\\nnote"]]\n[["2","plain"],["3","last"]]\nid\n1\n2\n3\nid\nNone\n[2.500000, nan, 4]\n1 4 1 7\nnan')
+run "$ROOT/test_misc.bloa" $'true\nYWJj\nabc\ntrue\nfoo_bar\ntrue\nbar\n.txt\n/tmp\nfoo.txt\n6\ntrue\n[tests/test_json.bloa]\n['"$TMP/test_dir/*ba]"$'\nbefore child\nchild\nafter child'
+run "$ROOT/test_sqlite.bloa" $'[[2, user2, 1], [3, user3, 1.500000]]\nint float\n1\n[[2]]\narray_i64 4\n[0.500000, 1.500000]'
+run "$ROOT/test_lang.bloa" $'15\n4\n6\n8\n10\n49\n42\ncaught\n6\n15\nfalse\n200\n8\n720\n8\n7\nbuiltin\narity\n6\n[0, 1, 2]\nnot a variable\n9007199254740993\nint 3.500000\n9223372036854775808.000000\n2\n11\n6\n3\n// kept/* kept */\n[1, 8, 27, 64, 125]\n[2, 11]\n[8, 4]\n27\n10\n5050\n3\n2\n1\n<a><b><><c>\nayybyyyyc\nn=1,2\narray_f64 array_i64\n6 4 2.666667\n14.500000\n[3, 6, 9]\n[1.500000, 2.500000, 4]\n3\n[2, 3]\n[9223372036854775808.000000]\nstray continue\nmine\n9\nint 9007199254740993 int'
+
+# A module runs once however often it is used; a required file runs every
+# time. The second pass reads both back from the on-disk cache.
+printf 'say "hello"\n' > "$TMP/greet.bloa"
+printf 'hits = hits + 1\n' > "$TMP/count.bloa"
+cat > "$TMP/test_modules.bloa" <<EOF
+use $TMP/greet;
+use $TMP/greet;
+hits = 0
+i = 0
+while (i < 3) {
+  require $TMP/count.bloa
+  i = i + 1
+}
+say hits
+EOF
+for pass in cold warm; do
+  run "$TMP/test_modules.bloa" $'hello\n3' --cache-dir "$TMP/cache"
+done
+
+# Archives: v1 files written by older releases stay readable; new ones are
+# v2, optionally with compressed entries.
+printf 'BLOAARCHIVE\n\x01\0\0\0\0\0\0\0\x09\0\0\0\0\0\0\0\x0d\0\0\0\0\0\0\0%s' \
+  'main.bloasay "from v1"' > "$TMP/v1.baar"
+run "$TMP/v1.baar" 'from v1'
+cat > "$TMP/test_baar.bloa" <<EOF
+data = repeat("abc", 100)
+baar_create("$TMP/v2.baar", [["main.bloa", "say \\"from v2\\""], ["data.txt", data]], true)
+say baar_list("$TMP/v2.baar")
+say baar_read("$TMP/v2.baar", "data.txt") == data
+require $TMP/v2.baar
+require $TMP/v1.baar
+EOF
+run "$TMP/test_baar.bloa" $'[main.bloa, data.txt]\ntrue\nfrom v2\nfrom v1'
+
+# --profile leaves stdout to the script, reports on stderr and writes one
+# collapsed stack per call path.
+cat > "$TMP/test_profile.bloa" <<'EOF'
+function inner(x) {
+  return x + 1
+}
+function outer(x) {
+  return inner(x) * 2
+}
+say outer(1)
+EOF
+echo "Running test_profile.bloa"
+output="$("$BLOA" --profile-out "$TMP/profile.folded" "$TMP/test_profile.bloa" \
+  2>"$TMP/profile.txt")"
+if [[ "$output" != "4" ]] ||
+   ! grep -q '^<main>;outer;inner [0-9]*$' "$TMP/profile.folded" ||
+   ! grep -q ' 1 .*  outer$' "$TMP/profile.txt" ||
+   ! grep -q '  <main>:7$' "$TMP/profile.txt"; then
+  echo "FAILED test_profile.bloa"
+  cat "$TMP/profile.txt" "$TMP/profile.folded"
+  exit 1
+fi
+
+# Requests sent to a server must behave as direct runs, and see a required
+# file change even though the server keeps it parsed.
+SOCK="$TMP/bloa.sock"
+"$BLOA" --socket "$SOCK" --serve 2>/dev/null &
+SERVER=$!
+trap 'kill "$SERVER" 2>/dev/null || true; rm -rf "$TMP"' EXIT
+for _ in $(seq 50); do [[ -S "$SOCK" ]] && break; sleep 0.1; done
+printf 'function twice(x) {\n  return 2 * x\n}\n' > "$TMP/lib.bloa"
+cat > "$TMP/test_serve.bloa" <<EOF
+require $TMP/lib.bloa
+say twice(21)
+say getenv("BLOA_TEST_VALUE")
+EOF
+export BLOA_TEST_VALUE=passed
+run "$TMP/test_serve.bloa" $'42\npassed' --socket "$SOCK" --client
+printf 'function twice(x) {\n  return x + x + 1\n}\n' > "$TMP/lib.bloa"
+run "$TMP/test_serve.bloa" $'43\npassed' --socket "$SOCK" --client
+if [[ "$(echo 'say 6 * 7' | "$BLOA" --socket "$SOCK" --client -)" != "42" ]] ||
+   "$BLOA" --socket "$SOCK" --client "$TMP/missing.bloa" 2>/dev/null; then
+  echo "FAILED --client"
+  exit 1
+fi
+kill "$SERVER"
+wait "$SERVER" || true
 
 echo "All tests passed."